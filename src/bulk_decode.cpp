@@ -0,0 +1,166 @@
+/**
+ * @file bulk_decode.cpp
+ * Implements the kernels decoding arrays of big-endian numbers.
+ */
+
+#include <string.h>
+#include "bulk_decode.h"
+#include "pb5_codec.h"
+
+#ifdef BULK_DECODE_SSSE3
+#include <tmmintrin.h>
+// The SSSE3 kernels are compiled for the instruction set regardless of the
+// compiler flags, and only run once the CPU is found to support it
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+
+static float fp2Table[0x10000];
+
+static const float* build_fp2_table()
+{
+    for (uint4 bits = 0; bits < 0x10000; bits++) {
+        fp2Table[bits] = GetFinalStorageFloat((uint2)bits);
+    }
+    return fp2Table;
+}
+
+/**
+ * Returns the decoder using the fastest kernels supported by the CPU.
+ */
+const BulkDecoder& BulkDecoder :: getInstance()
+{
+#ifdef BULK_DECODE_SSSE3
+    static Ssse3Decoder ssse3Decoder;
+    static bool ssse3 = (__builtin_cpu_init(),
+            __builtin_cpu_supports("ssse3"));
+
+    if (ssse3) {
+        return ssse3Decoder;
+    }
+#endif
+    return getScalar();
+}
+
+/**
+ * Returns the decoder using the scalar kernels.
+ */
+const BulkDecoder& BulkDecoder :: getScalar()
+{
+    static ScalarDecoder scalarDecoder;
+    return scalarDecoder;
+}
+
+/**
+ * Returns the table of the values of the 2-byte final storage floats,
+ * indexed by their bit pattern.
+ */
+const float* BulkDecoder :: getFp2Table()
+{
+    static const float* table = build_fp2_table();
+    return table;
+}
+
+/////////////////////////////////////////////////////////////////////
+//           Implementation of ScalarDecoder class                 //
+/////////////////////////////////////////////////////////////////////
+
+void ScalarDecoder :: decodeUint2(const byte* src, uint4* dst,
+        size_t count) const
+{
+    for (size_t idx = 0; idx < count; idx++, src += 2) {
+        dst[idx] = BigEndian<2>::load(src);
+    }
+}
+
+void ScalarDecoder :: decodeUint4(const byte* src, uint4* dst,
+        size_t count) const
+{
+    for (size_t idx = 0; idx < count; idx++, src += 4) {
+        dst[idx] = BigEndian<4>::load(src);
+    }
+}
+
+void ScalarDecoder :: decodeFloat4(const byte* src, float* dst,
+        size_t count) const
+{
+    for (size_t idx = 0; idx < count; idx++, src += 4) {
+        dst[idx] = float4(src);
+    }
+}
+
+void ScalarDecoder :: decodeFp2(const byte* src, float* dst,
+        size_t count) const
+{
+    for (size_t idx = 0; idx < count; idx++, src += 2) {
+        dst[idx] = fp2Table__[BigEndian<2>::load(src)];
+    }
+}
+
+#ifdef BULK_DECODE_SSSE3
+/////////////////////////////////////////////////////////////////////
+//           Implementation of Ssse3Decoder class                  //
+/////////////////////////////////////////////////////////////////////
+
+SSSE3_TARGET
+void Ssse3Decoder :: decodeUint2(const byte* src, uint4* dst,
+        size_t count) const
+{
+    // Each half of the block widens to four values, the bytes shuffled in
+    // from index -128 are zero
+    const __m128i lo = _mm_setr_epi8(1, 0, -128, -128, 3, 2, -128, -128,
+            5, 4, -128, -128, 7, 6, -128, -128);
+    const __m128i hi = _mm_setr_epi8(9, 8, -128, -128, 11, 10, -128, -128,
+            13, 12, -128, -128, 15, 14, -128, -128);
+    size_t idx = 0;
+
+    for (; idx + 8 <= count; idx += 8) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + 2*idx));
+        _mm_storeu_si128((__m128i *)(dst + idx),
+                _mm_shuffle_epi8(block, lo));
+        _mm_storeu_si128((__m128i *)(dst + idx + 4),
+                _mm_shuffle_epi8(block, hi));
+    }
+    ScalarDecoder::decodeUint2(src + 2*idx, dst + idx, count - idx);
+}
+
+SSSE3_TARGET
+void Ssse3Decoder :: decodeUint4(const byte* src, uint4* dst,
+        size_t count) const
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+            11, 10, 9, 8, 15, 14, 13, 12);
+    size_t idx = 0;
+
+    for (; idx + 4 <= count; idx += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + 4*idx));
+        _mm_storeu_si128((__m128i *)(dst + idx),
+                _mm_shuffle_epi8(block, swap));
+    }
+    ScalarDecoder::decodeUint4(src + 4*idx, dst + idx, count - idx);
+}
+
+SSSE3_TARGET
+void Ssse3Decoder :: decodeFloat4(const byte* src, float* dst,
+        size_t count) const
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+            11, 10, 9, 8, 15, 14, 13, 12);
+    const __m128i expMask  = _mm_set1_epi32(0x7f800000);
+    const __m128i fracMask = _mm_set1_epi32(0x007fffff);
+    const __m128i negZero  = _mm_set1_epi32((int)0x80000000);
+    size_t idx = 0;
+
+    for (; idx + 4 <= count; idx += 4) {
+        __m128i block = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)(src + 4*idx)), swap);
+        // Clear the fraction of the infinities and NaNs, then the sign of
+        // a negative zero
+        __m128i special = _mm_cmpeq_epi32(_mm_and_si128(block, expMask),
+                expMask);
+        block = _mm_andnot_si128(_mm_and_si128(special, fracMask), block);
+        block = _mm_andnot_si128(_mm_cmpeq_epi32(block, negZero), block);
+        _mm_storeu_ps(dst + idx, _mm_castsi128_ps(block));
+    }
+    ScalarDecoder::decodeFloat4(src + 4*idx, dst + idx, count - idx);
+}
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @file bulk_decode.h
+ * Provides the kernels decoding arrays of big-endian numbers from the
+ * records collected from a logger, vectorised where the CPU allows.
+ */
+
+#ifndef BULK_DECODE_H
+#define BULK_DECODE_H
+#include <stddef.h>
+#include <string.h>
+#include <fstream>
+#include "pb5_codec.h"
+
+// The SSSE3 kernels are compiled for x86 with GCC compatible compilers,
+// which select them at run time if the CPU supports the instructions
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BULK_DECODE_SSSE3
+#endif
+
+// Arrays shorter than this are decoded inline by the callers, as the call
+// to the kernels costs more than it saves on them
+#define BULK_DECODE_MIN_COUNT 4
+
+/**
+ * Kernels decoding contiguous arrays of big-endian values, as stored by the
+ * logger for the array fields of a table. getInstance() returns the fastest
+ * implementation the CPU supports, all of them producing the same bits.
+ *
+ * The floating point values are decoded as intBitsToFloat() does: a
+ * negative zero is decoded as zero, and the infinities and NaNs as
+ * infinities of the same sign. The final storage floats are looked up in
+ * a table holding GetFinalStorageFloat() of each of the 65536 patterns,
+ * built once on first use. Like it, the table maps the patterns 0x1fff,
+ * 0x9fff and 0x9ffe to +INF, -INF and NaN, and any other magnitude above
+ * 6999 to -9999. The patterns of the 0x8000 family decode to -0.
+ */
+class BulkDecoder {
+    public :
+        BulkDecoder() : fp2Table__(getFp2Table()) {}
+        virtual ~BulkDecoder() {}
+        static const BulkDecoder& getInstance();
+        static const BulkDecoder& getScalar();
+        static const float* getFp2Table();
+
+        /** Returns the value of a 2-byte final storage float. */
+        float  finalStorageFloat(uint2 bits) const { 
+            return fp2Table__[bits]; 
+        }
+        static float float4(const byte* src);
+
+        /** Returns the name of the implementation. */
+        virtual const char* getName() const = 0;
+        /** Decodes 2-byte unsigned integers, zero extended. */
+        virtual void decodeUint2(const byte* src, uint4* dst,
+                size_t count) const = 0;
+        /** Decodes 4-byte integers. */
+        virtual void decodeUint4(const byte* src, uint4* dst,
+                size_t count) const = 0;
+        /** Decodes 4-byte IEEE floating point values. */
+        virtual void decodeFloat4(const byte* src, float* dst,
+                size_t count) const = 0;
+        /** Decodes 2-byte final storage floating point values. */
+        virtual void decodeFp2(const byte* src, float* dst,
+                size_t count) const = 0;
+
+    protected :
+        const float* fp2Table__;  // Values of the final storage floats
+};
+
+/**
+ * Returns the value of a 4-byte IEEE float as the kernels decode it, from
+ * its bits rather than through pow(). The arrays shorter than
+ * BULK_DECODE_MIN_COUNT are decoded with it.
+ */
+inline float BulkDecoder :: float4(const byte* src)
+{
+    uint4 bits = BigEndian<4>::load(src);
+    float val;
+
+    if ((bits & 0x7f800000) == 0x7f800000) {
+        bits &= 0xff800000;
+    }
+    else if (bits == 0x80000000) {
+        bits = 0;
+    }
+    memcpy (&val, &bits, 4);
+    return val;
+}
+
+/**
+ * Implementation of the kernels decoding one value at a time.
+ */
+class ScalarDecoder : public BulkDecoder {
+    public :
+        virtual const char* getName() const { return "scalar"; }
+        virtual void decodeUint2(const byte* src, uint4* dst,
+                size_t count) const;
+        virtual void decodeUint4(const byte* src, uint4* dst,
+                size_t count) const;
+        virtual void decodeFloat4(const byte* src, float* dst,
+                size_t count) const;
+        virtual void decodeFp2(const byte* src, float* dst,
+                size_t count) const;
+};
+
+#ifdef BULK_DECODE_SSSE3
+/**
+ * Implementation of the kernels swapping the bytes of 16-byte blocks with
+ * the SSSE3 byte shuffle. The values left over after the last block are
+ * decoded by the scalar kernels, as are the final storage floats, SSSE3
+ * having no gather to look them up with.
+ */
+class Ssse3Decoder : public ScalarDecoder {
+    public :
+        virtual const char* getName() const { return "ssse3"; }
+        virtual void decodeUint2(const byte* src, uint4* dst,
+                size_t count) const;
+        virtual void decodeUint4(const byte* src, uint4* dst,
+                size_t count) const;
+        virtual void decodeFloat4(const byte* src, float* dst,
+                size_t count) const;
+};
+#endif
+
+#endif
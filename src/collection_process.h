@@ -15,6 +15,9 @@
 #include <log4cpp/Category.hh>
 #include "pb5.h"
 #include "init_comm.h"
+#include "event_loop.h"
+#include "pb5_link.h"
+#include "session_snapshot.h"
 
 using namespace std;
 
@@ -62,10 +65,16 @@ public:
 
 protected :
     void parseCommandLineArgs(int argc, char* argv[]) throw (exception);
+    void loadLoggers(const vector<string>& configFilePaths) 
+            throw (AppException);
+    void runLoggers() throw (exception);
+    void runBroker() throw (exception);
     void configure() throw (AppException);
     void checkLoggerTime() throw (AppException);
     void initSession(int nTry) throw (AppException);
-    void collect() throw (AppException);
+    void negotiateBaudRate(SerialConn* serialConn) throw (AppException);
+    void runDaemon() throw (exception);
+    int  collect(const vector<TableOpt>& tables) throw (AppException);
     void closeSession() throw ();
     void exitHandler(int signum) throw ();
 
@@ -73,19 +82,48 @@ private:
     auto_ptr<DataSource> dataSource__;
     CommInpCfg       appConfig__;
     pakbuf           IObuf__;
+    TransactionEngine tranEngine__;
+    SessionSnapshot  snapshot__;
     TableDataManager tblDataMgr__;
     PakCtrlObj       pakCtrlImplObj__;
     BMP5Obj          bmp5ImplObj__;
+    RttEstimator     rtt__;
+    vector<PB5CollectionProcess*> loggers__;
+    vector<PakBusLink*> links__;
 
     string           lockFilePath__;
+    string           brokerPath__;
+    string           rttFile__;
     bool             optDebug__;
+    bool             optDaemon__;
     bool             optCleanAppCache__;
     bool             executionComplete__;
     bool             loggerTimeCheckComplete__;
     stringstream     msgstrm;
 };
 
+/**
+ * Fiber running the collection process of one logger, used when several
+ * configuration files are given on the command line.
+ */
+class CollectionFiber : public Fiber {
+public:
+    CollectionFiber(const string& name, DataCollectionProcess* process) :
+        Fiber(name), process__(process) {}
+    virtual void run() throw ();
+
+private:
+    DataCollectionProcess* process__;
+};
+
 #define PB5_APP_NAME "PbCdlComm"
+
+// Daemon mode scheduling (seconds). Tables without sample_int_secs are
+// collected every DAEMON_POLL_SECS, all tables DAEMON_LAG_SECS after the 
+// end of their interval to let the logger store the record.
+#define DAEMON_POLL_SECS  60
+#define DAEMON_LAG_SECS   2
+#define DAEMON_RETRY_SECS 30
 // #define PB5_APP_VERS "1.3.5 (2008/07/28)"
 // #define PB5_APP_VERS "1.3.6 (2009/07/16)"
 // #define PB5_APP_VERS "1.3.8 (2010/05/12)" 
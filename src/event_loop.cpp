@@ -0,0 +1,243 @@
+/**
+ * @file event_loop.cpp
+ * Implements the fibers and event loop used to collect from several
+ * loggers in one process.
+ */
+
+#include <algorithm>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <log4cpp/NDC.hh>
+#include "event_loop.h"
+
+using namespace std;
+using namespace log4cpp;
+
+EventLoop :: EventLoop() : epollFd__(-1), current__(NULL)
+{
+}
+
+EventLoop :: ~EventLoop()
+{
+    if (epollFd__ >= 0) {
+        close(epollFd__);
+    }
+}
+
+/**
+ * Function to add a fiber to the loop. The fiber starts running once
+ * run() is called, and the caller keeps ownership of the object. A fiber
+ * that has finished may be spawned again.
+ *
+ * @param fiber: Fiber to schedule.
+ */
+void EventLoop :: spawn(Fiber* fiber) throw (AppException)
+{
+    if (getcontext(&fiber->context__) < 0) {
+        throw AppException(__FILE__, __LINE__, strerror(errno));
+    }
+
+    delete [] fiber->stack__;
+    fiber->stack__ = new char[FIBER_STACK_SIZE];
+    fiber->context__.uc_stack.ss_sp   = fiber->stack__;
+    fiber->context__.uc_stack.ss_size = FIBER_STACK_SIZE;
+    fiber->context__.uc_link          = &loopContext__;
+    fiber->finished__ = false;
+    makecontext(&fiber->context__, &EventLoop::fiber_main, 0);
+
+    if (find(fibers__.begin(), fibers__.end(), fiber) == fibers__.end()) {
+        fibers__.push_back(fiber);
+    }
+    readyQueue__.push_back(fiber);
+}
+
+/**
+ * Function to run the fibers until all of them have finished. Fibers are
+ * resumed in the order they became ready; when none is ready, the loop
+ * sleeps in epoll_wait() until a descriptor is ready or the earliest wait
+ * timeout expires.
+ */
+void EventLoop :: run() throw (AppException)
+{
+    struct epoll_event events[MAX_LOOP_EVENTS];
+
+    if (epollFd__ < 0) {
+        if ((epollFd__ = epoll_create(MAX_LOOP_EVENTS)) < 0) {
+            throw AppException(__FILE__, __LINE__, strerror(errno));
+        }
+    }
+
+    while (true) {
+        while (readyQueue__.size()) {
+            Fiber* fiber = readyQueue__.front();
+            readyQueue__.pop_front();
+            resume(fiber);
+        }
+
+        fibers__.erase(remove_if(fibers__.begin(), fibers__.end(),
+                mem_fun(&Fiber::isFinished)), fibers__.end());
+        if (fibers__.empty()) {
+            break;
+        }
+
+        int nevents = epoll_wait(epollFd__, events, MAX_LOOP_EVENTS,
+                next_timeout());
+        if ((nevents < 0) && (errno != EINTR)) {
+            throw AppException(__FILE__, __LINE__, strerror(errno));
+        }
+
+        for (int idx = 0; idx < nevents; idx++) {
+            Fiber* fiber = (Fiber*)events[idx].data.ptr;
+            epoll_ctl(epollFd__, EPOLL_CTL_DEL, fiber->fd__, NULL);
+            fiber->revents__ = (short)events[idx].events;
+            fiber->waiting__ = false;
+            readyQueue__.push_back(fiber);
+        }
+
+        wake_expired();
+    }
+}
+
+/**
+ * Function to wait for a descriptor to become ready. Inside a fiber, the
+ * fiber is suspended and the other fibers run in the meantime.
+ *
+ * @param fd: Descriptor to wait on, -1 to only wait for the timeout.
+ * @param events: poll() events to wait for (POLLIN, POLLOUT). They have
+ *                the same values as the epoll events.
+ * @param msecs: Timeout in milliseconds, -1 to wait indefinitely.
+ * @return Positive value if the descriptor is ready, 0 on timeout and -1
+ *         on error, as poll() would.
+ */
+int EventLoop :: waitFd(int fd, short events, int msecs)
+{
+    if (!inFiber()) {
+        struct pollfd pfd;
+        pfd.fd      = fd;
+        pfd.events  = events;
+        pfd.revents = 0;
+        return poll(&pfd, (fd >= 0) ? 1 : 0, msecs);
+    }
+
+    Fiber* fiber = current__;
+    fiber->fd__         = fd;
+    fiber->events__     = events;
+    fiber->revents__    = 0;
+    fiber->timeout__    = msecs;
+    fiber->waitStart__  = get_msec_clock();
+
+    if (fd >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = events;
+        ev.data.ptr = fiber;
+
+        if (epoll_ctl(epollFd__, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            // epoll can't watch regular files, which are always ready
+            return (errno == EPERM) ? 1 : -1;
+        }
+    }
+
+    fiber->waiting__ = true;
+    suspend();
+    return (fiber->revents__) ? 1 : 0;
+}
+
+/**
+ * Function to sleep for a number of seconds. Inside a fiber, only the
+ * calling fiber sleeps.
+ *
+ * @param secs: Number of seconds to sleep.
+ */
+void EventLoop :: sleep(unsigned int secs)
+{
+    if (!inFiber()) {
+        ::sleep(secs);
+        return;
+    }
+    waitFd(-1, 0, secs*1000);
+}
+
+/**
+ * Function to switch from the loop to a fiber until the fiber waits or
+ * finishes. The fiber name is set as the logging context meanwhile, so
+ * the log messages show which session they come from.
+ */
+void EventLoop :: resume(Fiber* fiber)
+{
+    current__ = fiber;
+    NDC::clear();
+    NDC::push(fiber->name__);
+    swapcontext(&loopContext__, &fiber->context__);
+    NDC::clear();
+    current__ = NULL;
+}
+
+/**
+ * Function to switch from the running fiber back to the loop.
+ */
+void EventLoop :: suspend()
+{
+    Fiber* fiber = current__;
+    swapcontext(&fiber->context__, &loopContext__);
+}
+
+/**
+ * Function to compute how long the loop may sleep in epoll_wait().
+ *
+ * @return Milliseconds until the earliest wait timeout, -1 if none.
+ */
+int EventLoop :: next_timeout()
+{
+    unsigned int now = get_msec_clock();
+    int timeout = -1;
+
+    for (size_t idx = 0; idx < fibers__.size(); idx++) {
+        Fiber* fiber = fibers__[idx];
+        if (!fiber->waiting__ || (fiber->timeout__ < 0)) {
+            continue;
+        }
+        int remaining = max(0, fiber->timeout__ -
+                msec_diff(now, fiber->waitStart__));
+        if ((timeout < 0) || (remaining < timeout)) {
+            timeout = remaining;
+        }
+    }
+    return timeout;
+}
+
+/**
+ * Function to make the fibers whose wait timed out ready.
+ */
+void EventLoop :: wake_expired()
+{
+    unsigned int now = get_msec_clock();
+
+    for (size_t idx = 0; idx < fibers__.size(); idx++) {
+        Fiber* fiber = fibers__[idx];
+        if (!fiber->waiting__ || (fiber->timeout__ < 0) ||
+                (msec_diff(now, fiber->waitStart__) < fiber->timeout__)) {
+            continue;
+        }
+        if (fiber->fd__ >= 0) {
+            epoll_ctl(epollFd__, EPOLL_CTL_DEL, fiber->fd__, NULL);
+        }
+        fiber->revents__ = 0;
+        fiber->waiting__ = false;
+        readyQueue__.push_back(fiber);
+    }
+}
+
+/**
+ * Entry point of every fiber. The loop sets current__ before switching to
+ * a new fiber; when run() returns, uc_link switches back to the loop.
+ */
+void EventLoop :: fiber_main()
+{
+    Fiber* fiber = getInstance().current__;
+    fiber->run();
+    fiber->finished__ = true;
+}
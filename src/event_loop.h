@@ -0,0 +1,95 @@
+/**
+ * @file event_loop.h
+ * Provides cooperative scheduling of several data collection sessions in a
+ * single process.
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+#include <ucontext.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "utils.h"
+using namespace std;
+
+// Size of the stack allocated to each fiber
+#define FIBER_STACK_SIZE (256*1024)
+
+// Maximum number of events collected by one epoll_wait()
+#define MAX_LOOP_EVENTS 64
+
+/**
+ * Interface for a task run by the EventLoop on a stack of its own. The
+ * task is written as ordinary blocking code; it gives way to the other
+ * fibers whenever it waits on a file descriptor or sleeps through the
+ * EventLoop. run() must not let an exception escape.
+ */
+class Fiber {
+    friend class EventLoop;
+    public :
+        explicit Fiber(const string& name) : name__(name), stack__(NULL),
+                finished__(false), fd__(-1), events__(0), revents__(0),
+                timeout__(-1), waitStart__(0), waiting__(false) {}
+        virtual ~Fiber() { delete [] stack__; }
+        virtual void run() throw () = 0;
+        const string& getName() { return name__; }
+        bool isFinished() { return finished__; }
+
+    private :
+        string       name__;             // Name used as the logging context
+        char        *stack__;            // Stack of the fiber
+        ucontext_t   context__;          // Saved context while suspended
+        bool         finished__;         // Set once run() returned
+        int          fd__;               // Descriptor waited on, -1 if none
+        short        events__;           // Events waited for
+        short        revents__;          // Events received, 0 on timeout
+        int          timeout__;          // Wait timeout in msecs, -1 if none
+        unsigned int waitStart__;        // Clock reading when the wait began
+        bool         waiting__;          // Set while suspended in a wait
+};
+
+/**
+ * Singleton epoll based event loop switching between fibers. A fiber that
+ * waits on a descriptor is suspended and resumed once the descriptor is
+ * ready or its timeout expires, so a session waiting on a slow logger
+ * never holds up the others.
+ *
+ * When called outside of a fiber, waitFd() and sleep() block the calling
+ * process as poll() and sleep() would, so the same code serves a process
+ * collecting from a single logger.
+ */
+class EventLoop {
+    public :
+        static EventLoop& getInstance()
+        {
+            static EventLoop eventLoop__;
+            return eventLoop__;
+        }
+
+        void spawn(Fiber* fiber) throw (AppException);
+        void run() throw (AppException);
+        int  waitFd(int fd, short events, int msecs);
+        void sleep(unsigned int secs);
+        /** Returns true if called from a fiber run by the loop. */
+        bool inFiber() { return current__ != NULL; }
+
+    protected :
+        void resume(Fiber* fiber);
+        void suspend();
+        int  next_timeout();
+        void wake_expired();
+        static void fiber_main();
+
+    private :
+        EventLoop();
+        ~EventLoop();
+
+        int             epollFd__;       // epoll instance, -1 until run()
+        Fiber          *current__;       // Running fiber, NULL in the loop
+        ucontext_t      loopContext__;   // Context of the loop itself
+        vector<Fiber*>  fibers__;        // Fibers that haven't finished
+        deque<Fiber*>   readyQueue__;    // Fibers ready to be resumed
+};
+
+#endif
@@ -15,8 +15,10 @@
 
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <exception>
 #include <string>
+#include <algorithm>
 #include <stdlib.h>
 #include <unistd.h>
 #include <libxml2/libxml/parser.h>
@@ -27,9 +29,19 @@
 #include <log4cpp/Layout.hh>
 #include <log4cpp/PatternLayout.hh>
 #include <cstring>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "init_comm.h"
 #include "serial_comm.h"
 #include "utils.h"
+#include "event_loop.h"
 using namespace std;
 using namespace log4cpp;
 
@@ -47,25 +59,58 @@ DataSource* DataSource :: decorate(DataSource* dataSource, const string& connect
         }
         string port;
         int speed = 0;
+        bool autoBaud = false;
         size_t pos = connectionString.find(",");
 
         if (string::npos != pos) {
             port = connectionString.substr(0, pos); 
+            autoBaud = !strcasecmp(connectionString.substr(pos+1).c_str(),
+                    AUTO_BAUD_NAME);
             speed = atoi(connectionString.substr(pos+1).c_str());
         }
         else {
             port = connectionString;
         }
+        SerialConn* serialConn = dynamic_cast<SerialConn*> (dataSource);
         if (dataSource) {
-            SerialConn* serialConn = dynamic_cast<SerialConn*> (dataSource);
             if (serialConn) {
                 serialConn->setPortName(port);
                 if (speed) serialConn->setBaudRate(speed);
             }
         }
         else {
-            dataSource = new SerialConn(port, speed);
+            dataSource = serialConn = new SerialConn(port, speed);
         } 
+        if (serialConn && (speed || autoBaud)) {
+            serialConn->setAutoBaud(autoBaud);
+        }
+    }
+    else if (connectionString.compare(0, strlen(BROKER_PREFIX), 
+                BROKER_PREFIX) == 0) {
+        if (dataSource && (dataSource->getType() != DataSource::BROKER)) {
+            return dataSource;
+        }
+        if (dataSource) {
+            dataSource->setConnInfo(connectionString);
+        }
+        else {
+            dataSource = new BrokerConn(
+                    connectionString.substr(strlen(BROKER_PREFIX)));
+        }
+    }
+    else if (connectionString.find(":") != string::npos) {
+        if (dataSource && (dataSource->getType() != DataSource::TCP)) {
+            return dataSource;
+        }
+        if (dataSource) {
+            dataSource->setConnInfo(connectionString);
+        }
+        else {
+            string host;
+            int port = DEFAULT_TCP_PORT;
+            TcpConn::parseAddress(connectionString, host, port);
+            dataSource = new TcpConn(host, port);
+        }
     }
     return dataSource;
 }
@@ -99,7 +144,7 @@ string DataSource :: getLockFileName (const char *AppName) throw (AppException)
 // TODO How to reset vtimeIndex__
 SerialConn :: SerialConn (const string& addr, int speed, int vtime) : 
     DataSource(RS232),
-    portAddr__(addr), baudRate__(speed)
+    portAddr__(addr), baudRate__(speed), nretry__(0), autoBaud__(false)
 {
     if (speed <= 0) {
         baudRate__ = DEFAULT_BAUD;
@@ -162,8 +207,18 @@ void SerialConn :: setVtime(int vtime)
     }
 }
 
+/**
+ * Function to decide whether a failed session is tried again. When reading
+ * up to a deadline, the deadline follows the round trip time measured on
+ * the link (see RttEstimator), so the session is retried as it is. When 
+ * waiting for the line to go idle, each retry waits for a longer idle 
+ * period (vtime).
+ */
 bool SerialConn :: retryOnFail()
 {
+    if (getReadMode() == pakbuf::READ_DEADLINE) {
+        return (++nretry__ <= NUM_MAX_RETRY);
+    }
     if (vtimeIndex__ < NUM_MAX_RETRY) {
         vtimeIndex__++;
         vtime__ = vtimeArray__[vtimeIndex__];
@@ -174,6 +229,76 @@ bool SerialConn :: retryOnFail()
     } 
 }
 
+/**
+ * Function to obtain the deadline for receiving a response packet. The 
+ * deadline allows for the logger turnaround (scaled by the current vtime, 
+ * which grows on every retry) plus the time to transfer a packet of 
+ * maximum size at the port speed (10 bits per byte).
+ */
+int SerialConn :: getReadTimeout()
+{
+    return vtime__*100 + (MAX_PACK_SIZE*10*1000)/baudRate__;
+}
+
+/**
+ * Function to obtain the baud rates to try when negotiating the rate with
+ * the logger: the rate found by the last negotiation on the port, followed
+ * by AUTO_BAUD_RATES from the fastest down.
+ *
+ * @param AppName: Name of the application, as for the lock file.
+ */
+vector<int> SerialConn :: getAutoBaudRates(const char *AppName)
+{
+    const int   candidates[] = AUTO_BAUD_RATES;
+    vector<int> rates;
+    int         cached = 0;
+    ifstream    cacheFs(get_baud_cache_file(AppName).c_str());
+
+    if ((cacheFs >> cached) && (cached > 0)) {
+        rates.push_back(cached);
+    }
+    for (int idx = 0; candidates[idx]; idx++) {
+        if (candidates[idx] != cached) {
+            rates.push_back(candidates[idx]);
+        }
+    }
+    return rates;
+}
+
+/**
+ * Function to remember the current baud rate as the rate the logger on 
+ * the port answers on, so that the next negotiation tries it first.
+ *
+ * @param AppName: Name of the application, as for the lock file.
+ */
+void SerialConn :: cacheBaudRate(const char *AppName)
+{
+    ofstream cacheFs(get_baud_cache_file(AppName).c_str(), ofstream::out);
+
+    if (cacheFs.is_open()) {
+        cacheFs << baudRate__ << endl;
+    }
+}
+
+/**
+ * Function to obtain the name of the file caching the negotiated baud
+ * rate, kept next to the lock file of the port.
+ */
+string SerialConn :: get_baud_cache_file(const char *AppName)
+{
+    string cacheFile = getLockFileName(AppName);
+    return cacheFile.substr(0, cacheFile.rfind(".")) + ".baud";
+}
+
+/**
+ * Returns the lower bound (msecs) of the read deadline, which allows for 
+ * the transfer of a packet of maximum size at the port speed.
+ */
+int SerialConn :: getMinReadTimeout()
+{
+    return RTT_MIN_TIMEOUT + (MAX_PACK_SIZE*10*1000)/baudRate__;
+}
+
 /**
  * A function to obtain a descriptive string about the connection, 
  * useful for writing to log.
@@ -201,11 +326,19 @@ void SerialConn :: setConnInfo (const string& arg)
  *
  * @return Returns name of the port as a string. For example, if the 
  *         port address was "/dev/ttyS1", "ttyS1" would be returend.
+ *         The slashes of a port below /dev (e.g. "/dev/pts/3") are 
+ *         replaced, and a port outside /dev is named by its last component.
  */
 string SerialConn :: getLockId () 
 {
-    char dev[32];
-    sscanf (portAddr__.c_str(), "/dev/%s", dev);
+    string dev(portAddr__);
+    if (dev.compare(0, 5, "/dev/") == 0) {
+        dev.erase(0, 5);
+    }
+    else {
+        dev.erase(0, dev.rfind('/') + 1);
+    }
+    replace(dev.begin(), dev.end(), '/', '_');
     return dev;
 }
 
@@ -256,6 +389,311 @@ SerialConn :: ~SerialConn ()
     }
 }
 
+/**
+ * Constructor for the TcpConn object. A TCP connection has no line to go 
+ * idle, so responses are always read against a deadline.
+ *
+ * @param host: Host name or IP address of the logger or converter.
+ * @param port: TCP port number.
+ */
+TcpConn :: TcpConn (const string& host, int port) : 
+    DataSource(TCP),
+    host__(host), port__(DEFAULT_TCP_PORT), fd__(-1),
+    connectTimeout__(TCP_CONNECT_TIMEOUT)
+{
+    setPort(port);
+    setReadMode(pakbuf::READ_DEADLINE);
+}
+
+/** 
+ * Setter method for the port number.
+ */
+void TcpConn :: setPort(int port)
+{
+    port__ = ((port > 0) && (port < 65536)) ? port : DEFAULT_TCP_PORT;
+}
+
+/**
+ * Function to split a "host:port" string. An IPv6 address has to be put 
+ * in brackets, as in "[::1]:6785". The port is left unchanged if the 
+ * string doesn't specify one.
+ *
+ * @return false if no host could be found in the string.
+ */
+bool TcpConn :: parseAddress(const string& addr, string& host, int& port)
+{
+    size_t pos = addr.rfind(":");
+    size_t bracket = addr.rfind("]");
+
+    if ((string::npos != pos) && 
+            ((string::npos == bracket) || (pos > bracket))) {
+        host = addr.substr(0, pos);
+        if (pos + 1 < addr.size()) {
+            port = atoi(addr.substr(pos+1).c_str());
+        }
+    }
+    else {
+        host = addr;
+    }
+
+    if ((host.size() > 1) && (host[0] == '[') && 
+            (host[host.size()-1] == ']')) {
+        host = host.substr(1, host.size()-2);
+    }
+    return !host.empty();
+}
+
+/**
+ * A function to obtain a descriptive string about the connection, 
+ * useful for writing to log.
+ */
+string TcpConn :: getConnInfo () 
+{
+    return "tcp://" + getAddress();
+}
+
+string TcpConn :: getAddress () 
+{
+    stringstream msg;
+    if (host__.find(":") != string::npos) {
+        msg << "[" << host__ << "]:" << port__;
+    }
+    else {
+        msg << host__ << ":" << port__;
+    }
+    return msg.str();
+}
+
+/**
+ * Function useful for setting connection parameters through command
+ * line arguments, in the form "host:port".
+ */
+void TcpConn :: setConnInfo (const string& arg) 
+{
+    int port = port__;
+    if (parseAddress(arg, host__, port)) {
+        setPort(port);
+    }
+}
+
+/**
+ * Function to obtain an identifier for the lock file, made from the host 
+ * and port so that two instances don't talk to the same logger.
+ */
+string TcpConn :: getLockId () 
+{
+    stringstream lockId;
+    lockId << "tcp_" << host__ << "_" << port__;
+
+    string id(lockId.str());
+    replace(id.begin(), id.end(), '/', '_');
+    replace(id.begin(), id.end(), ':', '_');
+    return id;
+}
+
+/**
+ * Function to connect to the logger. Each address the host name resolves
+ * to is tried with a non-blocking connect, waiting up to the connect
+ * timeout, TCP_CONNECT_TIMEOUT msecs by default, for it to complete.
+ *
+ * @return Returns the file descriptor of the connected socket.
+ */
+int TcpConn :: connect () throw (CommException)
+{
+    stringstream msgstrm;
+    stringstream service;
+    struct addrinfo  hints;
+    struct addrinfo* addrs = NULL;
+    struct addrinfo* ai;
+    string error("no address found");
+
+    disconnect();
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    service << port__;
+
+    int stat = getaddrinfo(host__.c_str(), service.str().c_str(), &hints, 
+            &addrs);
+    if (stat) {
+        error = gai_strerror(stat);
+        addrs = NULL;
+    }
+
+    for (ai = addrs; ai && (fd__ < 0); ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            error = strerror(errno);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        // A connect failing at once keeps its errno, and the next
+        // address is tried
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            errno = 0;
+        }
+        else if (errno == EINPROGRESS) {
+            if (EventLoop::getInstance()
+                    .waitFd(fd, POLLOUT, connectTimeout__) > 0) {
+                int       sock_err = 0;
+                socklen_t len = sizeof(sock_err);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &sock_err, &len);
+                errno = sock_err;
+            }
+            else {
+                errno = ETIMEDOUT;
+            }
+        }
+
+        if (errno) {
+            error = strerror(errno);
+            close(fd);
+            continue;
+        }
+
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        fd__ = fd;
+    }
+
+    if (addrs) {
+        freeaddrinfo(addrs);
+    }
+
+    if (fd__ < 0) {
+        msgstrm << "Failed to connect to " << getConnInfo() << " : " << error;
+        Category::getInstance("TcpConn")
+                 .error(msgstrm.str());
+        throw CommException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+
+    msgstrm << "Successfully connected to device: " << getConnInfo();
+    Category::getInstance("TcpConn")
+             .debug(msgstrm.str());
+    return fd__;
+}
+
+bool TcpConn :: disconnect()  throw (CommException)
+{
+    if (fd__ >= 0) {
+        close(fd__);
+        fd__ = -1;
+    }
+    return true;
+}
+
+/**
+ * Destructor for the TcpConn class.
+ * It closes the socket.
+ */
+TcpConn :: ~TcpConn ()
+{
+    this->disconnect();
+}
+
+/**
+ * Constructor for the BrokerConn object. Responses are read against a 
+ * deadline, as on a TCP connection.
+ *
+ * @param path: Path of the unix socket the broker listens on.
+ */
+BrokerConn :: BrokerConn (const string& path) : 
+    DataSource(BROKER), path__(path), fd__(-1)
+{
+    setReadMode(pakbuf::READ_DEADLINE);
+}
+
+/**
+ * Function useful for setting the socket path through command line 
+ * arguments, in the form "unix:/path/to/socket".
+ */
+void BrokerConn :: setConnInfo (const string& arg) 
+{
+    if (arg.compare(0, strlen(BROKER_PREFIX), BROKER_PREFIX) == 0) {
+        path__ = arg.substr(strlen(BROKER_PREFIX));
+    }
+    else {
+        path__ = arg;
+    }
+}
+
+/**
+ * Function to obtain an identifier for the lock file. The broker decides
+ * which client gets the port, so the clients of a broker don't keep each
+ * other out and the identifier is unique to the process.
+ */
+string BrokerConn :: getLockId () 
+{
+    stringstream lockId;
+    lockId << "broker" << path__ << "_" << getpid();
+
+    string id(lockId.str());
+    replace(id.begin(), id.end(), '/', '_');
+    return id;
+}
+
+/**
+ * Function to connect to the broker.
+ *
+ * @return Returns the file descriptor of the connected socket.
+ */
+int BrokerConn :: connect () throw (CommException)
+{
+    stringstream msgstrm;
+    struct sockaddr_un addr;
+
+    disconnect();
+
+    if (path__.size() >= sizeof(addr.sun_path)) {
+        msgstrm << "Socket path too long : " << path__;
+        throw CommException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path__.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || 
+            (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+        msgstrm << "Failed to connect to " << getConnInfo() << " : " 
+                << strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        Category::getInstance("BrokerConn")
+                 .error(msgstrm.str());
+        throw CommException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fd__ = fd;
+
+    msgstrm << "Successfully connected to broker: " << getConnInfo();
+    Category::getInstance("BrokerConn")
+             .debug(msgstrm.str());
+    return fd__;
+}
+
+bool BrokerConn :: disconnect()  throw (CommException)
+{
+    if (fd__ >= 0) {
+        close(fd__);
+        fd__ = -1;
+    }
+    return true;
+}
+
+/**
+ * Destructor for the BrokerConn class.
+ * It closes the socket.
+ */
+BrokerConn :: ~BrokerConn ()
+{
+    this->disconnect();
+}
+
 /**
  * Function to set the working path. Can be used to override the option set
  * in the configuration file.
@@ -281,6 +719,8 @@ void CommInpCfg :: loadSerialConfig (const xmlNodePtr node)
     xmlNodePtr cnode = node->children;
     char      *dummy;
     int        vtime = DEFAULT_VTIME;
+    bool       auto_baud = false;
+    pakbuf::ReadMode read_mode = pakbuf::READ_DEADLINE;
     
     InputValidator validator;
     validator.addRequiredInput("baud_rate");
@@ -290,7 +730,13 @@ void CommInpCfg :: loadSerialConfig (const xmlNodePtr node)
             port_name = xmlNodeGetNormContent(cnode);
         }
         else if ( ! xmlStrcasecmp ( cnode->name, (const xmlChar *)"baud_rate") ) {
-            speed = strtol (xmlNodeGetNormContent (cnode), &dummy, 10);
+            if ( ! strcasecmp (xmlNodeGetNormContent (cnode), AUTO_BAUD_NAME) ) {
+                auto_baud = true;
+                speed = DEFAULT_BAUD;
+            }
+            else {
+                speed = strtol (xmlNodeGetNormContent (cnode), &dummy, 10);
+            }
             if (speed > 0) {
                 validator.setInputStatusOk("baud_rate");
             }
@@ -298,6 +744,11 @@ void CommInpCfg :: loadSerialConfig (const xmlNodePtr node)
         else if ( ! xmlStrcasecmp ( cnode->name, (const xmlChar *)"vtime") ) {
             vtime = strtol (xmlNodeGetNormContent (cnode), &dummy, 10);
         }
+        else if ( ! xmlStrcasecmp ( cnode->name, (const xmlChar *)"read_mode") ) {
+            if ( ! strcasecmp (xmlNodeGetNormContent (cnode), "vtime") ) {
+                read_mode = pakbuf::READ_VTIME;
+            }
+        }
         cnode = cnode->next;
     }
 
@@ -306,7 +757,49 @@ void CommInpCfg :: loadSerialConfig (const xmlNodePtr node)
                 "Incomplete input for establishing serial connection");
     }
 
-    dataSource__.reset(new SerialConn (port_name, speed, vtime));
+    SerialConn* serialConn = new SerialConn (port_name, speed, vtime);
+    serialConn->setAutoBaud(auto_baud);
+    dataSource__.reset(serialConn);
+    dataSource__->setReadMode(read_mode);
+    return;
+}
+
+/**
+ * Function for loading the TCP/IP connection settings from the XML 
+ * configuration file.
+ *
+ * @node: Pointer to the <CONNECTION> node in the XML configuration file.
+ */ 
+void CommInpCfg :: loadTcpConfig (const xmlNodePtr node) 
+        throw (AppException)
+{
+    string     host;
+    int        port = DEFAULT_TCP_PORT;
+    xmlNodePtr cnode = node->children;
+    char      *dummy;
+    
+    InputValidator validator;
+    validator.addRequiredInput("host");
+
+    while (cnode) {
+        if ( ! xmlStrcasecmp ( cnode->name, (const xmlChar *)"host") ) {
+            host = xmlNodeGetNormContent(cnode);
+            if (host.size()) {
+                validator.setInputStatusOk("host");
+            }
+        }
+        else if ( ! xmlStrcasecmp ( cnode->name, (const xmlChar *)"port") ) {
+            port = strtol (xmlNodeGetNormContent (cnode), &dummy, 10);
+        }
+        cnode = cnode->next;
+    }
+
+    if (validator.validateInputs() == false) {
+        throw AppException(__FILE__, __LINE__, 
+                "Incomplete input for establishing TCP connection");
+    }
+
+    dataSource__.reset(new TcpConn (host, port));
     return;
 }
 
@@ -336,7 +829,7 @@ void CommInpCfg :: loadDataOutputConfig (const xmlNodePtr node)
             xmlNodePtr tnode = cnode->children;
             while (tnode) {
                 if (!xmlStrcasecmp(tnode->name, (const xmlChar *)"table")){
-                    tbl_opt.TableName = xmlNodeGetNormContent (tnode);
+                    loadTableFields (tnode, tbl_opt);
                     validator.setInputStatusOk("table");
                     properties = (char *)xmlGetProp (tnode, 
                             (const xmlChar*)"sample_int_secs");
@@ -372,6 +865,44 @@ void CommInpCfg :: loadDataOutputConfig (const xmlNodePtr node)
     }
 }
 
+/**
+ * Function to read the name of a table and the optional selection of fields
+ * to collect from it. The table name is the text of the <TABLE> node, the
+ * fields are listed in a <FIELDS> child node, separated by commas or 
+ * whitespace. For example:
+ *
+ *    <TABLE sample_int_secs="60">OneMin<FIELDS>AirTC_Avg, RH</FIELDS></TABLE>
+ *
+ * @param node: Pointer to the <TABLE> node in the XML configuration file.
+ * @param tbl_opt: Reference to the table options to fill in.
+ */
+void CommInpCfg :: loadTableFields (const xmlNodePtr node, TableOpt& tbl_opt)
+{
+    xmlNodePtr cnode = node->children;
+
+    tbl_opt.TableName.clear();
+    tbl_opt.Fields.clear();
+
+    while (cnode) {
+        if (cnode->type == XML_TEXT_NODE) {
+            if (tbl_opt.TableName.empty()) {
+                tbl_opt.TableName = xmlNodeGetNormContent (cnode);
+            }
+        }
+        else if ( !xmlStrcasecmp(cnode->name, (const xmlChar *)"fields") ) {
+            string list(xmlNodeGetNormContent (cnode));
+            replace (list.begin(), list.end(), ',', ' ');
+
+            stringstream fields(list);
+            string field;
+            while (fields >> field) {
+                tbl_opt.Fields.push_back (field);
+            }
+        }
+        cnode = cnode->next;
+    }
+}
+
 /**
  * Function to load the PakBus address information of the target device from 
  * the input configuration file.
@@ -407,6 +938,16 @@ void CommInpCfg :: loadPakbusConfig (const xmlNodePtr node)
                     (uint2)strtol(xmlNodeGetNormContent(cnode),&dummy, 10);
             validator.setInputStatusOk("security_code");
         }
+        else if(!xmlStrcasecmp(cnode->name, 
+                    (const xmlChar *)"collect_window") ) {
+            pbAddr__.CollectWindow = 
+                    (int)strtol(xmlNodeGetNormContent(cnode),&dummy, 10);
+        }
+        else if(!xmlStrcasecmp(cnode->name, 
+                    (const xmlChar *)"hop_count") ) {
+            pbAddr__.HopCount = 
+                    (int)strtol(xmlNodeGetNormContent(cnode),&dummy, 10);
+        }
         cnode = cnode->next;
     }
     if (validator.validateInputs() == false) {
@@ -484,6 +1025,10 @@ void CommInpCfg :: loadConfig (const char *filename)
                 loadSerialConfig (node);
                 validator.setInputStatusOk("CONNECTION");
             }
+            else if (! xmlStrcasecmp (properties, (const xmlChar*)"tcp")) {
+                loadTcpConfig (node);
+                validator.setInputStatusOk("CONNECTION");
+            }
         }
     }
 
@@ -504,6 +1049,12 @@ auto_ptr<DataSource> CommInpCfg :: getDataSource(const string& connectionString)
                 "No connection information is provided in config file/command line");
     }
 
+    // The broker stands in for the port given in the config file
+    if (connectionString.compare(0, strlen(BROKER_PREFIX), 
+                BROKER_PREFIX) == 0) {
+        dataSource__.reset();
+    }
+
     DataSource* dataSourcePtr = dataSource__.get(); 
     if (dataSourcePtr) {
         DataSource::decorate(dataSourcePtr, connectionString);
@@ -27,8 +27,9 @@ using namespace std;
  */
 class DataSource {
     public :
-        enum Type { UNKNOWN, RS232, TCP };
-        DataSource(DataSource::Type type) : type__(type) {}
+        enum Type { UNKNOWN, RS232, TCP, BROKER };
+        DataSource(DataSource::Type type) : type__(type), 
+                readMode__(pakbuf::READ_DEADLINE) {}
         static DataSource* createDataSource(const string& connectionString);
         static DataSource* decorate(DataSource* dataSource, 
                 const string& connectionString);
@@ -39,12 +40,19 @@ class DataSource {
         virtual string getAddress() = 0;
         virtual void   setConnInfo(const string& arg) = 0;
         virtual bool   retryOnFail() { return false; }
+        /** Returns the deadline (msecs) for receiving a response packet. */
+        virtual int    getReadTimeout() { return DEFAULT_READ_TIMEOUT; }
+        /** Returns the lower bound (msecs) of the read deadline. */
+        virtual int    getMinReadTimeout() { return RTT_MIN_TIMEOUT; }
+        pakbuf::ReadMode getReadMode() { return readMode__; }
+        void   setReadMode(pakbuf::ReadMode mode) { readMode__ = mode; }
         virtual string getLockId() = 0;
         string         getLockFileName(const char *AppName) throw (AppException);
         virtual ~DataSource () {};
         DataSource::Type getType() { return type__; } 
     private:
         DataSource::Type type__;
+        pakbuf::ReadMode readMode__;
 };
 
 
@@ -55,6 +63,11 @@ class DataSource {
 #define DEFAULT_BAUD  115200
 #define DEFAULT_VTIME 10
 #define NUM_MAX_RETRY 8
+// Baud rate given in the configuration to have the rate negotiated
+#define AUTO_BAUD_NAME "auto"
+// Candidate rates of the negotiation, from the fastest down, 0 terminated
+#define AUTO_BAUD_RATES { 921600, 460800, 230400, 115200, 57600, 38400, \
+                          19200, 9600, 0 }
 
 class SerialConn : public DataSource {
     public :
@@ -73,15 +86,91 @@ class SerialConn : public DataSource {
         void    setBaudRate(int baudRate);
         int     getVtime() { return vtime__; }
         void    setVtime(int vtime);
+        /** Returns true if the baud rate is negotiated with the logger. */
+        bool    isAutoBaud() { return autoBaud__; }
+        void    setAutoBaud(bool autoBaud) { autoBaud__ = autoBaud; }
+        vector<int> getAutoBaudRates(const char *AppName);
+        void    cacheBaudRate(const char *AppName);
         virtual bool   retryOnFail();
+        virtual int    getReadTimeout();
+        virtual int    getMinReadTimeout();
 
     private :
         string portAddr__;
         int    baudRate__;
         int    fd__;
-        int    vtimeArray__[7];
+        int    vtimeArray__[9];
         int    vtimeIndex__;
         int    vtime__;
+        int    nretry__;
+        bool   autoBaud__;
+
+        string get_baud_cache_file(const char *AppName);
+};
+
+
+/**
+ * Implementation of the DataSource interface that models a TCP/IP 
+ * connection to a logger, either to its built-in IP port or through a 
+ * serial-to-Ethernet converter. The socket is non-blocking, with Nagle's
+ * algorithm disabled and keepalive probes enabled.
+ */
+#define DEFAULT_TCP_PORT    6785
+#define TCP_CONNECT_TIMEOUT 10000
+
+class TcpConn : public DataSource {
+    public :
+        explicit TcpConn (const string& host, int port=DEFAULT_TCP_PORT);
+        ~TcpConn ();
+        virtual int    connect() throw (CommException);
+        virtual bool   disconnect() throw (CommException);
+        virtual bool   isOpen() { return (fd__ >= 0) ? true : false; }
+        virtual string getConnInfo();
+        virtual void   setConnInfo(const string& arg);
+        virtual string getLockId();
+        string  getAddress();
+        void    setHost(const string& host) { host__ = host; }
+        int     getPort() { return port__; }
+        void    setPort(int port);
+        void    setConnectTimeout(int msecs) { connectTimeout__ = msecs; }
+        static bool parseAddress(const string& addr, string& host, int& port);
+
+    private :
+        string host__;
+        int    port__;
+        int    fd__;
+        int    connectTimeout__;
+};
+
+
+/**
+ * Implementation of the DataSource interface that models the connection
+ * to a PbCdlComm broker owning the port (see the -B option). The broker
+ * passes the PakBus frames written on its unix socket to the logger and
+ * returns the responses, so the connection is used like a port of its own
+ * while the broker keeps collecting on schedule.
+ */
+#define BROKER_PREFIX "unix:"
+// Msecs a response from the broker may take, which allows for the broker
+// holding the request back while its scheduled collection is busy
+#define BROKER_READ_TIMEOUT 5000
+
+class BrokerConn : public DataSource {
+    public :
+        explicit BrokerConn (const string& path);
+        ~BrokerConn ();
+        virtual int    connect() throw (CommException);
+        virtual bool   disconnect() throw (CommException);
+        virtual bool   isOpen() { return (fd__ >= 0) ? true : false; }
+        virtual string getConnInfo() { return BROKER_PREFIX + path__; }
+        virtual string getAddress() { return path__; }
+        virtual void   setConnInfo(const string& arg);
+        virtual string getLockId();
+        virtual int    getReadTimeout() { return BROKER_READ_TIMEOUT; }
+
+    private :
+        string path__;
+        int    fd__;
 };
 
 
@@ -115,7 +204,10 @@ class CommInpCfg {
                 throw (AppException);
         void loadSerialConfig (const xmlNodePtr node) 
                 throw (AppException);
+        void loadTcpConfig (const xmlNodePtr node) 
+                throw (AppException);
         void loadDataOutputConfig (const xmlNodePtr node) throw (AppException);
+        void loadTableFields (const xmlNodePtr node, TableOpt& tbl_opt);
         void loadPakbusConfig (const xmlNodePtr node) 
                 throw (AppException);
 
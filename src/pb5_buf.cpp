@@ -16,6 +16,7 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <deque>
 #include <algorithm>
@@ -27,10 +28,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
 #include <time.h>
 #include "pb5_proto.h"
 #include "pb5_buf.h"
 #include "utils.h"
+#include "event_loop.h"
 #include "log4cpp/Category.hh"
 
 using namespace std;
@@ -43,19 +46,36 @@ using namespace log4cpp;
  * @param filedesc: File descriptor of the target device
  * @param log_dir: Directory for storing low-level log files
  */
-pakbuf :: pakbuf(int ibuflen, int obuflen) : devFd__(-1), traceCommEnabled__(false)
+pakbuf :: pakbuf(int ibuflen, int obuflen) : devFd__(-1), 
+        readMode__(READ_DEADLINE), readTimeout__(DEFAULT_READ_TIMEOUT),
+        rtt__(NULL), successiveBadRead__(0), dataLastRead__(true), batchDepth__(0), 
+        encSig__(SIG_SEED), traceCommEnabled__(false)
 {   
     ibuf__ = new char[ibuflen]; 
     obuf__ = new char[obuflen]; 
     ibufsize__ = ibuflen;
     obufsize__ = obuflen;
 
+    memset(tranSentAt__, 0, sizeof(tranSentAt__));
+    memset(tranSends__, 0, sizeof(tranSends__));
+
     // Setup streambuf pointers
     setp(obuf__, obuf__ + obufsize__);
-    setg((char *)ibuf__, (char *)ibuf__, (char *)ibuf__);
+    reset_framer();
     return;
 }
 
+/**
+ * Function to set the deadline for receiving a response packet when the 
+ * buffer operates in the READ_DEADLINE mode.
+ *
+ * @param msecs: Read deadline in milliseconds.
+ */
+void pakbuf :: setReadTimeout(int msecs)
+{
+    readTimeout__ = (msecs > 0) ? msecs : DEFAULT_READ_TIMEOUT;
+}
+
 void pakbuf :: setHexLogDir(const string& log_dir)
 {
     struct tm *ptm;
@@ -184,12 +204,30 @@ void pakbuf :: traceComm(char *beg_ptr, char *end_ptr, char type)
     return;
 }        
 
+/**
+ * Function to attach the buffer to a device. Any bytes or packets left over
+ * from a previous device are discarded.
+ *
+ * @param fd: File descriptor of the device.
+ */
+void pakbuf :: setFd(int fd)
+{
+    devFd__ = fd;
+    successiveBadRead__ = 0;
+    dataLastRead__ = true;
+    reset_framer();
+}
+
 /**
  * Function to read from the device identified by the file descriptor member.
- * A packet queue is built upon reading from the device based on the delimiters
- * (SerSyncByte) in the byte stream read. After the data is read from the 
- * device, the packet queue is traversed to unquote any special symbols from
- * each packet.
+ * The bytes read are appended to the input buffer and framed into PakBus 
+ * packets as they arrive (see frame_input()). Packets, and any partially 
+ * received packet, are kept across calls until consumed from the packet 
+ * queue.
+ *
+ * This function returns only after the device stayed idle for a full VTIME
+ * period. It is used as the fallback when the buffer is set to READ_VTIME 
+ * mode or when the caller is not waiting for a specific packet.
  *
  * @return The total number of bytes read from this call.
  */ 
@@ -198,164 +236,505 @@ int pakbuf :: readFromDevice() throw (CommException)
 {
     int        nbytes;
     int        nread  = 0;
-    static uint4 successive_bad_read = 0;
-    static int nbytes_last_read = 1; 
+    uint4      start_t = get_msec_clock();
 
-    // Initialize the input buffer and the read pointer
-
-    setg((char *)ibuf__, (char *)ibuf__, (char *)ibuf__);
-    char *read_ptr = eback ();
-    packetQueue__.clear ();
-    
     // Read bytes from the serial port. If there are no bytes to read
     // break out of the while loop.
     
     while(1) {
-       if ( (nbytes = read (devFd__, read_ptr, 1024)) ){
+       char *read_ptr = reserve_input (1024);
+       if ( (nbytes = read (devFd__, read_ptr, 1024)) > 0 ) {
            nread += nbytes;
-           read_ptr += nbytes;
+           frame_input (nbytes);
        }
        else {
-           if (nread) read_ptr--;
            break;
        } 
     } 
 
-    split_sequence_to_packets ((char *)ibuf__, read_ptr);
-    
-    setg((char *)ibuf__, (char *)ibuf__, read_ptr);
-    deque<Packet>::iterator pack_queue_itr;
-    for (pack_queue_itr = packetQueue__.begin(); pack_queue_itr != packetQueue__.end();
-            pack_queue_itr++) {
-        unquote_pack (*pack_queue_itr);
+    if (Category::getInstance("I/O").isDebugEnabled()) {
+        stringstream msgstrm;
+        msgstrm << "Read " << nread << " bytes in " 
+                << msec_diff(get_msec_clock(), start_t) << " ms (idle wait)";
+        Category::getInstance("I/O").debug(msgstrm.str());
     }
-    tcflush(devFd__, TCIFLUSH);
 
-    if (!nread && !nbytes_last_read) {
-        successive_bad_read++;
-        if (successive_bad_read == MAX_SUCCESSIVE_BAD_READ) {
-            Category::getInstance("I/O")
-                     .debug("No response from device");
-            throw CommException (__FILE__, __LINE__, "No response from device");
+    account_read (nread > 0);
+    return nread;
+}
+
+/**
+ * Function to read from the device until a link state packet is in the
+ * packet queue, or the read deadline expires. The handshake of the link
+ * is the only exchange outside the TransactionEngine, and it waits for
+ * this reply only. The device is polled for input, so the call returns as
+ * soon as the packet is in rather than waiting for the line to go idle.
+ * Any other packets received along the way are queued as well.
+ *
+ * If the buffer is set to READ_VTIME mode, this falls back to the idle-wait
+ * behaviour of readFromDevice().
+ *
+ * @return The total number of bytes read from this call.
+ */
+int pakbuf :: readLinkState() throw (CommException)
+{
+    if (readMode__ == READ_VTIME) {
+        return readFromDevice();
+    }
+
+    int    nbytes;
+    int    nread = 0;
+    bool   matched = false;
+    uint4  start_t = get_msec_clock();
+    int    timeout = getReadTimeout();
+    deque<Packet>::size_type idx;
+
+    for (idx = 0; (idx < packetQueue__.size()) && !matched; idx++) {
+        matched = is_link_state (packetQueue__[idx]);
+    }
+
+    while (!matched) {
+        int remaining = timeout - msec_diff(get_msec_clock(), start_t);
+
+        if ((remaining <= 0) || !(nbytes = readPackets (remaining))) {
+            break;
+        }
+        nread += nbytes;
+
+        for (; (idx < packetQueue__.size()) && !matched; idx++) {
+            matched = is_link_state (packetQueue__[idx]);
         }
     }
-    else {
-        successive_bad_read = 0;
+
+    if (!matched && rtt__) {
+        rtt__->backoff();
+    }
+
+    if (Category::getInstance("I/O").isDebugEnabled()) {
+        stringstream msgstrm;
+        msgstrm << "Read " << nread << " bytes in " 
+                << msec_diff(get_msec_clock(), start_t) << " ms (" 
+                << (matched ? "link state framed" : "deadline expired") 
+                << ")";
+        Category::getInstance("I/O").debug(msgstrm.str());
     }
-    nbytes_last_read = nread;
+
+    account_read (matched || (nread > 0));
     return nread;
 }
 
 /**
- * Function to split a sequence of bytes into PakBus packets.
- * Each PakBus packet begins and ends with 0xbd. The packets contain 
- * pointers to the beginning and end of each memory segment. Once found,
- * the packets are loaded in a double ended queue.
+ * Function to read from the device until at least one more packet is in
+ * the packet queue, or the given time elapses. It is used by the
+ * TransactionEngine, which matches the packets to the outstanding 
+ * transactions and keeps their deadlines itself, so a read receiving 
+ * nothing isn't counted as a failure here.
+ *
+ * If the buffer is set to READ_VTIME mode, this falls back to the idle-wait
+ * behaviour of readFromDevice().
  *
- * @param beg: Pointer to the beginning of the byte sequence.
- * @param end: Pointer to the end of the byte sequence.
- */
-void pakbuf :: split_sequence_to_packets (char *beg, char *end)
-{
-    char       *packet_beg;
-    char       *packet_end;
-    char       *beg_search = beg;
-    static char start_sym = SerSyncByte__;
-    static char end_sym = SerSyncByte__;
-    Packet      tmp_pack;
-	
-    while (beg_search <= end) {
-        packet_beg = find (beg_search, end, start_sym);
-
-        if (*packet_beg == start_sym) {
-            // A match is found for the beginning of the packet
-            tmp_pack.begPacket = packet_beg;
-
-            if (packet_beg == end) {
-                    tmp_pack.endPacket = end;
-                    tmp_pack.Complete  = false;
-                    packetQueue__.push_back(tmp_pack);
-                    break;
+ * @param msecs: Maximum time to wait in milliseconds, negative to use the
+ *               read deadline.
+ * @return The total number of bytes read from this call.
+ */
+int pakbuf :: readPackets(int msecs) throw (CommException)
+{
+    if (readMode__ == READ_VTIME) {
+        return readFromDevice();
+    }
+
+    int    nbytes;
+    int    nread = 0;
+    uint4  start_t = get_msec_clock();
+    deque<Packet>::size_type queued = packetQueue__.size();
+
+    if (msecs < 0) {
+        msecs = getReadTimeout();
+    }
+
+    while (packetQueue__.size() == queued) {
+        int remaining = msecs - msec_diff(get_msec_clock(), start_t);
+
+        if (remaining <= 0) {
+            break;
+        }
+        if (wait_for_input (remaining) <= 0) {
+            continue;
+        }
+
+        char *read_ptr = reserve_input (1024);
+        if ((nbytes = read (devFd__, read_ptr, 1024)) <= 0) {
+            if (nbytes == 0) {
+                throw CommException (__FILE__, __LINE__, 
+                        "Connection closed by device");
             }
-            else {
-                    beg_search = ++packet_beg;
+            if ((errno != EINTR) && (errno != EAGAIN)) {
+                break;
             }
+            continue;
         }
-        else {
-            // The char sequence does not contain the starting symbol
-            // of a packet. 
-            break;
+        nread += nbytes;
+        frame_input (nbytes);
+    }
+    return nread;
+}
+
+/**
+ * Function to take the input already received from the device, without 
+ * waiting for more. Nothing is read in READ_VTIME mode.
+ *
+ * @return The total number of bytes read from this call.
+ */
+int pakbuf :: readAvailable() throw (CommException)
+{
+    int nbytes;
+    int nread = 0;
+
+    if (readMode__ == READ_VTIME) {
+        return 0;
+    }
+
+    while (wait_for_input (0) > 0) {
+        char *read_ptr = reserve_input (1024);
+        if ((nbytes = read (devFd__, read_ptr, 1024)) <= 0) {
+            if (nbytes == 0) {
+                throw CommException (__FILE__, __LINE__, 
+                        "Connection closed by device");
+            }
+            if ((errno != EINTR) && (errno != EAGAIN)) {
+                break;
+            }
+            continue;
         }
+        nread += nbytes;
+        frame_input (nbytes);
+    }
+    return nread;
+}
 
-        // Now that the beginning of a packet is found, look for the end
-        packet_end = find (beg_search, end, end_sym);
-        tmp_pack.endPacket = packet_end;
+/**
+ * Function to account for the response to a transaction handled by the
+ * TransactionEngine.
+ *
+ * @param tran_nbr: Transaction number of the response.
+ * @param fresh: Set if the response was framed by the last read.
+ */
+void pakbuf :: responseReceived(byte tran_nbr, bool fresh)
+{
+    measure_rtt (tran_nbr, fresh);
+    account_read (true);
+}
+
+/**
+ * Function to account for a transaction handled by the TransactionEngine
+ * that wasn't answered before its deadline. The deadline is backed off,
+ * and CommException is thrown once too many transactions in a row went 
+ * unanswered.
+ */
+void pakbuf :: responseTimedOut() throw (CommException)
+{
+    if (rtt__) {
+        rtt__->backoff();
+    }
+    account_read (false);
+}
+
+/**
+ * Function to account for a "please wait" notification received in place
+ * of the response to a request. The logger announces how long it needs
+ * before it answers, so the response is due that long from now plus the 
+ * usual deadline, and the request shouldn't be sent again before. The 
+ * round trip time of the transaction isn't measured, as it includes the
+ * wait.
+ *
+ * @param pack: The notification, see getPleaseWait().
+ * @return The deadline (msecs) for receiving the response.
+ */
+int pakbuf :: deferResponse(const Packet& pack)
+{
+    int  wait_msecs = getPleaseWait(pack);
+    byte tran_nbr = pack.Summary.TranNbr;
+
+    tranSends__[tran_nbr] = 0xff;
+    account_read (true);
+
+    if (Category::getInstance("I/O").isDebugEnabled()) {
+        stringstream msgstrm;
+        msgstrm << "Logger asked to wait " << wait_msecs 
+                << " ms for the response to transaction " 
+                << byte2int(tran_nbr);
+        Category::getInstance("I/O").debug(msgstrm.str());
+    }
+    return wait_msecs + getReadTimeout();
+}
+
+/**
+ * Function to check if a packet is a BMP5 "please wait" notification. The
+ * notification carries the message type of the delayed request and the
+ * number of seconds the logger needs before it answers.
+ *
+ * @param pack: Packet in the packet queue.
+ * @return The wait announced in milliseconds, -1 if the packet isn't a 
+ *         "please wait" notification.
+ */
+int pakbuf :: getPleaseWait(const Packet& pack)
+{
+    // Header, message type of the request, wait and signature nullifier
+    // between the SerSyncBytes
+    if ((pack.endPacket - pack.begPacket + 1 < 17) || 
+            (pack.Summary.Protocol != 0x01) || 
+            (pack.Summary.MsgType != BMP5_PLEASE_WAIT)) {
+        return -1;
+    }
+    return PleaseWaitMsg::WaitSecs::get(frameBody(pack.begPacket)) * 1000;
+}
+
+/**
+ * Returns the deadline (msecs) for receiving the response to a request,
+ * taken from the RttEstimator if one is set.
+ */
+int pakbuf :: getReadTimeout()
+{
+    return rtt__ ? rtt__->getTimeout() : readTimeout__;
+}
+
+/**
+ * Function to measure the round trip time of a transaction once its 
+ * response is framed. A request sent more than once isn't measured, as the
+ * response to a retry can't be told from a late response.
+ *
+ * @param tran_nbr: Transaction number of the response.
+ * @param fresh: Set if the response was framed just now.
+ */
+void pakbuf :: measure_rtt (byte tran_nbr, bool fresh)
+{
+    if (rtt__ && fresh && (tranSends__[tran_nbr] == 1)) {
+        rtt__->addSample(msec_diff(get_msec_clock(), tranSentAt__[tran_nbr]));
+    }
+    tranSends__[tran_nbr] = 0;
+}
+
+/**
+ * Function to wait for input to be available on the device.
+ *
+ * @param msecs: Maximum time to wait in milliseconds.
+ * @return Positive value if input is available, 0 on timeout and -1 on error.
+ */
+int pakbuf :: wait_for_input (int msecs)
+{
+    int stat = EventLoop::getInstance().waitFd (devFd__, POLLIN, msecs);
+    if ((stat < 0) && (errno != EINTR)) {
+        Category::getInstance("I/O").debug(strerror(errno));
+    }
+    return stat;
+}
+
+/**
+ * Function to check if a queued packet is a link state packet, which
+ * carries a 4-byte header and the signature nullifier between the 
+ * SerSyncBytes.
+ */
+bool pakbuf :: is_link_state (const Packet& pack)
+{
+    return (pack.endPacket - pack.begPacket + 1 == 8);
+}
 
-        // Check if the end_sym 
-        tmp_pack.Complete = (*packet_end == end_sym) ? true : false;
-        packetQueue__.push_back(tmp_pack);
-        beg_search = packet_end+1;
+/**
+ * Function to keep track of successive reads that did not return any data.
+ *
+ * @param got_data: Set if the read received any data.
+ */
+void pakbuf :: account_read (bool got_data) throw (CommException)
+{
+    if (!got_data && !dataLastRead__) {
+        successiveBadRead__++;
+        if (successiveBadRead__ == MAX_SUCCESSIVE_BAD_READ) {
+            Category::getInstance("I/O")
+                     .debug("No response from device");
+            throw CommException (__FILE__, __LINE__, "No response from device");
+        }
+    }
+    else {
+        successiveBadRead__ = 0;
     }
-    // End of while loop
+    dataLastRead__ = got_data;
     return;
-}    
+}
 
 /**
- * This function takes a packet as an argument and checks for the
- * presence of the quote byte 0xbc. The value of the byte following 
- * the quote-byte is replaced with the appropriate value. The 
- * beginning and end pointer members of the packet is updated.
+ * Function to discard the contents of the input buffer and the packet queue
+ * and reset the state of the framer.
+ */
+void pakbuf :: reset_framer ()
+{
+    packetQueue__.clear ();
+    frameBeg__  = NULL;
+    outPtr__    = ibuf__;
+    quotePending__ = false;
+    frameSig__  = SIG_SEED;
+    scanPtr__   = ibuf__;
+    writePtr__  = ibuf__;
+    setg(ibuf__, ibuf__, ibuf__);
+}
+
+/**
+ * Function to make room for reading at least nbytes into the input buffer.
+ * The bytes still in use (queued packets and the frame being received) are
+ * moved to the beginning of the buffer, which is grown if that does not 
+ * free enough space. The pointers held by the queued packets are updated.
  *
- * @param pack: Reference to the PakBus packet to unquote.
+ * @param nbytes: Number of bytes to make room for.
+ * @return Pointer to the location for storing the next byte read.
  */
-void pakbuf :: unquote_pack (Packet& pack)
+char* pakbuf :: reserve_input (int nbytes)
 {
-    uint2 len = pack.endPacket - pack.begPacket;
-    uint2 i = 0;
-    uint2 j = 0;
-    int   num_quotebytes = 0;
-    byte *tmpbuf = new byte[len];
-    byte *pptr;
+    if ((ibuf__ + ibufsize__ - writePtr__) >= nbytes) {
+        return writePtr__;
+    }
 
-    // Write the received messages to the low-level log files before they are
-    // unquoted. That will allow the users to see the originally received msg.
+    char *keep = frameBeg__ ? frameBeg__ : scanPtr__;
+    if (!packetQueue__.empty()) {
+        keep = packetQueue__.front().begPacket;
+    }
+
+    int   used    = writePtr__ - keep;
+    char *newbuf  = ibuf__;
+    int   newsize = ibufsize__;
+
+    while ((newsize - used) < nbytes) {
+        newsize *= 2;
+    }
+    if (newsize != ibufsize__) {
+        newbuf = new char[newsize];
+        stringstream msgstrm;
+        msgstrm << "Growing input buffer to " << newsize << " bytes";
+        Category::getInstance("I/O").debug(msgstrm.str());
+    }
+    memmove (newbuf, keep, used);
+
+    deque<Packet>::iterator itr;
+    for (itr = packetQueue__.begin(); itr != packetQueue__.end(); itr++) {
+        itr->begPacket = newbuf + (itr->begPacket - keep);
+        itr->endPacket = newbuf + (itr->endPacket - keep);
+    }
+    if (frameBeg__) {
+        frameBeg__ = newbuf + (frameBeg__ - keep);
+        outPtr__   = newbuf + (outPtr__ - keep);
+    }
+    scanPtr__  = newbuf + (scanPtr__ - keep);
+    writePtr__ = newbuf + used;
+
+    if (newbuf != ibuf__) {
+        delete [] ibuf__;
+        ibuf__     = newbuf;
+        ibufsize__ = newsize;
+    }
+    setg(ibuf__, ibuf__, writePtr__);
+    return writePtr__;
+}
+
+/**
+ * Function to frame the bytes just read into the input buffer. Each PakBus 
+ * packet begins and ends with a SerSyncByte; a SerSyncByte closes the frame
+ * opened by the previous one and opens the next frame. The bytes of a frame
+ * are unquoted in place and added to its signature in the same pass, an 
+ * incomplete frame is carried over to the next read.
+ *
+ * @param nbytes: Number of bytes stored at the write pointer.
+ * @return Number of packets added to the packet queue.
+ */
+int pakbuf :: frame_input (int nbytes)
+{
+    int  npackets = 0;
+    byte c;
 
-    traceComm(pack.begPacket, pack.endPacket, 'R');
+    // Write the received bytes to the low-level log files before they are
+    // unquoted. That will allow the users to see the originally received msg.
 
-    // The bytes between the original beginning and end pointer of
-    // the packet is copied to a temporary buffer.
+    traceComm(writePtr__, writePtr__+nbytes-1, 'R');
+    writePtr__ += nbytes;
 
-    pptr = (byte *)pack.begPacket + 1;
-    memcpy ((char *)tmpbuf, (char *)pptr, len); 
+    for (; scanPtr__ < writePtr__; scanPtr__++) {
+        c = (byte)*scanPtr__;
 
-    while (i < len) {
-        if (tmpbuf[i] == 0xbc) {
-            num_quotebytes++;
-            i++;
-            if (tmpbuf[i] == 0xdd) {
-                *(pptr + j) = 0xbd;
+        if (c == SerSyncByte__) {
+            // Back-to-back SerSyncBytes do not delimit a packet
+            if (frameBeg__ && ((outPtr__ - frameBeg__) > 1)) {
+                close_frame ();
+                npackets++;
             }
-            else if (tmpbuf[i] == 0xdc) {
-                *(pptr + j) = 0xbc;
+            frameBeg__     = scanPtr__;
+            outPtr__       = scanPtr__ + 1;
+            quotePending__ = false;
+            frameSig__     = SIG_SEED;
+            continue;
+        }
+        if (!frameBeg__) {
+            continue;
+        }
+
+        if (quotePending__) {
+            if (c == 0xdd) {
+                c = 0xbd;
             }
-            else {
-                *(pptr + j) = tmpbuf[i];
+            else if (c == 0xdc) {
+                c = 0xbc;
             }
-            i++;
-            j++;
+            quotePending__ = false;
         }
-        else {
-            // Just keep copying
-            *(pptr + j) = tmpbuf[i++];
-            j++;
+        else if (c == 0xbc) {
+            quotePending__ = true;
+            continue;
         }
+        // The unquoted frame never runs ahead of the bytes scanned
+        *outPtr__++ = (char)c;
+        frameSig__  = CalcSigStep (frameSig__, c);
     }
-    
-    // Move the end pointer of the packet to reduce the effective
-    // packet length by the number of quotebytes read
 
-    pack.endPacket -= num_quotebytes;
-    delete [] tmpbuf;
+    // Don't let line noise without SerSyncBytes grow the buffer
+
+    if (frameBeg__ && ((writePtr__ - frameBeg__) > 2*MAX_PACK_SIZE)) {
+        Category::getInstance("I/O")
+                 .debug("Discarding oversized frame");
+        frameBeg__ = NULL;
+    }
+    setg(ibuf__, ibuf__, writePtr__);
+    return npackets;
+}
+
+/**
+ * Function to queue the frame that has just been closed by a SerSyncByte.
+ * The packet ends with a SerSyncByte written after the unquoted bytes, 
+ * which leaves the SerSyncByte opening the next frame intact. The address
+ * fields of the header are extracted into the packet summary.
+ */
+void pakbuf :: close_frame ()
+{
+    Packet      pack;
+    PktSummary &digest = pack.Summary;
+    const byte *hdr = (byte *)frameBeg__ + PakBusFrame::HEADER;
+    int         len = outPtr__ - frameBeg__ + 1;
+
+    *outPtr__ = (char)SerSyncByte__;
+    pack.begPacket = frameBeg__;
+    pack.endPacket = outPtr__;
+    pack.Complete  = true;
+    pack.SigOk     = (frameSig__ == 0);
+
+    if (len >= 8) {
+        digest.LinkState        = 
+                (byte)(PakBusHeader::LinkState::get(hdr) << 4);
+        digest.DstPhyAddrFrmPkt = (uint2)PakBusHeader::DstPhyAddr::get(hdr);
+        digest.SrcPhyAddrFrmPkt = (uint2)PakBusHeader::SrcPhyAddr::get(hdr);
+    }
+    if (len >= 14) {
+        digest.Protocol          = (byte)PakBusHeader::HiProtoCode::get(hdr);
+        digest.DstNodeAddrFrmPkt = (uint2)PakBusHeader::DstNodeId::get(hdr);
+        digest.SrcNodeAddrFrmPkt = (uint2)PakBusHeader::SrcNodeId::get(hdr);
+        digest.MsgType           = (byte)PakBusHeader::MsgType::get(hdr);
+        digest.TranNbr           = (byte)PakBusHeader::TranNbr::get(hdr);
+    }
+    packetQueue__.push_back (pack);
     return;
 }
 
@@ -366,77 +745,212 @@ void pakbuf :: unquote_pack (Packet& pack)
  */
 void pakbuf :: writeRaw() throw (CommException)
 {
-    traceComm(pbase(), pptr()-1, 'T');
+    flush_output();
+    return;
+}
 
-    int nbytes = pptr()-pbase();
-    int nwrite = write(devFd__, obuf__, nbytes);
+/**
+ * Function to send the PakBus frames built in the output buffer (see 
+ * appendFrame()) to a PakBus device. The frames are already quoted by the
+ * encoder. While a batch is open (see beginBatch()), the frames are held
+ * back so that they leave in a single write when the batch is closed.
+ *
+ * @return Number of bytes written to the device.
+ */
 
-    if ((nbytes > 0) && (nwrite == -1)) {
-        Category::getInstance("I/O")
-                 .debug(strerror(errno));
-        throw CommException(__FILE__, __LINE__,
-                strerror(errno));
+int pakbuf :: writeToDevice() throw (CommException)
+{
+    if (batchDepth__ > 0) {
+        return 0;
     }
+    return flush_output();
+}
 
-    setp(obuf__, obuf__+obufsize__);
-    return;
+/**
+ * Function to start holding back the frames written to the device, so that
+ * several requests can be sent with a single write. Batches may be nested.
+ */
+void pakbuf :: beginBatch()
+{
+    batchDepth__++;
 }
 
 /**
- * Function to send a PakBus message to a PakBus device.
- * Upon being called the function first checks the message in the output
- * buffer and quotes any 0xbc or 0xbd characters contained in the message
- * prior to sending the message to the device.
+ * Function to close a batch opened by beginBatch(). The frames held back 
+ * are sent once the outermost batch is closed.
+ *
+ * @return Number of bytes written to the device.
  */
+int pakbuf :: endBatch() throw (CommException)
+{
+    if (batchDepth__ > 0) {
+        batchDepth__--;
+    }
+    return writeToDevice();
+}
 
-int pakbuf :: writeToDevice() throw (CommException)
+/**
+ * Function to write the contents of the output buffer to the device. 
+ * Partial writes are continued until the whole buffer is sent.
+ *
+ * @return Number of bytes written to the device.
+ */
+int pakbuf :: flush_output() throw (CommException)
 {
-    int nbytes; 
-    int nwrite; 
-    nbytes = quote_msg (pbase(), pptr()-pbase());
-    traceComm(pbase(), pbase()+nbytes-1, 'T');
-    nwrite = write(devFd__, obuf__, nbytes);
+    int   nbytes = pptr() - pbase();
+    int   nwrite;
+    char *ptr = pbase();
 
-    if ((nbytes > 0) && (nwrite == -1)) {
-        Category::getInstance("I/O")
-                 .debug(strerror(errno));
-        throw CommException(__FILE__, __LINE__,
-                strerror(errno));
+    if (nbytes > 0) {
+        traceComm(pbase(), pptr()-1, 'T');
+    }
+
+    while (ptr < pptr()) {
+        if ((nwrite = write(devFd__, ptr, pptr()-ptr)) > 0) {
+            ptr += nwrite;
+            continue;
+        }
+        if ((nwrite < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((nwrite < 0) && (errno == EAGAIN)) {
+            if (EventLoop::getInstance()
+                    .waitFd (devFd__, POLLOUT, getReadTimeout()) > 0) {
+                continue;
+            }
+        }
+        string err = (nwrite < 0) ? strerror(errno) : "Device not accepting data";
+        setp(obuf__, obuf__ + obufsize__);
+        unsentTrans__.clear();
+        Category::getInstance("I/O").debug(err);
+        throw CommException(__FILE__, __LINE__, err.c_str());
     }
 
     setp(obuf__, obuf__ + obufsize__);
-    return nwrite;
+
+    uint4 now = get_msec_clock();
+    for (; unsentTrans__.size(); unsentTrans__.pop_front()) {
+        byte tran_nbr = unsentTrans__.front();
+        tranSentAt__[tran_nbr] = now;
+        if (tranSends__[tran_nbr] < 0xff) {
+            tranSends__[tran_nbr]++;
+        }
+    }
+    return nbytes;
 }
 
 /**
- * Function to check and quote the contents of a PakBus packet.
- * If a PakBus packet contains the 0xbc or 0xbd sysbol, the character 0xbc
- * is inserted in their place followed by 0xdc or 0xdd respectively.
+ * Function to make room for nbytes in the output buffer. The buffer is 
+ * grown, keeping its contents, if required.
  *
- * @param obuf: Pointer to the beginning of a PakBus packet.
- * @param msg_len: Length of the message to check for quote-bytes.
+ * @param nbytes: Number of bytes to make room for.
  */
-int pakbuf :: quote_msg (char* seqbuf, int msg_len)
+void pakbuf :: reserve_output (int nbytes)
 {
-    int   tmp_idx = 1; 
-    int   count = 1;
-    byte* tmpbuf = new byte[msg_len];
+    int used = pptr() - pbase();
 
-    // Copy the input messages to a temporary buffer
-    memcpy ((char *)tmpbuf, seqbuf, msg_len);
+    if ((obufsize__ - used) >= nbytes) {
+        return;
+    }
 
-    while (tmp_idx < (msg_len-1)) {
-        if ( (tmpbuf[tmp_idx] == 0xbc) || (tmpbuf[tmp_idx] == 0xbd) ) {
-            seqbuf[count] = (char) 0xbc; 
-            seqbuf[++count] = tmpbuf[tmp_idx] + 0x20;
-        }
-        else {
-            seqbuf[count] = tmpbuf[tmp_idx];
+    int newsize = obufsize__;
+    while ((newsize - used) < nbytes) {
+        newsize *= 2;
+    }
+    char *newbuf = new char[newsize];
+    memcpy (newbuf, obuf__, used);
+    delete [] obuf__;
+    obuf__     = newbuf;
+    obufsize__ = newsize;
+    setp(obuf__, obuf__ + obufsize__);
+    pbump(used);
+    return;
+}
+
+/**
+ * Function to open a PakBus frame in the output buffer. The SerSyncByte
+ * is written and the signature of the frame is initialized.
+ */
+void pakbuf :: beginFrame()
+{
+    reserve_output (1);
+    *pptr() = (char)SerSyncByte__;
+    pbump(1);
+    encSig__ = SIG_SEED;
+}
+
+/**
+ * Function to add bytes to the frame opened by beginFrame(). The bytes are
+ * added to the signature of the frame and quoted in the same pass: 0xbc
+ * and 0xbd are replaced by 0xbc followed by 0xdc or 0xdd respectively.
+ *
+ * @param data: Bytes to add to the frame.
+ * @param len: Number of bytes.
+ */
+void pakbuf :: putFrameBytes(const byte *data, int len)
+{
+    reserve_output (2*len);
+
+    char *out = pptr();
+    uint2 sig = encSig__;
+
+    for (int i = 0; i < len; i++) {
+        byte c = data[i];
+        sig = CalcSigStep (sig, c);
+        if ((c == 0xbc) || (c == 0xbd)) {
+            *out++ = (char)0xbc;
+            c += 0x20;
         }
-        count++;
-        tmp_idx++;
+        *out++ = (char)c;
+    }
+    encSig__ = sig;
+    pbump(out - pptr());
+}
+
+/**
+ * Function to add the nullifier of the signature computed so far to the
+ * frame, which brings the signature of the frame to zero.
+ */
+void pakbuf :: putSigNullifier()
+{
+    uint2 signull = CalcSigNullifier (encSig__);
+    byte  nullifier[2];
+
+    BigEndian<2>::store(nullifier, signull);
+    putFrameBytes (nullifier, 2);
+}
+
+/**
+ * Function to close the frame opened by beginFrame().
+ */
+void pakbuf :: closeFrame()
+{
+    reserve_output (1);
+    *pptr() = (char)SerSyncByte__;
+    pbump(1);
+}
+
+/**
+ * Function to encode a complete PakBus packet into the output buffer in 
+ * a single pass: framing, header, message body, signature nullifier and 
+ * quoting. The packet is sent with the next call to writeToDevice().
+ *
+ * @param hdr: Serialized PakBus header.
+ * @param hdrlen: Length of the header.
+ * @param body: Message body.
+ * @param bodylen: Length of the message body.
+ */
+void pakbuf :: appendFrame(const byte *hdr, int hdrlen, const byte *body, 
+        int bodylen)
+{
+    // The header ends with the message type and transaction number
+    if (hdrlen >= 10) {
+        unsentTrans__.push_back(hdr[9]);
     }
-    seqbuf[count++] = tmpbuf[tmp_idx]; // Get the SerSyncByte at the end of msg
-    delete [] tmpbuf;
-    return count;
+
+    beginFrame();
+    putFrameBytes (hdr, hdrlen);
+    putFrameBytes (body, bodylen);
+    putSigNullifier();
+    closeFrame();
 }
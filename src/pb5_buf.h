@@ -19,20 +19,68 @@
 #include <fstream>
 #include <deque>
 #include "utils.h"
+#include "pb5_data.h"
+#include "rtt_estimator.h"
 using namespace std;
 
 #define MAX_PACK_SIZE 1112
 
+// Default deadline (in milliseconds) for receiving a response packet
+#define DEFAULT_READ_TIMEOUT 2000
+
+// Message type of the BMP5 "please wait" notification, sent by a logger 
+// that needs more time to answer a request
+#define BMP5_PLEASE_WAIT 0xa1
+
+// Seed of the CSI signature computed over a PakBus packet
+#define SIG_SEED 0xaaaa
+
+/**
+ * Function to advance the CSI signature by one byte. The signature of a 
+ * byte sequence is obtained by applying this to each byte in turn, 
+ * starting with the seed (see CalcSig()).
+ */
+inline uint2 CalcSigStep (uint2 sig, byte b)
+{
+    byte lo = (byte)sig;
+    return (uint2)((lo << 8) | 
+            (byte)(((lo << 1) | (lo >> 7)) + (sig >> 8) + b));
+}
+
+/**
+ * Structure used to store the summary information about a PakBus packet.
+ * This is used to determine the required action based on its members and
+ * perform preliminary error handling. It is filled in by the framer in 
+ * pakbuf when a packet is received.
+ */
+struct PktSummary {
+    PktSummary() : LinkState(0), Protocol(0), MsgType(0), TranNbr(0), 
+            DstPhyAddrFrmPkt((uint2)0), SrcPhyAddrFrmPkt((uint2)0), 
+            DstNodeAddrFrmPkt((uint2)0), SrcNodeAddrFrmPkt((uint2)0) {}
+    byte LinkState;
+    byte Protocol;
+    byte MsgType;
+    byte TranNbr;
+    uint2 DstPhyAddrFrmPkt;
+    uint2 SrcPhyAddrFrmPkt;
+    uint2 DstNodeAddrFrmPkt;
+    uint2 SrcNodeAddrFrmPkt;
+} ;
+
 /** 
  * Packet structure definition.
  * The structure contains pointers beginning and end of a pakbus packet 
- * in the application input buffer. In case the packet is incomplete, 
- * Packet.Complete is set to false.
+ * in the application input buffer. Packets are queued only once both
+ * SerSyncBytes are received, so Packet.Complete is always set for the
+ * packets in the packet queue. The packet is unquoted, SigOk is set if 
+ * its signature was verified and Summary holds the parsed header.
  */
 typedef struct {
     char *begPacket;
     char *endPacket;
     bool  Complete;
+    bool  SigOk;
+    PktSummary Summary;
 } Packet;
 
 /**
@@ -45,32 +93,87 @@ typedef struct {
 class pakbuf : public streambuf {
 
     public :
+        /**
+         * Strategy used for deciding when a read from the device is complete.
+         * READ_VTIME waits until the device stays idle for a full VTIME period,
+         * READ_DEADLINE returns as soon as the expected packet is framed or the
+         * read deadline expires.
+         */
+        enum ReadMode { READ_VTIME, READ_DEADLINE };
+
         pakbuf (int ibufsize, int obufsize);
         ~pakbuf ();
         deque<Packet>* getPacketQueue () { return &packetQueue__; }
         int            readFromDevice() throw (CommException);
+        int            readLinkState() throw (CommException);
+        int            readPackets(int msecs) throw (CommException);
+        int            readAvailable() throw (CommException);
+        void           responseReceived(byte tran_nbr, bool fresh);
+        void           responseTimedOut() throw (CommException);
+        int            deferResponse(const Packet& pack);
+        static int     getPleaseWait(const Packet& pack);
         int            writeToDevice() throw (CommException);
         void           writeRaw() throw (CommException);
+        void           beginBatch();
+        int            endBatch() throw (CommException);
+        // Single-pass encoder for outgoing frames
+        void           appendFrame(const byte *hdr, int hdrlen, 
+                           const byte *body, int bodylen);
+        void           beginFrame();
+        void           putFrameBytes(const byte *data, int len);
+        void           putSigNullifier();
+        void           closeFrame();
         /** Function to get the number of bytes in the output buffer.*/
         int            showManyBytesObuf(){ return (pptr()-pbase()); }
         /** Function to access the beginning of the output buffer. */
         const char*    getobeg () { return pbase(); }
-        inline void    setFd(int fd) { devFd__ = fd; }
+        void           setFd(int fd);
         void           setHexLogDir(const string& dir);
+        void           setReadMode(ReadMode mode) { readMode__ = mode; }
+        ReadMode       getReadMode() { return readMode__; }
+        void           setReadTimeout(int msecs);
+        int            getReadTimeout();
+        void           setRttEstimator(RttEstimator* rtt) { rtt__ = rtt; }
 
     protected : 
-        void       split_sequence_to_packets (char *beg, char *end);
+        int        wait_for_input (int msecs);
+        static bool is_link_state (const Packet& pack);
+        void       account_read (bool got_data) throw (CommException);
+        void       measure_rtt (byte tran_nbr, bool fresh);
+        void       reset_framer ();
+        char*      reserve_input (int nbytes);
+        int        frame_input (int nbytes);
         // inline int byte2int (char c) { return (0x000000ff & (unsigned char)c); };
         void       traceComm(char *bptr, char *eptr, char type);
-        void       unquote_pack (Packet& pack);
-        int        quote_msg (char* seq, int len);
+        void       close_frame ();
+        int        flush_output () throw (CommException);
+        void       reserve_output (int nbytes);
 
     private :
-        char         *ibuf__;            // Input buffer
+        char         *ibuf__;            // Input buffer (grows as required)
         char         *obuf__;            // Output buffer
         int           ibufsize__;        // Input buffer size
         int           obufsize__;        // Output buffer size
         int           devFd__;          // Device file descriptor
+        ReadMode      readMode__;        // Strategy for completing a read
+        int           readTimeout__;     // Read deadline in milliseconds
+        RttEstimator *rtt__;             // Sets the read deadline, if any
+        uint4         tranSentAt__[256]; // Clock reading when the request 
+                                       // with a transaction nbr was sent
+        byte          tranSends__[256];  // Unanswered sends of the request
+        deque<byte>   unsentTrans__;     // Transaction nbrs of the requests
+                                       // in the output buffer
+        uint4         successiveBadRead__; // Number of successive empty reads
+        bool          dataLastRead__;    // Set if the last read received data
+        char         *frameBeg__;        // SerSyncByte opening the frame being
+                                       // received, NULL if none
+        char         *outPtr__;          // Next unquoted byte of the frame
+        bool          quotePending__;    // Set if the last byte was a quote
+        uint2         frameSig__;        // Running signature of the frame
+        char         *scanPtr__;         // Next input byte to be framed
+        char         *writePtr__;        // End of the bytes read
+        int           batchDepth__;      // Nesting level of output batches
+        uint2         encSig__;          // Signature of the frame being encoded
         deque<Packet> packetQueue__;     // Packet queue
         ofstream      ioCommLog__;       // Output file stream for writing I/O byte
                                        // streams to log file
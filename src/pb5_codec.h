@@ -0,0 +1,324 @@
+/**
+ * @file pb5_codec.h
+ * Provides the codec of the fixed-width fields of PakBus packets: loads
+ * and stores of big and little-endian integers whose width is known at
+ * compile time, and the layouts of the header and of the messages built
+ * and parsed by the application.
+ */
+
+#ifndef PAKBUS5_CODEC_H
+#define PAKBUS5_CODEC_H
+#include <fstream>
+#include "pb5_data.h"
+
+/**
+ * Load and store of a big-endian (MSB first) integer of Width bytes, as
+ * PakBus sends them. The byte loop is unrolled at compile time.
+ */
+template <int Width>
+struct BigEndian {
+    static uint4 load (const byte* ptr) {
+        return (BigEndian<Width - 1>::load(ptr) << 8) | ptr[Width - 1];
+    }
+    static void store (byte* ptr, uint4 val) {
+        BigEndian<Width - 1>::store(ptr, val >> 8);
+        ptr[Width - 1] = (byte)val;
+    }
+};
+
+template <>
+struct BigEndian<1> {
+    static uint4 load (const byte* ptr) { return ptr[0]; }
+    static void  store (byte* ptr, uint4 val) { ptr[0] = (byte)val; }
+};
+
+/**
+ * Load and store of a little-endian (LSB first) integer of Width bytes.
+ */
+template <int Width>
+struct LittleEndian {
+    static uint4 load (const byte* ptr) {
+        return (LittleEndian<Width - 1>::load(ptr + 1) << 8) | ptr[0];
+    }
+    static void store (byte* ptr, uint4 val) {
+        ptr[0] = (byte)val;
+        LittleEndian<Width - 1>::store(ptr + 1, val >> 8);
+    }
+};
+
+template <>
+struct LittleEndian<1> {
+    static uint4 load (const byte* ptr) { return ptr[0]; }
+    static void  store (byte* ptr, uint4 val) { ptr[0] = (byte)val; }
+};
+
+/**
+ * Integer field of Width bytes at Offset bytes from the beginning of a
+ * layout. The layouts below declare their fields as typedefs of this, so
+ * that a field is read with e.g. CollectTableData::BegRecNbr::get(ptr).
+ */
+template <int Offset, int Width, template <int> class Order = BigEndian>
+struct WireField {
+    enum { OFFSET = Offset, WIDTH = Width, END = Offset + Width };
+
+    static uint4 get (const void* base) {
+        return Order<Width>::load((const byte *)base + Offset);
+    }
+    static void set (void* base, uint4 val) {
+        Order<Width>::store((byte *)base + Offset, val);
+    }
+};
+
+/**
+ * Bits of a WireField, Bits wide above the Shift lower bits. The fields
+ * sharing a word are combined with pack() to set the word at once.
+ */
+template <class Word, int Shift, int Bits>
+struct WireBits {
+    enum { MASK = (1 << Bits) - 1 };
+
+    static uint4 get (const void* base) {
+        return (Word::get(base) >> Shift) & MASK;
+    }
+    static uint4 pack (uint4 val) {
+        return (val & MASK) << Shift;
+    }
+};
+
+/**
+ * Layout of the PakBus header, from its first byte. The link state
+ * sub-protocol packets carry the first two words only.
+ */
+struct PakBusHeader {
+    typedef WireField<0, 2> DstPhyWord;
+    typedef WireField<2, 2> SrcPhyWord;
+    typedef WireField<4, 2> DstNodeWord;
+    typedef WireField<6, 2> SrcNodeWord;
+
+    typedef WireBits<DstPhyWord, 12, 4>  LinkState;
+    typedef WireBits<DstPhyWord, 0, 12>  DstPhyAddr;
+    typedef WireBits<SrcPhyWord, 14, 2>  ExpMoreCode;
+    typedef WireBits<SrcPhyWord, 12, 2>  Priority;
+    typedef WireBits<SrcPhyWord, 0, 12>  SrcPhyAddr;
+    typedef WireBits<DstNodeWord, 12, 4> HiProtoCode;
+    typedef WireBits<DstNodeWord, 0, 12> DstNodeId;
+    typedef WireBits<SrcNodeWord, 12, 4> HopCnt;
+    typedef WireBits<SrcNodeWord, 0, 12> SrcNodeId;
+
+    typedef WireField<8, 1> MsgType;
+    typedef WireField<9, 1> TranNbr;
+
+    enum { LINK_SIZE = 4, SIZE = 10 };
+};
+
+/**
+ * Offsets in an unquoted frame of the input buffer (see Packet), from the
+ * leading SerSyncByte. The body is followed by the signature nullifier,
+ * TRAILER bytes before the closing SerSyncByte.
+ */
+struct PakBusFrame {
+    enum { HEADER = 1, BODY = HEADER + PakBusHeader::SIZE, TRAILER = 2 };
+};
+
+/** Returns the message body of an unquoted frame. */
+inline byte* frameBody (char* frame)
+{
+    return (byte *)frame + PakBusFrame::BODY;
+}
+
+/** Returns the message body of an unquoted frame. */
+inline const byte* frameBody (const char* frame)
+{
+    return (const byte *)frame + PakBusFrame::BODY;
+}
+
+/**
+ * Returns the end of the message body of an unquoted frame, given the
+ * closing SerSyncByte (Packet::endPacket).
+ */
+inline byte* frameBodyEnd (char* frame_end)
+{
+    return (byte *)frame_end - PakBusFrame::TRAILER;
+}
+
+/**
+ * Time stamp of a record (seconds and nanoseconds since 1990).
+ */
+struct RecordTimeLayout {
+    typedef WireField<0, 4> Sec;
+    typedef WireField<4, 4> Nsec;
+    enum { SIZE = 8 };
+};
+
+// Layouts of the message bodies, following the message type and the
+// transaction number
+
+/**
+ * Hello command and response (PakCtrl 0x09 and 0x89).
+ */
+struct HelloMsg {
+    typedef WireField<0, 1> IsRouter;
+    typedef WireField<1, 1> HopMetric;
+    typedef WireField<2, 2> VerifyIntv;
+    enum { SIZE = 4 };
+};
+
+/**
+ * Delivery failure message (PakCtrl 0x81), followed by the header of the
+ * undelivered message.
+ */
+struct DeliveryFailureMsg {
+    typedef WireField<0, 1> ErrCode;
+    enum { HEADER = 1 };
+};
+
+/**
+ * Beginning of the BMP5 requests sent by the application.
+ */
+struct BMP5RequestMsg {
+    typedef WireField<0, 2> SecurityCode;
+    enum { SIZE = 2 };
+};
+
+/**
+ * Please wait notification (BMP5 0xa1).
+ */
+struct PleaseWaitMsg {
+    typedef WireField<0, 1> CmdMsgType;
+    typedef WireField<1, 2> WaitSecs;
+    enum { SIZE = 3 };
+};
+
+/**
+ * Clock set command (BMP5 0x17) and response (0x97).
+ */
+struct ClockRequestMsg {
+    typedef BMP5RequestMsg::SecurityCode SecurityCode;
+    typedef WireField<2, 4> AdjustSecs;
+    typedef WireField<6, 4> AdjustNsecs;
+    enum { SIZE = 10 };
+};
+
+struct ClockResponseMsg {
+    typedef WireField<0, 1> RespCode;
+    typedef WireField<1, 4> OldTimeSecs;
+    typedef WireField<5, 4> OldTimeNsecs;
+};
+
+/**
+ * Table control command (BMP5 0x19).
+ */
+struct TableControlRequestMsg {
+    typedef BMP5RequestMsg::SecurityCode SecurityCode;
+    typedef WireField<2, 1> CtrlOption;
+    enum { SIZE = 3 };
+};
+
+/**
+ * File send (BMP5 0x1c), file receive (0x1d) and file control (0x1e)
+ * commands: the security code and the file name, null-terminated. The
+ * fields after the name are laid out by a tail layout, from the byte
+ * following the null.
+ */
+struct FileRequestMsg {
+    typedef BMP5RequestMsg::SecurityCode SecurityCode;
+    enum { FILE_NAME = 2 };
+
+    /** Returns the tail of a request naming a file of len characters. */
+    static byte* tail (byte* body, int len) {
+        return body + FILE_NAME + len + 1;
+    }
+    static const byte* tail (const byte* body, int len) {
+        return body + FILE_NAME + len + 1;
+    }
+};
+
+/**
+ * Tail of the file send command, followed by the data sent.
+ */
+struct FileSendTail {
+    typedef WireField<0, 1> Attribute;
+    typedef WireField<1, 1> CloseFlag;
+    typedef WireField<2, 4> FileOffset;
+    enum { DATA = 6 };
+};
+
+/**
+ * Tail of the file receive command.
+ */
+struct FileReceiveTail {
+    typedef WireField<0, 1> CloseFlag;
+    typedef WireField<1, 4> FileOffset;
+    typedef WireField<5, 2> Swath;
+    enum { SIZE = 7 };
+};
+
+/**
+ * Tail of the file control command.
+ */
+struct FileControlTail {
+    typedef WireField<0, 1> FileCmd;
+    enum { SIZE = 1 };
+};
+
+/**
+ * Collect data command (BMP5 0x09), followed for each table by a
+ * CollectTableSpec, the parameters of the collection mode and the list
+ * of fields ended by a zero.
+ */
+struct CollectRequestMsg {
+    typedef BMP5RequestMsg::SecurityCode SecurityCode;
+    typedef WireField<2, 1> CollectMode;
+    enum { SIZE = 3 };
+};
+
+struct CollectTableSpec {
+    typedef WireField<0, 2> TableNbr;
+    typedef WireField<2, 2> TableSig;
+    typedef WireField<0, 4> Param;     // Each of P1, P2
+    typedef WireField<0, 2> FieldNbr;  // Each of the field list
+    enum { SIZE = 4 };
+};
+
+/**
+ * Collect data response (BMP5 0x89), followed by a CollectTableData for
+ * each table, and ended by the TRAILER byte of the flag telling whether
+ * more records exist.
+ */
+struct CollectResponseMsg {
+    typedef WireField<0, 1> RespCode;
+    enum { TABLES = 1, TRAILER = 1 };
+};
+
+/**
+ * Records of a table in the collect data response. The records begin
+ * with the time of the first record. A partial record carries the byte
+ * offset into the record in place of the number of records, with the
+ * high bit set.
+ */
+struct CollectTableData {
+    typedef WireField<0, 2> TableNbr;
+    typedef WireField<2, 4> BegRecNbr;
+    typedef WireField<6, 2> NbrOfRecs;
+    typedef WireField<6, 4> ByteOffset;
+    enum { RECORDS = 8, FRAGMENT = 10 };
+};
+
+/**
+ * File send (BMP5 0x9c) and file receive (0x9d) responses.
+ */
+struct FileResponseMsg {
+    typedef WireField<0, 1> RespCode;
+    typedef WireField<1, 4> FileOffset;
+    enum { DATA = 5 };
+};
+
+/**
+ * File control response (BMP5 0x9e).
+ */
+struct FileControlResponseMsg {
+    typedef WireField<0, 1> RespCode;
+    typedef WireField<1, 2> HoldOff;
+};
+
+#endif
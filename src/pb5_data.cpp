@@ -20,6 +20,7 @@
 #include <sstream>
 #include <string>
 #include <cmath>
+#include <limits>
 #include <time.h>
 #include <unistd.h>
 #include <libxml2/libxml/parser.h>
@@ -27,6 +28,8 @@
 #include <log4cpp/Category.hh>
 #include "pb5.h"
 #include "utils.h"
+#include "session_snapshot.h"
+#include "bulk_decode.h"
 using namespace std;
 using namespace log4cpp;
 
@@ -144,9 +147,11 @@ float intBitsToFloat (uint4 bits)
  * final storage format.
  * This function doesn't inspect the input bit pattern to find out
  * if the input bytes are part of a special number as a record ID,
- * or if they are part of a 3/4 byte floating point number. If the
- * absolute value of the number extracted is > 6999, -9999 is 
- * returned.
+ * or if they are part of a 3/4 byte floating point number. The special
+ * patterns 0x1fff, 0x9fff and 0x9ffe are +INF, -INF and NaN; for any
+ * other pattern whose absolute value is > 6999, -9999 is returned. The 
+ * records are decoded through a table of its values, see
+ * BulkDecoder::getFp2Table().
  *
  * @param unum: Input bytes represented as unsigned short.
  * @return Equivalent floating point number, -9999 on overflow.
@@ -157,7 +162,13 @@ float GetFinalStorageFloat (uint2 unum)
     int   factor = (unum & 0x6000) >> 13;
     float abs_val = pow (10.0, -1*factor) * (unum & 0x1fff);
     
-    if (abs_val > 6999.0) {
+    if ((unum == 0x1fff) || (unum == 0x9fff)) {
+        return s*numeric_limits<float>::infinity();
+    }
+    else if (unum == 0x9ffe) {
+        return numeric_limits<float>::quiet_NaN();
+    }
+    else if (abs_val > 6999.0) {
         return -9999;
     }
     else {
@@ -171,7 +182,8 @@ float GetFinalStorageFloat (uint2 unum)
  * @param data_opt: Reference to the DataOutputConfig structure that contains
  *                  various information for generating file headers. 
  */
-TableDataManager :: TableDataManager () : tblDataWriter__(new AsciiWriter)
+TableDataManager :: TableDataManager () : tblDataWriter__(new AsciiWriter),
+        snapshot__(NULL), bulkDecoder__(&BulkDecoder::getInstance())
 { 
     tblDataWriter__->setTableDataManager(this);
 }
@@ -188,6 +200,15 @@ void TableDataManager :: setTableDataWriter(TableDataWriter* dataWriter)
     return; 
 }
 
+/**
+ * Function to set the session snapshot the tables are restored from and
+ * stored to along with the storage history.
+ */
+void TableDataManager :: setSessionSnapshot(SessionSnapshot* snapshot)
+{
+    snapshot__ = snapshot;
+}
+
 const DLProgStats& TableDataManager :: getProgStats() const
 {
     return dataLoggerProgStats__;
@@ -257,6 +278,76 @@ void TableDataManager :: saveTableStorageHistory()
         }
         tinfoFile.clear();
     }
+
+    // The snapshot is stored along with the history, so that both hold
+    // the same collection state
+    if (snapshot__ && tableList__.size()) {
+        snapshot__->setTables(tableList__, fslVersion__, 
+                dataLoggerProgStats__.ProgSig, selection_key());
+        snapshot__->save();
+    }
+}
+
+/**
+ * Function to restore the tables from the session snapshot instead of
+ * building them from the Table Definitions File. The programming 
+ * statistics must have been set, as the tables are only restored if they
+ * were compiled for the program running on the logger and for the fields 
+ * selected in the configuration. If the program changed, the cached
+ * table definitions file is removed so that it is uploaded again.
+ *
+ * @return true if the tables were restored.
+ */
+bool TableDataManager :: restoreSnapshot()
+{
+    if (!snapshot__ || !snapshot__->hasTables()) {
+        return false;
+    }
+
+    if (snapshot__->getProgSig() != dataLoggerProgStats__.ProgSig) {
+        Category::getInstance("TableDataManager")
+                 .notice("Logger program changed since the last session, "
+                         "reloading table definitions");
+        cleanCache();
+        return false;
+    }
+    if (snapshot__->getConfigKey() != selection_key()) {
+        Category::getInstance("TableDataManager")
+                 .info("Field selection changed since the last session");
+        return false;
+    }
+
+    tableList__   = snapshot__->getTables();
+    fslVersion__  = snapshot__->getFslVersion();
+    for (size_t idx = 0; idx < tableList__.size(); idx++) {
+        compileDecodePlan (tableList__[idx]);
+    }
+
+    stringstream logmsg;
+    logmsg << "Restored " << tableList__.size() 
+           << " tables from the session snapshot";
+    Category::getInstance("TableDataManager").debug(logmsg.str());
+    return true;
+}
+
+/**
+ * Returns a description of the fields selected for collection in the
+ * configuration, which the tables in the session snapshot were reduced to.
+ */
+string TableDataManager :: selection_key()
+{
+    string key;
+    vector<TableOpt>::const_iterator optItr;
+
+    for (optItr = dataOutputConfig__.Tables.begin(); 
+            optItr != dataOutputConfig__.Tables.end(); optItr++) {
+        key.append(optItr->TableName).append("(");
+        for (size_t idx = 0; idx < optItr->Fields.size(); idx++) {
+            key.append(idx ? "," : "").append(optItr->Fields[idx]);
+        }
+        key.append(")");
+    }
+    return key;
 }
 
 /**
@@ -345,6 +436,25 @@ int TableDataManager :: BuildTDF()
     // Dump the table definitions into a XML file
     xmlDumpTDF ((char *)xml_file.c_str());
 
+    // Reduce the tables to the fields selected for collection
+    vector<TableOpt>::const_iterator optItr;
+    for (optItr = dataOutputConfig__.Tables.begin(); 
+            optItr != dataOutputConfig__.Tables.end(); optItr++) {
+        if (optItr->Fields.empty()) {
+            continue;
+        }
+        try {
+            selectFields (getTableRef(optItr->TableName), optItr->Fields);
+        }
+        catch (invalid_argument& iae) {
+            // Reported when collecting data from the table
+        }
+    }
+
+    for (size_t idx = 0; idx < tableList__.size(); idx++) {
+        compileDecodePlan (tableList__[idx]);
+    }
+
     // Load the storage history for various tables - information as last 
     // stored index etc.
     loadTableStorageHistory();
@@ -411,6 +521,10 @@ TableDataManager :: cleanCache ()
     path += "/.working/tdf.xml";
     unlink(path.c_str());
 
+    if (snapshot__) {
+        snapshot__->clearTables();
+    }
+
     string tinfo_file;
 
     Category::getInstance("TableDataManager")
@@ -457,26 +571,26 @@ int TableDataManager :: readTableDefinition (int table_num, byte *byte_ptr, byte
     ptr += tbl.TblName.size ()+1;
 
     if (ptr > endptr) return -1;
-    tbl.TblSize = PBDeserialize (ptr, 4);
+    tbl.TblSize = BigEndian<4>::load (ptr);
     ptr += 4;
 
     if (ptr > endptr) return -1;
     tbl.TimeType = *ptr++;
 
     if (ptr > endptr) return -1;
-    tbl.TblTimeInfo.sec = PBDeserialize (ptr, 4);
+    tbl.TblTimeInfo.sec = BigEndian<4>::load (ptr);
     ptr += 4;
 
     if (ptr > endptr) return -1;
-    tbl.TblTimeInfo.nsec = PBDeserialize (ptr, 4);
+    tbl.TblTimeInfo.nsec = BigEndian<4>::load (ptr);
     ptr += 4;
 
     if (ptr > endptr) return -1;
-    tbl.TblTimeInterval.sec = PBDeserialize (ptr, 4);
+    tbl.TblTimeInterval.sec = BigEndian<4>::load (ptr);
     ptr += 4;
 
     if (ptr > endptr) return -1;
-    tbl.TblTimeInterval.nsec = PBDeserialize (ptr, 4);
+    tbl.TblTimeInterval.nsec = BigEndian<4>::load (ptr);
     ptr += 4;
 
     int nbytes = readFieldList (ptr, endptr, tbl);
@@ -486,7 +600,7 @@ int TableDataManager :: readTableDefinition (int table_num, byte *byte_ptr, byte
     ptr += nbytes;
     
     int table_len = ptr - byte_ptr;
-    tbl.TblSignature = CalcSig (byte_ptr, (uint4)(table_len), 0xaaaa);
+    tbl.TblSignature = CalcSigFast (byte_ptr, (uint4)(table_len), 0xaaaa);
     tbl.TblNum = table_num;    
 
     stringstream logmsg;
@@ -568,11 +682,11 @@ int TableDataManager :: readFieldList (byte *byte_ptr, byte *endptr, Table& Tbl)
         ptr += var.Description.size ()+1;
         
         if (ptr > endptr) return -1;
-        var.BegIdx  = PBDeserialize (ptr, 4);
+        var.BegIdx  = BigEndian<4>::load (ptr);
         ptr += 4;
 
         if (ptr > endptr) return -1;
-        var.Dimension = PBDeserialize (ptr, 4);
+        var.Dimension = BigEndian<4>::load (ptr);
         ptr += 4;
 
         // Commenting out the if statement based on Dennis Oracheski's suggestion
@@ -580,7 +694,7 @@ int TableDataManager :: readFieldList (byte *byte_ptr, byte *endptr, Table& Tbl)
         
             while (ptr < endptr) {
 
-                uint4 num = PBDeserialize (ptr, 4);
+                uint4 num = BigEndian<4>::load (ptr);
                 ptr += 4;
 
                 if (num != 0x00) {
@@ -595,7 +709,7 @@ int TableDataManager :: readFieldList (byte *byte_ptr, byte *endptr, Table& Tbl)
             // ptr += 4;
         // }
         Tbl.field_list.push_back (var);
-        next_num = PBDeserialize (ptr, 1);
+        next_num = BigEndian<1>::load (ptr);
 
     } while (next_num != 0);
     
@@ -603,6 +717,53 @@ int TableDataManager :: readFieldList (byte *byte_ptr, byte *endptr, Table& Tbl)
     return (ptr - byte_ptr);
 }
 
+/**
+ * Function to reduce a table to a selection of its fields. The numbers of 
+ * the selected fields are sent with the collect commands so that the logger
+ * only returns those fields, and the field list is reduced to match the 
+ * records returned. The fields keep the order of the table definition. 
+ * Names that don't match any field are ignored, and all the fields are 
+ * collected if none match.
+ *
+ * @param tbl: Reference to the Table structure to reduce.
+ * @param fields: Names of the fields to collect.
+ */
+void TableDataManager :: selectFields (Table& tbl, const vector<string>& fields)
+{
+    vector<Field> selected;
+    stringstream  logmsg;
+
+    tbl.FieldNbrs.clear();
+
+    for (size_t idx = 0; idx < tbl.field_list.size(); idx++) {
+        if (find (fields.begin(), fields.end(), tbl.field_list[idx].FieldName)
+                != fields.end()) {
+            selected.push_back (tbl.field_list[idx]);
+            tbl.FieldNbrs.push_back ((uint2)(idx+1));
+        }
+    }
+
+    if (selected.size() < fields.size()) {
+        logmsg << "Only " << selected.size() << " of " << fields.size() 
+               << " fields selected for [" << tbl.TblName 
+               << "] found in table definitions";
+        Category::getInstance("TableDataManager")
+                 .warn(logmsg.str());
+        logmsg.str("");
+    }
+
+    if (selected.empty()) {
+        return;
+    }
+
+    logmsg << "Collecting " << selected.size() << " of " 
+           << tbl.field_list.size() << " fields from [" << tbl.TblName << "]";
+    Category::getInstance("TableDataManager")
+             .info(logmsg.str());
+
+    tbl.field_list.swap (selected);
+}
+
 /**
  * Function to dump the table definition format information into a 
  * XML file. 
@@ -995,72 +1156,105 @@ Table& TableDataManager :: getTableRef (const string& TableName) throw (invalid_
 NSec parseRecordTime(const byte* data)
 {
     NSec recordTime;
-    recordTime.sec = PBDeserialize (data, 4);
-    recordTime.nsec = PBDeserialize (data+4, 4);
+    recordTime.sec = RecordTimeLayout::Sec::get (data);
+    recordTime.nsec = RecordTimeLayout::Nsec::get (data);
     return recordTime; 
 }
 
 /**
  * This function extracts a record from a byte stream for a Table structure and 
- * writes that to a file using the specified output stream.
- * In addition to extracting records and writing data to file, this function also
- * ensures splitting of files on hour boundaries.
+ * hands it to the TableDataWriter, as a batch of one record.
  *
- * @param fs: Reference to output file stream.
  * @param tbl_ref: Reference to corresponding Table strucrure.
  * @param data: Address of the pointer to the beginning of the byte sequence.
  * @param rec_num: Number of the record to store in file.
- * @param file_span: Span of a datafile in seconds
- * @return SUCCESS | FAILURE (If the data file couldn't be opened).
+ * @param parseTimestamp: Set if the record starts with its time.
+ * @return SUCCESS.
  */ 
 int TableDataManager :: storeRecord (Table& tbl_ref, byte **data, 
-        uint4 rec_num, int file_span, bool parseTimestamp) throw (StorageException)
+        uint4 rec_num, bool parseTimestamp) throw (StorageException)
 {
-    vector<Field>           field_list = tbl_ref.field_list;
-    vector<Field>::const_iterator start, end, itr;
-    NSec recordTime;
+    return storeRecords (tbl_ref, data, rec_num, 1, parseTimestamp);
+}
 
-    start = field_list.begin();
-    end   = field_list.end();
+/**
+ * Function to extract consecutive records from a byte stream for a Table
+ * structure and hand them to the TableDataWriter in a single RecordBatch.
+ * The records are decoded column by column through the decode plan of the
+ * table. Only the first record may carry its time, the time of the others
+ * follows from the interval of the table. The state of the table advances
+ * past the records the writer stored, even if it fails on a later one, so
+ * that they aren't collected and stored again.
+ *
+ * @param tbl_ref: Reference to corresponding Table strucrure.
+ * @param data: Address of the pointer to the beginning of the byte sequence,
+ *               moved past the records.
+ * @param rec_num: Number of the first record.
+ * @param nrecs: Number of records to store.
+ * @param parseTimestamp: Set if the first record starts with its time.
+ * @return SUCCESS.
+ */
+int TableDataManager :: storeRecords (Table& tbl_ref, byte **data, 
+        uint4 rec_num, int nrecs, bool parseTimestamp) 
+        throw (StorageException)
+{
+    vector<DecodeStep>::const_iterator step, end;
+    NSec recordTime = tbl_ref.LastRecordTime;
+    size_t stored = 0;
+
+    if (tbl_ref.DecodePlan.size() != tbl_ref.field_list.size()) {
+        compileDecodePlan (tbl_ref);
+    }
+    begin_batch (tbl_ref);
+    end = tbl_ref.DecodePlan.end();
 
     try {
-        if (parseTimestamp) {
-            // tbl_ref.LastRecordTime = parseRecordTime(*data);
-            recordTime = parseRecordTime(*data);
-            *data += 8;
-        } 
-        else {
-            // tbl_ref.LastRecordTime += tbl_ref.TblTimeInterval;
-            recordTime = tbl_ref.LastRecordTime;
-            recordTime += tbl_ref.TblTimeInterval;
-        }
-    
-        tblDataWriter__->processRecordBegin(tbl_ref, rec_num, 
-                recordTime);
-        
-        for (itr = start; itr < end; itr++) {
-            if ((itr->FieldType == 11) || (itr->FieldType == 16)) {
-                storeDataSample(*itr, data);
+        for (int rec = 0; rec < nrecs; rec++) {
+            if (parseTimestamp && !rec) {
+                recordTime = parseRecordTime(*data);
+                *data += 8;
+            } 
+            else {
+                recordTime += tbl_ref.TblTimeInterval;
+            }
+            batch__.RecordNbrs.push_back(rec_num + rec);
+            batch__.RecordTimes.push_back(recordTime);
+
+            vector<BatchColumn>::iterator column = batch__.Columns.begin();
+
+            if (tbl_ref.DecodedSize >= 0) {
+                const byte* record = *data;
+                for (step = tbl_ref.DecodePlan.begin(); step != end; 
+                        step++, column++) {
+                    (this->*step->Decode)(*step, record + step->Offset, 
+                            *column);
+                }
+                *data += tbl_ref.DecodedSize;
             }
             else {
-                for (int dim = 0; dim < (int)itr->Dimension; dim++) {
-                    storeDataSample(*itr, data);
-                } 
+                for (step = tbl_ref.DecodePlan.begin(); step != end; 
+                        step++, column++) {
+                    *data += (this->*step->Decode)(*step, *data, *column);
+                }
             }
         }
 
-        tblDataWriter__->processRecordEnd(tbl_ref);
-       
-        // Update state variables
-        tbl_ref.LastRecordTime = recordTime;
-        tbl_ref.NextRecord += 1;
+        tblDataWriter__->storeBatch(tbl_ref, batch__, stored);
+        advance_table (tbl_ref, stored);
     }
     catch (...) {
         stringstream errormsg;
         char timestamp[64];
+        uint4 failed = rec_num;
+
+        advance_table (tbl_ref, stored);
+        if (stored < batch__.size()) {
+            failed     = batch__.RecordNbrs[stored];
+            recordTime = batch__.RecordTimes[stored];
+        }
         AsciiWriter::GetTimestamp(timestamp, recordTime);
         errormsg << "Failure in storing data record{\"id\":" 
-                 << tbl_ref.NextRecord << ", \"timestamp\":"
+                 << failed << ", \"timestamp\":"
                  << timestamp << "}";
         throw StorageException(__FILE__, __LINE__, errormsg.str().c_str());
     } 
@@ -1068,206 +1262,341 @@ int TableDataManager :: storeRecord (Table& tbl_ref, byte **data,
 }
 
 /**
- * Function to extract a sample for a particular field from a data record
- * and write it to an output file stream.
+ * Function to update the state of a table (NextRecord, LastRecordTime) once
+ * the first records of the batch are stored.
  *
- * @param fs:   Reference to the output file stream.
- * @param var:  Reference to the Field structure being extracted from data.
- * @param data: Address of the pointer to the memory where the data sample
- *              is stored.
+ * @param tbl: Reference to the Table structure.
+ * @param stored: Number of records of the batch stored.
  */
-void TableDataManager :: storeDataSample (const Field& var, byte **data)
+void TableDataManager :: advance_table (Table& tbl, size_t stored)
 {
-     uint4   unum = 0;
-     uint2   unum2 = 0;
-     int     num  = 0;
-     string  str;
-    
-     switch (var.FieldType) 
-     {
-         case 7 : 
-             // 2-byte final storage floating point - Tested with CR1000 data
-             unum2 = (uint2) PBDeserialize (*data, 2);
-             tblDataWriter__->storeFloat(var, GetFinalStorageFloat(unum2));
-             *data += 2;
-             break;
-
-         case 6 : 
-             // 4-byte signed integer (MSB first) - Tested with CR1000 data
-             num   = (int)PBDeserialize (*data, 4);
-             tblDataWriter__->storeInt(var, num);
-             *data += 4;
-             break;
-
-         case 9 : 
-             // 4-byte floating point (IEEE standard, MSB first) - Tested with 
-             // CR1000 data
-             num = PBDeserialize (*data, 4);
-             tblDataWriter__->storeFloat(var, intBitsToFloat(num));
-             *data += 4;
-             break;
-
-         case 10 : 
-             // Boolean value - Tested with CR1000 data
-             unum = PBDeserialize (*data, 1);
-             tblDataWriter__->storeBool(var, unum & 0x80);
-             *data += 1;
-             break;
-
-         case 16 : 
-             // variable length null-terminated string of length n+1 - Tested 
-             // with CR1000 data
-             str = GetVarLenString (*data);
-             tblDataWriter__->storeString(var, str);
-             *data += str.size() + 1;
-             break;
-
-         case 11 : 
-             // fixed length string of lengh n, unused portion filled 
-             // with spaces/null - Tested with CR1000 data
-             str = GetFixedLenString (*data, var);
-             tblDataWriter__->storeString(var, str);
-             *data += var.Dimension;
-             break;
-
-         case 1 : 
-             // 1-byte uint
-             unum = PBDeserialize (*data, 1);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 1;
-             break;
-         case 2 : 
-             // 2-byte unsigned integer (MSB first)
-             unum = PBDeserialize (*data, 2);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 2;
-             break;
-         case 3 : 
-             // 4-byte unsigned integer (MSB first)
-             unum = PBDeserialize (*data, 4);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 4;
-             break;
-         case 4 : 
-             // 1-byte signed integer
-             num  = (int)PBDeserialize (*data, 1);
-             tblDataWriter__->storeInt(var, num);
-             *data += 1;
-             break;
-         case 5 : 
-             // 2-byte signed integer (MSB first)
-             num = (int)PBDeserialize (*data, 2);
-             tblDataWriter__->storeInt(var, num);
-             *data += 2;
-             break;
-         case 18 : 
-             // 8-byte floating point (IEEE standard, MSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 8;
-             break;
-         case 15 : 
-             // 3-byte final storage floating point
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 3;
-             break;
-         case 8 : 
-             // 4-byte final storage floating point (CSI format)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 4;
-             break;
-         case 17 : 
-             // Byte of flags
-             unum = PBDeserialize (*data, 1);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 1;
-             break;
-         case 27 : 
-             // Boolean value
-             unum = PBDeserialize (*data, 1);
-             tblDataWriter__->storeBool(var, unum & 0x80);
-             *data += 1;
-             break;
-         case 28 : 
-             // Boolean value
-             unum = PBDeserialize (*data, 1);
-             tblDataWriter__->storeBool(var, unum & 0x80);
-             *data += 1;
-             break;
-         case 12 : 
-             // 4-byte integer used for 1-sec resolution time
-             unum = PBDeserialize (*data, 4);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 4;
-             break;
-         case 13 : 
-             // 6-byte unsigned integer, 10's of ms resolution
-             // Read a ulong, then mask out last 2 bytes
-             unum = PBDeserialize (*data, 4);
-             tblDataWriter__->storeUint4(var, unum);
-             *data += 6;
-             break;
-         case 14 : 
-             // 2 4-byte integers, nanosecond time resolution
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 8;
-             break;
-         case 19 : 
-             // 2-byte integer (LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 2;
-             break;
-         case 20 : 
-             // 4-byte integer (LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 4;
-             break;
-         case 21 : 
-             // 2-byte unsigned integer (LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 2;
-             break;
-         case 22 : 
-             // 4-byte unsigned integer (LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 4;
-             break;
-         case 24 : 
-             // 4-byte floating point (IEEE format, LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 4;
-             break;
-         case 25 : 
-             // 8-byte floating point (IEEE format, LSB first)
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 8;
-             break;
-         case 23 : 
-             // 2 longs (LSB first), seconds then nanoseconds
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 8;
-             break;
-         case 26 : 
-             // 4-byte floating point value
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
-             *data += 4;
-             break;
-         default : 
-             tblDataWriter__->processUnimplemented(var);
-             logUnimplementedDataError(var);
+    if (stored > 0) {
+        tbl.NextRecord     = batch__.RecordNbrs[stored - 1] + 1;
+        tbl.LastRecordTime = batch__.RecordTimes[stored - 1];
     }
-    return;
+}
+
+/**
+ * Function to empty the record batch and set up its columns for the fields
+ * of a table.
+ */
+void TableDataManager :: begin_batch (Table& tbl)
+{
+    batch__.RecordNbrs.clear();
+    batch__.RecordTimes.clear();
+    batch__.Columns.resize(tbl.DecodePlan.size());
+
+    for (size_t idx = 0; idx < tbl.DecodePlan.size(); idx++) {
+        const DecodeStep& step = tbl.DecodePlan[idx];
+        BatchColumn& column = batch__.Columns[idx];
+
+        column.clear();
+        column.Var       = &tbl.field_list[step.FieldIdx];
+        column.ValueKind = step.ValueKind;
+        column.Count     = step.Count;
+    }
+}
+
+/**
+ * Function to compile the field list of a table into the program decoding
+ * its records. The data type of each field is resolved here once, so that
+ * decoding a record runs the handlers of the steps in turn. As long as no
+ * field varies in length, the offset of every value in the record is known
+ * as well.
+ *
+ * @param tbl: Reference to the Table structure to compile.
+ */
+void TableDataManager :: compileDecodePlan (Table& tbl)
+{
+    int offset = 0;
+
+    tbl.DecodePlan.clear();
+    tbl.DecodePlan.reserve(tbl.field_list.size());
+
+    for (size_t idx = 0; idx < tbl.field_list.size(); idx++) {
+        const Field& var = tbl.field_list[idx];
+        DecodeStep   step;
+
+        step.FieldIdx = idx;
+        step.Count    = var.Dimension;
+        step.Offset   = offset;
+        step.Decode   = &TableDataManager::decode_unimplemented;
+
+        switch (var.FieldType) 
+        {
+            case 7 :  // 2-byte final storage floating point
+                step.Decode = &TableDataManager::decode_fp2;
+                step.ValueKind = BatchColumn::FLOAT;
+                step.Width  = 2;
+                break;
+            case 9 :  // 4-byte floating point (IEEE standard, MSB first)
+                step.Decode = &TableDataManager::decode_ieee4;
+                step.ValueKind = BatchColumn::FLOAT;
+                step.Width  = 4;
+                break;
+            case 4 :  // 1-byte signed integer
+            case 5 :  // 2-byte signed integer (MSB first)
+            case 6 :  // 4-byte signed integer (MSB first)
+                step.Decode = &TableDataManager::decode_int;
+                step.ValueKind = BatchColumn::INT;
+                step.Width  = (var.FieldType == 6) ? 4 : var.FieldType - 3;
+                break;
+            case 1 :  // 1-byte uint
+            case 17 : // Byte of flags
+                step.Decode = &TableDataManager::decode_uint;
+                step.ValueKind = BatchColumn::UINT4;
+                step.Width  = 1;
+                break;
+            case 2 :  // 2-byte unsigned integer (MSB first)
+                step.Decode = &TableDataManager::decode_uint;
+                step.ValueKind = BatchColumn::UINT4;
+                step.Width  = 2;
+                break;
+            case 3 :  // 4-byte unsigned integer (MSB first)
+            case 12 : // 4-byte integer used for 1-sec resolution time
+                step.Decode = &TableDataManager::decode_uint;
+                step.ValueKind = BatchColumn::UINT4;
+                step.Width  = 4;
+                break;
+            case 13 : // 6-byte unsigned integer, 10's of ms resolution
+                step.Decode = &TableDataManager::decode_uint;
+                step.ValueKind = BatchColumn::UINT4;
+                step.Width  = 6;
+                break;
+            case 10 : // Boolean values
+            case 27 : 
+            case 28 : 
+                step.Decode = &TableDataManager::decode_bool;
+                step.ValueKind = BatchColumn::BOOL;
+                step.Width  = 1;
+                break;
+            case 11 : // fixed length string of length n
+                step.Decode = &TableDataManager::decode_fixed_string;
+                step.ValueKind = BatchColumn::STRING;
+                step.Count  = 1;
+                step.Width  = var.Dimension;
+                break;
+            case 16 : // variable length null-terminated string
+                step.Decode = &TableDataManager::decode_var_string;
+                step.ValueKind = BatchColumn::STRING;
+                step.Count  = 1;
+                break;
+            case 19 : // 2-byte integers (LSB first)
+            case 21 : 
+                step.Width  = 2;
+                break;
+            case 15 : // 3-byte final storage floating point
+                step.Width  = 3;
+                break;
+            case 8 :  // 4-byte final storage floating point (CSI format)
+            case 20 : // 4-byte integers (LSB first)
+            case 22 : 
+            case 24 : // 4-byte floating point (IEEE format, LSB first)
+            case 26 : // 4-byte floating point value
+                step.Width  = 4;
+                break;
+            case 14 : // 2 4-byte integers, nanosecond time resolution
+            case 18 : // 8-byte floating point (IEEE standard, MSB first)
+            case 23 : // 2 longs (LSB first), seconds then nanoseconds
+            case 25 : // 8-byte floating point (IEEE format, LSB first)
+                step.Width  = 8;
+                break;
+            default : 
+                break;
+        }
+
+        if (var.FieldType == 16) {
+            offset = -1;
+        }
+        else if (offset >= 0) {
+            offset += step.Count * step.Width;
+        }
+        tbl.DecodePlan.push_back(step);
+    }
+    tbl.DecodedSize = offset;
+}
+
+/**
+ * Function to decode values in the 2-byte final storage floating point 
+ * format.
+ *
+ * @param step: Step of the decode program.
+ * @param data: Pointer to the first value in the record.
+ * @param column: Column the values are appended to.
+ * @return Number of bytes decoded.
+ */
+int TableDataManager :: decode_fp2 (const DecodeStep& step, const byte* data,
+        BatchColumn& column)
+{
+    const byte* end = data + 2*step.Count;
+    size_t at = column.Floats.size();
+
+    if (step.Count < BULK_DECODE_MIN_COUNT) {
+        for (const byte* ptr = data; ptr < end; ptr += 2) {
+            column.Floats.push_back(bulkDecoder__->finalStorageFloat(
+                    (uint2)BigEndian<2>::load(ptr)));
+        }
+    }
+    else {
+        column.Floats.resize(at + step.Count);
+        bulkDecoder__->decodeFp2(data, &column.Floats[at], step.Count);
+    }
+    return end - data;
+}
+
+/**
+ * Function to decode 4-byte IEEE floating point values (MSB first).
+ */
+int TableDataManager :: decode_ieee4 (const DecodeStep& step, 
+        const byte* data, BatchColumn& column)
+{
+    const byte* end = data + 4*step.Count;
+    size_t at = column.Floats.size();
+
+    if (step.Count < BULK_DECODE_MIN_COUNT) {
+        for (const byte* ptr = data; ptr < end; ptr += 4) {
+            column.Floats.push_back(BulkDecoder::float4(ptr));
+        }
+    }
+    else {
+        column.Floats.resize(at + step.Count);
+        bulkDecoder__->decodeFloat4(data, &column.Floats[at], step.Count);
+    }
+    return end - data;
+}
+
+/**
+ * Function to decode 1, 2 or 4-byte signed integers (MSB first). The 1 and
+ * 2-byte values aren't sign extended.
+ */
+int TableDataManager :: decode_int (const DecodeStep& step, const byte* data,
+        BatchColumn& column)
+{
+    const byte* end = data + step.Width*step.Count;
+    const byte* ptr = data;
+    size_t at = column.Ints.size();
+
+    if (step.Count < BULK_DECODE_MIN_COUNT && step.Width != 1) {
+        for (; ptr < end; ptr += step.Width) {
+            column.Ints.push_back((int)((step.Width == 2) ? 
+                    BigEndian<2>::load(ptr) : BigEndian<4>::load(ptr)));
+        }
+        return end - data;
+    }
+
+    switch (step.Width) 
+    {
+        case 1 : 
+            column.Ints.insert(column.Ints.end(), ptr, end);
+            break;
+        case 2 : 
+            column.Ints.resize(at + step.Count);
+            bulkDecoder__->decodeUint2(ptr, (uint4 *)&column.Ints[at], 
+                    step.Count);
+            break;
+        default : 
+            column.Ints.resize(at + step.Count);
+            bulkDecoder__->decodeUint4(ptr, (uint4 *)&column.Ints[at], 
+                    step.Count);
+    }
+    return end - data;
+}
+
+/**
+ * Function to decode 1, 2 or 4-byte unsigned integers (MSB first). Only 
+ * the first 4 bytes of the 6-byte times are decoded.
+ */
+int TableDataManager :: decode_uint (const DecodeStep& step, const byte* data,
+        BatchColumn& column)
+{
+    const byte* end = data + step.Width*step.Count;
+    const byte* ptr = data;
+    size_t at = column.Uints.size();
+
+    if (step.Count < BULK_DECODE_MIN_COUNT && step.Width != 1) {
+        for (; ptr < end; ptr += step.Width) {
+            column.Uints.push_back((step.Width == 2) ? 
+                    BigEndian<2>::load(ptr) : BigEndian<4>::load(ptr));
+        }
+        return end - data;
+    }
+
+    switch (step.Width) 
+    {
+        case 1 : 
+            column.Uints.insert(column.Uints.end(), ptr, end);
+            break;
+        case 2 : 
+            column.Uints.resize(at + step.Count);
+            bulkDecoder__->decodeUint2(ptr, &column.Uints[at], step.Count);
+            break;
+        case 4 : 
+            column.Uints.resize(at + step.Count);
+            bulkDecoder__->decodeUint4(ptr, &column.Uints[at], step.Count);
+            break;
+        default : 
+            for (; ptr < end; ptr += step.Width) {
+                column.Uints.push_back(BigEndian<4>::load(ptr));
+            }
+    }
+    return end - data;
+}
+
+/**
+ * Function to decode 1-byte boolean values, set if the high bit is set.
+ */
+int TableDataManager :: decode_bool (const DecodeStep& step, const byte* data,
+        BatchColumn& column)
+{
+    for (uint4 idx = 0; idx < step.Count; idx++) {
+        column.Bools.push_back((data[idx] & 0x80) ? 1 : 0);
+    }
+    return step.Count;
+}
+
+/**
+ * Function to decode a fixed length string, with the unused portion filled
+ * with spaces/null.
+ */
+int TableDataManager :: decode_fixed_string (const DecodeStep& step, 
+        const byte* data, BatchColumn& column)
+{
+    column.Strings.push_back(GetFixedLenString (data, *column.Var));
+    return step.Width;
+}
+
+/**
+ * Function to decode a variable length null-terminated string.
+ */
+int TableDataManager :: decode_var_string (const DecodeStep& step, 
+        const byte* data, BatchColumn& column)
+{
+    column.Strings.push_back(GetVarLenString (data));
+    return column.Strings.back().size() + 1;
+}
+
+/**
+ * Function to skip the values of a data type that isn't supported.
+ */
+int TableDataManager :: decode_unimplemented (const DecodeStep& step, 
+        const byte* data, BatchColumn& column)
+{
+    if (step.Count) {
+        logUnimplementedDataError(*column.Var);
+    }
+    return step.Width*step.Count;
+}
+
+/**
+ * Function to clear the values of a column, keeping the memory allocated.
+ */
+void BatchColumn :: clear()
+{
+    Floats.clear();
+    Ints.clear();
+    Uints.clear();
+    Bools.clear();
+    Strings.clear();
 }
 
 /**
@@ -72,6 +72,7 @@ struct TableOpt {
     string TableName;
     int    TableSpan;
     int    SampleInt;
+    vector<string> Fields;  // Names of the fields to collect, all if empty
 } ;
 
 /**
@@ -106,6 +107,58 @@ struct Field {
     string getProperty(int infoType, int dim) const;
 } ;
 
+/**
+ * Values of a field for each record of a RecordBatch. The values are kept
+ * in the vector matching the kind of the column, Count values per record,
+ * record after record. A string column holds one string per record, and an
+ * UNIMPLEMENTED column, for data types that aren't decoded, holds none.
+ */
+struct BatchColumn {
+    enum Kind { FLOAT, INT, UINT4, BOOL, STRING, UNIMPLEMENTED };
+
+    BatchColumn() : Var(NULL), ValueKind(UNIMPLEMENTED), Count(0) {}
+    void clear();
+
+    const Field*   Var;
+    Kind           ValueKind;
+    uint4          Count;     // Values per record
+    vector<float>  Floats;
+    vector<int>    Ints;
+    vector<uint4>  Uints;
+    vector<byte>   Bools;     // Zero or one
+    vector<string> Strings;
+};
+
+class TableDataManager;
+
+/**
+ * Step of the program decoding the records of a table, compiled from the
+ * field list by TableDataManager::compileDecodePlan(). A step hands Count
+ * consecutive values of a field, Width bytes each, to the handler for the
+ * data type of the field, which decodes them into the column of the field
+ * in a RecordBatch.
+ */
+struct DecodeStep {
+    /** 
+     * Handler appending the values of a step to their column, returns the
+     * bytes decoded.
+     */
+    typedef int (TableDataManager::*Handler)(const DecodeStep& step, 
+            const byte* data, BatchColumn& column);
+
+    DecodeStep() : FieldIdx(0), Decode(NULL), 
+            ValueKind(BatchColumn::UNIMPLEMENTED), Count(0), Width(0), 
+            Offset(-1) {}
+    uint4   FieldIdx;  // Index of the field in the field list
+    Handler Decode;
+    BatchColumn::Kind ValueKind;  // Kind of the column of the values
+    uint4   Count;     // Number of values
+    uint4   Width;     // Bytes per value
+    int     Offset;    // Offset of the first value from the end of the 
+                       // record time, -1 if it follows a variable length
+                       // field
+};
+
 /**
  * Data structure that mirrors the binary structure in which the metadata for
  * a "Table" is stored in the data logger memory. As obvious, a table contains
@@ -115,7 +168,8 @@ struct Field {
 struct Table {
     Table() : TblNum(0), TblSize((uint4)0), TblSignature((uint2)0), 
             FirstSampleInFile((uint4)0), NewFileTime((uint4)0), 
-            NextRecord((uint4)0) {}
+            NextRecord((uint4)0), RecsPerRequest((uint4)0), 
+            MaxRecsPerRequest((uint4)0), DecodedSize(-1) {}
     /* 
      * The following parameters are read in from the Table Definitions file
      * stored on the logger.
@@ -128,6 +182,12 @@ struct Table {
     NSec   TblTimeInterval;
     vector<Field>  field_list;
     uint2  TblSignature;
+    /*
+     * Numbers of the fields (in the table definition) requested in collect
+     * commands, all fields are collected if empty. field_list is reduced to
+     * the same fields.
+     */
+    vector<uint2>  FieldNbrs;
     /*
      * The following parameters are tracked by this application as the data
      * collection progresses.
@@ -136,9 +196,33 @@ struct Table {
     uint4  NewFileTime;
     uint4  NextRecord;
     NSec   LastRecordTime;
+    uint4  RecsPerRequest;    // Records asked for in each collect request
+    uint4  MaxRecsPerRequest; // Upper bound for RecsPerRequest
+    /*
+     * Program decoding the records of the table, compiled from field_list
+     * once the table definitions are built or restored.
+     */
+    vector<DecodeStep> DecodePlan;
+    int    DecodedSize;       // Bytes per record after the record time, -1 
+                              // if the records vary in length
+};
+
+/**
+ * Records of a table decoded from a response, held column by column with
+ * one column for each field collected, in the order of the field list. 
+ */
+struct RecordBatch {
+    /** Returns the number of records in the batch. */
+    size_t size() const { return RecordNbrs.size(); }
+
+    vector<uint4>       RecordNbrs;
+    vector<NSec>        RecordTimes;
+    vector<BatchColumn> Columns;
 };
 
 class TableDataWriter;
+class SessionSnapshot;
+class BulkDecoder;
 
 /**
  * Class for holding the data structure information for Tables being stored
@@ -160,22 +244,29 @@ class TableDataManager {
         TableDataWriter* getTableDataWriter();
         void   setTableDataWriter(TableDataWriter* tblDataWriter);
 
+        void   setSessionSnapshot(SessionSnapshot* snapshot);
         int    BuildTDF();
+        bool   restoreSnapshot();
         int    xmlDumpTDF (char *filename);
 
         Table& getTableRef (const string& TableName) throw (invalid_argument);
         int    storeRecord (Table& tbl_ref, byte **data, 
-                       uint4 rec_num, int file_span, bool parseTimestamp)
+                       uint4 rec_num, bool parseTimestamp)
+               throw (StorageException);
+        int    storeRecords (Table& tbl_ref, byte **data, uint4 rec_num,
+                       int nrecs, bool parseTimestamp) 
                throw (StorageException);
         int    getRecordSize (const Table& tbl);
         int    getMaxRecordSize();
 
         void   cleanCache();
         void   flushTableDataCache(Table& tblRef);
+        void   saveTableStorageHistory();
 
     protected : 
         int    readTableDefinition (int table_num, byte *ptr, byte *endptr);
         int    readFieldList (byte *ptr, byte *endptr, Table& Tbl);
+        void   selectFields (Table& tbl, const vector<string>& fields);
 
         void   writeTableToXml (xmlNodePtr doc_root, Table& tbl);
         void   writeFieldToXml (xmlNodePtr table_node, Field& var);
@@ -183,11 +274,29 @@ class TableDataManager {
         const char* getDataType (const Field& var);
         void   logUnimplementedDataError(const Field& var);
 
-        void   storeDataSample(const Field& var, byte **data);
+        void   compileDecodePlan (Table& tbl);
+        void   begin_batch (Table& tbl);
+        void   advance_table (Table& tbl, size_t stored);
+        int    decode_fp2 (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_ieee4 (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_int (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_uint (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_bool (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_fixed_string (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_var_string (const DecodeStep& step, const byte* data, 
+                   BatchColumn& column);
+        int    decode_unimplemented (const DecodeStep& step, const byte* data,
+                   BatchColumn& column);
         int    getFieldSize (const Field& field);
 
         void   loadTableStorageHistory();
-        void   saveTableStorageHistory();
+        string selection_key();
 
     private :
         byte          fslVersion__;
@@ -195,6 +304,10 @@ class TableDataManager {
         DataOutputConfig       dataOutputConfig__;
         DLProgStats   dataLoggerProgStats__;
         auto_ptr<TableDataWriter> tblDataWriter__;
+        SessionSnapshot* snapshot__;
+        RecordBatch   batch__;       // Records being stored, kept to reuse
+                                     // the memory of the columns
+        const BulkDecoder* bulkDecoder__; // Kernels decoding the arrays
 };
 
 /**
@@ -257,6 +370,9 @@ public:
     /** Function called upon completion of parsing a binary data record */
     virtual void processRecordEnd(Table& tblRef) = 0;
 
+    virtual void storeBatch(Table& tblRef, const RecordBatch& batch,
+                size_t& stored);
+
     /** 
      * Function called to indicate the completion of data collection
      * for a specific table. 
@@ -347,7 +463,7 @@ private:
 }; 
 
 string GetVarLenString (const byte *ptr);
-string GetFixedLenString (const byte *str_ptr, Field& var);
+string GetFixedLenString (const byte *str_ptr, const Field& var);
 NSec   parseRecordTime(const byte* data);
 
 //! Function to convert a bit pattern to the equivalent floating
@@ -356,7 +472,6 @@ float  intBitsToFloat (uint4 bits);
 
 //! Function to extract floating point number from low resolution
 //! final storage format.
-float  GetFinalStorageFloat (byte **data);
-//float  GetFinalStorageFloat (uint2 unum);
+float  GetFinalStorageFloat (uint2 unum);
 
 #endif
@@ -16,6 +16,74 @@
 using namespace std;
 using namespace log4cpp;
 
+/**
+ * Function called to store a batch of records decoded from a response.
+ * This implementation replays the batch through the per-value callbacks,
+ * record by record and field by field, so that writers only implementing
+ * those (as AsciiWriter) see the same calls as if the records were stored
+ * one at a time. Writers able to store the values column by column 
+ * override it, and report the records they stored the same way.
+ *
+ * The records stored are reported as they are, so that the state of the
+ * table (NextRecord, LastRecordTime) only advances past those if a 
+ * callback throws in the middle of the batch.
+ *
+ * @param tblRef: Table the records belong to.
+ * @param batch: The records.
+ * @param stored: Set to the number of records stored, from the first one.
+ */
+void TableDataWriter :: storeBatch(Table& tblRef, const RecordBatch& batch,
+        size_t& stored)
+{
+    vector<BatchColumn>::const_iterator col;
+    string str;
+
+    for (size_t rec = 0; rec < batch.size(); rec++) {
+        processRecordBegin(tblRef, batch.RecordNbrs[rec], 
+                batch.RecordTimes[rec]);
+
+        for (col = batch.Columns.begin(); col != batch.Columns.end(); col++) {
+            const Field& var = *col->Var;
+            size_t beg = rec*col->Count;
+            size_t end = beg + col->Count;
+
+            switch (col->ValueKind) 
+            {
+                case BatchColumn::FLOAT : 
+                    for (size_t idx = beg; idx < end; idx++) {
+                        storeFloat(var, col->Floats[idx]);
+                    }
+                    break;
+                case BatchColumn::INT : 
+                    for (size_t idx = beg; idx < end; idx++) {
+                        storeInt(var, col->Ints[idx]);
+                    }
+                    break;
+                case BatchColumn::UINT4 : 
+                    for (size_t idx = beg; idx < end; idx++) {
+                        storeUint4(var, col->Uints[idx]);
+                    }
+                    break;
+                case BatchColumn::BOOL : 
+                    for (size_t idx = beg; idx < end; idx++) {
+                        storeBool(var, col->Bools[idx]);
+                    }
+                    break;
+                case BatchColumn::STRING : 
+                    str = col->Strings[rec];
+                    storeString(var, str);
+                    break;
+                default : 
+                    for (size_t idx = beg; idx < end; idx++) {
+                        processUnimplemented(var);
+                    }
+            }
+        }
+        processRecordEnd(tblRef);
+        stored = rec + 1;
+    }
+}
+
 /**
  * Accessor function for the TableDataWriterFactory object.
  * @return TableDataWriterFactory: Reference to the factory instance.
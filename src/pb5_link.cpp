@@ -0,0 +1,892 @@
+/**
+ * @file pb5_link.cpp
+ * Implements the sharing of a PakBus port between several node sessions
+ * and the clients of a broker.
+ */
+
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <log4cpp/Category.hh>
+#include "pb5_link.h"
+
+using namespace std;
+using namespace log4cpp;
+
+/**
+ * Function to unquote a frame received or written on the port.
+ *
+ * @param frame: Quoted frame, including both SerSyncBytes.
+ * @param packet: Returns the header, message and signature nullifier.
+ */
+static void unquote_frame(const string& frame, string& packet)
+{
+    bool quoted = false;
+
+    packet.clear();
+    packet.reserve(frame.size());
+    for (string::size_type idx = 1; idx + 1 < frame.size(); idx++) {
+        byte c = (byte)frame[idx];
+        if (quoted) {
+            c = (c == 0xdd) ? 0xbd : ((c == 0xdc) ? 0xbc : c);
+            quoted = false;
+        }
+        else if (c == 0xbc) {
+            quoted = true;
+            continue;
+        }
+        packet += (char)c;
+    }
+}
+
+/**
+ * Function to sign and quote a packet whose header or message changed.
+ *
+ * @param packet: Header, message and the signature nullifier to replace.
+ * @param frame: Returns the quoted frame, including both SerSyncBytes.
+ */
+static void quote_frame(const string& packet, string& frame)
+{
+    uint2 signull = CalcSigNullifier(CalcSigFast(packet.data(), 
+            packet.size() - 2, SIG_SEED));
+    string signedPacket(packet, 0, packet.size() - 2);
+    byte nullifier[2];
+    BigEndian<2>::store(nullifier, signull);
+    signedPacket.append((const char *)nullifier, 2);
+
+    frame.assign(1, (char)SerSyncByte__);
+    frame.reserve(2*signedPacket.size() + 2);
+    for (string::size_type idx = 0; idx < signedPacket.size(); idx++) {
+        byte c = (byte)signedPacket[idx];
+        if ((c == 0xbc) || (c == 0xbd)) {
+            frame += (char)0xbc;
+            c = (c == 0xbd) ? 0xdd : 0xdc;
+        }
+        frame += (char)c;
+    }
+    frame += (char)SerSyncByte__;
+}
+
+/** Returns the key of a transaction in the transaction table. */
+static inline uint4 tran_key(uint2 nodeId, byte tranNbr)
+{
+    return ((uint4)nodeId << 8) | tranNbr;
+}
+
+/**
+ * Constructor for the NodeConn class.
+ *
+ * @param link: Link shared with the sessions of other nodes.
+ * @param nodeId: PakBus node id of the logger.
+ */
+NodeConn :: NodeConn (PakBusLink* link, uint2 nodeId) :
+        DataSource(link->getDevice()->getType()), link__(link),
+        nodeId__(nodeId)
+{
+    setReadMode(pakbuf::READ_DEADLINE);
+}
+
+int NodeConn :: connect () throw (CommException)
+{
+    return link__->connectNode(nodeId__);
+}
+
+bool NodeConn :: disconnect () throw (CommException)
+{
+    link__->disconnectNode(nodeId__);
+    return true;
+}
+
+bool NodeConn :: isOpen ()
+{
+    return link__->isNodeConnected(nodeId__);
+}
+
+string NodeConn :: getConnInfo ()
+{
+    stringstream msg;
+    msg << link__->getDevice()->getConnInfo() << " node " << nodeId__;
+    return msg.str();
+}
+
+string NodeConn :: getAddress ()
+{
+    return link__->getDevice()->getAddress();
+}
+
+/**
+ * Function to obtain an identifier for the lock file, so that two
+ * instances don't collect from the same node.
+ */
+string NodeConn :: getLockId ()
+{
+    stringstream lockId;
+    lockId << link__->getDevice()->getLockId() << "_node" << nodeId__;
+    return lockId.str();
+}
+
+/**
+ * Returns the deadline (msecs) for receiving a response packet, which
+ * allows for the port deadline over each hop to the node.
+ */
+int NodeConn :: getReadTimeout ()
+{
+    return link__->getDevice()->getReadTimeout() *
+            (1 + link__->getRoute(nodeId__).HopCount);
+}
+
+/**
+ * Returns the lower bound (msecs) of the read deadline, which allows for
+ * the port lower bound over each hop to the node.
+ */
+int NodeConn :: getMinReadTimeout ()
+{
+    return link__->getDevice()->getMinReadTimeout() *
+            (1 + link__->getRoute(nodeId__).HopCount);
+}
+
+/**
+ * Constructor for the PakBusLink class.
+ *
+ * @param device: Port to share, the link takes its ownership.
+ */
+PakBusLink :: PakBusLink (auto_ptr<DataSource> device) :
+        Fiber(device->getConnInfo()), device__(device), devFd__(-1),
+        epollFd__(-1), listenFd__(-1), nconnected__(0), running__(false), 
+        connecting__(false)
+{
+}
+
+PakBusLink :: ~PakBusLink ()
+{
+    map<uint2, PakBusRoute>::iterator itr;
+    for (itr = routes__.begin(); itr != routes__.end(); itr++) {
+        disconnectNode(itr->first);
+    }
+    while (clients__.size()) {
+        close_client(clients__.begin()->first);
+    }
+    closeListener();
+    close_device();
+    if (epollFd__ >= 0) {
+        close(epollFd__);
+    }
+}
+
+/**
+ * Function to add a node to the routing table.
+ *
+ * @param pbAddr: PakBus address of the node and the neighbour relaying
+ *                its packets.
+ * @return Connection for the session with the node, owned by the caller.
+ */
+DataSource* PakBusLink :: addNode (const PBAddr& pbAddr) throw (AppException)
+{
+    uint2 nodeId = (uint2)pbAddr.NodePakBusID;
+
+    if (routes__.count(nodeId)) {
+        stringstream msgstrm;
+        msgstrm << "PakBus node " << nodeId << " is listed twice for "
+                << device__->getConnInfo();
+        throw AppException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+
+    PakBusRoute& route  = routes__[nodeId];
+    route.NodeId        = nodeId;
+    route.NeighbourAddr = (uint2)pbAddr.PakBusID;
+    route.HopCount      = pbAddr.HopCount;
+
+    return new NodeConn(this, nodeId);
+}
+
+/**
+ * Function to connect the session with a node. The port is opened if no
+ * other session uses it, and the link fiber is started if required.
+ *
+ * @param nodeId: PakBus node id of the logger.
+ * @return Descriptor the session reads and writes its frames on.
+ */
+int PakBusLink :: connectNode (uint2 nodeId) throw (CommException)
+{
+    PakBusRoute& route = routes__[nodeId];
+    int          sv[2];
+    struct epoll_event ev;
+
+    disconnectNode(nodeId);
+    open_device();
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        throw CommException(__FILE__, __LINE__, strerror(errno));
+    }
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = sv[0];
+    epoll_ctl(epollFd__, EPOLL_CTL_ADD, sv[0], &ev);
+
+    route.LinkFd    = sv[0];
+    route.SessionFd = sv[1];
+    route.Pending.clear();
+    nconnected__++;
+
+    if (!running__) {
+        running__ = true;
+        EventLoop::getInstance().spawn(this);
+    }
+    return route.SessionFd;
+}
+
+/**
+ * Function to disconnect the session with a node. The port is closed once
+ * no session uses it.
+ *
+ * @param nodeId: PakBus node id of the logger.
+ */
+void PakBusLink :: disconnectNode (uint2 nodeId)
+{
+    PakBusRoute& route = routes__[nodeId];
+
+    if (route.LinkFd < 0) {
+        return;
+    }
+    close(route.LinkFd);
+    close(route.SessionFd);
+    route.LinkFd    = -1;
+    route.SessionFd = -1;
+
+    if (--nconnected__ == 0) {
+        close_device();
+    }
+}
+
+bool PakBusLink :: isNodeConnected (uint2 nodeId)
+{
+    map<uint2, PakBusRoute>::iterator route = routes__.find(nodeId);
+    return (route != routes__.end()) && (route->second.LinkFd >= 0);
+}
+
+/**
+ * Function to open the port if no session uses it yet. Sessions asking
+ * for the port while it is being opened wait for it.
+ */
+void PakBusLink :: open_device () throw (CommException)
+{
+    struct epoll_event ev;
+
+    if ((epollFd__ < 0) && ((epollFd__ = epoll_create(MAX_LOOP_EVENTS)) < 0)) {
+        throw CommException(__FILE__, __LINE__, strerror(errno));
+    }
+
+    while (connecting__) {
+        EventLoop::getInstance().waitFd(-1, 0, LINK_CONNECT_POLL);
+    }
+
+    if (devFd__ >= 0) {
+        return;
+    }
+
+    connecting__ = true;
+    try {
+        devFd__ = device__->connect();
+    }
+    catch (CommException& ce) {
+        connecting__ = false;
+        throw;
+    }
+    connecting__ = false;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = devFd__;
+    epoll_ctl(epollFd__, EPOLL_CTL_ADD, devFd__, &ev);
+}
+
+/**
+ * Function to make the link a broker, accepting clients on a unix socket.
+ * A client writes and reads PakBus frames on the socket as it would on the
+ * port. The port is opened when the first client connects, if the
+ * sessions of the process haven't opened it already.
+ *
+ * @param path: Path of the socket, replaced if it exists.
+ */
+void PakBusLink :: listen (const string& path) throw (CommException)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    stringstream msgstrm;
+
+    closeListener();
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        msgstrm << "Socket path too long : " << path;
+        throw CommException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+    if ((epollFd__ < 0) && ((epollFd__ = epoll_create(MAX_LOOP_EVENTS)) < 0)) {
+        throw CommException(__FILE__, __LINE__, strerror(errno));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+            (::listen(fd, LINK_LISTEN_BACKLOG) < 0)) {
+        msgstrm << "Failed to listen on " << path << " : " << strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw CommException(__FILE__, __LINE__, msgstrm.str().c_str());
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epollFd__, EPOLL_CTL_ADD, fd, &ev);
+
+    listenFd__   = fd;
+    listenPath__ = path;
+
+    Category::getInstance("PakBusLink")
+             .notice("Sharing " + device__->getConnInfo() + " with clients on " 
+                     + path);
+
+    if (!running__) {
+        running__ = true;
+        EventLoop::getInstance().spawn(this);
+    }
+}
+
+/**
+ * Function to stop accepting clients. Connected clients are served until
+ * they disconnect.
+ */
+void PakBusLink :: closeListener ()
+{
+    if (listenFd__ < 0) {
+        return;
+    }
+    close(listenFd__);
+    unlink(listenPath__.c_str());
+    listenFd__ = -1;
+}
+
+/**
+ * Function to accept a client on the broker socket, opening the port for
+ * it if required.
+ */
+void PakBusLink :: accept_client ()
+{
+    struct epoll_event ev;
+    int fd = accept(listenFd__, NULL, NULL);
+
+    if (fd < 0) {
+        return;
+    }
+    try {
+        open_device();
+    }
+    catch (CommException& ce) {
+        Category::getInstance("PakBusLink").error(ce.what());
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epollFd__, EPOLL_CTL_ADD, fd, &ev);
+
+    clients__[fd].LinkFd = fd;
+    nconnected__++;
+    Category::getInstance("PakBusLink").info("Accepted a broker client");
+}
+
+/**
+ * Function to disconnect a broker client, forgetting its transactions. The
+ * port is closed once no session uses it.
+ *
+ * @param fd: Socket of the client.
+ */
+void PakBusLink :: close_client (int fd)
+{
+    map<uint4, PakBusTran>::iterator itr = trans__.begin();
+
+    while (itr != trans__.end()) {
+        if (itr->second.LinkFd == fd) {
+            trans__.erase(itr++);
+        }
+        else {
+            itr++;
+        }
+    }
+
+    close(fd);
+    clients__.erase(fd);
+    Category::getInstance("PakBusLink").info("Broker client disconnected");
+
+    if (--nconnected__ == 0) {
+        close_device();
+    }
+}
+
+/**
+ * Function to run the link, moving frames between the port and the
+ * sessions until all sessions have disconnected and the link no longer 
+ * listens for clients. If the port fails, the sessions are shut down so 
+ * that they establish their session again.
+ */
+void PakBusLink :: run () throw ()
+{
+    struct epoll_event events[MAX_LOOP_EVENTS];
+    map<uint2, PakBusRoute>::iterator itr;
+
+    while ((nconnected__ > 0) || (listenFd__ >= 0)) {
+        int timeout = held__.size() ? LINK_HOLD_POLL : LINK_IDLE_TIMEOUT;
+        int nevents = 0;
+
+        if (EventLoop::getInstance().waitFd(epollFd__, POLLIN, timeout) > 0) {
+            nevents = epoll_wait(epollFd__, events, MAX_LOOP_EVENTS, 0);
+        }
+
+        try {
+            for (int idx = 0; idx < nevents; idx++) {
+                int fd = events[idx].data.fd;
+                if (fd == devFd__) {
+                    read_device();
+                    continue;
+                }
+                if (fd == listenFd__) {
+                    accept_client();
+                    continue;
+                }
+                if (clients__.count(fd)) {
+                    read_session(clients__[fd], false);
+                    continue;
+                }
+                for (itr = routes__.begin(); itr != routes__.end(); itr++) {
+                    if (itr->second.LinkFd == fd) {
+                        read_session(itr->second, true);
+                        break;
+                    }
+                }
+            }
+            flush_held();
+        }
+        catch (CommException& ce) {
+            Category::getInstance("PakBusLink").error(ce.what());
+            for (itr = routes__.begin(); itr != routes__.end(); itr++) {
+                if (itr->second.LinkFd >= 0) {
+                    shutdown(itr->second.LinkFd, SHUT_RDWR);
+                }
+            }
+            while (clients__.size()) {
+                close_client(clients__.begin()->first);
+            }
+            held__.clear();
+            trans__.clear();
+            close_device();
+        }
+    }
+
+    close_device();
+    running__ = false;
+}
+
+/**
+ * Function to read from the port and pass each complete frame to the
+ * session it is addressed to. A partially received frame is kept until
+ * the next read.
+ */
+void PakBusLink :: read_device () throw (CommException)
+{
+    char buf[1024];
+    int  nbytes = read(devFd__, buf, sizeof(buf));
+
+    if (nbytes == 0) {
+        throw CommException(__FILE__, __LINE__, "Connection closed by device");
+    }
+    if (nbytes < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN)) {
+            return;
+        }
+        throw CommException(__FILE__, __LINE__, strerror(errno));
+    }
+
+    for (int idx = 0; idx < nbytes; idx++) {
+        if ((byte)buf[idx] == SerSyncByte__) {
+            if (inFrame__.size() > 1) {
+                inFrame__ += buf[idx];
+                route_frame(inFrame__);
+            }
+            inFrame__.assign(1, buf[idx]);
+        }
+        else if (inFrame__.size()) {
+            inFrame__ += buf[idx];
+            if (inFrame__.size() > 2*MAX_PACK_SIZE) {
+                inFrame__.clear();
+            }
+        }
+    }
+}
+
+/**
+ * Function to forward the frames written by a session to the port. Only
+ * whole frames are forwarded, so that they aren't broken up by the frames
+ * of other sessions. A broker client that closed its socket is 
+ * disconnected.
+ *
+ * @param route: Routing table entry of the session.
+ * @param priority: Set for the sessions of the scheduled collection.
+ */
+void PakBusLink :: read_session (PakBusRoute& route, bool priority) 
+        throw (CommException)
+{
+    char buf[1024];
+    int  nbytes = read(route.LinkFd, buf, sizeof(buf));
+
+    if ((nbytes == 0) || ((nbytes < 0) && (errno != EINTR) && 
+            (errno != EAGAIN))) {
+        if (!priority) {
+            close_client(route.LinkFd);
+        }
+        return;
+    }
+    if (nbytes < 0) {
+        return;
+    }
+    route.Pending.append(buf, nbytes);
+
+    // Frames end with a SerSyncByte, which also opens the next frame. The
+    // SerSyncBytes between frames wake up the logger and are passed on.
+
+    string::size_type pos = 0;
+    string::size_type beg, end;
+
+    while ((beg = route.Pending.find((char)SerSyncByte__, pos)) 
+            != string::npos) {
+        if ((end = route.Pending.find((char)SerSyncByte__, beg + 1)) 
+                == string::npos) {
+            break;
+        }
+        if (end == beg + 1) {
+            write_device(route.Pending.data() + beg, 1);
+            pos = end;
+            continue;
+        }
+        send_frame(route, route.Pending.substr(beg, end - beg + 1), priority);
+        pos = end;
+    }
+
+    route.Pending.erase(0, (beg == string::npos) ? route.Pending.size() : beg);
+}
+
+/**
+ * Function to send a frame of a session on the port. Frames of broker 
+ * clients are held back while the scheduled collection waits for a 
+ * response, or earlier frames of clients are still held.
+ *
+ * @param route: Routing table entry of the session.
+ * @param frame: Quoted frame, including both SerSyncBytes.
+ * @param priority: Set for the sessions of the scheduled collection.
+ */
+void PakBusLink :: send_frame (PakBusRoute& route, const string& frame, 
+        bool priority) throw (CommException)
+{
+    string packet;
+    unquote_frame(frame, packet);
+
+    if (!priority) {
+        if (packet.size() >= PakBusHeader::LINK_SIZE) {
+            route.NeighbourAddr = (uint2)PakBusHeader::DstPhyAddr::get(
+                    packet.data());
+        }
+        if (packet.size() >= 12) {
+            route.NodeId = (uint2)PakBusHeader::DstNodeId::get(packet.data());
+        }
+        if (held__.size() || priority_pending()) {
+            HeldFrame held;
+            held.LinkFd = route.LinkFd;
+            held.Frame  = frame;
+            held.Since  = get_msec_clock();
+            held__.push_back(held);
+            return;
+        }
+    }
+    forward_frame(route, frame, priority);
+}
+
+/**
+ * Function to write a frame of a session to the port. A request is given
+ * the next transaction number of the link for its node, and the number 
+ * the session chose is kept in the transaction table for the response.
+ *
+ * @param route: Routing table entry of the session.
+ * @param frame: Quoted frame, including both SerSyncBytes.
+ * @param priority: Set for the sessions of the scheduled collection.
+ */
+void PakBusLink :: forward_frame (PakBusRoute& route, const string& frame, 
+        bool priority) throw (CommException)
+{
+    string packet;
+    unquote_frame(frame, packet);
+
+    // Responses to requests of the node (message types with the high bit
+    // set) keep the node's transaction number
+
+    if ((packet.size() < 12) || 
+            (PakBusHeader::MsgType::get(packet.data()) & 0x80)) {
+        write_device(frame.data(), frame.size());
+        return;
+    }
+
+    uint2 nodeId = (uint2)PakBusHeader::DstNodeId::get(packet.data());
+    byte  tranNbr = next_tran(nodeId);
+
+    PakBusTran& tran = trans__[tran_key(nodeId, tranNbr)];
+    tran.LinkFd   = route.LinkFd;
+    tran.TranNbr  = (byte)PakBusHeader::TranNbr::get(packet.data());
+    tran.Priority = priority;
+    tran.SentAt   = get_msec_clock();
+
+    if (tran.TranNbr == tranNbr) {
+        write_device(frame.data(), frame.size());
+        return;
+    }
+
+    string linkFrame;
+    PakBusHeader::TranNbr::set(&packet[0], tranNbr);
+    quote_frame(packet, linkFrame);
+    write_device(linkFrame.data(), linkFrame.size());
+}
+
+/**
+ * Function to send the frames of broker clients held back, in the order
+ * they were received, once the scheduled collection has no response
+ * pending or they have been held for LINK_MAX_HOLD msecs.
+ */
+void PakBusLink :: flush_held () throw (CommException)
+{
+    while (held__.size()) {
+        HeldFrame held = held__.front();
+
+        if (priority_pending() && 
+                (msec_diff(get_msec_clock(), held.Since) < LINK_MAX_HOLD)) {
+            break;
+        }
+        held__.pop_front();
+
+        map<int, PakBusRoute>::iterator itr = clients__.find(held.LinkFd);
+        if (itr == clients__.end()) {
+            continue;
+        }
+        forward_frame(itr->second, held.Frame, false);
+    }
+}
+
+/**
+ * Function to check if the scheduled collection waits for a response. 
+ * Transactions left unanswered for LINK_TRAN_EXPIRY msecs are forgotten.
+ *
+ * @return true if a request of the scheduled collection is unanswered
+ *         and its response is still due.
+ */
+bool PakBusLink :: priority_pending ()
+{
+    unsigned int now = get_msec_clock();
+    bool pending = false;
+    map<uint4, PakBusTran>::iterator itr = trans__.begin();
+
+    while (itr != trans__.end()) {
+        int age = msec_diff(now, itr->second.SentAt);
+        if (age >= LINK_TRAN_EXPIRY) {
+            trans__.erase(itr++);
+            continue;
+        }
+        if (itr->second.Priority) {
+            map<uint2, PakBusRoute>::iterator route = 
+                    routes__.find((uint2)(itr->first >> 8));
+            if ((route != routes__.end()) && (age < 
+                    device__->getReadTimeout()*(1 + route->second.HopCount))) {
+                pending = true;
+            }
+        }
+        itr++;
+    }
+    return pending;
+}
+
+/**
+ * Function to pick the transaction number of the link for the next request
+ * to a node, skipping the numbers of the transactions still pending.
+ *
+ * @param nodeId: PakBus node id of the logger.
+ */
+byte PakBusLink :: next_tran (uint2 nodeId)
+{
+    byte& tranNbr = lastTran__[nodeId];
+
+    for (int idx = 0; idx < 256; idx++) {
+        if (++tranNbr == 0) {
+            tranNbr = 1;
+        }
+        if (!trans__.count(tran_key(nodeId, tranNbr))) {
+            break;
+        }
+    }
+    return tranNbr;
+}
+
+/**
+ * Function to pass a frame received on the port to the session it is
+ * addressed to. A response goes to the session that sent the request,
+ * found in the transaction table, under the transaction number the 
+ * session chose. Other packets go to the session of their source node, or
+ * the last broker client talking to it; link state packets, which only
+ * carry physical addresses, go to all the sessions behind their source
+ * neighbour.
+ *
+ * @param frame: Quoted frame, including both SerSyncBytes.
+ */
+void PakBusLink :: route_frame (const string& frame)
+{
+    string packet;
+    unquote_frame(frame, packet);
+
+    map<uint2, PakBusRoute>::iterator itr;
+    map<int, PakBusRoute>::iterator   citr;
+    int ndelivered = 0;
+
+    // A link state packet has a 4-byte header and the signature nullifier,
+    // other packets carry the node addresses as well
+
+    if (packet.size() >= 12) {
+        uint2 srcNode = (uint2)PakBusHeader::SrcNodeId::get(packet.data());
+        byte  msgType = (byte)PakBusHeader::MsgType::get(packet.data());
+        byte  pktTran = (byte)PakBusHeader::TranNbr::get(packet.data());
+        map<uint4, PakBusTran>::iterator titr = 
+                trans__.find(tran_key(srcNode, pktTran));
+
+        if ((msgType & 0x80) && (titr != trans__.end())) {
+            int  fd      = titr->second.LinkFd;
+            byte tranNbr = titr->second.TranNbr;
+
+            // Please wait messages (0xa1) announce that the response is late
+            if (msgType == 0xa1) {
+                titr->second.SentAt = get_msec_clock();
+            }
+            else {
+                trans__.erase(titr);
+            }
+
+            if (tranNbr == pktTran) {
+                deliver(fd, frame);
+            }
+            else {
+                string sessionFrame;
+                PakBusHeader::TranNbr::set(&packet[0], tranNbr);
+                quote_frame(packet, sessionFrame);
+                deliver(fd, sessionFrame);
+            }
+            return;
+        }
+
+        itr = routes__.find(srcNode);
+        if ((itr != routes__.end()) && (itr->second.LinkFd >= 0)) {
+            deliver(itr->second.LinkFd, frame);
+            ndelivered++;
+        }
+        for (citr = clients__.begin(); !ndelivered && 
+                (citr != clients__.end()); citr++) {
+            if (citr->second.NodeId == srcNode) {
+                deliver(citr->first, frame);
+                ndelivered++;
+            }
+        }
+    }
+    else if (packet.size() >= 4) {
+        uint2 srcPhy = (uint2)PakBusHeader::SrcPhyAddr::get(packet.data());
+        for (itr = routes__.begin(); itr != routes__.end(); itr++) {
+            if ((itr->second.NeighbourAddr == srcPhy) &&
+                    (itr->second.LinkFd >= 0)) {
+                deliver(itr->second.LinkFd, frame);
+                ndelivered++;
+            }
+        }
+        for (citr = clients__.begin(); citr != clients__.end(); citr++) {
+            if (citr->second.NeighbourAddr == srcPhy) {
+                deliver(citr->first, frame);
+                ndelivered++;
+            }
+        }
+    }
+
+    if (!ndelivered && Category::getInstance("PakBusLink").isDebugEnabled()) {
+        Category::getInstance("PakBusLink")
+                 .debug("Dropping packet not addressed to a session");
+    }
+}
+
+/**
+ * Function to pass a frame to a session. A session that doesn't keep up
+ * with its socket loses the frame, as it would on a noisy line.
+ */
+void PakBusLink :: deliver (int fd, const string& frame)
+{
+    if (write(fd, frame.data(), frame.size()) < 0) {
+        Category::getInstance("PakBusLink")
+                 .debug("Dropping packet, session not reading");
+    }
+}
+
+/**
+ * Function to write to the port, waiting for it to accept the data.
+ */
+void PakBusLink :: write_device (const char *data, int len)
+        throw (CommException)
+{
+    if (devFd__ < 0) {
+        throw CommException(__FILE__, __LINE__, "Port is not open");
+    }
+
+    while (len > 0) {
+        int nwrite = write(devFd__, data, len);
+        if (nwrite > 0) {
+            data += nwrite;
+            len  -= nwrite;
+            continue;
+        }
+        if ((nwrite < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((nwrite < 0) && (errno == EAGAIN) && (EventLoop::getInstance()
+                .waitFd(devFd__, POLLOUT, device__->getReadTimeout()) > 0)) {
+            continue;
+        }
+        throw CommException(__FILE__, __LINE__,
+                (nwrite < 0) ? strerror(errno) : "Device not accepting data");
+    }
+}
+
+/**
+ * Function to close the port, discarding any partially received frame.
+ */
+void PakBusLink :: close_device ()
+{
+    if (devFd__ >= 0) {
+        device__->disconnect();
+        devFd__ = -1;
+    }
+    inFrame__.clear();
+}
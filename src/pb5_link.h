@@ -0,0 +1,167 @@
+/**
+ * @file pb5_link.h
+ * Provides sharing of one PakBus port between the sessions with several
+ * nodes, such as loggers on an RS-485 or radio network, and with the 
+ * clients of a broker.
+ */
+
+#ifndef PB5_LINK_H
+#define PB5_LINK_H
+#include <string>
+#include <map>
+#include <deque>
+#include <memory>
+#include "pb5.h"
+#include "init_comm.h"
+#include "event_loop.h"
+using namespace std;
+
+// Msecs the link waits for traffic before checking if it is still in use
+#define LINK_IDLE_TIMEOUT 1000
+// Msecs between the checks of a session waiting for the port to open
+#define LINK_CONNECT_POLL 100
+// Msecs a client frame is held back at most while the scheduled
+// collection waits for a response
+#define LINK_MAX_HOLD 2000
+// Msecs between the checks of the client frames held back
+#define LINK_HOLD_POLL 50
+// Msecs after which an unanswered transaction is forgotten
+#define LINK_TRAN_EXPIRY 60000
+// Backlog of the broker socket
+#define LINK_LISTEN_BACKLOG 8
+
+/**
+ * Entry of the routing table of a PakBusLink. Packets from the node (or
+ * link state packets from its neighbour) are passed to the session through
+ * a socket pair, whose link end is held here.
+ */
+struct PakBusRoute {
+    PakBusRoute() : NodeId(0), NeighbourAddr(0), HopCount(0), LinkFd(-1),
+            SessionFd(-1) {}
+    uint2  NodeId;           // PakBus node id of the logger
+    uint2  NeighbourAddr;    // Physical address the packets come through
+    int    HopCount;         // Number of hops to the node
+    int    LinkFd;           // Link end of the session socket pair, -1 if
+                             // the session isn't connected
+    int    SessionFd;        // Session end of the socket pair
+    string Pending;          // Bytes from the session not yet forwarded
+};
+
+/**
+ * Entry of the transaction table of a PakBusLink. Each request sent on the
+ * port gets a transaction number of the link, so that the transactions of
+ * sessions talking to the same node don't collide, and the response is
+ * passed back under the number the session chose.
+ */
+struct PakBusTran {
+    PakBusTran() : LinkFd(-1), TranNbr(0), Priority(false), SentAt(0) {}
+    int          LinkFd;     // Link end of the session sending the request
+    byte         TranNbr;    // Transaction number chosen by the session
+    bool         Priority;   // Set for the scheduled collection
+    unsigned int SentAt;     // Clock reading when the request was sent
+};
+
+/**
+ * Frame of a broker client held back while the scheduled collection waits
+ * for a response.
+ */
+struct HeldFrame {
+    int          LinkFd;     // Socket of the client
+    string       Frame;      // Quoted frame
+    unsigned int Since;      // Clock reading when the frame was received
+};
+
+class PakBusLink;
+
+/**
+ * Implementation of the DataSource interface for the session with one node
+ * behind a shared PakBusLink. The session reads and writes PakBus frames
+ * as it would on a port of its own.
+ */
+class NodeConn : public DataSource {
+    public :
+        NodeConn (PakBusLink* link, uint2 nodeId);
+        virtual int    connect() throw (CommException);
+        virtual bool   disconnect() throw (CommException);
+        virtual bool   isOpen();
+        virtual string getConnInfo();
+        virtual void   setConnInfo(const string& arg) {}
+        virtual string getAddress();
+        virtual string getLockId();
+        virtual int    getReadTimeout();
+        virtual int    getMinReadTimeout();
+
+    private :
+        PakBusLink* link__;
+        uint2       nodeId__;
+};
+
+/**
+ * Fiber sharing one port between the sessions with several PakBus nodes.
+ * Outgoing frames of the sessions are interleaved on the port whole, and
+ * each received frame is passed to the session of its source node, looked
+ * up in the routing table. Link state packets, which carry no node
+ * address, go to the sessions of the nodes behind their source neighbour.
+ * The transactions with different nodes therefore overlap on the port.
+ *
+ * As a broker (see listen()), the link also accepts clients on a unix
+ * socket, e.g. other processes checking the clock of a logger. Their 
+ * requests are multiplexed onto the port by transaction number, and held
+ * back while the scheduled collection of this process waits for a
+ * response, up to LINK_MAX_HOLD msecs.
+ *
+ * The fiber is started when the first session connects and finishes once
+ * all sessions have disconnected and the link no longer listens.
+ */
+class PakBusLink : public Fiber {
+    public :
+        explicit PakBusLink (auto_ptr<DataSource> device);
+        ~PakBusLink ();
+        DataSource*  addNode(const PBAddr& pbAddr) throw (AppException);
+        int          connectNode(uint2 nodeId) throw (CommException);
+        void         disconnectNode(uint2 nodeId);
+        bool         isNodeConnected(uint2 nodeId);
+        const PakBusRoute& getRoute(uint2 nodeId) { return routes__[nodeId]; }
+        DataSource*  getDevice() { return device__.get(); }
+        void         listen(const string& path) throw (CommException);
+        void         closeListener();
+        virtual void run() throw ();
+
+    protected :
+        void open_device() throw (CommException);
+        void accept_client();
+        void close_client(int fd);
+        void read_device() throw (CommException);
+        void read_session(PakBusRoute& route, bool priority) 
+                throw (CommException);
+        void send_frame(PakBusRoute& route, const string& frame, 
+                bool priority) throw (CommException);
+        void forward_frame(PakBusRoute& route, const string& frame, 
+                bool priority) throw (CommException);
+        void flush_held() throw (CommException);
+        bool priority_pending();
+        byte next_tran(uint2 nodeId);
+        void route_frame(const string& frame);
+        void deliver(int fd, const string& frame);
+        void write_device(const char *data, int len) throw (CommException);
+        void close_device();
+
+    private :
+        auto_ptr<DataSource>    device__;      // Shared port
+        map<uint2, PakBusRoute> routes__;      // Routing table by node id
+        map<int, PakBusRoute>   clients__;     // Broker clients by socket
+        map<uint4, PakBusTran>  trans__;       // Transactions by node id 
+                                               // and link transaction nbr
+        map<uint2, byte>        lastTran__;    // Last transaction nbr by node
+        deque<HeldFrame>        held__;        // Client frames held back
+        int                     devFd__;       // Descriptor of the port
+        int                     epollFd__;     // Port and session ends
+        int                     listenFd__;    // Broker socket, -1 if none
+        string                  listenPath__;  // Path of the broker socket
+        int                     nconnected__;  // Number of connected sessions
+        bool                    running__;     // Set while the fiber runs
+        bool                    connecting__;  // Set while the port opens
+        string                  inFrame__;     // Frame being received
+};
+
+#endif
@@ -15,12 +15,18 @@ using namespace log4cpp;
 // TODO - Persist connection settings 
 
 PB5CollectionProcess :: PB5CollectionProcess() : IObuf__(8192, 512), 
-        optDebug__(false), optCleanAppCache__(false)
+        optDebug__(false), optDaemon__(false), optCleanAppCache__(false)
 {
 }
 
 PB5CollectionProcess :: ~PB5CollectionProcess() throw ()
 {
+    for (size_t idx = 0; idx < loggers__.size(); idx++) {
+        delete loggers__[idx];
+    }
+    for (size_t idx = 0; idx < links__.size(); idx++) {
+        delete links__[idx];
+    }
     this->onExit();
     cout << "============================================================"
          << endl;
@@ -46,8 +52,9 @@ void PB5CollectionProcess :: init(int argc, char* argv[])
 void PB5CollectionProcess :: parseCommandLineArgs(int argc, char* argv[])
     throw (exception)
 {
-    char optstring[] = "c:p:w:drvh";
+    char optstring[] = "B:c:p:w:dDrvh";
     string      configFilePath, workingPath, connectionString;
+    vector<string> configFilePaths;
     int         cmd_opt;
     bool        optDisplayHelp = false;
     bool        optDisplayVersion = false;
@@ -64,8 +71,10 @@ void PB5CollectionProcess :: parseCommandLineArgs(int argc, char* argv[])
 
     while((cmd_opt = getopt(argc, argv, optstring)) != -1) {
         switch(cmd_opt) {
-            case 'c' : configFilePath = optarg;  break;
+            case 'B' : brokerPath__ = optarg;     break;
+            case 'c' : configFilePaths.push_back(optarg);  break;
             case 'd' : optDebug__ = true;       break;
+            case 'D' : optDaemon__ = true;      break;
             case 'p' : connectionString = optarg;        break;
             // case 'e' : optCleanAppCache__ = true;  break;
                        // TODO implement the clean app cache option
@@ -105,6 +114,27 @@ void PB5CollectionProcess :: parseCommandLineArgs(int argc, char* argv[])
         printVersion();
         cout << "============================================================" << endl;
 
+        // The broker keeps the port open for its clients between the
+        // collections, so it runs as a daemon
+
+        if (brokerPath__.size()) {
+            optDaemon__ = true;
+        }
+
+        if (configFilePaths.size() > 1) {
+            if (brokerPath__.size()) {
+                throw invalid_argument("The -B option applies to a single configuration file");
+            }
+            if (connectionString.size() || workingPath.size()) {
+                throw invalid_argument("The -p and -w options apply to a single configuration file");
+            }
+            loadLoggers(configFilePaths);
+            return;
+        }
+        if (configFilePaths.size()) {
+            configFilePath = configFilePaths[0];
+        }
+
         Category::getInstance("Init").debug("Using configuration file : " + 
                 configFilePath);
         appConfig__.loadConfig ((char *)configFilePath.c_str());
@@ -122,6 +152,63 @@ void PB5CollectionProcess :: parseCommandLineArgs(int argc, char* argv[])
     return;
 }
 
+/**
+ * Function to set up a collection process for each configuration file, so
+ * that one process collects from several loggers. Each logger gets its 
+ * own buffers, protocol objects and table data, and runs in a fiber of the
+ * event loop (see runLoggers()).
+ *
+ * Loggers configured on the same port are PakBus nodes sharing the port, 
+ * e.g. on an RS-485 or radio network. Their sessions go through a 
+ * PakBusLink routing the packets by node id, so that the transactions 
+ * with the different nodes overlap.
+ *
+ * @param configFilePaths: Paths of the configuration files.
+ */
+void PB5CollectionProcess :: loadLoggers(const vector<string>& configFilePaths)
+    throw (AppException)
+{
+    for (size_t idx = 0; idx < configFilePaths.size(); idx++) {
+        PB5CollectionProcess* logger = new PB5CollectionProcess();
+        loggers__.push_back(logger);
+
+        logger->optDebug__  = optDebug__;
+        logger->optDaemon__ = optDaemon__;
+        logger->executionComplete__ = false;
+
+        Category::getInstance("Init").debug("Using configuration file : " + 
+                configFilePaths[idx]);
+        logger->appConfig__.loadConfig ((char *)configFilePaths[idx].c_str());
+        logger->dataSource__ = logger->appConfig__.getDataSource("");
+
+        // A read waiting for the line to go idle would block the process,
+        // so the loggers always read up to a deadline.
+        logger->dataSource__->setReadMode(pakbuf::READ_DEADLINE);
+    }
+
+    map<string, int>         nloggers;
+    map<string, PakBusLink*> links;
+
+    for (size_t idx = 0; idx < loggers__.size(); idx++) {
+        nloggers[loggers__[idx]->dataSource__->getLockId()]++;
+    }
+
+    for (size_t idx = 0; idx < loggers__.size(); idx++) {
+        PB5CollectionProcess* logger = loggers__[idx];
+        string port = logger->dataSource__->getLockId();
+
+        if (nloggers[port] < 2) {
+            continue;
+        }
+        if (!links.count(port)) {
+            links[port] = new PakBusLink(logger->dataSource__);
+            links__.push_back(links[port]);
+        }
+        logger->dataSource__.reset(
+                links[port]->addNode(logger->appConfig__.getPakbusAddr()));
+    }
+}
+
 /**
  * This function is responsible for wiring together different class members
  * based on their dependencies.
@@ -132,6 +219,13 @@ void PB5CollectionProcess :: configure() throw (AppException)
         return;
     }
 
+    if (loggers__.size()) {
+        for (size_t idx = 0; idx < loggers__.size(); idx++) {
+            loggers__[idx]->configure();
+        }
+        return;
+    }
+
     appConfig__.dirSetup();
 
     string lockFilePath__ = dataSource__->getLockFileName(PB5_APP_NAME);
@@ -157,6 +251,16 @@ void PB5CollectionProcess :: configure() throw (AppException)
         }
     }
 
+    // As a broker, the process shares the port it has locked with the 
+    // clients connecting to the broker socket
+
+    if (brokerPath__.size()) {
+        PakBusLink* link = new PakBusLink(dataSource__);
+        links__.push_back(link);
+        dataSource__.reset(link->addNode(appConfig__.getPakbusAddr()));
+        link->listen(brokerPath__);
+    }
+
     // Wire various objects
     const DataOutputConfig& dataOpt = appConfig__.getDataOutputConfig();
     const PBAddr& pbAddr = appConfig__.getPakbusAddr();
@@ -166,14 +270,35 @@ void PB5CollectionProcess :: configure() throw (AppException)
         IObuf__.setHexLogDir(dataOpt.WorkingPath);
     }
 
+    // The read deadlines follow the round trip time measured on the link,
+    // starting from the estimate of the previous run
+
+    rttFile__ = dataOpt.WorkingPath + "/.working/rtt.info";
+    rtt__.setBounds(dataSource__->getMinReadTimeout(), RTT_MAX_TIMEOUT);
+    rtt__.setInitialTimeout(dataSource__->getReadTimeout());
+    rtt__.load(rttFile__);
+    IObuf__.setRttEstimator(&rtt__);
+
     tblDataMgr__.setDataOutputConfig(dataOpt);
 
+    // Table definitions, program signature, collection state and clock
+    // checks of the last session, see initSession()
+
+    snapshot__.load(dataOpt.WorkingPath + "/.working/session.snap");
+    tblDataMgr__.setSessionSnapshot(&snapshot__);
+
     pakCtrlImplObj__.setPakBusAddr(pbAddr);
     pakCtrlImplObj__.setIOBuf(&IObuf__);
+    pakCtrlImplObj__.setTransactionEngine(&tranEngine__);
+
+    tranEngine__.setIOBuf(&IObuf__);
+    tranEngine__.setPacketScreen(&pakCtrlImplObj__);
    
     bmp5ImplObj__.setPakBusAddr(pbAddr);
     bmp5ImplObj__.setIOBuf(&IObuf__);
+    bmp5ImplObj__.setTransactionEngine(&tranEngine__);
     bmp5ImplObj__.setTableDataManager(&tblDataMgr__); 
+    bmp5ImplObj__.setCollectWindow(pbAddr.CollectWindow);
 
     return;
 }
@@ -184,17 +309,27 @@ void PB5CollectionProcess :: configure() throw (AppException)
  */
 void PB5CollectionProcess :: initSession(int nTry) throw (AppException)
 {
-    int fd;
+    int   fd;
+    uint4 start_t = get_msec_clock();
 
     try {
         cout << endl;
         Category::getInstance("InitSession")
                  .info("Trying to establish PakBus session => " + 
                        dataSource__->getConnInfo());
-        fd = dataSource__->connect();
-        IObuf__.setFd(fd);
-        pakCtrlImplObj__.InitComm();
-        pakCtrlImplObj__.HelloTransaction();
+        SerialConn* serialConn = dynamic_cast<SerialConn*>(dataSource__.get());
+
+        if (serialConn && serialConn->isAutoBaud()) {
+            negotiateBaudRate(serialConn);
+        }
+        else {
+            fd = dataSource__->connect();
+            IObuf__.setFd(fd);
+            IObuf__.setReadMode(dataSource__->getReadMode());
+            IObuf__.setReadTimeout(dataSource__->getReadTimeout());
+            pakCtrlImplObj__.InitComm();
+            pakCtrlImplObj__.HelloTransaction();
+        }
         pakCtrlImplObj__.HandShake(SERPKT_RING);
 
         try {
@@ -210,6 +345,10 @@ void PB5CollectionProcess :: initSession(int nTry) throw (AppException)
         }
         pakCtrlImplObj__.HandShake(SERPKT_FINISHED);
 
+        msgstrm << "Session set up in " 
+                << msec_diff(get_msec_clock(), start_t) << " ms";
+        Category::getInstance("InitSession").info(msgstrm.str());
+        msgstrm.str("");
     } 
     catch (IOException& ioe) {
         throw;
@@ -227,6 +366,63 @@ void PB5CollectionProcess :: initSession(int nTry) throw (AppException)
     } */
 }
 
+/**
+ * Function to find the fastest baud rate the logger answers on, for a
+ * serial port configured with the "auto" baud rate. The rate found by the
+ * last negotiation on the port is tried first, then the candidate rates
+ * from the fastest down, each with a single Hello. The port is left open
+ * at the rate found, which is cached for the next run.
+ *
+ * @param serialConn: Serial port of the logger.
+ */
+void PB5CollectionProcess :: negotiateBaudRate(SerialConn* serialConn) 
+    throw (AppException)
+{
+    vector<int> rates = serialConn->getAutoBaudRates(PB5_APP_NAME);
+
+    // A Hello at the wrong rate times out, which mustn't back off the
+    // read deadline of the link
+    IObuf__.setRttEstimator(NULL);
+
+    for (size_t idx = 0; idx < rates.size(); idx++) {
+        serialConn->setBaudRate(rates[idx]);
+        msgstrm << "Trying " << rates[idx] << " baud on " 
+                << serialConn->getAddress();
+        Category::getInstance("AutoBaud").debug(msgstrm.str());
+        msgstrm.str("");
+
+        try {
+            int fd = serialConn->connect();
+            IObuf__.setFd(fd);
+            IObuf__.setReadMode(serialConn->getReadMode());
+            IObuf__.setReadTimeout(serialConn->getReadTimeout());
+            pakCtrlImplObj__.InitComm();
+            pakCtrlImplObj__.HelloTransaction(0x01);
+        }
+        catch (AppException& e) {
+            serialConn->disconnect();
+            continue;
+        }
+
+        IObuf__.setRttEstimator(&rtt__);
+        rtt__.setBounds(serialConn->getMinReadTimeout(), RTT_MAX_TIMEOUT);
+        serialConn->cacheBaudRate(PB5_APP_NAME);
+
+        msgstrm << "Negotiated " << rates[idx] << " baud on " 
+                << serialConn->getAddress();
+        Category::getInstance("AutoBaud").notice(msgstrm.str());
+        msgstrm.str("");
+        return;
+    }
+
+    IObuf__.setRttEstimator(&rtt__);
+    msgstrm << "Logger didn't answer at any baud rate on " 
+            << serialConn->getAddress();
+    string errMsg = msgstrm.str();
+    msgstrm.str("");
+    throw PakBusException(__FILE__, __LINE__, errMsg.c_str());
+}
+
 void PB5CollectionProcess :: closeSession() throw ()
 {
     pakCtrlImplObj__.Bye();
@@ -239,6 +435,22 @@ void PB5CollectionProcess :: run() throw (exception)
     }
     loggerTimeCheckComplete__ = false;
 
+    if (loggers__.size()) {
+        runLoggers();
+        return;
+    }
+
+    if (brokerPath__.size() && !EventLoop::getInstance().inFiber()) {
+        runBroker();
+        return;
+    }
+
+    if (optDaemon__) {
+        runDaemon();
+        this->onExit();
+        return;
+    }
+
     int ntry = 0;
 
     do {
@@ -248,7 +460,8 @@ void PB5CollectionProcess :: run() throw (exception)
             Category::getInstance("InitSession")
                      .notice("Established PakBus session with datalogger at "
                           + dataSource__->getConnInfo());
-            collect();
+            collect(appConfig__.getDataOutputConfig().Tables);
+            Category::getInstance("Link").info("Link " + rtt__.toString());
             closeSession();
             break;
         } 
@@ -274,40 +487,235 @@ void PB5CollectionProcess :: run() throw (exception)
 }
 
 
-void PB5CollectionProcess :: collect() throw (AppException)
+/**
+ * Function to run as a daemon, keeping the PakBus session open between 
+ * collection cycles. Each table is collected once per sample interval, 
+ * shortly after the logger stores a record, so a cycle usually costs a 
+ * single collect exchange. The connection, table definitions and storage
+ * history stay in memory; the session is only established again when 
+ * communication with the logger fails.
+ */
+void PB5CollectionProcess :: runDaemon() throw (exception)
+{
+    const vector<TableOpt>& tables = appConfig__.getDataOutputConfig().Tables;
+    vector<time_t> nextDue(tables.size(), 0);
+    bool sessionOpen = false;
+
+    Category::getInstance("Daemon")
+             .notice("Running as a daemon, collecting on table sample intervals");
+
+    while (true) {
+        if (!sessionOpen) {
+            try {
+                loggerTimeCheckComplete__ = false;
+                dataSource__->disconnect();
+                initSession(0);
+                sessionOpen = true;
+                Category::getInstance("InitSession")
+                         .notice("Established PakBus session with datalogger at "
+                              + dataSource__->getConnInfo());
+            }
+            catch (StorageException& se) {
+                break;
+            }
+            catch (AppException& e) {
+                msgstrm << "Failed to establish PakBus session, retrying in " 
+                        << DAEMON_RETRY_SECS << " secs";
+                Category::getInstance("Daemon").warn(msgstrm.str());
+                msgstrm.str("");
+                EventLoop::getInstance().sleep(DAEMON_RETRY_SECS);
+                continue;
+            }
+        }
+        else if (snapshot__.isClockCheckDue(time(NULL), MAX_TIME_OFFSET)) {
+            // The session stays open for days: the clock is checked again
+            // on each cycle the checks so far call for it
+            loggerTimeCheckComplete__ = false;
+        }
+
+        // Collect the tables that are due, then sleep until the next one is
+
+        time_t now = time(NULL);
+        vector<TableOpt> dueTables;
+
+        for (size_t idx = 0; idx < tables.size(); idx++) {
+            if (nextDue[idx] <= now) {
+                int interval = (tables[idx].SampleInt > 0) ? 
+                        tables[idx].SampleInt : DAEMON_POLL_SECS;
+                dueTables.push_back(tables[idx]);
+                nextDue[idx] = (now/interval + 1)*interval + DAEMON_LAG_SECS;
+            }
+        }
+
+        if (dueTables.size()) {
+            try {
+                // Wake up the logger in case it powered down its port
+                pakCtrlImplObj__.InitComm();
+                checkLoggerTime();
+                int commFailures = collect(dueTables);
+                tblDataMgr__.saveTableStorageHistory();
+                rtt__.save(rttFile__);
+                Category::getInstance("Link").info("Link " + rtt__.toString());
+
+                if (commFailures < 0) {
+                    break;
+                }
+                else if (commFailures) {
+                    Category::getInstance("Daemon")
+                             .warn("Lost communication with datalogger");
+                    sessionOpen = false;
+                    continue;
+                }
+            }
+            catch (StorageException& se) {
+                break;
+            }
+            catch (AppException& e) {
+                Category::getInstance("Daemon").warn(e.what());
+                sessionOpen = false;
+                continue;
+            }
+        }
+
+        time_t wakeUp = nextDue[0];
+        for (size_t idx = 1; idx < nextDue.size(); idx++) {
+            wakeUp = min(wakeUp, nextDue[idx]);
+        }
+        now = time(NULL);
+        if (wakeUp > now) {
+            EventLoop::getInstance().sleep(wakeUp - now);
+        }
+    }
+
+    if (sessionOpen) {
+        closeSession();
+    }
+}
+
+/**
+ * Function to run the collection processes of several loggers, each in a
+ * fiber of the event loop. A logger waiting for a response or sleeping 
+ * until its next collection gives way to the others, so the loggers are
+ * collected concurrently from a single thread.
+ */
+void PB5CollectionProcess :: runLoggers() throw (exception)
+{
+    vector<CollectionFiber*> fibers;
+
+    for (size_t idx = 0; idx < loggers__.size(); idx++) {
+        fibers.push_back(new CollectionFiber(
+                loggers__[idx]->dataSource__->getConnInfo(), loggers__[idx]));
+        EventLoop::getInstance().spawn(fibers.back());
+    }
+
+    msgstrm << "Collecting from " << loggers__.size() << " loggers";
+    Category::getInstance("run").notice(msgstrm.str());
+    msgstrm.str("");
+
+    try {
+        EventLoop::getInstance().run();
+    }
+    catch (exception& e) {
+        for (size_t idx = 0; idx < fibers.size(); idx++) {
+            delete fibers[idx];
+        }
+        throw;
+    }
+
+    for (size_t idx = 0; idx < fibers.size(); idx++) {
+        delete fibers[idx];
+    }
+}
+
+/**
+ * Function to run the scheduled collection in a fiber of the event loop,
+ * next to the link serving the clients of the broker.
+ */
+void PB5CollectionProcess :: runBroker() throw (exception)
+{
+    CollectionFiber fiber(dataSource__->getConnInfo(), this);
+
+    EventLoop::getInstance().spawn(&fiber);
+    EventLoop::getInstance().run();
+}
+
+/**
+ * Function to run the collection process of a logger until it completes.
+ */
+void CollectionFiber :: run() throw ()
+{
+    try {
+        process__->run();
+    }
+    catch (exception& e) {
+        Category::getInstance("run").error(e.what());
+    }
+}
+
+/**
+ * Function to collect data from a list of tables.
+ *
+ * @param tables: Options of the tables to collect.
+ * @return Number of tables whose collection failed on a communication error,
+ *         -1 if the collection was aborted on a storage error.
+ */
+int PB5CollectionProcess :: collect(const vector<TableOpt>& tables) 
+        throw (AppException)
 {
     bool recollect_tdf = false;
-    int numTables = appConfig__.getDataOutputConfig().Tables.size();
+    int numTables = tables.size();
+    int commFailures = 0;
 
     if (0 == numTables) {
         Category::getInstance("Collect")
                  .info("No tables listed for data collection.");
-        return;
+        return 0;
     }
 
-    const DataOutputConfig& dataOpt = appConfig__.getDataOutputConfig();
+    // Bring the tables that are close to up to date with a single request,
+    // the others are collected one at a time.
+
+    vector<bool> upToDate;
+
+    try {
+        bmp5ImplObj__.CollectLatest(tables, upToDate);
+    }
+    catch (StorageException& ioe) {
+        Category::getInstance("Collect")
+                 .error("Aborting data collection process.");
+        return -1;
+    }
+    catch (AppException& e) {
+        msgstrm << "Collecting tables one at a time --> " << e.what();
+        Category::getInstance("Collect").notice(msgstrm.str());
+        msgstrm.str("");
+    }
 
     for (int count = 0; count < numTables; count++) {
 
+        if (upToDate.size() && upToDate[count]) {
+            continue;
+        }
+
         cout << endl;
-        msgstrm << "Downloading data from " << dataOpt.Tables[count].TableName;
+        msgstrm << "Downloading data from " << tables[count].TableName;
         Category::getInstance("Collect")
                  .notice(msgstrm.str());
         msgstrm.str("");
 
         try {
-            bmp5ImplObj__.CollectData(dataOpt.Tables[count]);
+            bmp5ImplObj__.CollectData(tables[count]);
         }
         catch (invalid_argument& iae) {
             msgstrm << "No data was downloaded for [" 
-                    << dataOpt.Tables[count].TableName;
+                    << tables[count].TableName;
             Category::getInstance("Collect").error(msgstrm.str()); 
             msgstrm.str("");
         }
         catch (StorageException& ioe) {
             Category::getInstance("Collect")
                      .error("Aborting data collection process.");
-            break;
+            return -1;
         }
         catch (InvalidTDFException& ite) {
 
@@ -331,16 +739,22 @@ void PB5CollectionProcess :: collect() throw (AppException)
         }
         catch (AppException& e1) {
 
-            msgstrm << dataOpt.Tables[count].TableName << " --> " << e1.what();
+            if (dynamic_cast<CommException*>(&e1)) {
+                commFailures++;
+            }
+
+            msgstrm << tables[count].TableName << " --> " << e1.what();
             Category::getInstance("Collect").error(msgstrm.str());
             msgstrm.str("");
 
             msgstrm << "Data collection failed for : ["
-                    << dataOpt.Tables[count].TableName << "]";
+                    << tables[count].TableName << "]";
             Category::getInstance("Collect").error(msgstrm.str()); 
             msgstrm.str("");
         }
     }
+
+    return commFailures;
 }
 
 void PB5CollectionProcess :: onExit() throw ()
@@ -348,6 +762,12 @@ void PB5CollectionProcess :: onExit() throw ()
     if (dataSource__.get() && dataSource__->isOpen()) {
         dataSource__->disconnect();
     }
+    for (size_t idx = 0; idx < links__.size(); idx++) {
+        links__[idx]->closeListener();
+    }
+    if (rttFile__.size()) {
+        rtt__.save(rttFile__);
+    }
     unlink (lockFilePath__.c_str());
 }
 
@@ -358,8 +778,16 @@ void PB5CollectionProcess :: printHelp() throw ()
     cout << "  Data Collection Software for PakBus Loggers                " << endl;
     cout << "  Usage : " << PB5_APP_NAME;
     cout << "  Options :                                                  " << endl;
-    cout << "     -c Complete path of the collection configuration file   " << endl;
+    cout << "     -B Share the port with other processes through a unix " << endl;
+    cout << "        socket at the given path, implies -D                 " << endl;
+    cout << "     -c Complete path of the collection configuration file.  " << endl;
+    cout << "        Repeat to collect from several loggers at once       " << endl;
     cout << "     -d Turn on debugging to print packet level errors       " << endl;
+    cout << "     -D Run as a daemon, keeping the session open and        " << endl;
+    cout << "        collecting each table on its sample interval         " << endl;
+    cout << "     -p Connection to use instead of the config file, either " << endl;
+    cout << "        a serial port (/dev/ttyS0[,baud|auto]) or host:port  " << endl;
+    cout << "        or the socket of a broker (unix:/path/to/socket)     " << endl;
     // cout << "     -e Erase application cache                              " << endl;
     cout << "     -w Override the working path mentioned in config file   " << endl;
     cout << "     -r Redirect log msgs to a file instead of stdout. The   " << endl;
@@ -384,8 +812,27 @@ void PB5CollectionProcess :: checkLoggerTime() throw (AppException)
         return;
     }
     stringstream msgstrm;
+    time_t now = time (NULL);
+
+    // The clock isn't checked again while the checks in the snapshot show
+    // it keeping time
+
+    if (!snapshot__.isClockCheckDue(now, MAX_TIME_OFFSET)) {
+        Category::getInstance("TimeCheck")
+                 .info("Skipping the clock check, " + 
+                       snapshot__.describeClock(now));
+        loggerTimeCheckComplete__ = true;
+        return;
+    }
+
+    // The programming statistics needed by the data definitions are 
+    // requested along with the logger time
 
-    time_t logger_t = (time_t)bmp5ImplObj__.ClockTransaction (0, 0);
+    bmp5ImplObj__.beginClockTransaction (0, 0);
+    bmp5ImplObj__.beginGetProgStats (0);
+    tranEngine__.run ();
+
+    time_t logger_t = (time_t)bmp5ImplObj__.getClockResult ();
     if (!logger_t) {
         throw AppException(__FILE__, __LINE__, "Invalid logger time !");
     }
@@ -400,6 +847,9 @@ void PB5CollectionProcess :: checkLoggerTime() throw (AppException)
             " " << ctime(&logger_t) << endl;
 	cout << "Offset:    " << time_offset << " seconds" << endl;
 
+    snapshot__.addClockCheck (host_t, time_offset, 
+            abs(time_offset) > MAX_TIME_OFFSET);
+
     if (abs(time_offset) > MAX_TIME_OFFSET) {
 
         Category::getInstance("TimeCheck")
@@ -17,6 +17,8 @@
 
 #include "pb5_buf.h"
 #include "pb5_data.h"
+#include "pb5_trans.h"
+#include "pb5_codec.h"
 
 const uint2 Seed = 0xaaaa;
 const byte  SerSyncByte__ = 0xbd;
@@ -28,9 +30,7 @@ const byte  STORE_DATA     = 0x20;
 
 uint2 CalcSigNullifier (uint2 sig);
 uint2 CalcSig (const void* buf, uint4 len, uint2 seed);
-
-void  PBSerialize (byte* ptr, uint4 val, uint2 len);
-uint4 PBDeserialize (const byte* ptr, uint2 len);
+uint2 CalcSigFast (const void* buf, uint4 len, uint2 seed);
 
 unsigned char str2hex (char* ptr);
 
@@ -40,29 +40,19 @@ unsigned char str2hex (char* ptr);
  */
  bool get_debug ();
 
-/**
- * Structure used to store the summary information about a PakBus packet.
- * This is used to determine the required action based on its members and
- * perform preliminary error handling.
- */
-struct PktSummary {
-    PktSummary() : Protocol(0), MsgType(0), TranNbr(0), 
-            SrcPhyAddrFrmPkt((uint2)0), SrcNodeAddrFrmPkt((uint2)0) {}
-    byte Protocol;
-    byte MsgType;
-    byte TranNbr;
-    uint2 SrcPhyAddrFrmPkt;
-    uint2 SrcNodeAddrFrmPkt;
-} ;
-
 /**
  * Structure to store to physical address of a PakBus device and its node ID.
+ * It also carries the PakBus protocol settings read from the configuration.
  */
 typedef struct PBAddr {
-    PBAddr() : PakBusID(1), NodePakBusID(1), SecurityCode(0) {}
-    int   PakBusID;
+    PBAddr() : PakBusID(1), NodePakBusID(1), SecurityCode(0), 
+            CollectWindow(1), HopCount(0) {}
+    int   PakBusID;      // Physical address of the neighbour relaying to
+                         // the node (the node itself if connected directly)
     int   NodePakBusID;
     uint2 SecurityCode;
+    int   CollectWindow; // Number of collect requests allowed in flight
+    int   HopCount;      // Number of hops to the node, 0 if connected directly
 }; 
 
 /**
@@ -81,6 +71,7 @@ class PakBusMsg {
 
         void  setPakBusAddr(const PBAddr& pbAddr);
         void  setIOBuf(pakbuf* IOBuf);
+        void  setTransactionEngine(TransactionEngine* engine);
         // Functions for establishing communication
         void  HandShake (int Mode) throw (CommException, PakBusException);
         void  InitComm () throw (CommException);
@@ -93,6 +84,7 @@ class PakBusMsg {
         // Functions for parsing packets received from the data logger
         int   ParsePakBusPacket (Packet& Pack, byte msg_type, 
                     byte tran_id) throw (AppException); 
+        int   ScreenPacket (Packet& Pack) throw (CommException);
 
         // Functions for displaying error messages from PakCtrl/BMP5 layer
         void  PacketErr (const char *transac_name, Packet& pack, int stat);
@@ -108,6 +100,12 @@ class PakBusMsg {
         int   parse_pakbus_header (Packet& pack, PktSummary& digest);
         void  reply_to_hello (PktSummary& digest, Packet& pack);
 
+        // Functions for running requests through the TransactionEngine
+        byte  begin_transaction (TranHandler& tran, byte resp_type, 
+                    int msecs = 0) throw (CommException);
+        bool  transact (ResponseTran& tran, byte resp_type, int msecs = 0)
+                    throw (CommException);
+
         /*
          * Members for creating message body
          */
@@ -127,7 +125,8 @@ class PakBusMsg {
         byte  HiProtoCode__; /**< Designates the high-level protocol followed
                                 in the packet - 0x00: PakCtrl 0x01: BMP5 */
         uint2 DstNodeId__;   /**< Node Id of the message destination */
-        byte  HopCnt__;      /**< Always zero when connected directly */
+        byte  HopCnt__;      /**< Number of hops to the destination node, 
+                                zero when connected directly */
         uint2 SrcNodeId__;   /**< Node id of source */
         byte  MsgType__;     /**< Message type to interpret the information 
                                 contained in the packet */
@@ -138,6 +137,8 @@ class PakBusMsg {
         pakbuf* pbuf__;
         /** Packet queue to store packets read from the device */
         deque<Packet>* packetQueue__;
+        /** Engine tracking the outstanding transactions of the session */
+        TransactionEngine* tranEngine__;
 
     private :
         /** Output stream attached to the I/O buffer */
@@ -152,7 +153,8 @@ class PakCtrlObj : public PakBusMsg{
         PakCtrlObj ();
         ~PakCtrlObj() {};
  
-        int   HelloTransaction () throw (PakBusException);
+        int   HelloTransaction (byte max_hop_metric = 0x05) 
+                  throw (CommException, PakBusException);
         byte  Bye ();
 
         // The following functions are not required by any application
@@ -177,6 +179,79 @@ struct RecordStat {
      RecordStat() : count(-1) {}
 };
 
+/**
+ * Handler of a request in flight when collect requests are pipelined. The
+ * response is copied to the slot, as it may arrive ahead of the responses
+ * to earlier requests and is stored only once they have been stored.
+ */
+class CollectSlot : public TranHandler {
+    public :
+        CollectSlot() : P1((uint4)0), P2((uint4)0), Requested((uint4)0), 
+                Attempts(0), Answered(false), TimedOut(false) {}
+        void  onResponse(Packet& pack);
+        void  onTimeout() { TimedOut = true; }
+
+        uint4  P1;
+        uint4  P2;
+        uint4  Requested;  // Records asked for by the last request sent
+        int    Attempts;
+        bool   Answered;
+        bool   TimedOut;   // No response before the deadline
+        Packet Response;   // Points into Frame once answered
+        vector<byte> Frame;
+};
+
+/**
+ * Structure to describe one table in a collect request. Several of them
+ * can be sent in a single message.
+ */
+struct CollectRequest {
+    CollectRequest(Table* tbl, uint4 p1, uint4 p2) : Tbl(tbl), P1(p1), 
+            P2(p2) {}
+    Table* Tbl;
+    uint4  P1;
+    uint4  P2;
+};
+
+// Bytes of a collect response packet not available for records: framing, 
+// header, response code, table number, record number, record count, time
+// of the first record and signature nullifier (rounded up)
+#define COLLECT_RESP_OVERHEAD 32
+#define MAX_COLLECT_PAYLOAD   (MAX_PACK_SIZE - COLLECT_RESP_OVERHEAD)
+// Bytes taken by each additional table in a multi-table collect response:
+// table number, record number, record count and time of the first record
+#define COLLECT_TABLE_OVERHEAD 16
+
+// Maximum number of collect requests allowed in flight
+#define MAX_COLLECT_WINDOW   16
+// Number of times a pipelined collect request is sent before giving up
+#define MAX_COLLECT_ATTEMPTS 3
+
+class BMP5Obj;
+
+/**
+ * Handler of a BMP5 transaction answered by a single response packet, which
+ * is parsed by a member function of BMP5Obj.
+ */
+class BMP5Tran : public TranHandler {
+    public :
+        typedef void (BMP5Obj::*ParseFn)(Packet& pack);
+
+        BMP5Tran(BMP5Obj* obj, const char* name, ParseFn parse) :
+                Answered(false), obj__(obj), name__(name), parse__(parse) {}
+        void  onResponse(Packet& pack);
+        void  onTimeout();
+        /** Returns the name of the transaction for the logs. */
+        const char* getName() { return name__; }
+
+        bool  Answered;  // Set once the response was parsed
+
+    private :
+        BMP5Obj*    obj__;
+        const char* name__;
+        ParseFn     parse__;
+};
+
 /**
  * This class implements the BMP5 protocol for sending application messages.
  */
@@ -189,23 +264,64 @@ class BMP5Obj : public PakBusMsg {
         // BMP5Obj (PBAddr* pb_addr, pakbuf* IOBuf, string appl_dir);
 	~BMP5Obj ();
         void  setTableDataManager(TableDataManager* tblDataMgr);
+        void  setCollectWindow(int window);
         void  getDataDefinitions() throw (IOException, ParseException);
-        int   ClockTransaction (uint4 offset_s, uint4 offset_ns);
+        int   ClockTransaction (uint4 offset_s, uint4 offset_ns)
+                throw (CommException);
+        void  beginClockTransaction (uint4 offset_s, uint4 offset_ns)
+                throw (CommException);
+        int   getClockResult ();
+        void  beginGetProgStats (uint2 security_code) throw (CommException);
         int   UploadFile (const char* get_file, char* write_to_file)
                 throw (IOException);
         int   DownloadFile (const char *filename);
         int   CollectData (const TableOpt& table_opt) 
                       throw (AppException, invalid_argument);
-	int   ControlTable (byte ctrl_opt);
-        int   ControlFile (const string& file_name, byte file_cmd);
+        int   CollectLatest (const vector<TableOpt>& table_opts, 
+                      vector<bool>& done) throw (AppException);
+	int   ControlTable (byte ctrl_opt) throw (CommException);
+        int   ControlFile (const string& file_name, byte file_cmd)
+                throw (CommException);
         int   ReloadTDF ();
  
     protected :
-        void  GetProgStats (uint2 security_code) throw (ParseException);
+        void  GetProgStats (uint2 security_code) 
+                throw (CommException, ParseException);
+        void  send_request (BMP5Tran& tran, byte resp_type) 
+                throw (CommException);
+        void  run_transactions (const char* tran_name, int max_pending = 0)
+                throw (CommException);
+        void  parse_clock (Packet& pack);
+        void  parse_prog_stats (Packet& pack);
+        void  parse_control_table (Packet& pack);
+        void  parse_control_file (Packet& pack);
         void  GetTDF () throw (IOException, ParseException);
-        int   sendCollectionCmd (byte MessageType, Table& tbl, uint4 P1, uint4 P2);
+        int   sendCollectionCmd (byte MessageType, Table& tbl, uint4 P1, 
+                uint4 P2, TranHandler& tran) throw (CommException);
+        int   sendCollectionCmd (byte MessageType, 
+                const vector<CollectRequest>& requests, TranHandler& tran)
+                throw (CommException);
+        bool  collect_transaction (byte MessageType, Table& tbl, uint4 P1, 
+                uint4 P2, ResponseTran& tran) throw (CommException);
+        bool  collect_transaction (byte MessageType, 
+                const vector<CollectRequest>& requests, ResponseTran& tran)
+                throw (CommException);
         RecordStat get_records (Table& tbl_ref, byte mode, int record_size, 
                 uint4 P1, uint4 P2, int file_span);
+        int   collect_pipelined (Table& tbl_ref, uint4 last_rec_nbr, 
+                int file_span) throw (AppException);
+        int   collect_to_newest (Table& tbl_ref, int record_size, 
+                int file_span, bool& caught_up) throw (AppException);
+        void  skip_lost_records (Table& tbl_ref, uint4 next_record);
+        void  close_completed_file (const TableOpt& table_opt, Table& tbl_ref);
+        void  init_request_size (Table& tbl_ref, int record_size);
+        void  adapt_request_size (Table& tbl_ref, uint4 requested, int nrecs);
+        void  send_slot_request (Table& tbl_ref, CollectSlot& slot) 
+                throw (CommException);
+        int   store_slot_response (Table& tbl_ref, CollectSlot& slot, 
+                byte* pkt, int file_span) throw (AppException);
+        void  drain_window (deque<CollectSlot>& window) 
+                throw (CommException);
         int   test_data_packet (Table& tbl_ref, Packet& pack) throw (AppException);
         int   store_data (byte* buf, Table& tbl, int beg, int nrecs, int file_span)
                 throw (StorageException);
@@ -215,7 +331,20 @@ class BMP5Obj : public PakBusMsg {
     private :
         byte*     dataBuf__;
         int       dataBufSize__;
+        int       collectWindow__;
+        bool      collectToNewest__;
         TableDataManager* tblDataMgr__;
+
+        // Transactions run through the TransactionEngine
+        BMP5Tran  clockTran__;
+        BMP5Tran  progStatsTran__;
+        BMP5Tran  ctrlTableTran__;
+        BMP5Tran  ctrlFileTran__;
+        bool      clockQuery__;   // Set if the clock is read, not adjusted
+        int       clockResult__;  // See ClockTransaction()
+        byte      progStatsCode__;
+        byte      ctrlRespCode__; // Response code of the control transactions
+        int       holdOff__;      // Hold off time returned by File Control
 };
 
 #define SUCCESS             0
@@ -240,6 +369,9 @@ class BMP5Obj : public PakBusMsg {
 #define INCOMPLETE_PKT      14
 #define DELIVERY_FAILURE    15
 
+// Notification that the response to a request will be late, not an error
+#define PLEASE_WAIT         16
+
 
 // Maximum allowable time offset between host and data logger
 #define MAX_TIME_OFFSET     1
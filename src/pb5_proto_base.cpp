@@ -64,6 +64,40 @@ uint2 CalcSig(const void *buf, uint4 len, uint2 seed)
   return ret;
 }
 
+/**
+ * Function to compute the signature of a byte sequence using the CSI 
+ * algorithm. This produces the same result as CalcSig(), which is kept as
+ * the reference implementation. The two signature bytes are kept apart 
+ * and the rotation of the low byte is computed without branches, four 
+ * bytes per iteration.
+ */
+uint2 CalcSigFast(const void *buf, uint4 len, uint2 seed)
+{
+    const byte *ptr = (const byte *)buf;
+    uint4 hi = seed >> 8;
+    uint4 lo = seed & 0xff;
+    uint4 tmp;
+    uint4 n;
+
+#define SIG_STEP(b) \
+    tmp = (((lo << 1) | (lo >> 7)) + hi + (b)) & 0xff; \
+    hi  = lo; \
+    lo  = tmp;
+
+    for (n = len >> 2; n > 0; n--, ptr += 4) {
+        SIG_STEP(ptr[0]);
+        SIG_STEP(ptr[1]);
+        SIG_STEP(ptr[2]);
+        SIG_STEP(ptr[3]);
+    }
+    for (n = len & 3; n > 0; n--, ptr++) {
+        SIG_STEP(ptr[0]);
+    }
+#undef SIG_STEP
+
+    return (uint2)((hi << 8) | lo);
+}
+
 /**
  * This function computes the nullifier of a 2-byte signature computed
  * by the CSI algorithm.
@@ -84,48 +118,6 @@ uint2 CalcSigNullifier(uint2 sig)
     return signull;
 }
 
-/**
- * This function serializes an unsigned integer into a byte sequence.
- * Note that the Most Significant Byte is written to the beginning
- * of the sequence.
- * @param ptr: Pointer to the target bytestream
- * @param val: The number to serialize
- * @param len: Number of bytes to serialize. This is useful for data 
- *             types smaller than integer.
- */
-void PBSerialize (byte *ptr, uint4 val, uint2 len)
-{
-    uint2 shift;
-    int   i;
-    len--;
-    for (i = 0; i <= len; i++) {
-        shift = 8*(len-i);
-        ptr[i] = (byte)(val >> shift);
-    }
-    return;
-}
-
-/**
- * This function extracts an integer from a byte array. It assumes 
- * that the MSB is stored in the first byte of the array. The 
- * funtions an returns unsigned integer - therefore, if the caller
- * is expecting anything else, it'll have to cast the return value.
- * 
- * @param ptr: Pointer to the MSB of the number to be deserialized.
- * @param len: Size of the number to be extracted in bytes.
- */
-uint4 PBDeserialize (const byte *ptr, uint2 len) 
-{
-    uint4 val = 0;
-    int   i;
-    for (i = 0; i < len; i++) {
-        val <<= 8;
-        val |= ptr[i];
-    }
-    return val;
-}
-
-
 /////////////////////////////////////////////////////////////////////
 //           Implementation of PakBusMsg class                     //
 /////////////////////////////////////////////////////////////////////
@@ -134,7 +126,8 @@ uint4 PBDeserialize (const byte *ptr, uint2 len)
  * @param pb_addr : Pointer to the structure containing source address 
  * @param IOBuf : Pointer to the I/O buffer object 
  */
-PakBusMsg :: PakBusMsg () : pbuf__(NULL), packetQueue__(NULL), odevs__(NULL)
+PakBusMsg :: PakBusMsg () : pbuf__(NULL), packetQueue__(NULL), 
+        tranEngine__(NULL), odevs__(NULL)
 {
     LinkState__   = 0x0a;
     ExpMoreCode__ = 0x01;
@@ -149,6 +142,7 @@ void PakBusMsg :: setPakBusAddr(const PBAddr&  pakbusAddr)
 {
     DstPhyAddr__  = pakbusAddr.PakBusID;
     DstNodeId__   = pakbusAddr.NodePakBusID;
+    HopCnt__      = (byte)(pakbusAddr.HopCount & 0x0f);
     SecurityCode__ = pakbusAddr.SecurityCode;
 }
 
@@ -163,17 +157,24 @@ void PakBusMsg :: setIOBuf(pakbuf* IOBuf)
     return;
 }
 
+/**
+ * Function to set the engine the transactions are run through. The engine
+ * also hands out the transaction numbers, so the objects sharing it don't
+ * reuse each other's numbers.
+ */
+void PakBusMsg :: setTransactionEngine(TransactionEngine* engine)
+{
+    tranEngine__ = engine;
+}
+
 /**
  * Function for sending a PakBus packet to the data logger. This 
- * function sort of builds the pakbus header section, calculates the
- * signature of the combined header and message body and sends the 
- * message to the device using the "odevs__" output stream.
+ * function sort of builds the pakbus header section and has the I/O
+ * buffer encode the header and message body into a signed and quoted
+ * packet in a single pass, before sending it to the device.
  */
 void PakBusMsg :: SendPBPacket() throw (CommException)
 {
-    unsigned short sig, signull;
-    byte           nullifier[4];
-
     if (MsgBodyLen__ < 6 && MsgBodyLen__ > 1000) {
         stringstream msgstrm;
         msgstrm << "Length of message body isn't within the 0-128 range" << endl
@@ -184,23 +185,11 @@ void PakBusMsg :: SendPBPacket() throw (CommException)
         return;
     }
 
-    // First, the framing character goes
-    odevs__ << SerSyncByte__;
-
-    // Serialize the PakBus header to the o/p buffer
+    // Serialize the PakBus header and encode the packet with the message
+    // body, signature nullifier and framing characters
     SerializeHdr();
-    odevs__.write((const char *)MsgBody__, MsgBodyLen__);
-
-    // Calculate the signature and signature nullifier. Append the 
-    // signature nullifier and framing character to complete the packet
-    sig = CalcSig ((void*)(pbuf__->getobeg()+1), pbuf__->showManyBytesObuf()
-            - 1, Seed);
-    signull = CalcSigNullifier (sig);
-    nullifier[0] = (byte)(signull >> 8);
-    nullifier[1] = (byte)(signull);
-
-    odevs__.write ((const char *)nullifier, 2);
-    odevs__ << SerSyncByte__;
+    pbuf__->appendFrame(Hdr__, PakBusHeader::SIZE, MsgBody__, MsgBodyLen__);
+
     // Now send the packet down the wire
     pbuf__->writeToDevice();
     return;
@@ -208,22 +197,23 @@ void PakBusMsg :: SendPBPacket() throw (CommException)
 
 /**
  * Function for serializing the header section of a PakBus packet
- * into the output stream buffer.
+ * into the Hdr__ member.
  */
 void PakBusMsg :: SerializeHdr ()
 {
-    Hdr__[0]  = (LinkState__ << 4) | (DstPhyAddr__ >> 8);
-    Hdr__[1]  = (byte)(DstPhyAddr__ & 0xff);
-    Hdr__[2]  = (ExpMoreCode__ << 6) | (Priority__ << 4) | (SrcPhyAddr__ >> 8);
-    Hdr__[3]  = (byte)(SrcPhyAddr__ & 0xff);
-    Hdr__[4]  = (HiProtoCode__ << 4) | (DstNodeId__ >> 8);
-    Hdr__[5]  = (byte)(DstNodeId__ & 0xff);
-    Hdr__[6]  = (HopCnt__ << 4) | (SrcNodeId__ >> 8);
-    Hdr__[7]  = (byte)(SrcNodeId__ & 0xff);
-    Hdr__[8]  = (byte)MsgType__;
-    Hdr__[9] = (byte)TranNbr__;
-
-    odevs__.write((const char *)Hdr__, 10);
+    typedef PakBusHeader Hdr;
+
+    Hdr::DstPhyWord::set(Hdr__, Hdr::LinkState::pack(LinkState__) | 
+            Hdr::DstPhyAddr::pack(DstPhyAddr__));
+    Hdr::SrcPhyWord::set(Hdr__, Hdr::ExpMoreCode::pack(ExpMoreCode__) | 
+            Hdr::Priority::pack(Priority__) | 
+            Hdr::SrcPhyAddr::pack(SrcPhyAddr__));
+    Hdr::DstNodeWord::set(Hdr__, Hdr::HiProtoCode::pack(HiProtoCode__) | 
+            Hdr::DstNodeId::pack(DstNodeId__));
+    Hdr::SrcNodeWord::set(Hdr__, Hdr::HopCnt::pack(HopCnt__) | 
+            Hdr::SrcNodeId::pack(SrcNodeId__));
+    Hdr::MsgType::set(Hdr__, MsgType__);
+    Hdr::TranNbr::set(Hdr__, TranNbr__);
     return;
 }
 
@@ -237,13 +227,48 @@ void PakBusMsg :: SerializeHdr ()
  */
 byte PakBusMsg :: GenTranNbr()
 {
-    return ++TranNbr__;
+    TranNbr__ = tranEngine__ ? tranEngine__->nextTranNbr() : TranNbr__ + 1;
+    return TranNbr__;
+}
+
+/**
+ * Function to send the message in the message buffer under a new
+ * transaction number, and register it with the TransactionEngine.
+ *
+ * @param tran: Handler notified of the outcome of the transaction.
+ * @param resp_type: Message type of the response.
+ * @param msecs: Deadline for the response, the read deadline if zero.
+ * @return The transaction number of the request.
+ */
+byte PakBusMsg :: begin_transaction (TranHandler& tran, byte resp_type,
+        int msecs) throw (CommException)
+{
+    byte tran_id = GenTranNbr();
+
+    SendPBPacket();
+    tranEngine__->begin(resp_type, tran_id, &tran, msecs);
+    return tran_id;
+}
+
+/**
+ * Function to send the message in the message buffer and run the
+ * TransactionEngine until it is answered or its deadline expires.
+ *
+ * @return true if the request was answered, the response is then held
+ *         by the handler.
+ */
+bool PakBusMsg :: transact (ResponseTran& tran, byte resp_type, int msecs)
+        throw (CommException)
+{
+    tran.reset();
+    begin_transaction (tran, resp_type, msecs);
+    tranEngine__->run();
+    return tran.Answered;
 }
 
 void PakBusMsg :: SetSecurityCodeInMsgBody()
 {
-    MsgBody__[0] = (byte)(SecurityCode__ >> 8);
-    MsgBody__[1] = (byte)(SecurityCode__);    
+    BMP5RequestMsg::SecurityCode::set(MsgBody__, SecurityCode__);
 }
 
 /**
@@ -257,23 +282,47 @@ void PakBusMsg :: SetSecurityCodeInMsgBody()
  * for a reply from the logger in response to a command. The 
  * arguments correspond to values expected in the received packet.
  *
- * The header section is parsed by the parse_pakbus_header() 
- * function. It also returns a PktSummary structure to the calling
- * ParsePakBusPacket() function. This is useful in determining if
- * any packet other than the desired type was received and take
- * apprpriate action.
+ * The packet is first screened by ScreenPacket(). This is useful in 
+ * determining if any packet other than the desired type was received 
+ * and take apprpriate action.
  */
 int PakBusMsg :: ParsePakBusPacket (Packet& Pack, byte msg_type, byte tran_id) 
         throw (AppException)
 {
-    PktSummary  digest;
+    PktSummary& digest = Pack.Summary;
+    int         stat;
+
+    if ((stat = ScreenPacket (Pack))) {
+        return stat;
+    }
+    if ((digest.TranNbr != tran_id) || (digest.MsgType != msg_type)) {
+        return IGNORE_MSG;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Function to screen a packet received from the data logger before it is
+ * matched to a transaction. The packet size, signature and addresses are 
+ * checked, link state packets and Hello requests are answered, and 
+ * delivery failures are reported.
+ *
+ * The header section is checked by the parse_pakbus_header() 
+ * function against the PktSummary structure filled in by pakbuf 
+ * when the packet was framed.
+ *
+ * @param Pack: Packet at the front of the packet queue.
+ * @return SUCCESS for a packet that may answer a transaction, 
+ *         LINK_STATE_PKT, HELLO_MSG or DELIVERY_FAILURE for the packets 
+ *         of the sub-protocols, PLEASE_WAIT for a BMP5 "please wait" 
+ *         notification, or one of the error codes.
+ */
+int PakBusMsg :: ScreenPacket (Packet& Pack) throw (CommException)
+{
+    PktSummary& digest = Pack.Summary;
     byte        link_state;
     int         len;
     int         stat;
-    // static byte last_msg_type;
-    // tatic byte last_tran_id;
-    // static int  last_err;
-    // static int  successive_err = 0;
 
     if (!Pack.Complete) {
 	return INCOMPLETE_PKT;
@@ -282,29 +331,10 @@ int PakBusMsg :: ParsePakBusPacket (Packet& Pack, byte msg_type, byte tran_id)
     if ( (len < 8) || (len > MAX_PACK_SIZE) ) {
         return INVALID_PACKET_SIZE;
     }
-    uint2 sig = CalcSig(Pack.begPacket + 1, (uint4)(len-2), 0xaaaa);
-    if (sig) {
+    // The signature is verified by pakbuf while the packet is unquoted
+    if (!Pack.SigOk) {
         return CORRUPT_DATA;
-        /*
-        if ( (last_err == CORRUPT_DATA) && (last_msg_type == msg_type)
-            && (last_tran_id == tran_id) ) {
-            successive_err++;
-        }
-        if (successive_err == 2) {
-            throw AppException(__FILE__, __LINE__, "Too many signature errors");
-        }
-        
-        last_msg_type = msg_type;
-        last_tran_id  = tran_id;
-        last_err      = CORRUPT_DATA;
-        return CORRUPT_DATA;
-        */
-    }
-    /*
-    else {
-        successive_err = 0;
     }
-    */
 
     if ((stat = parse_pakbus_header (Pack, digest))) {
         return stat;
@@ -319,26 +349,25 @@ int PakBusMsg :: ParsePakBusPacket (Packet& Pack, byte msg_type, byte tran_id)
         return LINK_STATE_PKT;
     }
      
-    if ((digest.TranNbr != tran_id) || (digest.MsgType != msg_type)) {
-        if ( !digest.Protocol && (digest.MsgType == 0x09) ) {
-            reply_to_hello (digest, Pack);
-            return HELLO_MSG;
-        }
-        else if ( !digest.Protocol && (digest.MsgType == 0x81) ) {
-            return DELIVERY_FAILURE;
-        }
-        else {
-            return IGNORE_MSG;
-        }
+    if ( !digest.Protocol && (digest.MsgType == 0x09) ) {
+        reply_to_hello (digest, Pack);
+        return HELLO_MSG;
+    }
+    else if ( !digest.Protocol && (digest.MsgType == 0x81) ) {
+        return DELIVERY_FAILURE;
+    }
+    else if (pakbuf::getPleaseWait(Pack) >= 0) {
+        return PLEASE_WAIT;
     }
     return SUCCESS;
 }
 
 /**
- * Function to parse the PakBus header and obtain summary information.
- * This function performs some error handling by extracting the address
- * information contained in the header section and compare that of the
- * host and the PakBus device connected to it.
+ * Function to check the summary information of the PakBus header.
+ * This function performs some error handling by comparing the address
+ * information contained in the header section (extracted by pakbuf when
+ * the packet was framed) to that of the host and the PakBus device 
+ * connected to it.
  * 
  * @param pack: Reference to the packet structure being parsed.
  * @param Digest: Structure storing the summary of the packet header.
@@ -351,39 +380,28 @@ int PakBusMsg :: parse_pakbus_header (Packet& pack, PktSummary& Digest)
 {
 
     int len = pack.endPacket - pack.begPacket + 1;
-    byte *ppkt = (byte *)pack.begPacket + 1;
 
-    uint2 DstPhyAddrFrmPkt  = (((0x0f & *ppkt) << 8) | (0x00ff & *(ppkt+1)));
-    if (DstPhyAddrFrmPkt != SrcPhyAddr__) {
+    if (Digest.DstPhyAddrFrmPkt != SrcPhyAddr__) {
         return DST_DIFF;
     }
-    uint2 SrcPhyAddrFrmPkt  = (((0x0f & *(ppkt+2)) << 8) | (0x00ff & *(ppkt+3)));
-    if (SrcPhyAddrFrmPkt != DstPhyAddr__) {
+    if (Digest.SrcPhyAddrFrmPkt != DstPhyAddr__) {
         return SRC_UNKNOWN;
     }
-    Digest.SrcPhyAddrFrmPkt = SrcPhyAddrFrmPkt;
     
     if (len == 8) {
         return SUCCESS;
     }
 
-    uint2 DstNodeAddrFrmPkt = (((0x0f & *(ppkt+4)) << 8) | (0x00ff & *(ppkt+5)));
-    if (DstNodeAddrFrmPkt != SrcNodeId__) {
+    if (Digest.DstNodeAddrFrmPkt != SrcNodeId__) {
         return DST_DIFF;
     }
-    uint2 SrcNodeAddrFrmPkt = (((0x0f & *(ppkt+6)) << 8) | (0x00ff & *(ppkt+7)));
-    if (SrcNodeAddrFrmPkt != DstNodeId__) {
+    if (Digest.SrcNodeAddrFrmPkt != DstNodeId__) {
         return SRC_UNKNOWN;
     }
-    Digest.SrcNodeAddrFrmPkt = SrcNodeAddrFrmPkt;
-    Digest.Protocol = (byte)((0xf0 & *(ppkt+4)) >> 4);
 
     if ( (Digest.Protocol != 0) && (Digest.Protocol != 1) ) {
         return INVALID_PROTOCOL;
     }
-
-    Digest.MsgType  = *(ppkt + 8);
-    Digest.TranNbr  = *(ppkt + 9);
     return SUCCESS;
 }
 
@@ -431,11 +449,12 @@ void PakBusMsg :: reply_to_hello (PktSummary& digest, Packet& pack)
         tmp_MsgBody[count] = MsgBody__[count];
     }
 
-    MsgBody__[0]  = 0x00;                   // Source is not router
-    MsgBody__[1]  = *(pack.begPacket + 12); // HopMetric
-    MsgBody__[2]  = 0x00; //*(pack.begPacket + 13); // Link verification interval
-    MsgBody__[3]  = 0x60; //*(pack.begPacket + 14); // LSB of link verification
-                                          // interval
+    // Source is not router, HopMetric of the hello message and link 
+    // verification interval
+    HelloMsg::IsRouter::set(MsgBody__, 0x00);
+    HelloMsg::HopMetric::set(MsgBody__, 
+            HelloMsg::HopMetric::get(frameBody(pack.begPacket)));
+    HelloMsg::VerifyIntv::set(MsgBody__, 0x0060);
     try {
         SendPBPacket();
     }
@@ -484,7 +503,8 @@ void PakBusMsg :: PacketErr (const char *tran_name, Packet& pack, int stat)
     msgstrm << "Packet Processing error (" << tran_name << ") : "; 
 
     if (stat == DELIVERY_FAILURE) {
-        byte err_code = *(pack.begPacket + 11);
+        byte err_code = (byte)DeliveryFailureMsg::ErrCode::get(
+                frameBody(pack.begPacket));
 
         if (err_code == 0x01) {
             msgstrm << "Delivery failed (Destination unreachable)";
@@ -568,7 +588,6 @@ void PakBusMsg :: send_link_state_pkt (int SerPktMsgFormat, int PackSize)
     byte  Msg[10];
     byte  ExpCode = 0x80;
     byte  Prio    = 0x00;
-    uint2 sig;
     uint2 signull = 0;
     byte  LinkState;
     uint2 DstAddr = DstPhyAddr__;
@@ -599,33 +618,27 @@ void PakBusMsg :: send_link_state_pkt (int SerPktMsgFormat, int PackSize)
             return;
     }
     
-    Msg[0] = (byte)( LinkState | (DstAddr >> 8) );
-    Msg[1] = (byte)( DstAddr & 0xff );
-    Msg[2] = (byte)( ExpCode | Prio | (SrcPhyAddr__ >> 8) );
-    Msg[3] = (byte)( SrcPhyAddr__ & 0xff );
+    // The link state, expect more code and priority are given in place
+    PakBusHeader::DstPhyWord::set(Msg, (LinkState << 8) | DstAddr);
+    PakBusHeader::SrcPhyWord::set(Msg, ((ExpCode | Prio) << 8) | 
+            SrcPhyAddr__);
 
-    odevs__ << SerSyncByte__;
+    pbuf__->beginFrame();
 
     if (PackSize == 8) {
-        Msg[4] = (byte)(DstAddr >> 8);
-        Msg[5] = (byte)(DstAddr & 0xff);
-        Msg[6] = (byte)(SrcPhyAddr__ >> 8);
-        Msg[7] = (byte)(SrcPhyAddr__ & 0xff);
-        Msg[8] = (byte)(signull >> 8);
-        Msg[9] = (byte)(signull & 0xff);
+        PakBusHeader::DstNodeWord::set(Msg, DstAddr);
+        PakBusHeader::SrcNodeWord::set(Msg, SrcPhyAddr__);
+        BigEndian<2>::store(Msg + 8, signull);
         // uint2 sig = CalcSig(Msg, 8, Seed);
         // uint2 signull = CalcSigNullifier(sig);
-        odevs__.write((const char*)Msg, 10);
+        pbuf__->putFrameBytes(Msg, 10);
     }
     else {
-        sig = CalcSig(Msg, 4, Seed);
-        signull = CalcSigNullifier(sig);
-        Msg[4] = (byte)(signull >> 8);
-        Msg[5] = (byte)(signull & 0xff);
-        odevs__.write((const char*)Msg, 6);
+        pbuf__->putFrameBytes(Msg, 4);
+        pbuf__->putSigNullifier();
     }
 
-    odevs__ << SerSyncByte__;
+    pbuf__->closeFrame();
     pbuf__->writeToDevice();
     return;
 }
@@ -655,7 +668,7 @@ void PakBusMsg :: HandShake (int mode) throw (CommException, PakBusException)
     send_link_state_pkt (mode, 4);
 
     try {
-        pbuf__->readFromDevice();
+        pbuf__->readLinkState();
     }
     catch (CommException& ce) {
         Category::getInstance("PakBusMsg")
@@ -715,9 +728,7 @@ void PakBusMsg :: HandShake (int mode) throw (CommException, PakBusException)
  */
 byte PakBusMsg :: get_link_state (Packet& Pack)
 {
-    byte *ppkt = (byte *)Pack.begPacket + 1;
-    byte link_state = (*ppkt & 0xf0);
-    return link_state;
+    return Pack.Summary.LinkState;
 }
 
 /*
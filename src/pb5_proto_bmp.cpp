@@ -26,6 +26,7 @@
 #include <cstring>
 #include "pb5.h"
 #include "utils.h"
+#include "event_loop.h"
 using namespace std;
 using namespace log4cpp;
 
@@ -37,7 +38,16 @@ using namespace log4cpp;
  *         name of tables to collect and the station name.
  */
 BMP5Obj :: BMP5Obj () : PakBusMsg(), dataBufSize__(BMP5_BUFLEN), 
-        tblDataMgr__(NULL) 
+        collectWindow__(1), collectToNewest__(true), tblDataMgr__(NULL),
+        clockTran__(this, "Clock Transaction", &BMP5Obj::parse_clock),
+        progStatsTran__(this, "Programming Statistics transaction", 
+                &BMP5Obj::parse_prog_stats),
+        ctrlTableTran__(this, "Control Table transaction", 
+                &BMP5Obj::parse_control_table),
+        ctrlFileTran__(this, "Control File transaction", 
+                &BMP5Obj::parse_control_file),
+        clockQuery__(true), clockResult__(0), progStatsCode__(0x01), 
+        ctrlRespCode__(0x01), holdOff__(0)
 {
     HiProtoCode__ = 0x01;
     dataBuf__ = new byte[dataBufSize__];
@@ -55,6 +65,96 @@ void BMP5Obj :: setTableDataManager(TableDataManager* tblDataMgr)
     tblDataMgr__ = tblDataMgr;
 }
 
+/**
+ * Function to set the number of collect requests that may be outstanding
+ * at any time. A window of one keeps the stop-and-wait collection.
+ *
+ * @param window: Number of collect requests allowed in flight.
+ */
+void BMP5Obj :: setCollectWindow(int window)
+{
+    if (window < 1) {
+        collectWindow__ = 1;
+    }
+    else if (window > MAX_COLLECT_WINDOW) {
+        collectWindow__ = MAX_COLLECT_WINDOW;
+    }
+    else {
+        collectWindow__ = window;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////
+//           Implementation of BMP5Tran class                      //
+/////////////////////////////////////////////////////////////////////
+
+void BMP5Tran :: onResponse(Packet& pack)
+{
+    Answered = true;
+    (obj__->*parse__)(pack);
+}
+
+void BMP5Tran :: onTimeout()
+{
+    Category::getInstance("BMP5")
+             .warn(string("No response to the ") + name__);
+}
+
+/////////////////////////////////////////////////////////////////////
+//           Implementation of CollectSlot class                   //
+/////////////////////////////////////////////////////////////////////
+
+void CollectSlot :: onResponse(Packet& pack)
+{
+    Frame.assign ((byte *)pack.begPacket, (byte *)pack.endPacket + 1);
+    Response = pack;
+    Response.begPacket = (char *)&Frame[0];
+    Response.endPacket = Response.begPacket + Frame.size() - 1;
+    Answered = true;
+}
+
+/**
+ * Function to send the request in the message buffer under a new
+ * transaction number, and register it with the TransactionEngine.
+ *
+ * @param tran: Handler parsing the response.
+ * @param resp_type: Message type of the response.
+ */
+void 
+BMP5Obj :: send_request (BMP5Tran& tran, byte resp_type) throw (CommException)
+{
+    tran.Answered = false;
+    try {
+        begin_transaction (tran, resp_type);
+    }
+    catch (CommException& ce) {
+        Category::getInstance("BMP5")
+                 .error(string("Communication error during ") + tran.getName());
+        throw;
+    }
+}
+
+/**
+ * Function to run the TransactionEngine until the outstanding transactions
+ * are answered or timed out.
+ *
+ * @param tran_name: Name of the transaction for the logs.
+ * @param max_pending: Number of transactions left outstanding on return.
+ */
+void 
+BMP5Obj :: run_transactions (const char* tran_name, int max_pending) 
+        throw (CommException)
+{
+    try {
+        tranEngine__->run(max_pending);
+    }
+    catch (CommException& ce) {
+        Category::getInstance("BMP5")
+                 .error(string("Communication error during ") + tran_name);
+        throw;
+    }
+}
+
 /**
  * Function to check or adjust the time of a PakBus device.
  * A nonzero value for the seconds and nanoseconds arguments will add them 
@@ -72,56 +172,65 @@ void BMP5Obj :: setTableDataManager(TableDataManager* tblDataMgr)
  *              either cases to indicate error. 
  */
 int 
-BMP5Obj :: ClockTransaction (uint4 secs, uint4 nsecs)
+BMP5Obj :: ClockTransaction (uint4 secs, uint4 nsecs) throw (CommException)
 {
-    int    stat;
-    uint4  old_time;
-    int    ret_value = 0;
+    beginClockTransaction (secs, nsecs);
+    run_transactions (clockTran__.getName());
+    return getClockResult ();
+}
 
+/**
+ * Function to send the Clock Transaction without waiting for the response,
+ * so that other transactions can be run along with it. The result is 
+ * obtained from getClockResult() once the TransactionEngine has run.
+ *
+ * @param secs, nsecs: See ClockTransaction().
+ */
+void 
+BMP5Obj :: beginClockTransaction (uint4 secs, uint4 nsecs) 
+        throw (CommException)
+{
     Priority__ = 0x02;
     MsgType__  = 0x17;
-    MsgBodyLen__ = 10;
+    MsgBodyLen__ = ClockRequestMsg::SIZE;
 
     SetSecurityCodeInMsgBody();
     // Rest of the message body contains the adjustment to the clock
     // in seconds. It would be zero for a check.
-    PBSerialize (MsgBody__ + 2, secs, 4);
-    PBSerialize (MsgBody__ + 6, nsecs, 4);
-    byte tran_id = GenTranNbr();
+    ClockRequestMsg::AdjustSecs::set (MsgBody__, secs);
+    ClockRequestMsg::AdjustNsecs::set (MsgBody__, nsecs);
 
-    try {
-        SendPBPacket();
-        pbuf__->readFromDevice();
-    }
-    catch (CommException& ce) {
-        Category::getInstance("BMP5")
-                 .error("Communication error during Clock Transaction");
-        throw;
-    }
+    clockQuery__  = !secs && !nsecs;
+    clockResult__ = 0;
+    send_request (clockTran__, 0x97);
+}
 
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x97, tran_id);
+/**
+ * Returns the result of the last Clock Transaction, as returned by 
+ * ClockTransaction().
+ */
+int 
+BMP5Obj :: getClockResult ()
+{
+    return clockResult__;
+}
 
-        if (stat) {
-            PacketErr ("Clock Transaction", pack, stat);
-        }
-        else {
-            if (!secs && !nsecs) {
-                // If the transaction was to query datalogger time
-                // return datalogger time
-                old_time = PBDeserialize ((byte *)pack.begPacket + 12, 4);
-                ret_value = old_time + SECS_BEFORE_1990;
-            }
-            else {
-                // If the transaction was to update datalogger time
-                // return response code
-                ret_value = *(pack.begPacket + 11) ? 1 : 0;
-            }
-        }
-        packetQueue__->pop_front ();
+void 
+BMP5Obj :: parse_clock (Packet& pack)
+{
+    if (clockQuery__) {
+        // If the transaction was to query datalogger time
+        // return datalogger time
+        uint4 old_time = ClockResponseMsg::OldTimeSecs::get (
+                frameBody(pack.begPacket));
+        clockResult__ = old_time + SECS_BEFORE_1990;
+    }
+    else {
+        // If the transaction was to update datalogger time
+        // return response code
+        clockResult__ = ClockResponseMsg::RespCode::get (
+                frameBody(pack.begPacket)) ? 1 : 0;
     }
-    return ret_value;
 }
 
 
@@ -130,15 +239,26 @@ BMP5Obj :: ClockTransaction (uint4 secs, uint4 nsecs)
  * First, the function would try to read the <DATA_DIR>/conf/tdf.dat file
  * and build the table definitions from it. If not found, it'll fetch
  * the table definitions file from the logger. Also an XML file called tdf.xml
- * will be created in the <DATA_DIR>/conf directory.
+ * will be created in the <DATA_DIR>/conf directory. Both are skipped if the
+ * tables can be restored from the session snapshot.
  *
  * @return Throws AppException on failure.
  */
 void 
 BMP5Obj :: getDataDefinitions() throw (IOException, ParseException)
 {
-    this->GetTDF();
-    this->GetProgStats((uint2)0);
+    // The statistics may have been requested along with another 
+    // transaction, see beginGetProgStats()
+    if (!progStatsTran__.Answered || progStatsCode__) {
+        this->GetProgStats((uint2)0);
+    }
+    progStatsTran__.Answered = false;
+
+    // The program signature in the statistics tells if the tables compiled
+    // in the last session can be used again
+    if (!tblDataMgr__->restoreSnapshot()) {
+        this->GetTDF();
+    }
 
     int maxRecordSize = tblDataMgr__->getMaxRecordSize();
     if (maxRecordSize > dataBufSize__) {
@@ -223,21 +343,24 @@ BMP5Obj :: DownloadFile (const char *filename)
     int      nread = 0;
     byte     close_flag = 0;
     byte     resp_code = 0;
-    byte     tran_id;
     uint4    resp_offset = 0;
     int      stat = 0;
+    bool     answered;
+    ResponseTran tran;
 
     store_file += filename;
     int      len = store_file.size();
+    byte*    tail = FileRequestMsg::tail (MsgBody__, len);
+    int      head_len = tail + FileSendTail::DATA - MsgBody__;
 
     MsgType__ = 0x1c;
     // Including the null-character at the end of the string
-    MsgBodyLen__ = buf_size + 9 + len;
+    MsgBodyLen__ = head_len + buf_size;
 
     SetSecurityCodeInMsgBody();
-    memcpy (MsgBody__+2, store_file.c_str(), len + 1);
-    MsgBody__[len+3] = 0x00;
-    tran_id = GenTranNbr();
+    memcpy (MsgBody__ + FileRequestMsg::FILE_NAME, store_file.c_str(), 
+            len + 1);
+    FileSendTail::Attribute::set (tail, 0x00);
 
     while (!ifs.eof()) {
         // Checking the stat variable is important because that
@@ -250,20 +373,19 @@ BMP5Obj :: DownloadFile (const char *filename)
             // Assuming read() reached end of file
 	    if (nread < buf_size) {
 	        close_flag = 0x01;
-                MsgBodyLen__ = len + 9 + nread;
+                MsgBodyLen__ = head_len + nread;
             }
 	    else {
 	        close_flag = 0x00;
             }
         }
 
-        MsgBody__[len+4] = close_flag;
-        PBSerialize (MsgBody__+len+5, (uint4)file_offset, 4);
-        memcpy (MsgBody__+len+9, buf, nread);
+        FileSendTail::CloseFlag::set (tail, close_flag);
+        FileSendTail::FileOffset::set (tail, (uint4)file_offset);
+        memcpy (tail + FileSendTail::DATA, buf, nread);
 
         try {
-            SendPBPacket();
-            pbuf__->readFromDevice();
+            answered = transact (tran, 0x9c);
         } 
         catch (CommException& ce) {
             Category::getInstance("BMP5")
@@ -271,18 +393,17 @@ BMP5Obj :: DownloadFile (const char *filename)
             throw;
         }
 
-        while (packetQueue__->size()) {
-            Packet pack = packetQueue__->front();
-            stat = ParsePakBusPacket (pack, 0x9c, tran_id);
-
-            if (stat) {
-                PacketErr ("File Download Transaction", pack, stat);
-            }
-            else {
-		        resp_code = (byte)*(pack.begPacket+11);
-                resp_offset = PBDeserialize ((byte *)(pack.begPacket+12), 4);
-            }
-            packetQueue__->pop_front ();
+        if (answered) {
+            const byte* body = frameBody(tran.Response.begPacket);
+            resp_code = (byte)FileResponseMsg::RespCode::get (body);
+            resp_offset = FileResponseMsg::FileOffset::get (body);
+            stat = SUCCESS;
+        }
+        else if (tran.Failed) {
+            return FAILURE;
+        }
+        else {
+            stat = FAILURE;
         }
 
         if (!stat) {
@@ -312,7 +433,8 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
     int      len, stat = FAILURE;
     uint4    file_offset = 0;
     uint4    file_datalen = 0;
-    Packet   pack;
+    bool     answered;
+    ResponseTran tran;
     ofstream TDFdata;
     bool     ioException = false;
     
@@ -325,7 +447,6 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
     MsgType__  = 0x1d;
     // uint2 Swath = 0x0158;
     uint2 Swath = 0x03d9;
-    byte  tran_id =  GenTranNbr();
 
     // Keep the file open for possible exchanges, the logger will close
     // the file automatically is complete file is read
@@ -334,17 +455,16 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
     SetSecurityCodeInMsgBody();
 
     len = strlen (get_file);
-    memcpy (MsgBody__+2, get_file, len);
-    MsgBody__[len+2] = 0x00;
+    memcpy (MsgBody__ + FileRequestMsg::FILE_NAME, get_file, len + 1);
 
-    MsgBody__[len+3] = CloseFlag;
+    byte* tail = FileRequestMsg::tail (MsgBody__, len);
+    FileReceiveTail::CloseFlag::set (tail, CloseFlag);
 
     // Byte offset into the file is set within the loop below
 
-    MsgBody__[len+8] = (byte)(Swath >> 8);
-    MsgBody__[len+9] = (byte)(Swath & 0xff);
+    FileReceiveTail::Swath::set (tail, Swath);
 
-    MsgBodyLen__ = len+10;
+    MsgBodyLen__ = tail + FileReceiveTail::SIZE - MsgBody__;
 
     TDFdata.open (write_to_file, ofstream::binary | ofstream::out);
     
@@ -357,11 +477,10 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
     }
 
     while (1) {
-        PBSerialize (MsgBody__+len+4, (uint4)file_offset, 4);
+        FileReceiveTail::FileOffset::set (tail, file_offset);
 
         try {
-            SendPBPacket();
-            pbuf__->readFromDevice();
+            answered = transact (tran, 0x9d);
         }
         catch (CommException& ce) {
             Category::getInstance("BMP5")
@@ -369,53 +488,31 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
             throw;
         }
 
-        if (!packetQueue__->size()) {
+        // Any wait the logger asked for has been waited out. The upload
+        // fails without a response by then, or if a router couldn't 
+        // deliver the request.
+        if (!answered) {
             Category::getInstance("BMP5")
                     .warn("No data was found to read.");
+            stat = FAILURE;
             break;
         }
 
-        // There will be zero or one packets containing response
-        // to Uploadfile command and some hello packets
-
-        while (packetQueue__->size()) {
-            pack = packetQueue__->front();
-            stat = ParsePakBusPacket (pack, 0x9d, tran_id);
-            if (stat) {
-                PacketErr ("File Upload Transaction", pack, stat);
-            }
-            else {
-                try {
-                    file_datalen = process_upload_file (pack, TDFdata);
-                } 
-                catch (IOException& ioe) {
-                    string err("I/O error occurred while writing to : ");
-                    err.append(write_to_file);
-                    Category::getInstance("BMP5").warn(err);
-                    ioException = true;
-                    break;
-                }
-                file_offset += file_datalen;
-            }
-            packetQueue__->pop_front ();
-        }
-
-        if (ioException) { 
+        stat = SUCCESS;
+        try {
+            file_datalen = process_upload_file (tran.Response, TDFdata);
+        } 
+        catch (IOException& ioe) {
+            string err("I/O error occurred while writing to : ");
+            err.append(write_to_file);
+            Category::getInstance("BMP5").warn(err);
+            ioException = true;
             break;
         }
+        file_offset += file_datalen;
 
-        if (!stat) {
-            if (file_datalen != Swath) {
-                break;
-            }
-        }
-        else {
-            if (stat == DELIVERY_FAILURE) {
-                break;
-            }
-            else {
-                sleep (1);
-            }
+        if (file_datalen != Swath) {
+            break;
         }
     }
     
@@ -433,13 +530,11 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
         // trasaction so that the file can be closed.
         // CloseFlag = 0x01;
 
-        MsgBody__[len+3] = 0x01;
-        MsgBody__[len+8] = 0x00;
-        MsgBody__[len+9] = 0x00;
+        FileReceiveTail::CloseFlag::set (tail, 0x01);
+        FileReceiveTail::Swath::set (tail, 0);
 
         try {
-            SendPBPacket();
-            pbuf__->readFromDevice();
+            transact (tran, 0x9d);
         } 
         catch (CommException& ce) {
             Category::getInstance("BMP5")
@@ -464,10 +559,10 @@ BMP5Obj :: UploadFile (const char *get_file, char *write_to_file) throw (IOExcep
 int 
 BMP5Obj :: process_upload_file (Packet& pack, ofstream& filedata) throw (IOException)
 {
-    byte *pack_ptr = (byte *)(pack.begPacket + 11);
+    byte *pack_ptr = frameBody(pack.begPacket);
     string errormsg;
 
-    byte stat = *pack_ptr++;
+    byte stat = (byte)FileResponseMsg::RespCode::get (pack_ptr);
     if (stat) {
         if (stat == 0x01) {
             errormsg = "Permission denied";
@@ -482,10 +577,9 @@ BMP5Obj :: process_upload_file (Packet& pack, ofstream& filedata) throw (IOExcep
                 .error("process_upload_file() : " + errormsg);
         return 0;
     }
-    pack_ptr += 4;
+    pack_ptr += FileResponseMsg::DATA;
 
-    int file_data_len = pack.endPacket - (char *)pack_ptr - 2;
-    // Need to subtract the signature length as well
+    int file_data_len = frameBodyEnd(pack.endPacket) - pack_ptr;
     filedata.write ((const char *)pack_ptr, file_data_len);
     filedata.flush();
     if (filedata.bad()) {
@@ -500,74 +594,149 @@ BMP5Obj :: process_upload_file (Packet& pack, ofstream& filedata) throw (IOExcep
  * data logger software may not have the features implemented. 
  * @param message_type: Message type to indicate the data collection.
  *              mode. Modes 0x03-0x07 are implenented in this function,
- *              although only 0x05 and 0x06 are used in this program
+ *              although only 0x04, 0x05 and 0x06 are used in this program
  *              for data collection.
  * @param tbl:  Reference to the Table structure containing information
  *              about the table to collect data from.
  * @param P1, P2: Parameters corresponding to the data collection mode.
  *              If a collection mode requires only one parameter, then
  *              the second argument (P2) will be ignored.
- * @return Returns -1 if an invalud collection mode is specified.
+ * @param tran: Handler of the transaction, registered with the 
+ *              TransactionEngine.
+ * @return Returns the transaction number of the command, or -1 if an 
+ *              invalud collection mode is specified.
+ */
+int 
+BMP5Obj :: sendCollectionCmd (byte message_type, Table& tbl, uint4 P1, 
+        uint4 P2, TranHandler& tran) throw (CommException)
+{
+    vector<CollectRequest> requests(1, CollectRequest(&tbl, P1, P2));
+    return sendCollectionCmd (message_type, requests, tran);
+}
+
+/**
+ * Function to send a "collect" command for several tables in one message.
+ * The collection mode applies to all the tables, while each table has its
+ * own parameters. The response contains the records of the tables in the
+ * order of the request.
+ *
+ * @param message_type: Collection mode, see the single table version.
+ * @param requests: Tables to collect data from and the parameters for each.
+ * @param tran: Handler of the transaction.
+ * @return Returns the transaction number of the command, or -1 if an 
+ *              invalud collection mode is specified.
  */
 int 
-BMP5Obj :: sendCollectionCmd (byte message_type, Table& tbl, uint4 P1, uint4 P2)
+BMP5Obj :: sendCollectionCmd (byte message_type, 
+        const vector<CollectRequest>& requests, TranHandler& tran)
+        throw (CommException)
 {
     Priority__ = 0x02;
     MsgType__  = 0x09;
-    stringstream msgstrm;
+    int nparams;
 
     switch (message_type) {
-        // Collect records between P1 and P2. Include P1 but exclude P2
-        case 0x06 : MsgBodyLen__ = 17;
-                    break;
-        // Collect last P1 records
-        case 0x05 : MsgBodyLen__ = 13;
-                    break;
-        // Collect a partial record with P1 describing the record number
-        // while P2 specifies the byte offset into the record.
-        case 0x08 : MsgBodyLen__ = 17;
-                    break;
         // Get all the data stored on the logger
-        case 0x03 : MsgBodyLen__ = 9;
+        case 0x03 : nparams = 0;
                     break;
         // Collect from P1 to the latest record
-        case 0x04 : MsgBodyLen__ = 13;
+        case 0x04 : nparams = 1;
+                    break;
+        // Collect last P1 records
+        case 0x05 : nparams = 1;
+                    break;
+        // Collect records between P1 and P2. Include P1 but exclude P2
+        case 0x06 : nparams = 2;
                     break;
         // Collect a Time Swath described by P1 and P2
-        case 0x07 : MsgBodyLen__ = 17;
+        case 0x07 : nparams = 2;
+                    break;
+        // Collect a partial record with P1 describing the record number
+        // while P2 specifies the byte offset into the record.
+        case 0x08 : nparams = 2;
                     break;
-        // Get all the data stored on the logger
         default   : return -1;
     }
 
+    typedef CollectTableSpec Spec;
+
     SetSecurityCodeInMsgBody();
-    MsgBody__[2] = message_type;
-    PBSerialize (MsgBody__+3, tbl.TblNum, 2);
-    PBSerialize (MsgBody__+5, tbl.TblSignature, 2);
+    CollectRequestMsg::CollectMode::set (MsgBody__, message_type);
+    MsgBodyLen__ = CollectRequestMsg::SIZE;
+
+    for (vector<CollectRequest>::const_iterator it = requests.begin(); 
+            it != requests.end(); ++it) {
+        Spec::TableNbr::set (MsgBody__+MsgBodyLen__, it->Tbl->TblNum);
+        Spec::TableSig::set (MsgBody__+MsgBodyLen__, it->Tbl->TblSignature);
+        MsgBodyLen__ += Spec::SIZE;
+
+        if (nparams > 0) {
+            Spec::Param::set (MsgBody__+MsgBodyLen__, it->P1);
+            MsgBodyLen__ += Spec::Param::WIDTH;
+        }
+        if (nparams > 1) {
+            Spec::Param::set (MsgBody__+MsgBodyLen__, it->P2);
+            MsgBodyLen__ += Spec::Param::WIDTH;
+        }
 
-    if (MsgBodyLen__ == 9) {
-        // No parameters required, just pass the field list terminator
-        PBSerialize (MsgBody__+7, 0, 2);
+        // Field list, all the fields are collected if it is empty
+        const vector<uint2>& field_nbrs = it->Tbl->FieldNbrs;
+        if (MsgBodyLen__ + 2*((int)field_nbrs.size() + 1) 
+                > (int)sizeof(MsgBody__)) {
+            Category::getInstance("BMP5")
+                     .error("Collect command too long for message body");
+            return -1;
+        }
+        for (size_t idx = 0; idx < field_nbrs.size(); idx++) {
+            Spec::FieldNbr::set (MsgBody__+MsgBodyLen__, field_nbrs[idx]);
+            MsgBodyLen__ += Spec::FieldNbr::WIDTH;
+        }
+        Spec::FieldNbr::set (MsgBody__+MsgBodyLen__, 0);
+        MsgBodyLen__ += Spec::FieldNbr::WIDTH;
     }
-    else {
-        PBSerialize (MsgBody__+7, P1, 4);
+    return begin_transaction (tran, 0x89);
+}
 
-        if (MsgBodyLen__ == 13) {
-            PBSerialize (MsgBody__+11, 0, 2);
-        }
-        else {
-            PBSerialize (MsgBody__+11, P2, 4);
-            PBSerialize (MsgBody__+15, 0, 2);
+/**
+ * Function to send a "collect" command and run the TransactionEngine until
+ * it is answered or its deadline expires.
+ *
+ * @param tran: Handler holding the response.
+ * @return true if the command was answered.
+ */
+bool 
+BMP5Obj :: collect_transaction (byte message_type, Table& tbl, uint4 P1, 
+        uint4 P2, ResponseTran& tran) throw (CommException)
+{
+    vector<CollectRequest> requests(1, CollectRequest(&tbl, P1, P2));
+    return collect_transaction (message_type, requests, tran);
+}
+
+bool 
+BMP5Obj :: collect_transaction (byte message_type, 
+        const vector<CollectRequest>& requests, ResponseTran& tran)
+        throw (CommException)
+{
+    tran.reset();
+    try {
+        if (sendCollectionCmd (message_type, requests, tran) < 0) {
+            return false;
         }
+        tranEngine__->run();
+    }
+    catch (CommException& ce) {
+        Category::getInstance("BMP5")
+                 .error("Communication error during collect transaction");
+        throw;
     }
-    SendPBPacket();
-    return TranNbr__;
+    return tran.Answered;
 }
 
 /**
  * Function to store data for a table from a bytesequence.
  * This function uses the information stored in Table Definition File to 
- * extract data for a specified table from a given bytestream. Typically the 
+ * extract data for a specified table from a given bytestream, and hands the
+ * records to the TableDataWriter in a single batch. Typically the 
  * byte sequence points to the data section of a PakBus packet or in case,
  * a large data record is fragmented into multiple packets, it will point to
  * the beginning of a buffer where data is stored.
@@ -588,38 +757,34 @@ BMP5Obj :: store_data (byte* buf, Table& tbl, int beg, int nrecs,
         int file_span) throw (StorageException)
 {
     int stat = FAILURE;
-    bool parseTimestamp = true;
-    int rec_num = 0;
-    while (rec_num < nrecs) {
-        try {
-            stat = tblDataMgr__->storeRecord (tbl, &buf, beg+rec_num, file_span, 
-                    parseTimestamp);
-        } catch (StorageException& e) {
-            Category::getInstance("BMP5")
-                     .error("Caught exception while storing data for " + tbl.TblName);
-            Category::getInstance("BMP5")
-                     .error(e.what()); 
-            throw;
-        }
-        parseTimestamp = false;
-        if (stat == FAILURE) {
-            break;
-        }
-        rec_num++;
-    } 
+    if (nrecs <= 0) {
+        return stat;
+    }
+    try {
+        stat = tblDataMgr__->storeRecords (tbl, &buf, beg, nrecs, true);
+    } catch (StorageException& e) {
+        Category::getInstance("BMP5")
+                 .error("Caught exception while storing data for " + tbl.TblName);
+        Category::getInstance("BMP5")
+                 .error(e.what()); 
+        throw;
+    }
     return stat;
 }
 
 /**
  * Function to collect data from a specified table. 
- * First a message is sent to the data logger to query about the last stored
- * record. Next, the record number to begin the collection from is determined.
+ * If the record to begin the collection from is known, the records from it
+ * to the newest one are requested directly (see collect_to_newest()).
+ * Otherwise, or if that is not possible, a message is first sent to the 
+ * data logger to query about the last stored record. Next, the record 
+ * number to begin the collection from is determined.
  * If the record number collected during is last attempt is known, then 
  * the collection begins from the record next to it. Else, the collection
  * begins from the earliest possible record. The collection goes one record
  * at a time untill the response to collect command returns an empty
  * data section. Data packets are parsed using process_data_packet().
- * It calls storeRecord() in turn to actually extract records for the
+ * It calls storeRecords() in turn to actually extract records for the
  * specified table from the byte sequence and write them to disk.
  *
  * @param table_opt: Structure containing table name and span information.
@@ -631,9 +796,8 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
 {
     // bool     alloc_buffer = true;
     int      record_size;
-    int      last_rec_nbr;
+    int      last_rec_nbr = -1;
     int      nrecs_read = 0;
-    uint4    recs_per_request = 1;
     int      records_pending;
     uint4    num_collected_recs = 0;
     stringstream msgstrm;
@@ -643,34 +807,38 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
     
     record_size = tblDataMgr__->getRecordSize (tbl_ref);
 
-    // If there is a possibility of the data record be fragmented into multiple
-    // packets, then allocate buffer memory to accumulate the data stored in 
-    // incoming packets.
+    // Size the requests so that the responses fill up a packet. Records 
+    // that may be fragmented into multiple packets are requested one at 
+    // a time.
 
-    /*
-    if ( (record_size > 512) ) {
-        // dataBuf__ = new byte[record_size];
-        recs_per_request = 1;
-    }
-    else if (record_size == -1) {
-        // This is the case when a record may have a variable size member. 
-        // Allocate a large memory chunk of arbitrary size.
-        // dataBuf__ = new byte[3000];
-        recs_per_request = 1;
-    }
-    else */
-    if ((record_size > 0) && (record_size < 512)) {
-        // alloc_buffer = false;
-        recs_per_request = (uint4) (512/record_size);
+    init_request_size (tbl_ref, record_size);
+
+    // Collect straight from the next record when it is known. The inquiry
+    // about the last stored record is only needed if this is not possible
+    // or if records are left for the pipelined collection.
+
+    bool caught_up = false;
+
+    if ((tbl_ref.TblSize > 1) && collectToNewest__ && 
+            (tbl_ref.NextRecord > 0) && (record_size > 0) && 
+            (record_size <= MAX_COLLECT_PAYLOAD)) {
+        int nnewest = collect_to_newest (tbl_ref, record_size, 
+                table_opt.TableSpan, caught_up);
+        if (nnewest > 0) {
+            num_collected_recs += nnewest;
+        }
     }
 
     // If the table size is known 
 
-    if (tbl_ref.TblSize > 1) {
+    if (caught_up) {
+        // Nothing is left to collect
+    }
+    else if (tbl_ref.TblSize > 1) {
 
         int numAttempts = 0;
         // get the last record number the logger is written in it's memory.
-        while (numAttempts < 3) {
+        while (numAttempts++ < 3) {
             recordStat = get_records (tbl_ref, GET_LAST_REC | INQ_REC_INFO,
                     record_size, 1, 0, table_opt.TableSpan);
             last_rec_nbr = recordStat.count;
@@ -754,27 +922,8 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
         //    reached the maximum  record id and then started back from 1 again.
 
         if ((records_pending >= (int)tbl_ref.TblSize) || (records_pending < 0)) {
-
-            msgstrm << "Adjusting start record index to compensate for backlog:\n"
-                    << "\tTable(" << tbl_ref.TblName << ") size: "
-                    << tbl_ref.TblSize << " records" << endl
-                    << "\tLast stored record id : " << last_rec_nbr << endl
-                    << "\tLast collected record id : " << tbl_ref.NextRecord << endl;
-
             int newIndex = last_rec_nbr - tbl_ref.TblSize + 2;
-      
-            tbl_ref.NextRecord = (newIndex < 0) ? 1 : ((uint4)newIndex);
-
-            msgstrm << "\tAdvancing next collection record to : ";
-            msgstrm << tbl_ref.NextRecord << endl;
-
-            Category::getInstance("BMP5").info(msgstrm.str());
-            msgstrm.str("");
-         
-            // Reset all the history for this Table
-            if (tbl_ref.NewFileTime) {
-                tblDataMgr__->flushTableDataCache(tbl_ref);
-            }
+            skip_lost_records (tbl_ref, (newIndex < 0) ? 1 : ((uint4)newIndex));
         }
     
         // If the temporary data file for this table already exists, 
@@ -787,17 +936,36 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
         * Main collection loop
         */
  
+        // Keep several requests in flight while the records fit in a 
+        // single packet. Whatever is left when the pipelined collection
+        // stops is collected by the stop-and-wait loop below.
+
+        if ((collectWindow__ > 1) && (record_size > 0) && 
+                (record_size <= MAX_COLLECT_PAYLOAD)) {
+            int npipelined = collect_pipelined (tbl_ref, (uint4)last_rec_nbr, 
+                    table_opt.TableSpan);
+            if (npipelined > 0) {
+                num_collected_recs += npipelined;
+            }
+        }
+
         uint4 lastBadRecordIndex = (unsigned int) -1;
         int countBadRecordCollAttempt = 0;
         int MAX_BAD_REC_COLL_REATTEMPT = 2;
 
         while (tbl_ref.NextRecord <= (uint4) last_rec_nbr) 
         {
+            uint4 requested = min(tbl_ref.RecsPerRequest, 
+                    (uint4)last_rec_nbr + 1 - tbl_ref.NextRecord);
             recordStat = get_records (tbl_ref, GET_DATA_RANGE | STORE_DATA,
                     record_size, tbl_ref.NextRecord, 
-                    tbl_ref.NextRecord + recs_per_request, table_opt.TableSpan);
+                    tbl_ref.NextRecord + requested, table_opt.TableSpan);
             nrecs_read = recordStat.count;
 
+            if (record_size > 0) {
+                adapt_request_size (tbl_ref, requested, nrecs_read);
+            }
+
             if (nrecs_read < 0) {
                 break;
             }
@@ -850,7 +1018,8 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
 
     if (get_debug()) {
         msgstrm << "Collected " << num_collected_recs << " records from " 
-                << tbl_ref.TblName;
+                << tbl_ref.TblName << " (" << tbl_ref.RecsPerRequest 
+                << " records per request)";
         Category::getInstance("BMP5").debug(msgstrm.str());
         msgstrm.str("");
     }
@@ -859,12 +1028,7 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
         delete [] dataBuf__;
     }*/
 
-    if ((table_opt.SampleInt >= 0) && (tbl_ref.LastRecordTime.sec > 0)) {
-        if ((tbl_ref.LastRecordTime.sec + table_opt.SampleInt) 
-                >= tbl_ref.NewFileTime) {
-            tblDataMgr__->flushTableDataCache(tbl_ref);
-        }
-    }
+    close_completed_file (table_opt, tbl_ref);
     
     // A negative nrecs_read indicates some sort of error in data collection
     if (nrecs_read >= 0) {
@@ -876,133 +1040,722 @@ BMP5Obj :: CollectData (const TableOpt& table_opt) throw (AppException, invalid_
 }
 
 /**
- * Function for sending a message to administer tables on the datalogger.
- * @param ctrl_opt: 0x01 (Reset the table and trash existing records)\n 
- *                  0x02 (Roll over to a new file if the tables are managed
- *                        in files)
- * @return Returns SUCCESS if the Response code is "Complete". FAILIRE if
- * the response code indicates permission denied, or invalid option/table 
- * name.
+ * Function to bring several tables up to date with one collect request.
+ * The last record of each table is requested with collection mode 0x05 in
+ * a single message, which answers for all the tables what an inquiry about
+ * the last record answers for one. A table is done if the last record was
+ * collected before, or if it is the next record to collect, which is then
+ * stored. Other tables, and tables whose records don't fit in a packet,
+ * are left for CollectData(). Tables are batched as long as their records
+ * fit in the response.
+ *
+ * @param table_opts: Options for the tables to collect.
+ * @param done: Set to true for the tables that are up to date.
+ * @return Number of records collected.
  */
 int 
-BMP5Obj :: ControlTable (byte ctrl_opt)
+BMP5Obj :: CollectLatest (const vector<TableOpt>& table_opts, 
+        vector<bool>& done) throw (AppException)
 {
-    int  stat;
-    byte resp_code = 0;
-
-    Priority__ = 0x02;
-    MsgType__  = 0x19;
-    MsgBodyLen__ = 3;
-
-    SetSecurityCodeInMsgBody();
-    MsgBody__[2] = ctrl_opt; // Control option code
-
-    byte tran_id = GenTranNbr();
+    vector<size_t> eligible;
+    size_t next = 0;
+    int    num_collected = 0;
+    ResponseTran tran;
+    stringstream msgstrm;
 
-    try {
-        SendPBPacket();
-        pbuf__->readFromDevice();
-    } catch (CommException& ce) {
-        Category::getInstance("BMP5")
-                 .error("Communication error during Control Table transaction");
-        throw;
-    }
+    done.assign (table_opts.size(), false);
 
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x99, tran_id);
-        if (stat) {
-            PacketErr ("Control Table Transaction", pack, stat);
+    for (size_t i = 0; i < table_opts.size(); i++) {
+        Table* tbl;
+        try {
+            tbl = &tblDataMgr__->getTableRef (table_opts[i].TableName);
         }
-        else {
-	    resp_code = (byte)*(pack.begPacket + 11);
+        catch (invalid_argument& iae) {
+            continue;
+        }
+        int record_size = tblDataMgr__->getRecordSize (*tbl);
+        if ((tbl->TblSize > 1) && (tbl->NextRecord > 0) && 
+                (record_size > 0) && (record_size <= MAX_COLLECT_PAYLOAD)) {
+            eligible.push_back (i);
         }
-        packetQueue__->pop_front ();
     }
 
-    if (resp_code == 0x00) {
-	return SUCCESS;
-    }
-    else {
-	return FAILURE;
+    // A single table gains nothing over the collection in CollectData()
+    if (eligible.size() < 2) {
+        return 0;
     }
-}
 
-/**
- * Function to manage program and data files on a data logger.
- * The file control transaction controls compilation execution of the data-
- * logger program and manages files on the data logger. Following options are 
- * supported :
- * 0x01: Compile and run the program and also make it "run on power-up" file.\n
- * 0x04: Delete this file.\n
- * 0x05: Format the device.\n
- * 0x06: Compile and run the program without deleting data files\n
- * 0x07: Stop the running program\n
- * 0x08: Stop the running program and delete associated data files.\n
- * 0x0a: Compile and run the program without changing "run on power-up" attribute.\n
- * 0x0c: Resume running program execution.\n
- * 0x0d: Stop the running program, delete associated data files, run specified 
- *       file and set it to "run on power-up".\n
- * 0x0e: Stop the running program, delete associated data files, run specified 
- *       file but don't change the "run on power-up" attribute.
- * 
- * @param file_name: Complete name of the program file (i.e. specify CPU:prog.CR1
- *                   than prog.CR1)
- * @param cmd: Code to specify the command to execute. 
- */
-int 
-BMP5Obj :: ControlFile (const string& file_name, byte cmd)
-{
-    int  stat;
-    byte resp_code = 0x01;
-    int  hold_off  = 0;
-    int  len = file_name.size();
+    while (next < eligible.size()) {
+        vector<CollectRequest> batch;
+        vector<size_t> batch_opts;
+        int room = MAX_COLLECT_PAYLOAD + COLLECT_TABLE_OVERHEAD;
+        int req_room = (int)sizeof(MsgBody__) - 3;
+
+        while (next < eligible.size()) {
+            const TableOpt& opt = table_opts[eligible[next]];
+            Table& tbl = tblDataMgr__->getTableRef (opt.TableName);
+            int size = COLLECT_TABLE_OVERHEAD 
+                    + tblDataMgr__->getRecordSize (tbl);
+            int req_size = 10 + 2*(int)tbl.FieldNbrs.size();
+            if (!batch.empty() && ((size > room) || (req_size > req_room))) {
+                break;
+            }
+            room -= size;
+            req_room -= req_size;
+            batch.push_back (CollectRequest(&tbl, 1, 0));
+            batch_opts.push_back (eligible[next++]);
+        }
 
-    Priority__ = 0x02;
-    MsgType__  = 0x1e;
-    MsgBodyLen__ = 3 + len + 1;
+        // Tables without an answer are collected by CollectData()
+        if (!collect_transaction (0x05, batch, tran)) {
+            continue;
+        }
 
-    SetSecurityCodeInMsgBody();
-    memcpy (MsgBody__+2, file_name.c_str(), len + 1);
-    MsgBody__[len+3] = cmd;
+        Packet& resp = tran.Response;
+        byte* ptr = frameBody(resp.begPacket);
+        byte* end = frameBodyEnd(resp.endPacket);
+
+        // An error response carries no table data, and the code can't be
+        // told apart for the tables of the batch. CollectData() collects
+        // them and reports the error against the table it applies to.
+        if (CollectResponseMsg::RespCode::get (ptr)) {
+            msgstrm << "Collect request for the last record of " 
+                    << batch.size() << " tables failed with response code 0x"
+                    << setfill('0') << setw(2) << hex 
+                    << CollectResponseMsg::RespCode::get (ptr) << dec;
+            Category::getInstance("BMP5").notice(msgstrm.str());
+            msgstrm.str("");
+            continue;
+        }
+        ptr += CollectResponseMsg::TABLES;
 
-    byte tran_id = GenTranNbr();
+        for (size_t k = 0; k < batch.size(); k++) {
+            Table& tbl = *batch[k].Tbl;
+            const TableOpt& opt = table_opts[batch_opts[k]];
+
+            if ((ptr + CollectTableData::RECORDS > end) || 
+                    ((int)CollectTableData::TableNbr::get (ptr) != 
+                     tbl.TblNum)) {
+                break;
+            }
+            uint4 beg_rec_nbr = CollectTableData::BegRecNbr::get (ptr);
+            uint2 nrecs = (uint2) CollectTableData::NbrOfRecs::get (ptr);
+            ptr += CollectTableData::RECORDS;
+
+            if (nrecs & 0x8000) {
+                break;
+            }
+            if (nrecs == 0) {
+                continue;
+            }
+
+            byte* records = ptr;
+            ptr += RecordTimeLayout::SIZE + 
+                    nrecs*tblDataMgr__->getRecordSize (tbl);
+            if (ptr > end) {
+                break;
+            }
+
+            if ((beg_rec_nbr + 1 == tbl.NextRecord) && 
+                    (0 == nseccmp(tbl.LastRecordTime, 
+                                  parseRecordTime(records)))) {
+                Category::getInstance("BMP5")
+                         .info("No new data is available yet for : " 
+                                + opt.TableName);
+                done[batch_opts[k]] = true;
+            }
+            else if ((beg_rec_nbr == tbl.NextRecord) && (nrecs == 1)) {
+                tblDataMgr__->getTableDataWriter()->initWrite(tbl);
+                int stat = store_data (records, tbl, beg_rec_nbr, 1, 
+                        opt.TableSpan);
+                tblDataMgr__->getTableDataWriter()->finishWrite(tbl);
+
+                if (stat == SUCCESS) {
+                    num_collected++;
+                    done[batch_opts[k]] = true;
+                    close_completed_file (opt, tbl);
+                }
+            }
+        }
+
+        if (get_debug()) {
+            msgstrm << "Requested the last record of " << batch.size() 
+                    << " tables in one message";
+            Category::getInstance("BMP5").debug(msgstrm.str());
+            msgstrm.str("");
+        }
+    }
+
+    return num_collected;
+}
+
+/**
+ * Function to move the datafile of a table out of the working directory 
+ * once the last record collected completes it.
+ *
+ * @param table_opt: Options for the table.
+ * @param tbl_ref: Reference to the Table structure.
+ */
+void 
+BMP5Obj :: close_completed_file (const TableOpt& table_opt, Table& tbl_ref)
+{
+    if ((table_opt.SampleInt >= 0) && (tbl_ref.LastRecordTime.sec > 0)) {
+        if ((tbl_ref.LastRecordTime.sec + table_opt.SampleInt) 
+                >= tbl_ref.NewFileTime) {
+            tblDataMgr__->flushTableDataCache(tbl_ref);
+        }
+    }
+}
+
+/**
+ * Function to collect the records of a table from Table::NextRecord to the
+ * newest one with collection mode 0x04. This saves the inquiry about the 
+ * last stored record. Responses are requested until the logger reports 
+ * that no more records exist, or a response comes back empty. With a 
+ * collect window larger than one, only the first response is requested 
+ * and the remaining records are left to the pipelined collection.
+ *
+ * Nothing is collected, so that the caller falls back to the inquiry, if
+ * the logger rejects the collection mode, has no records to return, or 
+ * returns records preceding Table::NextRecord (the table was reset or the
+ * record numbers wrapped around). A response beginning after 
+ * Table::NextRecord means that records were overwritten before they could
+ * be collected; collection then skips ahead as it does for a backlog.
+ *
+ * @param tbl_ref: Reference to the Table structure to collect data for.
+ * @param record_size: Size of a record, which must fit in a packet.
+ * @param file_span: Span of a datafile in seconds.
+ * @param caught_up: Set to true if the newest record has been collected.
+ * @return Number of records collected, or -1 if none were.
+ */
+int 
+BMP5Obj :: collect_to_newest (Table& tbl_ref, int record_size, int file_span,
+        bool& caught_up) throw (AppException)
+{
+    int  num_collected = 0;
+    bool writing = false;
+    ResponseTran tran;
+    stringstream msgstrm;
+
+    caught_up = false;
+
+    while (!caught_up) {
+        if (!collect_transaction (0x04, tbl_ref, tbl_ref.NextRecord, 0, 
+                tran)) {
+            break;
+        }
+
+        Packet& resp = tran.Response;
+        byte* body = frameBody(resp.begPacket);
+        byte* data = body + CollectResponseMsg::TABLES;
+
+        if (*body) {
+            if ((*body == 0x01) || (*body == 0x07)) {
+                test_data_packet (tbl_ref, resp);
+            }
+            msgstrm << "Collection mode 0x04 rejected with response code 0x"
+                    << setfill('0') << setw(2) << hex << byte2int(*body)
+                    << ", inquiring about the last record instead";
+            Category::getInstance("BMP5").notice(msgstrm.str());
+            msgstrm.str("");
+            collectToNewest__ = false;
+            break;
+        }
+
+        if (((int)CollectTableData::TableNbr::get (data) != tbl_ref.TblNum) ||
+                (frameBodyEnd(resp.endPacket) < 
+                 data + CollectTableData::RECORDS)) {
+            Category::getInstance("BMP5")
+                     .warn("Invalid response to collect request for " 
+                           + tbl_ref.TblName);
+            break;
+        }
+
+        uint4 beg_rec_nbr = CollectTableData::BegRecNbr::get (data);
+        uint2 nrecs = (uint2) CollectTableData::NbrOfRecs::get (data);
+
+        if (nrecs == 0) {
+            caught_up = (num_collected > 0);
+            break;
+        }
+        if ((nrecs & 0x8000) || (beg_rec_nbr < tbl_ref.NextRecord)) {
+            break;
+        }
+
+        // The records are followed by a flag telling whether more records 
+        // exist. Keep asking until an empty response if it is missing.
+
+        byte* records  = data + CollectTableData::RECORDS;
+        byte* recs_end = records + RecordTimeLayout::SIZE + nrecs*record_size;
+        bool  more = true;
+
+        if (recs_end > frameBodyEnd(resp.endPacket)) {
+            Category::getInstance("BMP5")
+                     .warn("Truncated response to collect request for " 
+                           + tbl_ref.TblName);
+            break;
+        }
+        else if (recs_end < frameBodyEnd(resp.endPacket)) {
+            more = (*recs_end != 0);
+        }
+
+        if (beg_rec_nbr > tbl_ref.NextRecord) {
+            if (writing) {
+                tblDataMgr__->getTableDataWriter()->finishWrite(tbl_ref);
+                writing = false;
+            }
+            skip_lost_records (tbl_ref, beg_rec_nbr);
+        }
+        if (!writing) {
+            tblDataMgr__->getTableDataWriter()->initWrite(tbl_ref);
+            writing = true;
+        }
+
+        if (store_data (records, tbl_ref, beg_rec_nbr, nrecs, file_span) 
+                != SUCCESS) {
+            break;
+        }
+        num_collected += nrecs;
+
+        if (!more) {
+            caught_up = true;
+        }
+        else if (collectWindow__ > 1) {
+            break;
+        }
+    }
+
+    if (writing) {
+        tblDataMgr__->getTableDataWriter()->finishWrite(tbl_ref);
+    }
+
+    return (num_collected > 0) ? num_collected : -1;
+}
+
+/**
+ * Function to advance the collection past records that were overwritten on
+ * the logger before they could be collected, or that can't be collected 
+ * because the record numbers wrapped around. The cached data for the table
+ * is flushed so that the gap doesn't end up inside a datafile.
+ *
+ * @param tbl_ref: Reference to the Table structure.
+ * @param next_record: Number of the next record to collect.
+ */
+void 
+BMP5Obj :: skip_lost_records (Table& tbl_ref, uint4 next_record)
+{
+    stringstream msgstrm;
+
+    msgstrm << "Adjusting start record index to compensate for backlog:\n"
+            << "\tTable(" << tbl_ref.TblName << ") size: "
+            << tbl_ref.TblSize << " records" << endl
+            << "\tLast collected record id : " << tbl_ref.NextRecord << endl
+            << "\tAdvancing next collection record to : " << next_record 
+            << endl;
+    Category::getInstance("BMP5").info(msgstrm.str());
+
+    tbl_ref.NextRecord = next_record;
+
+    // Reset all the history for this Table
+    if (tbl_ref.NewFileTime) {
+        tblDataMgr__->flushTableDataCache(tbl_ref);
+    }
+}
+
+/**
+ * Function to collect records with a window of GET_DATA_RANGE requests in
+ * flight, each a transaction of the TransactionEngine with its slot of the
+ * window as handler. The engine matches the responses to the requests and
+ * enforces their deadlines; a response arriving ahead of the responses to
+ * earlier requests is held back, so that records are always stored in 
+ * order and Table::NextRecord advances as in the stop-and-wait collection.
+ * A request whose response did not arrive in time is retransmitted once it
+ * is the oldest in the window.
+ *
+ * The pipelined collection stops on anything it does not handle (fragmented
+ * records, empty responses, responses not starting at the requested record
+ * or a request failing MAX_COLLECT_ATTEMPTS times); the requests still in
+ * flight are waited out (see drain_window()) and the caller carries on 
+ * from Table::NextRecord.
+ *
+ * @param tbl_ref: Reference to the Table structure to collect data for.
+ * @param last_rec_nbr: Number of the last record to collect.
+ * @param file_span: Span of a datafile in seconds.
+ * @return Number of records collected.
+ */
+int 
+BMP5Obj :: collect_pipelined (Table& tbl_ref, uint4 last_rec_nbr, 
+        int file_span) throw (AppException)
+{
+    deque<CollectSlot> window;
+    uint4  next_req = tbl_ref.NextRecord;
+    int    num_recs = 0;
+    int    nstored;
+    int    stat;
+    bool   abandon = false;
+    stringstream msgstrm;
+
+    try {
+        while (!abandon && (tbl_ref.NextRecord <= last_rec_nbr)) {
+
+            // Fill up the window, the new requests leave in a single write.
+            // A slot is the handler of its transaction, so it is added to 
+            // the window (where it stays in place) before the request is
+            // sent.
+
+            pbuf__->beginBatch();
+            while ((window.size() < (unsigned int)collectWindow__) && 
+                    (next_req <= last_rec_nbr)) {
+                window.push_back (CollectSlot());
+                CollectSlot& new_slot = window.back();
+                new_slot.P1 = next_req;
+                new_slot.P2 = min(next_req + tbl_ref.RecsPerRequest, 
+                        last_rec_nbr + 1);
+                send_slot_request (tbl_ref, new_slot);
+                next_req = new_slot.P2;
+            }
+            pbuf__->endBatch();
+
+            // Wait for one more request to be answered or to time out
+            if (tranEngine__->getPending()) {
+                run_transactions ("collect transaction", 
+                        tranEngine__->getPending() - 1);
+            }
+
+            // Store the responses in the order of the requests. A response
+            // arriving ahead of the responses to earlier requests is held
+            // in its slot until then.
+
+            while (!abandon && !window.empty()) {
+                CollectSlot& oldest = window.front();
+
+                if (oldest.TimedOut) {
+                    // Retransmit the oldest request
+                    adapt_request_size (tbl_ref, oldest.Requested, 0);
+                    if (++oldest.Attempts >= MAX_COLLECT_ATTEMPTS) {
+                        abandon = true;
+                        break;
+                    }
+                    send_slot_request (tbl_ref, oldest);
+
+                    msgstrm << "Resending request for records " << oldest.P1 
+                            << " to " << oldest.P1 + oldest.Requested - 1 
+                            << " of " << tbl_ref.TblName;
+                    Category::getInstance("BMP5").notice(msgstrm.str());
+                    msgstrm.str("");
+                    break;
+                }
+                if (!oldest.Answered) {
+                    break;
+                }
+
+                if ((stat = test_data_packet (tbl_ref, oldest.Response))) {
+                    PacketErr ("collect_pipelined::test_data_packet", 
+                            oldest.Response, stat);
+                    abandon = true;
+                }
+                else if (CollectTableData::NbrOfRecs::get (frameBody(
+                        oldest.Response.begPacket) + 
+                        CollectResponseMsg::TABLES) & 0x8000) {
+                    // Fragmented records are left to the stop-and-wait 
+                    // collection
+                    abandon = true;
+                }
+                else {
+                    nstored = store_slot_response (tbl_ref, oldest, 
+                            (byte *)oldest.Response.begPacket, file_span);
+                    if (nstored < 0) {
+                        abandon = true;
+                    }
+                    else {
+                        num_recs += nstored;
+                        if (oldest.P1 >= oldest.P2) {
+                            window.pop_front();
+                        }
+                    }
+                }
+            }
+        }
+
+        if (abandon) {
+            msgstrm << "Pipelined collection of " << tbl_ref.TblName 
+                    << " stopped at record " << tbl_ref.NextRecord;
+            Category::getInstance("BMP5").debug(msgstrm.str());
+            drain_window (window);
+        }
+    }
+    catch (AppException& e) {
+        // The slots go away with the window, so their transactions are 
+        // dropped and late responses ignored
+        tranEngine__->cancelAll();
+        throw;
+    }
+    return num_recs;
+}
+
+/**
+ * Function to wait out the requests left in flight when the pipelined 
+ * collection stops. The TransactionEngine runs until each of them is 
+ * answered or its deadline expires, and the responses are discarded with
+ * the window, so that they don't turn up one by one during the 
+ * stop-and-wait collection that carries on from Table::NextRecord.
+ *
+ * @param window: Requests of the pipelined collection, emptied on return.
+ */
+void 
+BMP5Obj :: drain_window (deque<CollectSlot>& window) throw (CommException)
+{
+    run_transactions ("collect transaction");
+    window.clear();
+}
+
+/**
+ * Function to send the collect request for the records of a slot of the
+ * pipelined collection, with the slot as the handler of the transaction.
+ * No more than Table::RecsPerRequest records are asked for; the slot keeps
+ * its range, and the records left out are asked for once the response is
+ * stored (see store_slot_response()), so that the slot still ends where 
+ * the next one begins. A request that can't be sent is treated as timed 
+ * out.
+ *
+ * @param tbl_ref: Reference to the Table structure to collect data for.
+ * @param slot: Request in the window, from P1 up to P2 excluded.
+ */
+void 
+BMP5Obj :: send_slot_request (Table& tbl_ref, CollectSlot& slot) 
+        throw (CommException)
+{
+    slot.Requested = min(slot.P2 - slot.P1, tbl_ref.RecsPerRequest);
+    slot.Answered  = false;
+    slot.TimedOut  = false;
+    slot.Frame.clear();
 
     try {
-        SendPBPacket();
-        pbuf__->readFromDevice();
+        if (sendCollectionCmd (GET_DATA_RANGE, tbl_ref, slot.P1, 
+                slot.P1 + slot.Requested, slot) < 0) {
+            slot.TimedOut = true;
+        }
     } 
     catch (CommException& ce) {
         Category::getInstance("BMP5")
-                 .error("Communication error during Control File transaction");
+                 .error("Communication error during collect transaction");
         throw;
     }
+}
 
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x9e, tran_id);
-        if (stat) {
-            PacketErr ("Control File Transaction", pack, stat);
-        }
-        else {
-	        resp_code = (byte)*(pack.begPacket + 11);
-            if (!resp_code) {
-                hold_off = (int) PBDeserialize ((byte *)pack.begPacket + 12, 2);
-            }
-        }
+/**
+ * Function to store the records contained in the response to the oldest
+ * pipelined collect request. If the response holds fewer records than 
+ * the slot covers, the request is resent for the remaining records. Otherwise 
+ * the request is marked complete (P1 reaches P2) for the caller to remove
+ * it from the window.
+ *
+ * @param tbl_ref: Reference to the Table structure to store data for.
+ * @param slot: Request at the head of the window.
+ * @param pkt: Pointer to the beginning of the (unquoted) response packet.
+ * @param file_span: Span of a datafile in seconds.
+ * @return Number of records stored, -1 if the response doesn't continue 
+ *         the records already stored.
+ */
+int 
+BMP5Obj :: store_slot_response (Table& tbl_ref, CollectSlot& slot, 
+        byte* pkt, int file_span) throw (AppException)
+{
+    byte* data = pkt + PakBusFrame::BODY + CollectResponseMsg::TABLES;
+    uint4 beg_rec_nbr = CollectTableData::BegRecNbr::get (data);
+    uint2 nrecs = (uint2) CollectTableData::NbrOfRecs::get (data) & 0x7fff;
+
+    if ((beg_rec_nbr != slot.P1) || (beg_rec_nbr != tbl_ref.NextRecord) || 
+            !nrecs) {
+        return -1;
+    }
+    if (store_data (data + CollectTableData::RECORDS, tbl_ref, beg_rec_nbr, 
+            nrecs, file_span) 
+            != SUCCESS) {
+        return -1;
+    }
+    adapt_request_size (tbl_ref, slot.Requested, nrecs);
+
+    if ((beg_rec_nbr + nrecs) < slot.P2) {
+        slot.P1       += nrecs;
+        slot.Attempts  = 0;
+        send_slot_request (tbl_ref, slot);
+    }
+    else {
+        slot.P1 = slot.P2;
+    }
+    return nrecs;
+}
+
+/**
+ * Function to set the initial number of records to ask for in each collect
+ * request for a table. Records that fit in a packet are requested so that
+ * the response fills the payload of a packet of MAX_PACK_SIZE bytes, 
+ * records that may be fragmented into several packets one at a time. The 
+ * size adapted during earlier collections is kept.
+ *
+ * @param tbl_ref: Reference to the Table structure.
+ * @param record_size: Size of a record, -1 if the size is variable.
+ */
+void 
+BMP5Obj :: init_request_size (Table& tbl_ref, int record_size)
+{
+    stringstream msgstrm;
+
+    if ((record_size <= 0) || (record_size > MAX_COLLECT_PAYLOAD)) {
+        tbl_ref.MaxRecsPerRequest = 1;
+        tbl_ref.RecsPerRequest    = 1;
+    }
+    else if (!tbl_ref.MaxRecsPerRequest) {
+        tbl_ref.MaxRecsPerRequest = MAX_COLLECT_PAYLOAD/record_size;
+        tbl_ref.RecsPerRequest    = tbl_ref.MaxRecsPerRequest;
+    }
+
+    msgstrm << "Collecting " << tbl_ref.TblName << " with " 
+            << tbl_ref.RecsPerRequest << " records per request (record size "
+            << record_size << " bytes)";
+    Category::getInstance("BMP5").info(msgstrm.str());
+}
+
+/**
+ * Function to adapt the number of records asked for in each collect request
+ * to the outcome of a request, much like a congestion window. The size 
+ * grows by one record after a complete response and is halved when no 
+ * records were received (signature errors or timeouts). A response with 
+ * fewer records than requested brings the size down to the records 
+ * received. This need not be lasting (the ring buffer wrapped around, or
+ * the logger limited that response), so MaxRecsPerRequest is left at the
+ * size derived from the payload for the size to grow back.
+ *
+ * @param tbl_ref: Reference to the Table structure.
+ * @param requested: Number of records requested.
+ * @param nrecs: Number of records received, zero or less on failure.
+ */
+void 
+BMP5Obj :: adapt_request_size (Table& tbl_ref, uint4 requested, int nrecs)
+{
+    uint4 old_size = tbl_ref.RecsPerRequest;
+
+    if (nrecs <= 0) {
+        tbl_ref.RecsPerRequest = max(old_size/2, (uint4)1);
+    }
+    else if ((uint4)nrecs < requested) {
+        tbl_ref.RecsPerRequest = (uint4)nrecs;
+    }
+    else if ((requested >= old_size) && 
+            (old_size < tbl_ref.MaxRecsPerRequest)) {
+        tbl_ref.RecsPerRequest = old_size + 1;
+    }
+
+    if (tbl_ref.RecsPerRequest != old_size) {
+        stringstream msgstrm;
+        msgstrm << "Records per request for " << tbl_ref.TblName 
+                << " changed from " << old_size << " to " 
+                << tbl_ref.RecsPerRequest;
+        Category::getInstance("BMP5").debug(msgstrm.str());
+    }
+}
+
+/**
+ * Function for sending a message to administer tables on the datalogger.
+ * @param ctrl_opt: 0x01 (Reset the table and trash existing records)\n 
+ *                  0x02 (Roll over to a new file if the tables are managed
+ *                        in files)
+ * @return Returns SUCCESS if the Response code is "Complete". FAILIRE if
+ * the response code indicates permission denied, or invalid option/table 
+ * name.
+ */
+int 
+BMP5Obj :: ControlTable (byte ctrl_opt) throw (CommException)
+{
+    Priority__ = 0x02;
+    MsgType__  = 0x19;
+    MsgBodyLen__ = TableControlRequestMsg::SIZE;
+
+    SetSecurityCodeInMsgBody();
+    TableControlRequestMsg::CtrlOption::set (MsgBody__, ctrl_opt);
 
-        packetQueue__->pop_front ();
+    ctrlRespCode__ = 0x01;
+    send_request (ctrlTableTran__, 0x99);
+    run_transactions (ctrlTableTran__.getName());
+
+    if (ctrlRespCode__ == 0x00) {
+	return SUCCESS;
     }
+    else {
+	return FAILURE;
+    }
+}
+
+void 
+BMP5Obj :: parse_control_table (Packet& pack)
+{
+    ctrlRespCode__ = (byte)FileControlResponseMsg::RespCode::get (
+            frameBody(pack.begPacket));
+}
+
+/**
+ * Function to manage program and data files on a data logger.
+ * The file control transaction controls compilation execution of the data-
+ * logger program and manages files on the data logger. Following options are 
+ * supported :
+ * 0x01: Compile and run the program and also make it "run on power-up" file.\n
+ * 0x04: Delete this file.\n
+ * 0x05: Format the device.\n
+ * 0x06: Compile and run the program without deleting data files\n
+ * 0x07: Stop the running program\n
+ * 0x08: Stop the running program and delete associated data files.\n
+ * 0x0a: Compile and run the program without changing "run on power-up" attribute.\n
+ * 0x0c: Resume running program execution.\n
+ * 0x0d: Stop the running program, delete associated data files, run specified 
+ *       file and set it to "run on power-up".\n
+ * 0x0e: Stop the running program, delete associated data files, run specified 
+ *       file but don't change the "run on power-up" attribute.
+ * 
+ * @param file_name: Complete name of the program file (i.e. specify CPU:prog.CR1
+ *                   than prog.CR1)
+ * @param cmd: Code to specify the command to execute. 
+ */
+int 
+BMP5Obj :: ControlFile (const string& file_name, byte cmd) throw (CommException)
+{
+    int   len = file_name.size();
+    byte* tail = FileRequestMsg::tail (MsgBody__, len);
+
+    Priority__ = 0x02;
+    MsgType__  = 0x1e;
+    MsgBodyLen__ = tail + FileControlTail::SIZE - MsgBody__;
 
-    if (resp_code == 0x00) {
-        sleep (hold_off);
+    SetSecurityCodeInMsgBody();
+    memcpy (MsgBody__ + FileRequestMsg::FILE_NAME, file_name.c_str(), 
+            len + 1);
+    FileControlTail::FileCmd::set (tail, cmd);
+
+    ctrlRespCode__ = 0x01;
+    holdOff__      = 0;
+    send_request (ctrlFileTran__, 0x9e);
+    run_transactions (ctrlFileTran__.getName());
+
+    if (ctrlRespCode__ == 0x00) {
+        EventLoop::getInstance().sleep (holdOff__);
 	    return SUCCESS;
     }
     else {
-	    return resp_code;
+	    return ctrlRespCode__;
     }
 } 
 
+void 
+BMP5Obj :: parse_control_file (Packet& pack)
+{
+    const byte* body = frameBody(pack.begPacket);
+
+    ctrlRespCode__ = (byte)FileControlResponseMsg::RespCode::get (body);
+    if (!ctrlRespCode__) {
+        holdOff__ = (int)FileControlResponseMsg::HoldOff::get (body);
+    }
+}
+
 /**
  * Function to retrieve available status information from the datalogger.
  * This function retrieves information about the datalogger, its operating 
@@ -1015,89 +1768,74 @@ BMP5Obj :: ControlFile (const string& file_name, byte cmd)
  * @return Throws AppException on failure;
  */
 void 
-BMP5Obj :: GetProgStats (uint2 security_code) throw (ParseException)
+BMP5Obj :: GetProgStats (uint2 security_code) 
+        throw (CommException, ParseException)
 {
-    int         stat;
-    DLProgStats prog_stat;
-    byte        resp_code = 0x01;
-    byte       *pack_ptr;
+    beginGetProgStats (security_code);
+    run_transactions (progStatsTran__.getName());
+
+    if (!progStatsTran__.Answered || (progStatsCode__ != 0x00)) {
+	throw ParseException(__FILE__, __LINE__,
+                "Failed to obtain programming statistics information"); 
+    }
+    return;
+}
 
+/**
+ * Function to send the Programming Statistics transaction without waiting
+ * for the response, so that other transactions can be run along with it.
+ * The statistics are stored in the TableDataManager once the response is
+ * dispatched by the TransactionEngine.
+ *
+ * @param security_code: Security code of the datalogger, zero by default.
+ */
+void 
+BMP5Obj :: beginGetProgStats (uint2 security_code) throw (CommException)
+{
     Priority__ = 0x02;
     MsgType__  = 0x18;
     MsgBodyLen__ = 2;
 
-    MsgBody__[0] = (byte)(security_code >> 8);     
-    MsgBody__[1] = (byte)(security_code);
+    BMP5RequestMsg::SecurityCode::set (MsgBody__, security_code);
 
-    byte tran_id = GenTranNbr();
+    progStatsCode__ = 0x01;
+    send_request (progStatsTran__, 0x98);
+}
 
-    try {
-        SendPBPacket();
-        pbuf__->readFromDevice();
-    } 
-    catch (CommException& ce) {
-        Category::getInstance("BMP5")
-                 .error("Communication error during Programming Statistics transaction");
-        throw;
+void 
+BMP5Obj :: parse_prog_stats (Packet& pack)
+{
+    DLProgStats prog_stat;
+    byte       *pack_ptr;
+
+    pack_ptr = frameBody(pack.begPacket);
+    progStatsCode__ = *pack_ptr++;
+    if (progStatsCode__) {
+        return;
     }
 
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x98, tran_id);
-        /* 
-         * TODO
-         * I'm seeing a signature error in parsing the response to the GetProgStats
-         * transaction at some of the sites. It is not a random error. The same byte
-         * sequence is returned. This should be investigated to determine if this
-         * error is caused by a special character in the response. i.e. the driver
-         * software transforming a special byte etc. 
-         * However, for now - I'm changing the code to go ahead and parse the response
-         * since this is concerned only with metadata. All transactions dealing with
-         * actual/critical data will continue operating in a strict mode.
-         */
-        if (stat) {
-            Category::getInstance("BMP5").warn("Packet error in Programming Statistics transaction");
-            PacketErr ("Get Programming Statistics Transaction", pack, stat);
-        }
-        else { 
-
-	    resp_code = (byte)*(pack.begPacket + 11);
-            if (!resp_code) {
-                pack_ptr = (byte *)(pack.begPacket + 12);
-
-                prog_stat.OSVer = GetVarLenString (pack_ptr); 
-                pack_ptr += prog_stat.OSVer.size() + 1;
-  
-                prog_stat.OSSig = (uint2) PBDeserialize (pack_ptr, 2);
-                pack_ptr += 2;
-
-                prog_stat.SerialNbr = GetVarLenString (pack_ptr); 
-                int serialNumber = atoi(prog_stat.SerialNbr.c_str());
-
-                if ((serialNumber == 0) && (errno == EINVAL)) {
-                    prog_stat.SerialNbr = "Unknown";
-                }
-                pack_ptr += prog_stat.SerialNbr.size() + 1;
+    prog_stat.OSVer = GetVarLenString (pack_ptr); 
+    pack_ptr += prog_stat.OSVer.size() + 1;
 
-                prog_stat.PowUpProg = GetVarLenString (pack_ptr); 
-                pack_ptr += prog_stat.PowUpProg.size() + 2;
+    prog_stat.OSSig = (uint2) BigEndian<2>::load (pack_ptr);
+    pack_ptr += 2;
 
-                prog_stat.ProgName = GetVarLenString (pack_ptr); 
-                pack_ptr += prog_stat.ProgName.size() + 1;
-  
-                prog_stat.ProgSig = (uint2) PBDeserialize (pack_ptr, 2);
-                tblDataMgr__->setProgStats (prog_stat);
-            }
-        } 
+    prog_stat.SerialNbr = GetVarLenString (pack_ptr); 
+    int serialNumber = atoi(prog_stat.SerialNbr.c_str());
 
-        packetQueue__->pop_front ();
+    if ((serialNumber == 0) && (errno == EINVAL)) {
+        prog_stat.SerialNbr = "Unknown";
     }
+    pack_ptr += prog_stat.SerialNbr.size() + 1;
 
-    if (resp_code != 0x00) {
-	throw ParseException(__FILE__, __LINE__,
-                "Failed to obtain programming statistics information"); 
-    }
-    return;
+    prog_stat.PowUpProg = GetVarLenString (pack_ptr); 
+    pack_ptr += prog_stat.PowUpProg.size() + 2;
+
+    prog_stat.ProgName = GetVarLenString (pack_ptr); 
+    pack_ptr += prog_stat.ProgName.size() + 1;
+
+    prog_stat.ProgSig = (uint2) BigEndian<2>::load (pack_ptr);
+    tblDataMgr__->setProgStats (prog_stat);
 }
 
 /**
@@ -1135,11 +1873,10 @@ BMP5Obj :: get_records (Table& tbl_ref, byte start_mode, int record_size,
     int    data_len = 0;
     byte   frag_record = 0;
     uint2  num_recs = 0;
-    Packet pack;
     int    pack_data_len;
     bool   pending = false;
     int    stat = SUCCESS;
-    int    pack_stat;
+    ResponseTran tran;
     stringstream msgstrm;
     RecordStat recordStat;
 
@@ -1153,111 +1890,104 @@ BMP5Obj :: get_records (Table& tbl_ref, byte start_mode, int record_size,
     }
 
     do {
-        byte tran_id = GenTranNbr();
-        try {
-            sendCollectionCmd (collect_mode, tbl_ref, P1, P2); 
-            pbuf__->readFromDevice();
-        } 
-        catch (CommException& ce) {
-            Category::getInstance("BMP5")
-                     .error("Communication error during collect transaction");
-            throw;
-        }
-        
-        while (packetQueue__->size()) {
-            pack = packetQueue__->front();
-
-            if ((pack_stat = ParsePakBusPacket (pack, 0x89, tran_id))) {
-                stat = ((pack_stat == FAILURE)||((pack_stat & 0x0b) == 0x0b)) 
-                        ? FAILURE:SUCCESS;
-                PacketErr ("get_record::ParsePakBusPacket", pack, pack_stat);
-                packetQueue__->pop_front();
-                continue;
+        if (!collect_transaction (collect_mode, tbl_ref, P1, P2, tran)) {
+            // A request a router couldn't deliver fails the collection,
+            // while the rest of a pending record is asked for again if no
+            // response arrived
+            if (tran.Failed) {
+                stat = FAILURE;
+                break;
             }
+            continue;
+        }
+        Packet& pack = tran.Response;
 
-            /* Check the data packets for problems typical with a data
-             * packet */
-            if ((stat = test_data_packet (tbl_ref, pack))) {
-                PacketErr ("get_record::test_data_packet", pack, stat);
-                packetQueue__->pop_front();
-                continue;
-            }
+        /* Check the data packets for problems typical with a data
+         * packet */
+        if ((stat = test_data_packet (tbl_ref, pack))) {
+            PacketErr ("get_record::test_data_packet", pack, stat);
+            break;
+        }
 
-            /* Obtain the beginning record number and determine if the 
-             * data packet contains a fragmented record */
-            beg_rec_nbr = PBDeserialize ((byte *)(pack.begPacket+14), 4);
-            frag_record = ( (*(pack.begPacket+18) & 0x80) >> 7 );
-            
-             /* Get the time of the first record */
-            if (frag_record) {
-                beg_rec_time = parseRecordTime((byte *)(pack.begPacket+22));
-            }
-            else {
-                beg_rec_time = parseRecordTime((byte *)(pack.begPacket+20));
-            }
+        /* Obtain the beginning record number and determine if the 
+         * data packet contains a fragmented record */
+        byte* data = frameBody(pack.begPacket) + CollectResponseMsg::TABLES;
+        byte* fragment = data + CollectTableData::FRAGMENT;
 
-            if (frag_record) {
-                byte_offset =  PBDeserialize ((byte *)(pack.begPacket+18), 4);
-                byte_offset &= 0x7fffffff; 
-                pack_data_len = (pack.endPacket-4) - (pack.begPacket+30) + 1;
-                // Copy data from the packet to the buffer
-                memcpy ((char*)(dataBuf__+byte_offset), (char*)(pack.begPacket+22), 
-                        pack_data_len); 
-
-                // Set parameters for the next "collect" request
-                collect_mode = 0x08;
-                P1 = beg_rec_nbr;
-                P2 = pack_data_len + byte_offset;
-
-                // In case the data record contains variable length 
-                // fields, I'm assuming that a packet smaller than 512
-                // bytes will indicate that the last data packet for a
-                // record has been received.
-
-                if (record_size == -1) {
-                    if (pack_data_len < 512) {
-                        if (store_mode) {
-                            stat = store_data (dataBuf__, tbl_ref, beg_rec_nbr, 
-                                    1, span); 
-                            if (SUCCESS == stat) {
-                                num_recs = 1;
-                            }
+        beg_rec_nbr = CollectTableData::BegRecNbr::get (data);
+        frag_record = (CollectTableData::NbrOfRecs::get (data) & 0x8000) 
+                >> 15;
+        
+         /* Get the time of the first record */
+        if (frag_record) {
+            beg_rec_time = parseRecordTime(fragment);
+        }
+        else {
+            beg_rec_time = parseRecordTime(data + 
+                    CollectTableData::RECORDS);
+        }
+
+        if (frag_record) {
+            byte_offset =  CollectTableData::ByteOffset::get (data);
+            byte_offset &= 0x7fffffff; 
+            pack_data_len = (frameBodyEnd(pack.endPacket) - 
+                    CollectResponseMsg::TRAILER) - 
+                    (fragment + RecordTimeLayout::SIZE);
+            // Copy data from the packet to the buffer
+            memcpy ((char*)(dataBuf__+byte_offset), (char*)fragment, 
+                    pack_data_len); 
+
+            // Set parameters for the next "collect" request
+            collect_mode = 0x08;
+            P1 = beg_rec_nbr;
+            P2 = pack_data_len + byte_offset;
+
+            // In case the data record contains variable length 
+            // fields, I'm assuming that a packet smaller than 512
+            // bytes will indicate that the last data packet for a
+            // record has been received.
+
+            if (record_size == -1) {
+                if (pack_data_len < 512) {
+                    if (store_mode) {
+                        stat = store_data (dataBuf__, tbl_ref, beg_rec_nbr, 
+                                1, span); 
+                        if (SUCCESS == stat) {
+                            num_recs = 1;
                         }
-                        pending = false;
-                    }
-                    else {
-                        pending  = true;
                     }
+                    pending = false;
                 }
                 else {
-                    data_len += pack_data_len; 
-                    if (data_len >= record_size) {
-                        if (store_mode) {
-                            stat = store_data (dataBuf__, tbl_ref, beg_rec_nbr, 
-                                    1, span); 
-                            if (SUCCESS == stat) {
-                                num_recs = 1;
-                            }
-                        }
-                        pending = false;
-                    }
-                    else {
-                        pending = true;
-                    }
+                    pending  = true;
                 }
             }
             else {
-                // We are not dealing with a fragmented record
-                if (store_mode) {
-                    num_recs = (uint2) PBDeserialize ((byte *)(pack.begPacket+18), 2);
-                    num_recs &= 0x7fff;
-                    stat = store_data ((byte *)(pack.begPacket+20), tbl_ref, 
-                               beg_rec_nbr, num_recs, span);
+                data_len += pack_data_len; 
+                if (data_len >= record_size) {
+                    if (store_mode) {
+                        stat = store_data (dataBuf__, tbl_ref, beg_rec_nbr, 
+                                1, span); 
+                        if (SUCCESS == stat) {
+                            num_recs = 1;
+                        }
+                    }
+                    pending = false;
+                }
+                else {
+                    pending = true;
                 }
-                pending = false;
             }
-
-            packetQueue__->pop_front();
+        }
+        else {
+            // We are not dealing with a fragmented record
+            if (store_mode) {
+                num_recs = (uint2) CollectTableData::NbrOfRecs::get (data);
+                num_recs &= 0x7fff;
+                stat = store_data (data + CollectTableData::RECORDS, 
+                           tbl_ref, beg_rec_nbr, num_recs, span);
+            }
+            pending = false;
         }
 
         if (stat != SUCCESS) {
@@ -1290,12 +2020,13 @@ BMP5Obj :: get_records (Table& tbl_ref, byte start_mode, int record_size,
 int 
 BMP5Obj :: test_data_packet (Table& tbl_ref, Packet& pack) throw (AppException)
 {
-    byte* ptr = (byte *)(pack.begPacket + 11);
+    byte* ptr = frameBody(pack.begPacket);
+    byte* end = frameBodyEnd(pack.endPacket);
 
-    // The response should be larger than 12 bytes to contain any record
-    if (pack.endPacket < (pack.begPacket + 10)) {
+    // The response should at least hold the response code
+    if (end < ptr + CollectResponseMsg::TABLES) {
         Category::getInstance("BMP5")
-                .warn("Invalid response - data packet smaller than 12 bytes.");
+                .warn("Invalid response - data packet without a response code.");
         return FAILURE;
     }
 
@@ -1319,11 +2050,11 @@ BMP5Obj :: test_data_packet (Table& tbl_ref, Packet& pack) throw (AppException)
                     "Collect Error");
         }
     }
-    ptr++;
+    ptr += CollectResponseMsg::TABLES;
 
     // Get past the "Table Number" field
-    int tbl_num_from_resp = (int) PBDeserialize (ptr, 2);
-    ptr += 2;
+    int tbl_num_from_resp = (int) CollectTableData::TableNbr::get (ptr);
+    ptr += CollectTableData::TableNbr::END;
 
     if (tbl_num_from_resp != tbl_ref.TblNum) {
         Category::getInstance("BMP5")
@@ -1331,7 +2062,7 @@ BMP5Obj :: test_data_packet (Table& tbl_ref, Packet& pack) throw (AppException)
         return FAILURE;
     }
 
-    if (ptr >= ((byte *)pack.endPacket-2)) {
+    if (ptr >= end) {
         Category::getInstance("BMP5")
                 .warn("No data available from table - " + tbl_ref.TblName);
         return FAILURE;
@@ -38,46 +38,52 @@ PakCtrlObj :: PakCtrlObj() : PakBusMsg()
 
 /**
  * Execute a "HelloTransaction" prior to sending a command to a PakBus device.
+ * The Hello is repeated with increasing hop metrics, which give the device
+ * more time to respond, up to max_hop_metric. The time allowed by the hop 
+ * metric is added to the deadline of the transaction, which ends as soon as
+ * the device responds.
  */
-int PakCtrlObj :: HelloTransaction() throw (PakBusException)
+int PakCtrlObj :: HelloTransaction(byte max_hop_metric) 
+        throw (CommException, PakBusException)
 {
-    Packet pack;    
-    int    stat;
+    ResponseTran tran;
     byte   hop_metric = 0x01;
     bool   dev_replied = false;
     int    sleep_secs = 0;
     byte   hop_metric_response = 0;
 
     MsgType__    = 0x09;         // Message type
-    MsgBodyLen__ = 4;
-    MsgBody__[0] = 0x00;         // Source is not router
-    MsgBody__[2] = 0x00;         // Link verification interval
-    MsgBody__[3] = 0x3c;         // LSB of link verification
-                               // interval
-    while (hop_metric < 0x06) 
+    MsgBodyLen__ = HelloMsg::SIZE;
+
+    // Source is not router, link verification interval of 60 secs
+    HelloMsg::IsRouter::set(MsgBody__, 0x00);
+    HelloMsg::VerifyIntv::set(MsgBody__, 0x003c);
+
+    while (hop_metric <= max_hop_metric) 
     {
-        MsgBody__[1] = hop_metric; 
-        GenTranNbr();
-        byte tran_id = GenTranNbr();
-        
+        HelloMsg::HopMetric::set(MsgBody__, hop_metric);
+
+        switch (hop_metric) 
+        {
+            case 0x01 : sleep_secs = 1; 
+                        break;
+            case 0x02 : sleep_secs = 5; 
+                        break;
+            case 0x03 : sleep_secs = 10; 
+                        break;
+            case 0x04 : sleep_secs = 20; 
+                        break;
+            case 0x05 : sleep_secs = 60; 
+                        break;
+        }
+
         try {
-            SendPBPacket();
-            switch (hop_metric) 
-            {
-                case 0x01 : sleep_secs = 1; 
-                            break;
-                case 0x02 : sleep_secs = 5; 
-                            break;
-                case 0x03 : sleep_secs = 10; 
-                            break;
-                case 0x04 : sleep_secs = 20; 
-                            break;
-                case 0x05 : sleep_secs = 60; 
-                            break;
+            if (transact (tran, 0x89, 
+                    sleep_secs*1000 + pbuf__->getReadTimeout())) {
+	        hop_metric_response = (byte)HelloMsg::HopMetric::get(
+                        frameBody(tran.Response.begPacket));
+                dev_replied = true;
             }
-            sleep (sleep_secs);
-          
-            pbuf__->readFromDevice();
         }
         catch (CommException& ce) {
             Category::getInstance("PakCtrl")
@@ -85,19 +91,6 @@ int PakCtrlObj :: HelloTransaction() throw (PakBusException)
             throw;
         }
 
-        while (packetQueue__->size()) {
-            pack = packetQueue__->front();
-            stat = ParsePakBusPacket (pack, 0x89, tran_id);
-            if (stat) {
-                PacketErr ("Hello Transaction", pack, stat);
-            }
-            else {
-	        hop_metric_response = (byte)*(pack.begPacket + 12);
-                dev_replied = true;
-            }
-            packetQueue__->pop_front ();
-        }
-
         if (dev_replied) {
             break;
         }
@@ -177,27 +170,15 @@ byte PakCtrlObj :: HelloRequest ()
 
 void PakCtrlObj :: GetSetting (uint2 setting_id)
 {
-    int stat;
+    ResponseTran tran;
     MsgType__  = 0x0f;
-    GenTranNbr();
     MsgBodyLen__ = 4;
     SetSecurityCodeInMsgBody();
-    PBSerialize (MsgBody+2, setting_id, 2);
-    byte tran_id = TranNbr;
-    SendPBPacket();
-
-    pbuf__->readFromDevice();
+    BigEndian<2>::store (MsgBody+2, setting_id);
 
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x8f, tran_id);
-        if (stat) {
-            PacketErr ("DevConfig Get Setting Transaction", pack, stat);
-        }
-        else {
-            byte val = (byte)PBDeserialize ((byte *)pack.begPacket + 9, 4);
-        }
-        packetQueue__->pop_front ();
+    if (transact (tran, 0x8f)) {
+        byte val = (byte)BigEndian<4>::load (
+                (byte *)tran.Response.begPacket + 9);
     }
     return;
 }
@@ -211,7 +192,7 @@ int PakCtrlObj :: SetSetting (uint2 setting_id, string val)
 int PakCtrlObj :: SetSetting (uint2 setting_id, uint2 val)
 {
     byte tmp[2];
-    PBSerialize (tmp, val, 2);
+    BigEndian<2>::store (tmp, val);
     int stat = generic_set_setting (setting_id, 2, tmp);
     return stat;
 }
@@ -219,40 +200,27 @@ int PakCtrlObj :: SetSetting (uint2 setting_id, uint2 val)
 int PakCtrlObj :: SetSetting (uint2 setting_id, uint4 val)
 {
     byte tmp[4];
-    PBSerialize (tmp, val, 4);
+    BigEndian<4>::store (tmp, val);
     int stat = generic_set_setting (setting_id, 4, tmp);
     return stat;
 }
 
 int PakCtrlObj :: generic_set_setting (uint2 setting_id, uint2 setting_len, byte *val)
 {
-    int stat;
-    byte cmd_stat;
+    ResponseTran tran;
+    byte cmd_stat = 0;
 
     MsgType__  = 0x10;
-    GenTranNbr();
     MsgBodyLen__ = 6 + setting_len;
 
     SetSecurityCodeInMsgBody();
-    PBSerialize (MsgBody+2, setting_id, 2);
-    PBSerialize (MsgBody+4, setting_len, 2);
+    BigEndian<2>::store (MsgBody+2, setting_id);
+    BigEndian<2>::store (MsgBody+4, setting_len);
     memcpy (MsgBody+6, val, setting_len);
-    byte tran_id = TranNbr;
-    SendPBPacket();
 
-    pbuf__->readFromDevice();
-
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x90, tran_id);
-        if (stat) {
-            PacketErr ("DevConfig Set Setting Transaction", pack, stat);
-        }
-        else {
-            cmd_stat = (byte)(*(pack.begPacket + 11) |
-                            *(pack.begPacket + 14));
-        }
-        packetQueue__->pop_front ();
+    if (transact (tran, 0x90)) {
+        cmd_stat = (byte)(*(tran.Response.begPacket + 11) |
+                        *(tran.Response.begPacket + 14));
     }
 
     if (cmd_stat == 0x01){
@@ -270,30 +238,17 @@ int PakCtrlObj :: generic_set_setting (uint2 setting_id, uint2 setting_len, byte
 
 int PakCtrlObj :: devconfig_ctrl_transaction (byte action)
 {
-    int stat;
-    byte cmd_stat;
+    ResponseTran tran;
+    byte cmd_stat = 0;
 
     MsgType__  = 0x13;
-    GenTranNbr();
     MsgBodyLen__ = 3;
 
     SetSecurityCodeInMsgBody();
     MsgBody__[2] = action;
-    byte tran_id = TranNbr;
-    SendPBPacket();
 
-    pbuf__->readFromDevice();
-
-    while (packetQueue__->size()) {
-        Packet pack = packetQueue__->front();
-        stat = ParsePakBusPacket (pack, 0x93, tran_id);
-        if (stat) {
-            PacketErr ("DevConfig Control Transaction", pack, stat);
-        }
-        else {
-            cmd_stat = (byte)(*(pack.begPacket + 11));
-        }
-        packetQueue__->pop_front ();
+    if (transact (tran, 0x93)) {
+        cmd_stat = (byte)(*(tran.Response.begPacket + 11));
     }
     return cmd_stat;
 } 
@@ -0,0 +1,330 @@
+/**
+ * @file pb5_trans.cpp
+ * Implements the engine driving the PakBus transactions of a session.
+ */
+
+#include <sstream>
+#include <algorithm>
+#include <log4cpp/Category.hh>
+#include "pb5_trans.h"
+#include "pb5_proto.h"
+
+using namespace std;
+using namespace log4cpp;
+
+/////////////////////////////////////////////////////////////////////
+//           Implementation of TimerWheel class                    //
+/////////////////////////////////////////////////////////////////////
+
+TimerWheel :: TimerWheel() : slots__(TRAN_WHEEL_SLOTS), baseTime__(0),
+        lastTick__(0), count__(0)
+{
+}
+
+uint4 TimerWheel :: current_tick()
+{
+    return (uint4)msec_diff(get_msec_clock(), baseTime__) / TRAN_WHEEL_TICK;
+}
+
+/**
+ * Function to start a timer.
+ *
+ * @param id: Identifier returned by expire() when the timer expires.
+ * @param msecs: Time to expiry, rounded up to the next tick.
+ */
+void TimerWheel :: schedule(uint4 id, int msecs)
+{
+    if (count__ == 0) {
+        baseTime__ = get_msec_clock();
+        lastTick__ = 0;
+    }
+
+    uint4 elapsed = (uint4)msec_diff(get_msec_clock(), baseTime__);
+    uint4 due = (elapsed + max(msecs, 0) + TRAN_WHEEL_TICK - 1)/
+            TRAN_WHEEL_TICK;
+
+    if (due <= lastTick__) {
+        due = lastTick__ + 1;
+    }
+    // The slot is visited once per turn of the wheel, starting with the
+    // first visit after the last expired tick
+    slots__[due % TRAN_WHEEL_SLOTS]
+            .push_back(Timer(id, (due - lastTick__ - 1)/TRAN_WHEEL_SLOTS));
+    count__++;
+}
+
+/**
+ * Returns the time (msecs) until the next timer expires, zero if a timer
+ * is already due and -1 if no timer is running. If no timer expires
+ * within a turn of the wheel, the time to the end of the turn is returned.
+ */
+int TimerWheel :: nextExpiry()
+{
+    if (count__ == 0) {
+        return -1;
+    }
+
+    int   elapsed = msec_diff(get_msec_clock(), baseTime__);
+    uint4 tick;
+
+    for (tick = lastTick__ + 1; tick <= lastTick__ + TRAN_WHEEL_SLOTS;
+            tick++) {
+        list<Timer>& slot = slots__[tick % TRAN_WHEEL_SLOTS];
+        list<Timer>::iterator it;
+
+        for (it = slot.begin(); it != slot.end(); it++) {
+            if (it->Rounds == 0) {
+                return max((int)(tick*TRAN_WHEEL_TICK) - elapsed, 0);
+            }
+        }
+    }
+    return max((int)((tick - 1)*TRAN_WHEEL_TICK) - elapsed, 0);
+}
+
+/**
+ * Function to remove the timers that expired since the last call.
+ *
+ * @param due: The identifiers of the expired timers are appended to it.
+ */
+void TimerWheel :: expire(vector<uint4>& due)
+{
+    uint4 now = current_tick();
+
+    while ((lastTick__ < now) && count__) {
+        lastTick__++;
+
+        list<Timer>& slot = slots__[lastTick__ % TRAN_WHEEL_SLOTS];
+        list<Timer>::iterator it = slot.begin();
+
+        while (it != slot.end()) {
+            if (it->Rounds == 0) {
+                due.push_back(it->Id);
+                it = slot.erase(it);
+                count__--;
+            }
+            else {
+                it->Rounds--;
+                it++;
+            }
+        }
+    }
+}
+
+void TimerWheel :: clear()
+{
+    for (size_t idx = 0; idx < slots__.size(); idx++) {
+        slots__[idx].clear();
+    }
+    count__ = 0;
+}
+
+/////////////////////////////////////////////////////////////////////
+//           Implementation of TransactionEngine class             //
+/////////////////////////////////////////////////////////////////////
+
+TransactionEngine :: TransactionEngine() : lastTimerId__(0),
+        lastTranNbr__(0), pbuf__(NULL), screen__(NULL)
+{
+}
+
+/**
+ * Function to allocate the transaction number of a new request. Numbers
+ * of the outstanding transactions are skipped.
+ */
+byte TransactionEngine :: nextTranNbr()
+{
+    for (int count = 0; count < 256; count++) {
+        if (!isPending(++lastTranNbr__)) {
+            break;
+        }
+    }
+    return lastTranNbr__;
+}
+
+/**
+ * Function to register a request that was sent to the logger. A request
+ * sent again under the same transaction number replaces the earlier one
+ * along with its deadline.
+ *
+ * @param resp_type: Message type of the response.
+ * @param tran_nbr: Transaction number of the request.
+ * @param handler: Object notified of the outcome, it must stay valid until
+ *                 then.
+ * @param msecs: Deadline for the response, the read deadline of the I/O
+ *               buffer if zero.
+ */
+void TransactionEngine :: begin(byte resp_type, byte tran_nbr,
+        TranHandler* handler, int msecs)
+{
+    Outstanding tran;
+
+    if (msecs <= 0) {
+        msecs = pbuf__->getReadTimeout();
+    }
+    // The transaction number is kept in the timer id, so that a timer
+    // expiring for an earlier request under the same number is ignored
+    tran.RespType = resp_type;
+    tran.Handler  = handler;
+    tran.TimerId  = (++lastTimerId__ << 8) | tran_nbr;
+    outstanding__[tran_nbr] = tran;
+    wheel__.schedule(tran.TimerId, msecs);
+}
+
+/**
+ * Function to drop an outstanding transaction without notifying its
+ * handler. A late response is ignored.
+ */
+void TransactionEngine :: cancel(byte tran_nbr)
+{
+    outstanding__.erase(tran_nbr);
+}
+
+void TransactionEngine :: cancelAll()
+{
+    outstanding__.clear();
+    wheel__.clear();
+}
+
+bool TransactionEngine :: isPending(byte tran_nbr)
+{
+    return outstanding__.find(tran_nbr) != outstanding__.end();
+}
+
+/**
+ * Function to remove an outstanding transaction.
+ *
+ * @return The handler of the transaction, NULL if it isn't outstanding.
+ */
+TranHandler* TransactionEngine :: take(byte tran_nbr)
+{
+    map<byte, Outstanding>::iterator it = outstanding__.find(tran_nbr);
+    TranHandler* handler = NULL;
+
+    if (it != outstanding__.end()) {
+        handler = it->second.Handler;
+        outstanding__.erase(it);
+    }
+    return handler;
+}
+
+/**
+ * Function to read from the device and dispatch the responses until no
+ * more than max_pending transactions are outstanding. Packets already in
+ * the packet queue, and the input received since the last run, are 
+ * dispatched first: the caller may have been busy with earlier responses
+ * past the deadline of a transaction whose response is already there. On
+ * a communication error, the outstanding transactions are dropped without
+ * notifying their handlers and the error is thrown.
+ */
+void TransactionEngine :: run(int max_pending) throw (CommException)
+{
+    bool fresh = false;
+
+    try {
+        if ((int)outstanding__.size() > max_pending) {
+            pbuf__->readAvailable();
+        }
+        while ((int)outstanding__.size() > max_pending) {
+            dispatch_queue(fresh);
+            expire_timers();
+
+            if ((int)outstanding__.size() <= max_pending) {
+                break;
+            }
+            pbuf__->readPackets(wheel__.nextExpiry());
+            fresh = true;
+        }
+    }
+    catch (CommException& ce) {
+        cancelAll();
+        throw;
+    }
+    // The timers left by cancelled transactions are dropped once nothing
+    // is outstanding
+    if (outstanding__.empty()) {
+        wheel__.clear();
+    }
+}
+
+/**
+ * Function to hand the queued packets to the handlers of the transactions
+ * they answer. Hello requests and link state packets are answered by the
+ * packet screen, and a "please wait" notification extends the deadline of
+ * its transaction by the wait the logger announced. Other packets are 
+ * dropped.
+ *
+ * @param fresh: Set if the packets were framed by the last read, so that
+ *               the round trip time of the transactions can be measured.
+ */
+void TransactionEngine :: dispatch_queue(bool fresh) throw (CommException)
+{
+    deque<Packet>* packetQueue = pbuf__->getPacketQueue();
+
+    while (packetQueue->size()) {
+        Packet pack = packetQueue->front();
+        int    stat = screen__->ScreenPacket(pack);
+        byte   tran_nbr = pack.Summary.TranNbr;
+
+        // A delivery failure carries the header of the undelivered
+        // request after the error code
+        if ((stat == DELIVERY_FAILURE) &&
+                (pack.endPacket - pack.begPacket + 1 >= 25)) {
+            tran_nbr = (byte)PakBusHeader::TranNbr::get(
+                    frameBody(pack.begPacket) + DeliveryFailureMsg::HEADER);
+        }
+
+        map<byte, Outstanding>::iterator it = outstanding__.find(tran_nbr);
+
+        if ((stat == SUCCESS) && ((it == outstanding__.end()) ||
+                (it->second.RespType != pack.Summary.MsgType))) {
+            stat = IGNORE_MSG;
+        }
+
+        if (stat == SUCCESS) {
+            pbuf__->responseReceived(tran_nbr, fresh);
+            take(tran_nbr)->onResponse(pack);
+        }
+        else if ((stat == PLEASE_WAIT) && (it != outstanding__.end())) {
+            // The deadline moves to the end of the wait, the timer armed
+            // earlier is ignored once it expires
+            it->second.TimerId = (++lastTimerId__ << 8) | tran_nbr;
+            wheel__.schedule(it->second.TimerId, pbuf__->deferResponse(pack));
+        }
+        else if ((stat == DELIVERY_FAILURE) && (it != outstanding__.end())) {
+            screen__->PacketErr("Transaction Engine", pack, stat);
+            take(tran_nbr)->onDeliveryFailure(pack);
+        }
+        else {
+            screen__->PacketErr("Transaction Engine", pack, stat);
+        }
+        packetQueue->pop_front();
+    }
+}
+
+/**
+ * Function to notify the handlers of the transactions whose deadline
+ * expired. Each expiry backs off the read deadline.
+ */
+void TransactionEngine :: expire_timers() throw (CommException)
+{
+    vector<uint4> due;
+
+    wheel__.expire(due);
+    for (size_t idx = 0; idx < due.size(); idx++) {
+        byte tran_nbr = (byte)(due[idx] & 0xff);
+        map<byte, Outstanding>::iterator it = outstanding__.find(tran_nbr);
+
+        if ((it == outstanding__.end()) || (it->second.TimerId != due[idx])) {
+            continue;
+        }
+        if (Category::getInstance("TransactionEngine").isDebugEnabled()) {
+            stringstream msgstrm;
+            msgstrm << "No response to transaction " << byte2int(tran_nbr)
+                    << " before the deadline";
+            Category::getInstance("TransactionEngine").debug(msgstrm.str());
+        }
+        TranHandler* handler = take(tran_nbr);
+        pbuf__->responseTimedOut();
+        handler->onTimeout();
+    }
+}
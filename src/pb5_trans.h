@@ -0,0 +1,141 @@
+/**
+ * @file pb5_trans.h
+ * Provides the engine tracking the outstanding PakBus transactions on a
+ * session, dispatching their responses and enforcing their deadlines.
+ */
+
+#ifndef PB5_TRANS_H
+#define PB5_TRANS_H
+#include <map>
+#include <list>
+#include <vector>
+#include "pb5_buf.h"
+using namespace std;
+
+// Resolution of the transaction deadlines (msecs)
+#define TRAN_WHEEL_TICK  20
+// Number of slots in the timer wheel. Deadlines further away than a full
+// turn of the wheel wait for the required number of turns in their slot.
+#define TRAN_WHEEL_SLOTS 256
+
+class PakBusMsg;
+
+/**
+ * Interface of the objects notified of the outcome of a transaction.
+ * Exactly one of the functions is called for each transaction started
+ * with TransactionEngine::begin(), after the transaction is removed from
+ * the engine. The functions may start further transactions.
+ */
+class TranHandler {
+    public :
+        virtual ~TranHandler() {}
+        /** Called with the response to the request. */
+        virtual void onResponse(Packet& pack) = 0;
+        /** Called if no response arrived before the deadline. */
+        virtual void onTimeout() = 0;
+        /**
+         * Called if a router reported that the request couldn't be
+         * delivered. The error code is at offset 11 of the packet.
+         */
+        virtual void onDeliveryFailure(Packet& pack) { onTimeout(); }
+};
+
+/**
+ * Handler keeping the response to a request for the caller to process once
+ * the engine has run. The frame of the response stays in the input buffer
+ * until the next read from the device.
+ */
+class ResponseTran : public TranHandler {
+    public :
+        ResponseTran() : Answered(false), Failed(false) {}
+        void  reset() { Answered = Failed = false; }
+        void  onResponse(Packet& pack) { Response = pack; Answered = true; }
+        void  onTimeout() {}
+        void  onDeliveryFailure(Packet& pack) { Failed = true; }
+
+        Packet Response;
+        bool   Answered;
+        bool   Failed;    // A router couldn't deliver the request
+};
+
+/**
+ * Hashed timer wheel. Each timer is kept in the slot of the tick it
+ * expires at, along with the number of turns of the wheel left before
+ * expiry, so that starting and expiring a timer take constant time
+ * regardless of the number of timers running.
+ *
+ * The ticks are counted from the time the first timer was started while
+ * the wheel was empty.
+ */
+class TimerWheel {
+    public :
+        TimerWheel();
+        void  schedule(uint4 id, int msecs);
+        int   nextExpiry();
+        void  expire(vector<uint4>& due);
+        void  clear();
+        bool  empty() { return count__ == 0; }
+
+    private :
+        struct Timer {
+            Timer(uint4 id, uint4 rounds) : Id(id), Rounds(rounds) {}
+            uint4 Id;
+            uint4 Rounds;  // Turns of the wheel left before expiry
+        };
+        uint4 current_tick();
+
+        vector< list<Timer> > slots__;
+        uint4 baseTime__;  // Clock reading at tick 0
+        uint4 lastTick__;  // Last tick whose slot was expired
+        int   count__;     // Number of timers in the wheel
+};
+
+/**
+ * Engine driving the PakBus transactions of a session over the I/O buffer.
+ * A transaction is started by sending the request and registering it with
+ * begin(), which arms its deadline. run() then reads from the device and
+ * hands each response to the handler registered under its transaction
+ * number, until no transaction is outstanding. Hello requests and link
+ * state packets from the logger are answered while reading, and requests
+ * not answered by their deadline are reported to their handlers, so
+ * several requests can be in flight at once instead of each one waiting
+ * for the previous one to be answered or to time out.
+ *
+ * The engine hands out the transaction numbers of the session, so that the
+ * numbers stay unique across the protocol objects sharing the buffer.
+ */
+class TransactionEngine {
+    public :
+        TransactionEngine();
+        void  setIOBuf(pakbuf* IOBuf) { pbuf__ = IOBuf; }
+        void  setPacketScreen(PakBusMsg* screen) { screen__ = screen; }
+        byte  nextTranNbr();
+        void  begin(byte resp_type, byte tran_nbr, TranHandler* handler,
+                  int msecs = 0);
+        void  cancel(byte tran_nbr);
+        void  cancelAll();
+        bool  isPending(byte tran_nbr);
+        /** Returns the number of outstanding transactions. */
+        int   getPending() { return outstanding__.size(); }
+        void  run(int max_pending = 0) throw (CommException);
+
+    protected :
+        void  dispatch_queue(bool fresh) throw (CommException);
+        void  expire_timers() throw (CommException);
+        TranHandler* take(byte tran_nbr);
+
+    private :
+        struct Outstanding {
+            byte         RespType;  // Message type of the response
+            TranHandler* Handler;
+            uint4        TimerId;   // Id of the deadline in the wheel
+        };
+        map<byte, Outstanding> outstanding__;
+        TimerWheel  wheel__;
+        uint4       lastTimerId__;
+        byte        lastTranNbr__;
+        pakbuf     *pbuf__;
+        PakBusMsg  *screen__;   // Validates packets and answers Hello
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file rtt_estimator.cpp
+ * Implements the round trip time estimator setting the read deadlines.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <math.h>
+#include <log4cpp/Category.hh>
+#include "rtt_estimator.h"
+#include "pb5_buf.h"
+
+using namespace std;
+using namespace log4cpp;
+
+RttEstimator :: RttEstimator() : srtt__(0), rttvar__(0), nsamples__(0),
+        backoff__(0), initial__(DEFAULT_READ_TIMEOUT), min__(RTT_MIN_TIMEOUT),
+        max__(RTT_MAX_TIMEOUT)
+{
+}
+
+/**
+ * Function to set the bounds of the deadline.
+ *
+ * @param minTimeout: Lower bound (msecs), e.g. the time to transfer a
+ *                    packet of maximum size on a slow port.
+ * @param maxTimeout: Upper bound (msecs).
+ */
+void RttEstimator :: setBounds(int minTimeout, int maxTimeout)
+{
+    min__ = max(minTimeout, RTT_CLOCK_GRANULARITY);
+    max__ = max(maxTimeout, min__);
+}
+
+/**
+ * Function to add the round trip time of a transaction to the estimate.
+ * Only transactions answered at the first attempt must be measured, as the
+ * response to a retry can't be told from a late response.
+ *
+ * @param msecs: Time from sending the request to receiving the response.
+ */
+void RttEstimator :: addSample(int msecs)
+{
+    double rtt = max(msecs, 0);
+
+    if (nsamples__ == 0) {
+        srtt__   = rtt;
+        rttvar__ = rtt/2;
+    }
+    else {
+        rttvar__ = 0.75*rttvar__ + 0.25*fabs(srtt__ - rtt);
+        srtt__   = 0.875*srtt__ + 0.125*rtt;
+    }
+    nsamples__++;
+    backoff__ = 0;
+}
+
+/**
+ * Function to double the deadline after a transaction timed out.
+ */
+void RttEstimator :: backoff()
+{
+    if (backoff__ < RTT_MAX_BACKOFF) {
+        backoff__++;
+    }
+}
+
+/**
+ * Returns the deadline (msecs) for receiving the response to a request.
+ */
+int RttEstimator :: getTimeout()
+{
+    double timeout = initial__;
+
+    if (nsamples__) {
+        timeout = srtt__ + max((double)RTT_CLOCK_GRANULARITY, 4*rttvar__);
+    }
+    timeout = max((double)min__, timeout) * (1 << backoff__);
+    return (int)min((double)max__, timeout);
+}
+
+/**
+ * Returns a description of the estimate for the logs.
+ */
+string RttEstimator :: toString()
+{
+    stringstream msgstrm;
+
+    if (nsamples__) {
+        msgstrm << "round trip time " << (int)srtt__ << " ms (deviation "
+                << (int)rttvar__ << " ms, " << nsamples__ << " samples)";
+    }
+    else {
+        msgstrm << "round trip time not measured yet";
+    }
+    msgstrm << ", read deadline " << getTimeout() << " ms";
+    return msgstrm.str();
+}
+
+/**
+ * Function to load the estimate saved by an earlier run.
+ *
+ * @param file: Path of the file written by save().
+ * @return true if an estimate was loaded.
+ */
+bool RttEstimator :: load(const string& file)
+{
+    ifstream rttFs(file.c_str());
+    string   comment;
+    double   srtt, rttvar;
+    long     nsamples;
+
+    getline(rttFs, comment);
+    if (!(rttFs >> srtt >> rttvar >> nsamples) || (srtt < 0) ||
+            (rttvar < 0) || (nsamples <= 0)) {
+        return false;
+    }
+    srtt__     = srtt;
+    rttvar__   = rttvar;
+    nsamples__ = nsamples;
+    backoff__  = 0;
+
+    Category::getInstance("RttEstimator")
+             .info("Loaded the " + toString());
+    return true;
+}
+
+/**
+ * Function to save the estimate for the next run.
+ *
+ * @param file: Path of the file, in the working directory.
+ */
+void RttEstimator :: save(const string& file)
+{
+    if (nsamples__ == 0) {
+        return;
+    }
+
+    ofstream rttFs(file.c_str(), ofstream::out);
+
+    if (rttFs.is_open()) {
+        rttFs << "# SmoothedRtt, RttDeviation, Samples" << endl
+              << srtt__ << " " << rttvar__ << " " << nsamples__ << endl;
+    }
+    else {
+        Category::getInstance("RttEstimator")
+                 .error("Failed to store the round trip time in " + file);
+    }
+}
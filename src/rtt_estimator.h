@@ -0,0 +1,54 @@
+/**
+ * @file rtt_estimator.h
+ * Provides the estimate of the round trip time to a logger, from which the
+ * read deadline of each transaction is set.
+ */
+
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+#include <string>
+using namespace std;
+
+// Bounds of the read deadline (msecs)
+#define RTT_MIN_TIMEOUT 100
+#define RTT_MAX_TIMEOUT 60000
+// Resolution of the clock the round trip times are measured with (msecs)
+#define RTT_CLOCK_GRANULARITY 10
+// Maximum number of times the deadline is doubled after successive timeouts
+#define RTT_MAX_BACKOFF 6
+
+/**
+ * Estimator of the round trip time to a logger, computed as for the TCP
+ * retransmission timeout (RFC 6298): the deadline is the smoothed round
+ * trip time plus four times its mean deviation. Each timeout doubles the
+ * deadline until the next measurement. Until the first measurement, the
+ * initial deadline of the connection is used.
+ *
+ * The estimate is kept in the working directory between runs, so that a
+ * run starts with the deadline the previous one ended with.
+ */
+class RttEstimator {
+    public :
+        RttEstimator();
+        void   setBounds(int minTimeout, int maxTimeout);
+        void   setInitialTimeout(int msecs) { initial__ = msecs; }
+        void   addSample(int msecs);
+        void   backoff();
+        int    getTimeout();
+        /** Returns the number of round trip times measured. */
+        long   getSamples() { return nsamples__; }
+        string toString();
+        bool   load(const string& file);
+        void   save(const string& file);
+
+    private :
+        double srtt__;         // Smoothed round trip time (msecs)
+        double rttvar__;       // Mean deviation of the round trip time
+        long   nsamples__;     // Number of measurements, 0 if none yet
+        int    backoff__;      // Doublings since the last measurement
+        int    initial__;      // Deadline used before the first measurement
+        int    min__;          // Lower bound of the deadline
+        int    max__;          // Upper bound of the deadline
+};
+
+#endif
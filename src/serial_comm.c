@@ -23,6 +23,60 @@
 #include <sys/ioctl.h>
 #include "serial_comm.h"
 
+/**
+ * Function to look up the termios constant of a standard baud rate.
+ *
+ * @param baudRate: Baudrate specified as integer.
+ * @return Returns the constant, B0 if the rate has none.
+ */
+static speed_t baud_constant(long baudRate)
+{
+    switch(baudRate){
+        case 1200   : return B1200;
+        case 2400   : return B2400;
+        case 4800   : return B4800;
+        case 9600   : return B9600;
+        case 19200  : return B19200;
+        case 38400  : return B38400;
+        case 57600  : return B57600;
+        case 115200 : return B115200;
+#ifdef B230400
+        case 230400 : return B230400;
+#endif
+#ifdef B460800
+        case 460800 : return B460800;
+#endif
+#ifdef B500000
+        case 500000 : return B500000;
+#endif
+#ifdef B576000
+        case 576000 : return B576000;
+#endif
+#ifdef B921600
+        case 921600 : return B921600;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+#ifdef B1152000
+        case 1152000: return B1152000;
+#endif
+#ifdef B1500000
+        case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+        case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+        case 3000000: return B3000000;
+#endif
+#ifdef B4000000
+        case 4000000: return B4000000;
+#endif
+        default     : return B0;
+    }
+}
+
 int canon_read(int dev_fd, char *buf, int nbytes) 
 {
     int nread = 0;
@@ -49,7 +103,8 @@ int canon_read(int dev_fd, char *buf, int nbytes)
  * based on the input parameters.
  * 
  * @param portname:  Complete path of the serial device.
- * @param baudRate:  Baudrate specified as integer.
+ * @param baudRate:  Baudrate specified as integer. Rates without a termios
+ *                   constant, e.g. 250000, are set through termios2.
  * @param parity:    Number of parity bits.
  * @param data_bits: Number of data bits.
  * @param stop_bits: Number of stop bits.
@@ -62,6 +117,7 @@ int OpenComConfig(const char StrCOMPort[], long baudRate,
 {
     int COMfd;
     struct termios COMPort;
+    speed_t speed;
 
     if((COMfd = open(StrCOMPort, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1){
         printf("\tError opening serial port : %s\n", strerror(errno));
@@ -72,25 +128,10 @@ int OpenComConfig(const char StrCOMPort[], long baudRate,
         return(-1);
     }
 
-    switch(baudRate){
-        case 9600 :  cfsetispeed(&COMPort, B9600);
-                     cfsetospeed(&COMPort, B9600);
-                     break;
-        case 19200 : cfsetispeed(&COMPort, B19200);
-                     cfsetospeed(&COMPort, B19200);
-                     break;
-        case 38400 : cfsetispeed(&COMPort, B38400);
-                     cfsetospeed(&COMPort, B38400);
-                     break;
-        case 57600 : cfsetispeed(&COMPort, B57600);
-                     cfsetospeed(&COMPort, B57600);
-                     break;
-        case 115200: cfsetispeed(&COMPort, B115200);
-                     cfsetospeed(&COMPort, B115200);
-                     break;
-        default    : cfsetispeed(&COMPort, B9600);
-                     cfsetospeed(&COMPort, B9600);
-    }
+    /* Rates without a termios constant are set after tcsetattr() */
+    speed = baud_constant(baudRate);
+    cfsetispeed(&COMPort, (speed != B0) ? speed : B38400);
+    cfsetospeed(&COMPort, (speed != B0) ? speed : B38400);
 
     switch(parity){
         case 0:  COMPort.c_cflag &= ~(PARENB | CSIZE);
@@ -156,11 +197,16 @@ int OpenComConfig(const char StrCOMPort[], long baudRate,
 
     if(tcsetattr(COMfd, TCSANOW, &COMPort) != 0){
         printf("\tError configuring serial port : %s\n", strerror(errno));
+        close(COMfd);
         return(-1);
     }
-    else{
-        return(COMfd);
+    if((speed == B0) && (set_custom_baud(COMfd, baudRate) != 0)){
+        printf("\tError setting baud rate %ld : %s\n", baudRate, 
+                strerror(errno));
+        close(COMfd);
+        return(-1);
     }
+    return(COMfd);
 }
 
 /**
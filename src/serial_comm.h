@@ -36,5 +36,7 @@ int OpenComConfig(const char *StrCOMPort, long baudRate, int parity,
         int dataBits, int stopBits, int vtime);
 int CloseCom(int COMfd);
 int test_connection(int fd);
+int set_custom_baud(int COMfd, long baudRate);
+long get_custom_baud(int COMfd);
 
 #endif
@@ -0,0 +1,65 @@
+/**
+ * @file serial_termios2.c
+ * Contains the functions setting and reading the baud rate of a serial
+ * port through the termios2 interface of Linux, which takes any rate.
+ * struct termios2 is declared by <asm/termbits.h>, whose layout differs
+ * between architectures and clashes with <termios.h>, so these functions
+ * are kept apart from serial_comm.c.
+ */
+
+#include <errno.h>
+#include "serial_comm.h"
+
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <asm/termbits.h>
+#endif
+
+/**
+ * Function to set a baud rate without a termios constant, through the
+ * termios2 interface (BOTHER) of Linux. The rest of the configuration is
+ * set beforehand with tcsetattr().
+ *
+ * @param COMfd:    File descriptor for the serial port.
+ * @param baudRate: Baudrate specified as integer.
+ * @return Returns 0 on success, else -1
+ */
+int set_custom_baud(int COMfd, long baudRate)
+{
+#if defined(TCGETS2) && defined(TCSETS2) && defined(BOTHER)
+    struct termios2 COMPort2;
+
+    if(ioctl(COMfd, TCGETS2, &COMPort2) < 0){
+        return(-1);
+    }
+    COMPort2.c_cflag &= ~CBAUD;
+    COMPort2.c_cflag |= BOTHER;
+    COMPort2.c_ispeed = baudRate;
+    COMPort2.c_ospeed = baudRate;
+    return(ioctl(COMfd, TCSETS2, &COMPort2));
+#else
+    errno = EINVAL;
+    return(-1);
+#endif
+}
+
+/**
+ * Function to read the output baud rate a serial port is set to, through
+ * the termios2 interface of Linux.
+ *
+ * @param COMfd: File descriptor for the serial port.
+ * @return Returns the baud rate, -1 if it can't be read.
+ */
+long get_custom_baud(int COMfd)
+{
+#if defined(TCGETS2)
+    struct termios2 COMPort2;
+
+    if(ioctl(COMfd, TCGETS2, &COMPort2) == 0){
+        return(COMPort2.c_ospeed);
+    }
+#else
+    errno = EINVAL;
+#endif
+    return(-1);
+}
@@ -0,0 +1,406 @@
+/**
+ * @file session_snapshot.cpp
+ * Implements the snapshot of a PakBus session kept in the working directory.
+ */
+
+#include <sstream>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <log4cpp/Category.hh>
+#include "session_snapshot.h"
+#include "pb5_proto.h"
+
+using namespace std;
+using namespace log4cpp;
+
+/*
+ * The snapshot is made of the magic string, the version byte, the body and
+ * the signature of the body. Numbers are stored most significant byte
+ * first, strings and lists are preceded by their length.
+ */
+
+static void put_uint (string& buf, uint4 val, int len)
+{
+    while (len--) {
+        buf += (char)(val >> (8*len));
+    }
+}
+
+static void put_str (string& buf, const string& str)
+{
+    put_uint (buf, str.size(), 4);
+    buf += str;
+}
+
+/**
+ * Cursor over the body of a snapshot being loaded. Reading past the end
+ * clears Ok and returns zeros.
+ */
+struct SnapshotReader {
+    SnapshotReader(const byte* beg, const byte* end) : Ptr(beg), End(end),
+            Ok(true) {}
+    const byte* Ptr;
+    const byte* End;
+    bool        Ok;
+
+    uint4 getUint(int len) {
+        uint4 val = 0;
+        if (End - Ptr < len) {
+            Ok  = false;
+            Ptr = End;
+            return 0;
+        }
+        while (len--) {
+            val = (val << 8) | *Ptr++;
+        }
+        return val;
+    }
+    string getStr() {
+        uint4 len = getUint(4);
+        if ((uint4)(End - Ptr) < len) {
+            Ok  = false;
+            Ptr = End;
+            return string();
+        }
+        string str((const char*)Ptr, len);
+        Ptr += len;
+        return str;
+    }
+};
+
+static void put_field (string& buf, const Field& var)
+{
+    put_uint (buf, var.FieldType, 1);
+    put_str  (buf, var.FieldName);
+    put_uint (buf, var.NullByte, 1);
+    put_str  (buf, var.Processing);
+    put_str  (buf, var.Unit);
+    put_str  (buf, var.Description);
+    put_uint (buf, var.BegIdx, 4);
+    put_uint (buf, var.Dimension, 4);
+    put_uint (buf, var.SubDim.size(), 4);
+    for (size_t idx = 0; idx < var.SubDim.size(); idx++) {
+        put_uint (buf, var.SubDim[idx], 4);
+    }
+    put_uint (buf, var.SubDimListTerm, 4);
+}
+
+static void get_field (SnapshotReader& rd, Field& var)
+{
+    var.FieldType   = (byte)rd.getUint(1);
+    var.FieldName   = rd.getStr();
+    var.NullByte    = (byte)rd.getUint(1);
+    var.Processing  = rd.getStr();
+    var.Unit        = rd.getStr();
+    var.Description = rd.getStr();
+    var.BegIdx      = rd.getUint(4);
+    var.Dimension   = rd.getUint(4);
+
+    uint4 ndims = rd.getUint(4);
+    for (uint4 idx = 0; (idx < ndims) && rd.Ok; idx++) {
+        var.SubDim.push_back(rd.getUint(4));
+    }
+    var.SubDimListTerm = rd.getUint(4);
+}
+
+static void put_table (string& buf, const Table& tbl)
+{
+    put_str  (buf, tbl.TblName);
+    put_uint (buf, tbl.TblNum, 4);
+    put_uint (buf, tbl.TblSize, 4);
+    put_uint (buf, tbl.TimeType, 1);
+    put_uint (buf, tbl.TblTimeInfo.sec, 4);
+    put_uint (buf, tbl.TblTimeInfo.nsec, 4);
+    put_uint (buf, tbl.TblTimeInterval.sec, 4);
+    put_uint (buf, tbl.TblTimeInterval.nsec, 4);
+    put_uint (buf, tbl.field_list.size(), 4);
+    for (size_t idx = 0; idx < tbl.field_list.size(); idx++) {
+        put_field (buf, tbl.field_list[idx]);
+    }
+    put_uint (buf, tbl.TblSignature, 2);
+    put_uint (buf, tbl.FieldNbrs.size(), 4);
+    for (size_t idx = 0; idx < tbl.FieldNbrs.size(); idx++) {
+        put_uint (buf, tbl.FieldNbrs[idx], 2);
+    }
+    put_uint (buf, tbl.FirstSampleInFile, 4);
+    put_uint (buf, tbl.NewFileTime, 4);
+    put_uint (buf, tbl.NextRecord, 4);
+    put_uint (buf, tbl.LastRecordTime.sec, 4);
+    put_uint (buf, tbl.LastRecordTime.nsec, 4);
+}
+
+static void get_table (SnapshotReader& rd, Table& tbl)
+{
+    tbl.TblName              = rd.getStr();
+    tbl.TblNum               = (int)rd.getUint(4);
+    tbl.TblSize              = rd.getUint(4);
+    tbl.TimeType             = (byte)rd.getUint(1);
+    tbl.TblTimeInfo.sec      = rd.getUint(4);
+    tbl.TblTimeInfo.nsec     = rd.getUint(4);
+    tbl.TblTimeInterval.sec  = rd.getUint(4);
+    tbl.TblTimeInterval.nsec = rd.getUint(4);
+
+    uint4 nfields = rd.getUint(4);
+    for (uint4 idx = 0; (idx < nfields) && rd.Ok; idx++) {
+        tbl.field_list.push_back(Field());
+        get_field (rd, tbl.field_list.back());
+    }
+    tbl.TblSignature = (uint2)rd.getUint(2);
+
+    uint4 nnbrs = rd.getUint(4);
+    for (uint4 idx = 0; (idx < nnbrs) && rd.Ok; idx++) {
+        tbl.FieldNbrs.push_back((uint2)rd.getUint(2));
+    }
+    tbl.FirstSampleInFile   = rd.getUint(4);
+    tbl.NewFileTime         = rd.getUint(4);
+    tbl.NextRecord          = rd.getUint(4);
+    tbl.LastRecordTime.sec  = rd.getUint(4);
+    tbl.LastRecordTime.nsec = rd.getUint(4);
+}
+
+SessionSnapshot :: SessionSnapshot() : hasTables__(false), fslVersion__(0),
+        progSig__(0)
+{
+}
+
+/**
+ * Function to load the snapshot saved by an earlier run. The file is read
+ * in a single read and its signature verified before anything is taken
+ * from it.
+ *
+ * @param file: Path of the snapshot, also used by save().
+ * @return true if a valid snapshot was loaded.
+ */
+bool SessionSnapshot :: load(const string& file)
+{
+    struct stat  st;
+    int          fd;
+    int          magic_len = strlen(SNAPSHOT_MAGIC);
+
+    file__ = file;
+    if ((fd = open(file.c_str(), O_RDONLY)) < 0) {
+        return false;
+    }
+
+    vector<byte> buf;
+    ssize_t      nread = -1;
+
+    if ((fstat(fd, &st) == 0) && (st.st_size > magic_len + 3)) {
+        buf.resize(st.st_size);
+        nread = read(fd, &buf[0], buf.size());
+    }
+    close(fd);
+
+    if ((nread != (ssize_t)buf.size()) || buf.empty() ||
+            memcmp(&buf[0], SNAPSHOT_MAGIC, magic_len) ||
+            (buf[magic_len] != SNAPSHOT_VERSION)) {
+        Category::getInstance("SessionSnapshot")
+                 .warn("Ignoring invalid session snapshot " + file);
+        return false;
+    }
+
+    const byte* body = &buf[0] + magic_len + 1;
+    const byte* end  = &buf[0] + buf.size() - 2;
+    uint2       sig  = (uint2)((end[0] << 8) | end[1]);
+
+    if (CalcSigFast(body, end - body, SIG_SEED) != sig) {
+        Category::getInstance("SessionSnapshot")
+                 .warn("Ignoring corrupt session snapshot " + file);
+        return false;
+    }
+
+    SnapshotReader    rd(body, end);
+    vector<Table>     tables;
+    deque<ClockCheck> checks;
+    bool              has_tables = rd.getUint(1);
+    byte              fsl_version = (byte)rd.getUint(1);
+    uint2             prog_sig = (uint2)rd.getUint(2);
+    string            config_key = rd.getStr();
+    uint4             ntables = rd.getUint(4);
+
+    for (uint4 idx = 0; (idx < ntables) && rd.Ok; idx++) {
+        tables.push_back(Table());
+        get_table (rd, tables.back());
+    }
+
+    uint4 nchecks = rd.getUint(4);
+    for (uint4 idx = 0; (idx < nchecks) && rd.Ok; idx++) {
+        ClockCheck check;
+        check.HostTime = (time_t)rd.getUint(4);
+        check.Offset   = (int)rd.getUint(4);
+        check.Adjusted = rd.getUint(1);
+        checks.push_back(check);
+    }
+
+    if (!rd.Ok || (rd.Ptr != end)) {
+        Category::getInstance("SessionSnapshot")
+                 .warn("Ignoring truncated session snapshot " + file);
+        return false;
+    }
+
+    hasTables__    = has_tables;
+    fslVersion__   = fsl_version;
+    progSig__      = prog_sig;
+    configKey__    = config_key;
+    tables__.swap(tables);
+    clockChecks__.swap(checks);
+
+    stringstream msgstrm;
+    msgstrm << "Loaded session snapshot (" << tables__.size()
+            << " tables for program signature " << progSig__ << ", "
+            << clockChecks__.size() << " clock checks)";
+    Category::getInstance("SessionSnapshot").debug(msgstrm.str());
+    return true;
+}
+
+/**
+ * Function to save the snapshot to the file given to load(). The snapshot
+ * is written to a temporary file first, so a run that is interrupted
+ * never leaves a partial snapshot behind.
+ */
+void SessionSnapshot :: save()
+{
+    if (file__.empty()) {
+        return;
+    }
+
+    string body;
+
+    put_uint (body, hasTables__ ? 1 : 0, 1);
+    put_uint (body, fslVersion__, 1);
+    put_uint (body, progSig__, 2);
+    put_str  (body, configKey__);
+    put_uint (body, tables__.size(), 4);
+    for (size_t idx = 0; idx < tables__.size(); idx++) {
+        put_table (body, tables__[idx]);
+    }
+    put_uint (body, clockChecks__.size(), 4);
+    for (size_t idx = 0; idx < clockChecks__.size(); idx++) {
+        put_uint (body, (uint4)clockChecks__[idx].HostTime, 4);
+        put_uint (body, (uint4)clockChecks__[idx].Offset, 4);
+        put_uint (body, clockChecks__[idx].Adjusted ? 1 : 0, 1);
+    }
+
+    string buf(SNAPSHOT_MAGIC);
+    buf += (char)SNAPSHOT_VERSION;
+    buf += body;
+    put_uint (buf, CalcSigFast(body.data(), body.size(), SIG_SEED), 2);
+
+    string tmp_file = file__ + ".tmp";
+    int    fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool   written = false;
+
+    if (fd >= 0) {
+        written = (write(fd, buf.data(), buf.size()) == (ssize_t)buf.size());
+        written = (close(fd) == 0) && written;
+    }
+    if (!written || rename(tmp_file.c_str(), file__.c_str())) {
+        Category::getInstance("SessionSnapshot")
+                 .error("Failed to store the session snapshot in " + file__);
+        unlink(tmp_file.c_str());
+    }
+}
+
+/**
+ * Function to set the compiled table definitions and collection state.
+ *
+ * @param tables: Tables built from the TDF, reduced to the selected fields.
+ * @param fsl_version: Version byte at the beginning of the TDF.
+ * @param prog_sig: Signature of the logger program the TDF belongs to.
+ * @param config_key: Description of the fields selected in the
+ *                    configuration.
+ */
+void SessionSnapshot :: setTables(const vector<Table>& tables,
+        byte fsl_version, uint2 prog_sig, const string& config_key)
+{
+    hasTables__  = true;
+    tables__     = tables;
+    fslVersion__ = fsl_version;
+    progSig__    = prog_sig;
+    configKey__  = config_key;
+}
+
+void SessionSnapshot :: clearTables()
+{
+    hasTables__ = false;
+    tables__.clear();
+}
+
+/**
+ * Function to record a check of the logger clock. Only the latest
+ * SNAPSHOT_CLOCK_CHECKS checks are kept.
+ *
+ * @param host_t: Time of the check on the host.
+ * @param offset: Host time less logger time (secs).
+ * @param adjusted: Set if the logger clock was set after the check.
+ */
+void SessionSnapshot :: addClockCheck(time_t host_t, int offset,
+        bool adjusted)
+{
+    ClockCheck check;
+
+    check.HostTime = host_t;
+    check.Offset   = offset;
+    check.Adjusted = adjusted;
+    clockChecks__.push_back(check);
+
+    while (clockChecks__.size() > SNAPSHOT_CLOCK_CHECKS) {
+        clockChecks__.pop_front();
+    }
+}
+
+/**
+ * Function to decide if the logger clock must be checked when a session
+ * is established. The check can be skipped if the last one is recent,
+ * didn't set the clock, and the drift seen between the last two checks
+ * keeps the offset within the allowed range.
+ *
+ * @param now: Current time on the host.
+ * @param max_offset: Largest offset (secs) left uncorrected.
+ * @return true if the clock must be checked.
+ */
+bool SessionSnapshot :: isClockCheckDue(time_t now, int max_offset)
+{
+    if (clockChecks__.empty()) {
+        return true;
+    }
+
+    const ClockCheck& last = clockChecks__.back();
+    double drift = 0;
+
+    if (last.Adjusted || (now < last.HostTime) ||
+            (now - last.HostTime >= SNAPSHOT_CLOCK_CHECK_AGE)) {
+        return true;
+    }
+    if (clockChecks__.size() > 1) {
+        const ClockCheck& prev = clockChecks__[clockChecks__.size() - 2];
+        if (!prev.Adjusted && (last.HostTime > prev.HostTime)) {
+            drift = (double)(last.Offset - prev.Offset)/
+                    (last.HostTime - prev.HostTime);
+        }
+    }
+    return fabs(last.Offset + drift*(now - last.HostTime)) > max_offset;
+}
+
+/**
+ * Returns a description of the last clock check for the logs.
+ */
+string SessionSnapshot :: describeClock(time_t now)
+{
+    stringstream msgstrm;
+
+    if (clockChecks__.empty()) {
+        msgstrm << "logger clock never checked";
+    }
+    else {
+        msgstrm << "logger clock offset " << clockChecks__.back().Offset
+                << " secs " << (now - clockChecks__.back().HostTime)
+                << " secs ago";
+    }
+    return msgstrm.str();
+}
@@ -0,0 +1,77 @@
+/**
+ * @file session_snapshot.h
+ * Provides the snapshot of a PakBus session kept in the working directory,
+ * from which the next run restores the session without repeating its setup.
+ */
+
+#ifndef SESSION_SNAPSHOT_H
+#define SESSION_SNAPSHOT_H
+#include <string>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <time.h>
+#include "pb5_data.h"
+using namespace std;
+
+#define SNAPSHOT_MAGIC   "PBSNAP"
+#define SNAPSHOT_VERSION 1
+// Number of logger clock checks kept in the snapshot
+#define SNAPSHOT_CLOCK_CHECKS 8
+// Age (secs) after which the logger clock is checked again, even if it
+// isn't expected to have drifted
+#define SNAPSHOT_CLOCK_CHECK_AGE 21600
+
+/**
+ * Structure recording a check of the logger clock.
+ */
+struct ClockCheck {
+    ClockCheck() : HostTime(0), Offset(0), Adjusted(false) {}
+    time_t HostTime;  // Time of the check on the host
+    int    Offset;    // Host time less logger time (secs)
+    bool   Adjusted;  // Set if the logger clock was set after the check
+};
+
+/**
+ * Binary snapshot of the state set up at the start of a session: the table
+ * definitions compiled from the TDF (reduced to the fields selected for
+ * collection), the signature of the logger program they were compiled
+ * for, the collection state of the tables and the history of the logger
+ * clock checks.
+ *
+ * The snapshot is loaded with a single read and is checked against its own
+ * signature. The tables are only restored if the program signature
+ * reported by the logger and the fields selected in the configuration
+ * still match, see TableDataManager::restoreSnapshot().
+ */
+class SessionSnapshot {
+    public :
+        SessionSnapshot();
+        bool   load(const string& file);
+        void   save();
+        /** Returns true if the tables were loaded or set. */
+        bool   hasTables() { return hasTables__; }
+        void   setTables(const vector<Table>& tables, byte fsl_version,
+                   uint2 prog_sig, const string& config_key);
+        void   clearTables();
+        const vector<Table>& getTables() { return tables__; }
+        byte   getFslVersion() { return fslVersion__; }
+        uint2  getProgSig() { return progSig__; }
+        const string& getConfigKey() { return configKey__; }
+
+        void   addClockCheck(time_t host_t, int offset, bool adjusted);
+        bool   isClockCheckDue(time_t now, int max_offset);
+        string describeClock(time_t now);
+
+    private :
+        string        file__;
+        bool          hasTables__;
+        byte          fslVersion__;  // Version byte of the TDF
+        uint2         progSig__;     // ProgSig of the program the tables
+                                     // were compiled for
+        string        configKey__;   // Fields selected in the configuration
+        vector<Table> tables__;
+        deque<ClockCheck> clockChecks__;
+};
+
+#endif
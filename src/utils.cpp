@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
 #include <log4cpp/Category.hh>
 #include <libxml2/libxml/parser.h>
 #include <libxml2/libxml/tree.h>
@@ -172,6 +173,18 @@ char* get_timestamp()
     return log_timestamp;
 }
 
+/**
+ * Function to read a monotonic millisecond counter. The counter is meant for
+ * measuring intervals and computing deadlines only, use msec_diff() to compare
+ * two readings.
+ */
+unsigned int get_msec_clock()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((unsigned int)ts.tv_sec*1000U + (unsigned int)(ts.tv_nsec/1000000));
+}
+
 /**
  * Construtor for the AppException class that defines the syntax to use for
  * throwing the exception.
@@ -252,7 +265,7 @@ char* xmlNodeGetNormContent(xmlNodePtr node)
  * @param inputName: Name of the input parameter to validate.
  * @return void.
  */
-void InputValidator :: addRequiredInput(char *inputName) 
+void InputValidator :: addRequiredInput(const char *inputName) 
 {
     inputMap[inputName] = false;
 }
@@ -265,7 +278,7 @@ void InputValidator :: addRequiredInput(char *inputName)
  * @param inputName: Name of the validated input parameter.
  * @return void.
  */ 
-void InputValidator :: setInputStatusOk(char *inputName)
+void InputValidator :: setInputStatusOk(const char *inputName)
 {
     // If entry for inputName exists in the Map
 
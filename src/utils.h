@@ -31,6 +31,17 @@ int  open_lockfile (const char *lock_file, const char *process_name);
 int  is_running (const char *StrLockFile);
 int  setup_dir (const string& dirpath);
 char* get_timestamp ();
+unsigned int get_msec_clock ();
+
+/**
+ * Returns the number of milliseconds elapsed between two readings of the
+ * get_msec_clock() counter. The difference is computed modulo 2^32, so it
+ * stays correct across a wrap-around of the counter.
+ */
+inline int msec_diff (unsigned int later, unsigned int earlier) 
+{ 
+    return (int)(later - earlier); 
+}
 
 /**
  * A class derived from std::exception for error handling.
@@ -109,8 +120,8 @@ class InputValidator {
     public :
         InputValidator() {};
         ~InputValidator() {};
-        void addRequiredInput(char *inputName);
-        void setInputStatusOk(char *name);
+        void addRequiredInput(const char *inputName);
+        void setInputStatusOk(const char *name);
         bool validateInputs();
    
     private :
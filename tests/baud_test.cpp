@@ -0,0 +1,101 @@
+/**
+ * @file baud_test.cpp
+ * Checks the negotiation of the baud rate of a serial port configured
+ * with the "auto" rate, against a stand-in logger on a pty which answers
+ * at a single rate: the rate found, and the cache of the rate which lets
+ * the next session try it first.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include "collection_process.h"
+#include "stand_in_logger.h"
+#include "collector_session.h"
+#include "test_util.h"
+
+/**
+ * Returns the rate cached by the last negotiation on the port, 0 if none.
+ */
+static int cached_rate (const string& cache_file)
+{
+    ifstream cache(cache_file.c_str());
+    int      rate = 0;
+
+    cache >> rate;
+    return rate;
+}
+
+int main ()
+{
+    char tmpl[] = "/tmp/baud_test.XXXXXX";
+    if (!mkdtemp (tmpl)) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    string work_dir = tmpl;
+    string config_file = work_dir + "/config.xml";
+    string log_file = work_dir + "/session.log";
+
+    // The port is named after the link, which names the lock and cache
+    // files of the application
+    stringstream name;
+    name << "ttyStandIn" << getpid();
+    SessionConfig cfg;
+    cfg.WorkDir  = work_dir;
+    cfg.PortName = work_dir + "/" + name.str();
+    cfg.Tables.push_back ("T1");
+    string cache_file = string("/tmp/" PB5_APP_NAME "-") + name.str() +
+            ".baud";
+    string lock_file = string("/tmp/" PB5_APP_NAME "-") + name.str() +
+            ".lck";
+
+    StandInLogger logger;
+    StandInLogger::Stats stats;
+    logger.addTable ("T1", 5, 2, 60);
+    logger.openPty (cfg.PortName);
+    write_session_config (config_file, cfg);
+    unlink (cache_file.c_str());
+
+    // Nothing cached: the faster rates are tried first, and dropped
+    logger.setAnswerBaud (57600);
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.HelloBaud == 57600);
+    CHECK(stats.DroppedReads > 0);
+    CHECK(stats.FileUploads > 0);
+    CHECK(stats.Collects > 0);
+    CHECK(cached_rate (cache_file) == 57600);
+
+    // The cached rate is tried first and answered
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.HelloBaud == 57600);
+    CHECK(stats.DroppedReads == 0);
+    CHECK(stats.Collects > 0);
+    CHECK(cached_rate (cache_file) == 57600);
+
+    // The logger moved to another rate: the cached rate fails, and the
+    // new rate is found and cached
+    logger.setAnswerBaud (38400);
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.HelloBaud == 38400);
+    CHECK(stats.DroppedReads > 0);
+    CHECK(cached_rate (cache_file) == 38400);
+
+    unlink (cache_file.c_str());
+    unlink (lock_file.c_str());
+    if (testFailures) {
+        printf ("session log kept in %s\n", work_dir.c_str());
+    }
+    else {
+        system (("rm -rf " + work_dir).c_str());
+    }
+    return test_result ("baud_test");
+}
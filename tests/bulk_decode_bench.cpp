@@ -0,0 +1,121 @@
+/**
+ * @file bulk_decode_bench.cpp
+ * Measures the throughput of the kernels decoding arrays of big-endian
+ * values, against the value-by-value decoding they replaced, for arrays
+ * of the lengths found in the tables of a logger.
+ */
+
+#include <stdlib.h>
+#include "bulk_decode.h"
+#include "pb5_codec.h"
+#include "test_util.h"
+
+// Values decoded for each measurement
+#define BENCH_VALUES 50000000
+
+static float floats[1024];
+static uint4 uints[1024];
+
+/**
+ * Decodes 4-byte IEEE floats one at a time, as the records were before
+ * the kernels.
+ */
+static void loop_float4 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    for (size_t idx = 0; idx < count; idx++, src += 4) {
+        floats[idx] = intBitsToFloat (BigEndian<4>::load (src));
+    }
+}
+
+/**
+ * Decodes 2-byte final storage floats one at a time through pow(), as
+ * GetFinalStorageFloat() does and as the records were before the table.
+ */
+static void loop_fp2 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    for (size_t idx = 0; idx < count; idx++, src += 2) {
+        floats[idx] = GetFinalStorageFloat (
+                (uint2)BigEndian<2>::load (src));
+    }
+}
+
+static void kernel_float4 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    decoder.decodeFloat4 (src, floats, count);
+}
+
+static void kernel_fp2 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    decoder.decodeFp2 (src, floats, count);
+}
+
+static void kernel_uint4 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    decoder.decodeUint4 (src, uints, count);
+}
+
+static void kernel_uint2 (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    decoder.decodeUint2 (src, uints, count);
+}
+
+typedef void (*DecodeFunc)(const BulkDecoder&, const byte*, size_t);
+
+/**
+ * Returns the millions of values decoded per second by the function.
+ */
+static double measure (DecodeFunc func, const BulkDecoder& decoder,
+        const byte* src, size_t count)
+{
+    size_t iters = BENCH_VALUES / count;
+    double start = bench_now();
+
+    for (size_t it = 0; it < iters; it++) {
+        func (decoder, src, count);
+    }
+    return (double)iters * count / (bench_now() - start) / 1e6;
+}
+
+int main ()
+{
+    static byte src[4*1024];
+    const size_t lengths[] = { 1, 4, 16, 64, 1024 };
+    const BulkDecoder& scalar = BulkDecoder::getScalar();
+    const BulkDecoder& best = BulkDecoder::getInstance();
+    const struct {
+        const char* Name;
+        DecodeFunc  Loop;     // Value by value decoding replaced, if any
+        DecodeFunc  Kernel;
+    } kernels[] = { { "float4", loop_float4, kernel_float4 },
+            { "fp2", loop_fp2, kernel_fp2 }, { "uint4", NULL, kernel_uint4 },
+            { "uint2", NULL, kernel_uint2 } };
+
+    for (size_t idx = 0; idx < sizeof(src); idx++) {
+        src[idx] = (byte)rand();
+    }
+
+    printf ("%-8s%-8s%12s%12s%12s   (Mvalues/s)\n", "kernel", "length",
+            "loop", "scalar", best.getName());
+    for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++) {
+        for (size_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+            printf ("%-8s%-8u", kernels[k].Name, (uint4)lengths[l]);
+            if (kernels[k].Loop) {
+                printf ("%12.0f", measure (kernels[k].Loop, scalar, src,
+                        lengths[l]));
+            }
+            else {
+                printf ("%12s", "");
+            }
+            printf ("%12.0f%12.0f\n",
+                    measure (kernels[k].Kernel, scalar, src, lengths[l]),
+                    measure (kernels[k].Kernel, best, src, lengths[l]));
+        }
+    }
+    return 0;
+}
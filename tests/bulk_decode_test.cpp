@@ -0,0 +1,112 @@
+/**
+ * @file bulk_decode_test.cpp
+ * Checks that the kernels of the scalar and SSSE3 decoders produce the
+ * same bits as the value-by-value decoding, intBitsToFloat() and
+ * BigEndian<>, for every count up to a few blocks and every alignment of
+ * the source.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bulk_decode.h"
+#include "pb5_codec.h"
+#include "test_util.h"
+
+// Values decoded at most by each call, past four 16-byte blocks
+#define MAX_COUNT 67
+
+// Value written after the last one expected, which must be left alone
+#define GUARD 0xdeadbeef
+
+// Bit patterns of the IEEE floats decoded apart: the zeros, infinities,
+// NaNs, denormals and the extremes of the normal numbers
+static const uint4 specialFloats[] = { 0x00000000, 0x80000000, 0x7f800000,
+        0xff800000, 0x7fc00000, 0xffc00000, 0x7f800001, 0xffffffff,
+        0x00000001, 0x807fffff, 0x00800000, 0x7f7fffff, 0xff7fffff,
+        0x3f800000, 0xbf800000 };
+#define NUM_SPECIAL_FLOATS (sizeof(specialFloats) / sizeof(specialFloats[0]))
+
+/**
+ * Decodes count values at src with each kernel of the decoder, and checks
+ * them against the value-by-value decoding.
+ */
+static void check_kernels (const BulkDecoder& decoder, const byte* src,
+        size_t count)
+{
+    float floats[MAX_COUNT + 1];
+    uint4 uints[MAX_COUNT + 1];
+    uint4 guard = GUARD;
+
+    memcpy (&floats[count], &guard, 4);
+    decoder.decodeFloat4 (src, floats, count);
+    for (size_t idx = 0; idx < count; idx++) {
+        float ref = intBitsToFloat (BigEndian<4>::load (src + 4*idx));
+        CHECK(memcmp (&floats[idx], &ref, 4) == 0);
+    }
+    CHECK(memcmp (&floats[count], &guard, 4) == 0);
+
+    uints[count] = GUARD;
+    decoder.decodeUint4 (src, uints, count);
+    for (size_t idx = 0; idx < count; idx++) {
+        CHECK(uints[idx] == BigEndian<4>::load (src + 4*idx));
+    }
+    CHECK(uints[count] == GUARD);
+
+    uints[count] = GUARD;
+    decoder.decodeUint2 (src, uints, count);
+    for (size_t idx = 0; idx < count; idx++) {
+        CHECK(uints[idx] == BigEndian<2>::load (src + 2*idx));
+    }
+    CHECK(uints[count] == GUARD);
+}
+
+/**
+ * Checks the kernels of a decoder on random values and on the special
+ * floats, at each alignment and count, then on a sweep of the sign,
+ * exponent and upper fraction bits of the floats.
+ */
+static void check_decoder (const BulkDecoder& decoder)
+{
+    // Room for the values at any of the 16 alignments of a block
+    static byte buf[4*MAX_COUNT + 16];
+    static byte sweep[4*0x10000];
+
+    for (size_t idx = 0; idx < sizeof(buf); idx++) {
+        buf[idx] = (byte)rand();
+    }
+    for (size_t idx = 0; idx < NUM_SPECIAL_FLOATS; idx++) {
+        BigEndian<4>::store (buf + 4*(idx*3), specialFloats[idx]);
+    }
+    for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t count = 0; count <= MAX_COUNT; count++) {
+            check_kernels (decoder, buf + offset, count);
+        }
+    }
+
+    for (uint4 high = 0; high < 0x10000; high++) {
+        BigEndian<4>::store (sweep + 4*high, 
+                (high << 16) | (rand() & 0xffff));
+    }
+    for (uint4 idx = 0; idx < 0x10000; idx += MAX_COUNT) {
+        check_kernels (decoder, sweep + 4*idx, 
+                (idx + MAX_COUNT <= 0x10000) ? MAX_COUNT : 0x10000 - idx);
+    }
+}
+
+int main ()
+{
+    srand (23);
+
+    check_decoder (BulkDecoder::getScalar());
+#ifdef BULK_DECODE_SSSE3
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("ssse3")) {
+        Ssse3Decoder ssse3;
+        check_decoder (ssse3);
+    }
+    else {
+        printf ("the CPU lacks SSSE3, its kernels weren't checked\n");
+    }
+#endif
+    return test_result ("bulk_decode_test");
+}
@@ -0,0 +1,155 @@
+/**
+ * @file collector_session.cpp
+ * Implements the helpers running collection sessions of the application
+ * against the stand-in logger of the tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
+#include "collection_process.h"
+#include "stand_in_logger.h"
+#include "collector_session.h"
+
+/**
+ * Writes the configuration of a session, with hourly files for each
+ * table.
+ */
+void write_session_config (const string& path, const SessionConfig& cfg)
+{
+    ofstream out(path.c_str());
+
+    out << "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n"
+        << "<COLLECTION logger=\"CR1000\" station_name=\"test\">\n";
+    if (cfg.Host.size()) {
+        out << "<CONNECTION type=\"tcp\"><host>" << cfg.Host
+            << "</host><port>" << cfg.TcpPort << "</port></CONNECTION>\n";
+    }
+    else {
+        out << "<CONNECTION type=\"serial\"><port_name>" << cfg.PortName
+            << "</port_name><baud_rate>" << cfg.BaudRate
+            << "</baud_rate></CONNECTION>\n";
+    }
+    out << "<DEBUG>FALSE</DEBUG>\n"
+        << "<DATA>\n"
+        << "<WORKING_PATH>" << cfg.WorkDir << "/data</WORKING_PATH>\n"
+        << "<COLLECT_TABLE>\n";
+    for (size_t idx = 0; idx < cfg.Tables.size(); idx++) {
+        out << "<TABLE sample_int_secs=\"" << cfg.SampleInt
+            << "\" file_span_secs=\"3600\">"
+            << cfg.Tables[idx] << "</TABLE>\n";
+    }
+    out << "</COLLECT_TABLE>\n"
+        << "</DATA>\n"
+        << "<PAKBUS><DST_PAKBUS_ID>1</DST_PAKBUS_ID>"
+        << "<DST_NODE_PAKBUS_ID>1</DST_NODE_PAKBUS_ID>"
+        << "<SECURITY_CODE>0</SECURITY_CODE>"
+        << "<COLLECT_WINDOW>" << cfg.CollectWindow << "</COLLECT_WINDOW>"
+        << "</PAKBUS>\n"
+        << "</COLLECTION>\n";
+}
+
+/**
+ * Starts a collection session in a child process, with its output
+ * appended to the given log.
+ *
+ * @param daemon: Run as a daemon (-D), until the process is killed.
+ * @return The process id of the child.
+ */
+pid_t start_session (const string& config_file, const string& log_file,
+        bool daemon)
+{
+    pid_t pid = fork ();
+
+    if (pid == 0) {
+        int fd = open (log_file.c_str(), O_WRONLY|O_CREAT|O_APPEND, 0644);
+        dup2 (fd, 1);
+        dup2 (fd, 2);
+        alarm (120);
+
+        try {
+            PB5CollectionProcess proc;
+            char* argv[] = { (char *)"collector_session", (char *)"-c",
+                    (char *)config_file.c_str(), (char *)"-D", NULL };
+            proc.init (daemon ? 4 : 3, argv);
+            proc.run ();
+        }
+        catch (exception& e) {
+            fprintf (stderr, "%s\n", e.what());
+            _exit (1);
+        }
+        _exit (0);
+    }
+    return pid;
+}
+
+/**
+ * Runs a collection session in a child process, with its output appended
+ * to the given log.
+ *
+ * @return true if the session exited normally.
+ */
+bool run_session (const string& config_file, const string& log_file)
+{
+    pid_t pid = start_session (config_file, log_file);
+    int   status;
+
+    waitpid (pid, &status, 0);
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+/**
+ * Reads the record numbers stored for a table, in the order of the files
+ * the application wrote (TOA5): the completed files, then the file in the
+ * working directory.
+ *
+ * @param data_dir: Working path of the sessions.
+ * @param table: Name of the table.
+ * @param values_ok: Cleared if a field doesn't hold the value the
+ *                   stand-in logger stores in it.
+ */
+vector<uint4> read_record_nbrs (const string& data_dir, const string& table,
+        bool& values_ok)
+{
+    vector<uint4>  recs;
+    vector<string> files;
+    glob_t         found;
+
+    if (glob ((data_dir + "/" + table + ".*").c_str(), 0, NULL, &found)
+            == 0) {
+        files.assign (found.gl_pathv, found.gl_pathv + found.gl_pathc);
+    }
+    globfree (&found);
+    files.push_back (data_dir + "/.working/" + table + ".tmp");
+
+    values_ok = true;
+    for (size_t idx = 0; idx < files.size(); idx++) {
+        ifstream in(files[idx].c_str());
+        string   line;
+
+        // Four lines of headers
+        for (int count = 0; count < 4; count++) {
+            getline (in, line);
+        }
+        while (getline (in, line)) {
+            stringstream fields(line.substr (line.find (',') + 1));
+            string       field;
+            uint4        rec_nbr;
+
+            getline (fields, field, ',');
+            rec_nbr = (uint4)strtoul (field.c_str(), NULL, 10);
+            for (int col = 0; getline (fields, field, ','); col++) {
+                if (strtoul (field.c_str(), NULL, 10) !=
+                        StandInLogger::fieldValue (rec_nbr, col)) {
+                    values_ok = false;
+                }
+            }
+            recs.push_back (rec_nbr);
+        }
+    }
+    return recs;
+}
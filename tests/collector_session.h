@@ -0,0 +1,40 @@
+/**
+ * @file collector_session.h
+ * Declares the helpers running collection sessions of the application
+ * against the stand-in logger of the tests.
+ */
+
+#ifndef COLLECTOR_SESSION_H
+#define COLLECTOR_SESSION_H
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "pb5.h"
+using namespace std;
+
+/**
+ * Settings of a session collecting tables of the stand-in logger over a
+ * serial port, or over TCP when a host is set.
+ */
+struct SessionConfig {
+    SessionConfig () : BaudRate("auto"), TcpPort(0), SampleInt(60),
+            CollectWindow(1) {}
+
+    string WorkDir;          // The data go to WorkDir/data
+    string PortName;
+    string BaudRate;
+    string Host;
+    int    TcpPort;
+    int    SampleInt;        // Secs between the collections of a daemon
+    int    CollectWindow;
+    vector<string> Tables;
+};
+
+void   write_session_config (const string& path, const SessionConfig& cfg);
+pid_t  start_session (const string& config_file, const string& log_file,
+           bool daemon = false);
+bool   run_session (const string& config_file, const string& log_file);
+vector<uint4> read_record_nbrs (const string& data_dir, const string& table,
+           bool& values_ok);
+
+#endif
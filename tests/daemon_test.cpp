@@ -0,0 +1,94 @@
+/**
+ * @file daemon_test.cpp
+ * Checks the collection cycles of the application run as a daemon (-D)
+ * against a stand-in logger whose clock is off: the session stays open,
+ * and each cycle collects the table and checks the clock again while the
+ * checks so far call for it.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <sstream>
+#include "collection_process.h"
+#include "stand_in_logger.h"
+#include "collector_session.h"
+#include "test_util.h"
+
+// Secs the daemon runs for, a few one-second cycles
+#define DAEMON_RUN_SECS 8
+
+/**
+ * Returns the number of lines of the given file holding the text.
+ */
+static int count_lines (const string& path, const string& text)
+{
+    ifstream in(path.c_str());
+    string   line;
+    int      count = 0;
+
+    while (getline (in, line)) {
+        if (line.find (text) != string::npos) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int main ()
+{
+    char tmpl[] = "/tmp/daemon_test.XXXXXX";
+    if (!mkdtemp (tmpl)) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    string work_dir = tmpl;
+    string config_file = work_dir + "/config.xml";
+    string log_file = work_dir + "/session.log";
+
+    SessionConfig cfg;
+    cfg.WorkDir   = work_dir;
+    cfg.Host      = "127.0.0.1";
+    cfg.SampleInt = 1;
+    cfg.Tables.push_back ("T1");
+
+    // The logger clock is an hour ahead until the application sets it
+    StandInLogger logger;
+    StandInLogger::Stats stats;
+    logger.addTable ("T1", 20, 2, 60);
+    logger.setClockOffset (3600);
+    cfg.TcpPort = logger.listenTcp ();
+    write_session_config (config_file, cfg);
+
+    logger.start ();
+    pid_t pid = start_session (config_file, log_file, true);
+    sleep (DAEMON_RUN_SECS);
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+    stats = logger.stop ();
+
+    // A single session, collected on every cycle
+    CHECK(stats.Connections == 1);
+    CHECK(stats.Hellos == 1);
+    CHECK(count_lines (log_file, "Link ") >= 2);
+    CHECK(stats.Collects >= 2);
+
+    // The clock is set when the session is established, and checked again
+    // on the next cycle as the last check set it
+    CHECK(stats.ClockSets == 1);
+    CHECK(stats.ClockChecks >= 3);
+
+    stringstream lock_file;
+    lock_file << "/tmp/" PB5_APP_NAME "-tcp_127.0.0.1_" << cfg.TcpPort
+              << ".lck";
+    unlink (lock_file.str().c_str());
+    if (testFailures) {
+        printf ("session log kept in %s\n", work_dir.c_str());
+    }
+    else {
+        system (("rm -rf " + work_dir).c_str());
+    }
+    return test_result ("daemon_test");
+}
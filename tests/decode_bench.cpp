@@ -0,0 +1,59 @@
+/**
+ * @file decode_bench.cpp
+ * Measures the records stored per second into a writer summing the
+ * values, through the decode plans of the tables and through the
+ * reference decoder, which decodes value by value as the application
+ * did before the plans.
+ */
+
+#include "record_fixture.h"
+#include "test_util.h"
+
+// Records of each response, and records stored for each measurement
+#define NUM_RECORDS 64
+#define BENCH_RECORDS 400000
+
+static const char* layoutNames[] = { "typical", "all types", "var string",
+        "arrays" };
+
+int main ()
+{
+    printf ("%-12s%14s%14s   (records/s)\n", "table", "value by value",
+            "decode plan");
+
+    for (int layout = 0; layout < NUM_RECORD_LAYOUTS; layout++) {
+        Table tbl = make_table ((RecordLayout)layout);
+        vector<byte> data = encode_records (tbl, NUM_RECORDS, 1);
+        int iters = BENCH_RECORDS / NUM_RECORDS;
+        TableDataManager mgr;
+        ReferenceDecoder ref;
+        RecordingWriter* writer = new RecordingWriter (false);
+        RecordingWriter* ref_writer = new RecordingWriter (false);
+
+        mgr.setTableDataWriter (writer);
+        ref.setTableDataWriter (ref_writer);
+        printf ("%-12s", layoutNames[layout]);
+
+        double start = bench_now();
+        for (int it = 0; it < iters; it++) {
+            const byte* ptr = &data[0];
+            ref.storeReference (tbl, &ptr, 1, NUM_RECORDS, true);
+        }
+        double secs = bench_now() - start;
+        printf ("%14.0f", (double)iters * NUM_RECORDS / secs);
+
+        start = bench_now();
+        for (int it = 0; it < iters; it++) {
+            byte* ptr = &data[0];
+            mgr.storeRecords (tbl, &ptr, 1, NUM_RECORDS, true);
+        }
+        secs = bench_now() - start;
+        printf ("%14.0f\n", (double)iters * NUM_RECORDS / secs);
+
+        if (writer->Sum != ref_writer->Sum) {
+            printf ("checksums differ\n");
+            return 1;
+        }
+    }
+    return 0;
+}
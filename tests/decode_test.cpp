@@ -0,0 +1,63 @@
+/**
+ * @file decode_test.cpp
+ * Checks that the records stored through the decode plans of the tables
+ * reach the writer as they did when they were decoded value by value: the
+ * same callbacks with the same values, byte for byte, and the same state
+ * of the table afterwards.
+ */
+
+#include "record_fixture.h"
+#include "test_util.h"
+
+// Records of each response
+#define NUM_RECORDS 40
+
+/**
+ * Stores the records of a response at once, or one at a time, and checks
+ * the writer got what the reference decoder hands it.
+ */
+static void check_layout (RecordLayout layout, bool one_at_a_time)
+{
+    Table tbl = make_table (layout);
+    Table ref_tbl = tbl;
+    vector<byte> data = encode_records (tbl, NUM_RECORDS, layout + 1);
+    const byte* end = &data[0] + data.size();
+
+    ReferenceDecoder ref;
+    RecordingWriter* ref_writer = new RecordingWriter;
+    const byte* ref_ptr = &data[0];
+    ref.setTableDataWriter (ref_writer);
+    ref.storeReference (ref_tbl, &ref_ptr, 1, NUM_RECORDS, true);
+    CHECK(ref_ptr == end);
+
+    TableDataManager mgr;
+    RecordingWriter* writer = new RecordingWriter;
+    byte* ptr = &data[0];
+    mgr.setTableDataWriter (writer);
+    if (one_at_a_time) {
+        for (int rec = 0; rec < NUM_RECORDS; rec++) {
+            mgr.storeRecord (tbl, &ptr, rec + 1, rec == 0);
+        }
+    }
+    else {
+        mgr.storeRecords (tbl, &ptr, 1, NUM_RECORDS, true);
+    }
+
+    CHECK(ptr == end);
+    CHECK(writer->Transcript == ref_writer->Transcript);
+    CHECK(tbl.NextRecord == ref_tbl.NextRecord);
+    CHECK(nseccmp (tbl.LastRecordTime, ref_tbl.LastRecordTime) == 0);
+    if (writer->Transcript != ref_writer->Transcript) {
+        printf ("layout %d (%s) differs from the reference\n", layout,
+                one_at_a_time ? "one at a time" : "batch");
+    }
+}
+
+int main ()
+{
+    for (int layout = 0; layout < NUM_RECORD_LAYOUTS; layout++) {
+        check_layout ((RecordLayout)layout, false);
+        check_layout ((RecordLayout)layout, true);
+    }
+    return test_result ("decode_test");
+}
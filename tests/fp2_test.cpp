@@ -0,0 +1,102 @@
+/**
+ * @file fp2_test.cpp
+ * Checks the decoding of the 2-byte final storage floats through the
+ * table of their values: the table, finalStorageFloat() and the
+ * decodeFp2() kernels of the scalar and SSSE3 decoders against
+ * GetFinalStorageFloat() for all 65536 patterns, and the values decoded
+ * for the special patterns.
+ */
+
+#include <string.h>
+#include <limits>
+#include "bulk_decode.h"
+#include "pb5_codec.h"
+#include "test_util.h"
+
+/**
+ * Returns true if the two floats have the same bits.
+ */
+static bool same_bits (float val, float ref)
+{
+    return memcmp (&val, &ref, sizeof(float)) == 0;
+}
+
+/**
+ * Decodes every pattern with the kernel of the decoder, from a source at
+ * an odd address, and checks the values against GetFinalStorageFloat().
+ */
+static void check_kernel (const BulkDecoder& decoder)
+{
+    static byte  src[2*0x10000 + 1];
+    static float dst[0x10000];
+
+    for (uint4 bits = 0; bits < 0x10000; bits++) {
+        BigEndian<2>::store (src + 1 + 2*bits, bits);
+    }
+    decoder.decodeFp2 (src + 1, dst, 0x10000);
+    for (uint4 bits = 0; bits < 0x10000; bits++) {
+        CHECK(same_bits (dst[bits], GetFinalStorageFloat ((uint2)bits)));
+    }
+
+    // Short arrays, with the value after the last one left alone
+    for (size_t count = 0; count < 20; count++) {
+        dst[count] = 12345;
+        decoder.decodeFp2 (src + 1 + 2*0x1ff0, dst, count);
+        for (size_t idx = 0; idx < count; idx++) {
+            CHECK(same_bits (dst[idx],
+                    GetFinalStorageFloat ((uint2)(0x1ff0 + idx))));
+        }
+        CHECK(dst[count] == 12345);
+    }
+}
+
+int main ()
+{
+    const float* table = BulkDecoder::getFp2Table();
+    const BulkDecoder& decoder = BulkDecoder::getInstance();
+
+    for (uint4 bits = 0; bits < 0x10000; bits++) {
+        float ref = GetFinalStorageFloat ((uint2)bits);
+        CHECK(same_bits (table[bits], ref));
+        CHECK(same_bits (decoder.finalStorageFloat ((uint2)bits), ref));
+    }
+
+    check_kernel (BulkDecoder::getScalar());
+#ifdef BULK_DECODE_SSSE3
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("ssse3")) {
+        Ssse3Decoder ssse3;
+        check_kernel (ssse3);
+    }
+#endif
+
+    // The sign, the decimal places and the mantissa
+    CHECK(decoder.finalStorageFloat (0x0000) == 0);
+    CHECK(decoder.finalStorageFloat (0x0001) == 1);
+    CHECK(decoder.finalStorageFloat (0x2001) == (float)0.1);
+    CHECK(decoder.finalStorageFloat (0x4001) == (float)0.01);
+    CHECK(decoder.finalStorageFloat (0x6001) == (float)0.001);
+    CHECK(decoder.finalStorageFloat (0x8001) == -1);
+    CHECK(decoder.finalStorageFloat (0x1b57) == 6999);
+    CHECK(decoder.finalStorageFloat (0x9b57) == -6999);
+    CHECK(decoder.finalStorageFloat (0x3fff) == (float)819.1);
+
+    // A negative zero keeps its sign
+    CHECK(same_bits (decoder.finalStorageFloat (0x8000), -0.0f));
+    CHECK(same_bits (decoder.finalStorageFloat (0xe000), -0.0f));
+
+    // The +INF, -INF and NaN patterns, then the other magnitudes above
+    // 6999 which decode to -9999
+    float nan = decoder.finalStorageFloat (0x9ffe);
+    CHECK(decoder.finalStorageFloat (0x1fff) == 
+            numeric_limits<float>::infinity());
+    CHECK(decoder.finalStorageFloat (0x9fff) == 
+            -numeric_limits<float>::infinity());
+    CHECK(nan != nan);
+    CHECK(decoder.finalStorageFloat (0x1ffe) == -9999);
+    CHECK(decoder.finalStorageFloat (0x9ffd) == -9999);
+    CHECK(decoder.finalStorageFloat (0x1b58) == -9999);
+    CHECK(decoder.finalStorageFloat (0x9b58) == -9999);
+
+    return test_result ("fp2_test");
+}
@@ -0,0 +1,329 @@
+/**
+ * @file record_fixture.cpp
+ * Implements the tables, the encoded records and the writer shared by the
+ * tests and benchmarks of the decoding of data records, along with the
+ * reference decoder they are checked against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pb5_codec.h"
+#include "record_fixture.h"
+
+void RecordingWriter :: processRecordBegin (Table& tblRef, int recordIdx,
+        NSec recordTime)
+{
+    char buf[64];
+
+    if (Record) {
+        sprintf (buf, "R%d %u.%u|", recordIdx, recordTime.sec,
+                recordTime.nsec);
+        Transcript += buf;
+    }
+}
+
+void RecordingWriter :: storeBool (const Field& var, bool flag)
+{
+    if (Record) {
+        Transcript += var.FieldName + (flag ? "=T," : "=F,");
+    }
+    else {
+        Sum += flag;
+    }
+}
+
+void RecordingWriter :: storeInt (const Field& var, int num)
+{
+    char buf[32];
+
+    if (Record) {
+        sprintf (buf, "=%d,", num);
+        Transcript += var.FieldName + buf;
+    }
+    else {
+        Sum += num;
+    }
+}
+
+void RecordingWriter :: storeFloat (const Field& var, float num)
+{
+    char  buf[32];
+    uint4 bits;
+
+    memcpy (&bits, &num, 4);
+    if (Record) {
+        sprintf (buf, "=%08x,", bits);
+        Transcript += var.FieldName + buf;
+    }
+    else {
+        Sum += bits;
+    }
+}
+
+void RecordingWriter :: storeString (const Field& var, string& str)
+{
+    if (Record) {
+        Transcript += var.FieldName + "=" + str + ",";
+    }
+    else {
+        Sum += str.size();
+    }
+}
+
+void RecordingWriter :: storeUint4 (const Field& var, uint4 num)
+{
+    char buf[32];
+
+    if (Record) {
+        sprintf (buf, "=%u,", num);
+        Transcript += var.FieldName + buf;
+    }
+    else {
+        Sum += num;
+    }
+}
+
+void RecordingWriter :: storeUint2 (const Field& var, uint2 num)
+{
+    storeUint4 (var, num);
+}
+
+void RecordingWriter :: processUnimplemented (const Field& var)
+{
+    if (Record) {
+        Transcript += var.FieldName + "=?,";
+    }
+}
+
+void RecordingWriter :: processRecordEnd (Table& tblRef)
+{
+    if (Record) {
+        Transcript += "\n";
+    }
+}
+
+static Field make_field (const string& name, byte type, uint4 dim)
+{
+    Field var;
+
+    var.FieldName   = name;
+    var.FieldType   = type;
+    var.Dimension   = dim;
+    var.Processing  = "Smp";
+    var.Unit        = "V";
+    var.Description = "d";
+    return var;
+}
+
+/**
+ * Returns a table of one-second records with the fields of the layout,
+ * collected from record 1.
+ */
+Table make_table (RecordLayout layout)
+{
+    Table tbl;
+    char  name[32];
+
+    tbl.TblName = "T";
+    tbl.TblTimeInterval.sec = 1;
+    tbl.NextRecord = 1;
+
+    if (layout == TYPICAL_LAYOUT) {
+        tbl.field_list.push_back (make_field ("Batt", 7, 1));
+        tbl.field_list.push_back (make_field ("Temp", 9, 8));
+        tbl.field_list.push_back (make_field ("RH", 7, 16));
+        tbl.field_list.push_back (make_field ("Cnt", 6, 2));
+        tbl.field_list.push_back (make_field ("WS", 9, 4));
+    }
+    else if (layout == ARRAYS_LAYOUT) {
+        const byte types[] = { 2, 3, 5, 6, 7, 9, 12, 13 };
+        const uint4 dims[] = { 1, 3, 4, 7, 8, 17, 64 };
+
+        for (size_t t = 0; t < sizeof(types); t++) {
+            for (size_t d = 0; d < sizeof(dims)/sizeof(dims[0]); d++) {
+                sprintf (name, "F%d_%u", types[t], dims[d]);
+                tbl.field_list.push_back (make_field (name, types[t],
+                        dims[d]));
+            }
+        }
+    }
+    else {
+        const byte types[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 13, 14,
+                15, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 30 };
+
+        for (size_t t = 0; t < sizeof(types); t++) {
+            sprintf (name, "F%d", types[t]);
+            tbl.field_list.push_back (make_field (name, types[t], t%3 + 1));
+        }
+        tbl.field_list.push_back (make_field ("S11", 11, 6));
+        if (layout == VAR_STRING_LAYOUT) {
+            tbl.field_list.push_back (make_field ("S16", 16, 12));
+            tbl.field_list.push_back (make_field ("After", 9, 2));
+        }
+    }
+    return tbl;
+}
+
+/**
+ * Returns the bytes per value of a data type, 0 for the types the
+ * application reads nothing of, -1 for the strings.
+ */
+static int value_width (byte type)
+{
+    switch (type) {
+    case 1: case 4: case 10: case 17: case 27: case 28:
+        return 1;
+    case 2: case 5: case 7: case 19: case 21:
+        return 2;
+    case 15:
+        return 3;
+    case 3: case 6: case 8: case 9: case 12: case 20: case 22: case 24:
+    case 26:
+        return 4;
+    case 13:
+        return 6;
+    case 14: case 18: case 23: case 25:
+        return 8;
+    case 11: case 16:
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Returns records of the table as a collect response holds them: the time
+ * of the first record, then the values of every record. The values are
+ * random bytes, the strings random letters.
+ */
+vector<byte> encode_records (const Table& tbl, int nrecs, unsigned seed)
+{
+    vector<byte> data(8);
+
+    srand (seed);
+    RecordTimeLayout::Sec::set (&data[0], 1000000000);
+    RecordTimeLayout::Nsec::set (&data[0], 500);
+
+    for (int rec = 0; rec < nrecs; rec++) {
+        for (size_t idx = 0; idx < tbl.field_list.size(); idx++) {
+            const Field& var = tbl.field_list[idx];
+            int width = value_width (var.FieldType);
+
+            if (var.FieldType == 11) {
+                for (uint4 n = 0; n < var.Dimension; n++) {
+                    data.push_back ((byte)('a' + rand()%26));
+                }
+            }
+            else if (var.FieldType == 16) {
+                int len = rand() % var.Dimension;
+                for (int n = 0; n < len; n++) {
+                    data.push_back ((byte)('a' + rand()%26));
+                }
+                data.push_back (0);
+            }
+            else {
+                for (uint4 n = 0; n < var.Dimension*width; n++) {
+                    data.push_back ((byte)rand());
+                }
+            }
+        }
+    }
+    return data;
+}
+
+/**
+ * Decodes a value of a field as TableDataManager::storeDataSample() did
+ * before the records were decoded through a decode plan, and hands it to
+ * the writer.
+ */
+void ReferenceDecoder :: store_sample (const Field& var, const byte** data)
+{
+    TableDataWriter& writer = *getTableDataWriter();
+    string str;
+
+    switch (var.FieldType) {
+    case 7:
+        writer.storeFloat (var, GetFinalStorageFloat (
+                (uint2)BigEndian<2>::load (*data)));
+        break;
+    case 9:
+        writer.storeFloat (var, intBitsToFloat (BigEndian<4>::load (*data)));
+        break;
+    case 4:
+        writer.storeInt (var, (int)BigEndian<1>::load (*data));
+        break;
+    case 5:
+        writer.storeInt (var, (int)BigEndian<2>::load (*data));
+        break;
+    case 6:
+        writer.storeInt (var, (int)BigEndian<4>::load (*data));
+        break;
+    case 1: case 17:
+        writer.storeUint4 (var, BigEndian<1>::load (*data));
+        break;
+    case 2:
+        writer.storeUint4 (var, BigEndian<2>::load (*data));
+        break;
+    case 3: case 12: case 13:
+        writer.storeUint4 (var, BigEndian<4>::load (*data));
+        break;
+    case 10: case 27: case 28:
+        writer.storeBool (var, (*data)[0] & 0x80);
+        break;
+    case 11:
+        str = GetFixedLenString (*data, var);
+        writer.storeString (var, str);
+        *data += var.Dimension;
+        return;
+    case 16:
+        str = GetVarLenString (*data);
+        writer.storeString (var, str);
+        *data += str.size() + 1;
+        return;
+    default:
+        writer.processUnimplemented (var);
+        logUnimplementedDataError (var);
+    }
+    *data += value_width (var.FieldType);
+}
+
+/**
+ * Decodes records value by value, as TableDataManager::storeRecord() did
+ * before the records were decoded through a decode plan: the field list
+ * is copied for each record, and each value is decoded on its own.
+ */
+void ReferenceDecoder :: storeReference (Table& tbl, const byte** data,
+        uint4 rec_num, int nrecs, bool parse_timestamp)
+{
+    TableDataWriter& writer = *getTableDataWriter();
+    NSec recordTime = tbl.LastRecordTime;
+
+    for (int rec = 0; rec < nrecs; rec++) {
+        vector<Field> field_list = tbl.field_list;
+        vector<Field>::const_iterator itr;
+
+        if (parse_timestamp && !rec) {
+            recordTime = parseRecordTime (*data);
+            *data += 8;
+        }
+        else {
+            recordTime += tbl.TblTimeInterval;
+        }
+        writer.processRecordBegin (tbl, rec_num + rec, recordTime);
+
+        for (itr = field_list.begin(); itr != field_list.end(); itr++) {
+            if ((itr->FieldType == 11) || (itr->FieldType == 16)) {
+                store_sample (*itr, data);
+            }
+            else {
+                for (uint4 dim = 0; dim < itr->Dimension; dim++) {
+                    store_sample (*itr, data);
+                }
+            }
+        }
+        writer.processRecordEnd (tbl);
+        tbl.LastRecordTime = recordTime;
+        tbl.NextRecord += 1;
+    }
+}
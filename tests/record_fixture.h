@@ -0,0 +1,72 @@
+/**
+ * @file record_fixture.h
+ * Declares the tables, the encoded records and the writer shared by the
+ * tests and benchmarks of the decoding of data records, along with the
+ * reference decoder they are checked against.
+ */
+
+#ifndef RECORD_FIXTURE_H
+#define RECORD_FIXTURE_H
+#include <fstream>
+#include <string>
+#include <vector>
+#include "pb5_data.h"
+using namespace std;
+
+/**
+ * Layouts of the tables of the fixture.
+ */
+enum RecordLayout {
+    TYPICAL_LAYOUT,     // Met station table of FP2, IEEE4 and INT4 values
+    ALL_TYPES_LAYOUT,   // Every data type, with a fixed length string
+    VAR_STRING_LAYOUT,  // Every data type, with a variable length string
+    ARRAYS_LAYOUT,      // Arrays of 1 to 64 values of the numeric types
+    NUM_RECORD_LAYOUTS
+};
+
+/**
+ * Writer recording the per-value callbacks as text, or only summing the
+ * values when the cost of decoding is measured. The floats are recorded
+ * and summed by their bit pattern, as the NaNs don't compare.
+ */
+class RecordingWriter : public TableDataWriter {
+public:
+    RecordingWriter (bool record = true) : Record(record), Sum(0) {}
+
+    void configure (const DataOutputConfig& config) {}
+    void initWrite (Table& tblRef) throw (StorageException) {}
+    void processRecordBegin (Table& tblRef, int recordIdx, NSec recordTime);
+    void storeBool (const Field& var, bool flag);
+    void storeInt (const Field& var, int num);
+    void storeFloat (const Field& var, float num);
+    void storeString (const Field& var, string& str);
+    void storeUint4 (const Field& var, uint4 num);
+    void storeUint2 (const Field& var, uint2 num);
+    void processUnimplemented (const Field& var);
+    void processRecordEnd (Table& tblRef);
+    void finishWrite (Table& tblRef) throw (StorageException) {}
+    void flush (const Table& tblRef) {}
+
+    bool   Record;
+    double Sum;
+    string Transcript;
+};
+
+/**
+ * Manager storing records as the application did before the records were
+ * decoded through a decode plan, for the others to be checked and timed
+ * against.
+ */
+class ReferenceDecoder : public TableDataManager {
+public:
+    void storeReference (Table& tbl, const byte** data, uint4 rec_num,
+             int nrecs, bool parse_timestamp);
+
+private:
+    void store_sample (const Field& var, const byte** data);
+};
+
+Table  make_table (RecordLayout layout);
+vector<byte> encode_records (const Table& tbl, int nrecs, unsigned seed);
+
+#endif
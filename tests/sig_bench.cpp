@@ -0,0 +1,71 @@
+/**
+ * @file sig_bench.cpp
+ * Measures the throughput of the CSI signature functions on frames of 
+ * the sizes exchanged with a logger, from the 6-byte link state packets
+ * up to a full packet.
+ */
+
+#include <stdlib.h>
+#include "pb5_proto.h"
+#include "test_util.h"
+
+// Bytes signed for each measurement
+#define BENCH_BYTES 200000000
+
+// Table of the next state indexed by the current one, less the byte 
+// being added: the alternative to CalcSigFast() that keeps the whole 
+// state in one lookup
+static byte stateTable[0x10000];
+
+static uint2 CalcSigTable (const void* buf, uint4 len, uint2 seed)
+{
+    const byte* ptr = (const byte *)buf;
+    uint2 sig = seed;
+
+    for (uint4 n = 0; n < len; n++) {
+        sig = (uint2)((sig << 8) | (byte)(stateTable[sig] + ptr[n]));
+    }
+    return sig;
+}
+
+typedef uint2 (*SigFunc)(const void*, uint4, uint2);
+
+int main ()
+{
+    static byte frame[MAX_PACK_SIZE];
+    const uint4 sizes[] = { 6, 14, 64, 256, MAX_PACK_SIZE };
+    const SigFunc funcs[] = { CalcSig, CalcSigFast, CalcSigTable };
+    const char* names[] = { "CalcSig", "CalcSigFast", "state table" };
+    volatile uint2 sink = 0;
+
+    for (uint4 sig = 0; sig < 0x10000; sig++) {
+        stateTable[sig] = (byte)CalcSigStep ((uint2)sig, 0);
+    }
+    for (uint4 idx = 0; idx < MAX_PACK_SIZE; idx++) {
+        frame[idx] = (byte)rand();
+    }
+
+    printf ("%-12s", "frame bytes");
+    for (int f = 0; f < 3; f++) {
+        printf ("%14s", names[f]);
+    }
+    printf ("   (MB/s)\n");
+
+    for (int s = 0; s < 5; s++) {
+        printf ("%-12u", sizes[s]);
+        for (int f = 0; f < 3; f++) {
+            uint4 iters = BENCH_BYTES / sizes[s];
+            uint2 acc = 0;
+            double start = bench_now();
+
+            for (uint4 it = 0; it < iters; it++) {
+                acc ^= funcs[f](frame, sizes[s], (uint2)it);
+            }
+            double secs = bench_now() - start;
+            sink = sink ^ acc;
+            printf ("%14.0f", (double)iters * sizes[s] / secs / 1e6);
+        }
+        printf ("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file sig_test.cpp
+ * Checks that CalcSigFast() and CalcSigStep() compute the same CSI 
+ * signature as the reference CalcSig().
+ */
+
+#include <stdlib.h>
+#include "pb5_proto.h"
+#include "test_util.h"
+
+// Seeds with all, none or alternate bits set in either byte, plus the 
+// seed of the PakBus packets
+static const uint2 edgeSeeds[] = { 0x0000, 0xffff, 0x00ff, 0xff00, 0x0001,
+        0x8000, 0x7fff, 0x5555, 0xaaaa, 0x0100, 0x0080 };
+#define NUM_EDGE_SEEDS (sizeof(edgeSeeds) / sizeof(edgeSeeds[0]))
+
+// Random seeds tried on each length in addition to the edge ones
+#define NUM_RANDOM_SEEDS 8
+
+/**
+ * Fills the buffer with the pattern of the given number.
+ */
+static void fill_pattern (byte* buf, uint4 len, int pattern)
+{
+    for (uint4 idx = 0; idx < len; idx++) {
+        switch (pattern) {
+        case 0:  buf[idx] = 0x00; break;
+        case 1:  buf[idx] = 0xff; break;
+        case 2:  buf[idx] = (idx & 1) ? 0x55 : 0xaa; break;
+        case 3:  buf[idx] = (byte)idx; break;
+        case 4:  buf[idx] = 0xbd; break;   // SerSyncByte
+        default: buf[idx] = (byte)rand(); break;
+        }
+    }
+}
+#define NUM_PATTERNS 8
+
+static void check_sig (const byte* buf, uint4 len, uint2 seed)
+{
+    uint2 ref = CalcSig (buf, len, seed);
+    uint2 sig = seed;
+
+    for (uint4 idx = 0; idx < len; idx++) {
+        sig = CalcSigStep (sig, buf[idx]);
+    }
+    CHECK(CalcSigFast (buf, len, seed) == ref);
+    CHECK(sig == ref);
+}
+
+int main ()
+{
+    // One spare byte in front, so that the frames start unaligned too
+    static byte frame[MAX_PACK_SIZE + 1];
+
+    srand (5);
+
+    // Every seed with every byte value
+    for (uint4 seed = 0; seed < 0x10000; seed++) {
+        for (uint4 val = 0; val < 0x100; val++) {
+            byte b = (byte)val;
+            check_sig (&b, 1, (uint2)seed);
+        }
+    }
+
+    // Every length up to a full packet, covering the unrolled loop and 
+    // each length of the tail
+    for (int pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+        for (uint4 len = 0; len <= MAX_PACK_SIZE; len++) {
+            byte* buf = frame + (len & 1);
+
+            fill_pattern (buf, len, pattern);
+            for (uint4 n = 0; n < NUM_EDGE_SEEDS; n++) {
+                check_sig (buf, len, edgeSeeds[n]);
+            }
+            for (uint4 n = 0; n < NUM_RANDOM_SEEDS; n++) {
+                check_sig (buf, len, (uint2)rand());
+            }
+        }
+    }
+
+    // The nullifier appended to a packet brings its signature to zero
+    for (uint4 len = 0; len <= MAX_PACK_SIZE - 2; len += 37) {
+        fill_pattern (frame, len, NUM_PATTERNS - 1);
+        uint2 nullifier = CalcSigNullifier (CalcSigFast (frame, len, 
+                SIG_SEED));
+        frame[len]     = (byte)(nullifier >> 8);
+        frame[len + 1] = (byte)nullifier;
+        CHECK(CalcSigFast (frame, len + 2, SIG_SEED) == 0);
+    }
+
+    return test_result ("sig_test");
+}
@@ -0,0 +1,626 @@
+/**
+ * @file stand_in_logger.cpp
+ * Implements the stand-in PakBus logger of the tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "serial_comm.h"
+#include "stand_in_logger.h"
+
+// Set by SIGTERM to have the child report its stats and exit
+static volatile sig_atomic_t stopRequested = 0;
+
+static void on_stop (int)
+{
+    stopRequested = 1;
+}
+
+static void put_uint4 (vector<byte>& buf, uint4 val)
+{
+    byte tmp[4];
+    BigEndian<4>::store (tmp, val);
+    buf.insert (buf.end(), tmp, tmp + 4);
+}
+
+static void put_uint2 (vector<byte>& buf, uint4 val)
+{
+    byte tmp[2];
+    BigEndian<2>::store (tmp, val);
+    buf.insert (buf.end(), tmp, tmp + 2);
+}
+
+static void put_string (vector<byte>& buf, const string& str)
+{
+    buf.insert (buf.end(), str.begin(), str.end());
+    buf.push_back (0);
+}
+
+StandInLogger :: StandInLogger () : answerBaud__(0), maxPayload__(1000),
+        dropEvery__(0), rangeCollects__(0), clockOffset__(0), masterFd__(-1), slaveFd__(-1), listenFd__(-1),
+        connFd__(-1), pid__(0), statsFd__(-1), obuf__(64, 2*MAX_PACK_SIZE)
+{
+    memset (&stats__, 0, sizeof(stats__));
+    baseTime__ = (uint4)(time(NULL) - SECS_BEFORE_1990);
+}
+
+StandInLogger :: ~StandInLogger ()
+{
+    if (pid__) {
+        stop ();
+    }
+    if (masterFd__ >= 0) {
+        close (masterFd__);
+        close (slaveFd__);
+    }
+    if (listenFd__ >= 0) {
+        close (listenFd__);
+    }
+    if (linkPath__.size()) {
+        unlink (linkPath__.c_str());
+    }
+}
+
+/**
+ * Adds a table holding the records 1 to nrecs, the last of which was
+ * stored when the logger was created.
+ *
+ * @param name: Name of the table.
+ * @param nrecs: Number of records.
+ * @param nfields: Number of fields of each record.
+ * @param interval: Seconds between the records.
+ */
+void StandInLogger :: addTable (const string& name, uint4 nrecs,
+        int nfields, uint4 interval)
+{
+    Table tbl;
+    tbl.Name        = name;
+    tbl.Size        = nrecs;
+    tbl.FirstRec    = 1;
+    tbl.NbrOfRecs   = nrecs;
+    tbl.NbrOfFields = nfields;
+    tbl.Interval    = interval;
+    tbl.LastTime    = baseTime__;
+    tables__.push_back (tbl);
+    build_tdf ();
+}
+
+/**
+ * Stores further records in a table, each an interval after the newest.
+ * The table keeps its size, the oldest records are overwritten.
+ *
+ * @param tbl_idx: Index of the table, in the order the tables were added.
+ * @param nrecs: Number of records to store.
+ */
+void StandInLogger :: appendRecords (int tbl_idx, uint4 nrecs)
+{
+    Table& tbl = tables__[tbl_idx];
+
+    tbl.NbrOfRecs += nrecs;
+    tbl.LastTime  += nrecs*tbl.Interval;
+    if (tbl.NbrOfRecs > tbl.Size) {
+        tbl.FirstRec  += tbl.NbrOfRecs - tbl.Size;
+        tbl.NbrOfRecs  = tbl.Size;
+    }
+}
+
+/**
+ * Returns the time stamp (secs since 1990) of a record of a table.
+ */
+uint4 StandInLogger :: getRecordTime (int tbl_idx, uint4 rec_nbr)
+{
+    const Table& tbl = tables__[tbl_idx];
+    return tbl.LastTime - (tbl.FirstRec + tbl.NbrOfRecs - 1 - rec_nbr) *
+            tbl.Interval;
+}
+
+/**
+ * Opens the pty pair the logger serves, and links the given path to its
+ * slave side. The slave is held open until the logger is destroyed, so
+ * that the master keeps working while the application reopens the port.
+ *
+ * @param link_path: Path of the link, handed to the application as the
+ *                   name of the port.
+ * @return The path of the link.
+ */
+string StandInLogger :: openPty (const string& link_path)
+{
+    struct termios tio;
+
+    if (openpty (&masterFd__, &slaveFd__, NULL, NULL, NULL) < 0) {
+        perror ("openpty");
+        exit (1);
+    }
+    tcgetattr (slaveFd__, &tio);
+    cfmakeraw (&tio);
+    tcsetattr (slaveFd__, TCSANOW, &tio);
+
+    unlink (link_path.c_str());
+    if (symlink (ttyname(slaveFd__), link_path.c_str()) < 0) {
+        perror ("symlink");
+        exit (1);
+    }
+    linkPath__ = link_path;
+    obuf__.setFd (masterFd__);
+    return linkPath__;
+}
+
+/**
+ * Listens on a TCP port of the loopback interface instead of a pty. The
+ * child serves one connection at a time, and accepts the next one once
+ * the application closes it.
+ *
+ * @param backlog: Connections the port queues before they are accepted.
+ * @return The port number, picked by the system.
+ */
+int StandInLogger :: listenTcp (int backlog)
+{
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int                on = 1;
+
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    listenFd__ = socket (AF_INET, SOCK_STREAM, 0);
+    setsockopt (listenFd__, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((bind (listenFd__, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+            (listen (listenFd__, backlog) < 0) ||
+            (getsockname (listenFd__, (struct sockaddr*)&addr, &len) < 0)) {
+        perror ("listen");
+        exit (1);
+    }
+    return ntohs (addr.sin_port);
+}
+
+/**
+ * Writes the table definitions, as the application caches them after
+ * uploading the .TDF file.
+ */
+void StandInLogger :: writeTdf (const string& path)
+{
+    FILE* fp = fopen (path.c_str(), "wb");
+    if (!fp || (fwrite (&tdf__[0], 1, tdf__.size(), fp) != tdf__.size())) {
+        perror (path.c_str());
+        exit (1);
+    }
+    fclose (fp);
+}
+
+/**
+ * Forks the child process serving the pty.
+ */
+void StandInLogger :: start ()
+{
+    int fds[2];
+
+    if (pipe (fds) < 0) {
+        perror ("pipe");
+        exit (1);
+    }
+    if ((pid__ = fork ()) == 0) {
+        signal (SIGTERM, on_stop);
+        close (fds[0]);
+        statsFd__ = fds[1];
+        serve ();
+    }
+    close (fds[1]);
+    statsFd__ = fds[0];
+}
+
+/**
+ * Stops the child process.
+ *
+ * @return The counters of the logger.
+ */
+StandInLogger::Stats StandInLogger :: stop ()
+{
+    Stats stats;
+    memset (&stats, 0, sizeof(stats));
+
+    kill (pid__, SIGTERM);
+    if (read (statsFd__, &stats, sizeof(stats)) != sizeof(stats)) {
+        fprintf (stderr, "stand-in logger: no stats reported\n");
+    }
+    waitpid (pid__, NULL, 0);
+    close (statsFd__);
+    pid__ = 0;
+    return stats;
+}
+
+/**
+ * Serves the pty until stopped: the received frames are unquoted, and
+ * each frame is answered as it is closed by the next SerSyncByte.
+ */
+void StandInLogger :: serve () throw ()
+{
+    vector<byte> frame;
+    bool         in_frame = false;
+    bool         quoted = false;
+    byte         buf[1024];
+
+    while (!stopRequested) {
+        int fd = wait_input ();
+        if (fd < 0) {
+            continue;
+        }
+
+        int nbytes = read (fd, buf, sizeof(buf));
+        if (nbytes <= 0) {
+            if (fd == connFd__) {
+                // Closed by the application, the next one is accepted
+                close (connFd__);
+                connFd__ = -1;
+                in_frame = false;
+            }
+            continue;
+        }
+        if (answerBaud__ && (current_baud () != answerBaud__)) {
+            stats__.DroppedReads++;
+            in_frame = false;
+            continue;
+        }
+
+        for (int idx = 0; idx < nbytes; idx++) {
+            byte c = buf[idx];
+
+            if (c == 0xbd) {
+                if (in_frame && (frame.size() >= 4)) {
+                    handle_frame (frame);
+                }
+                in_frame = true;
+                quoted   = false;
+                frame.clear ();
+            }
+            else if (!in_frame) {
+                continue;
+            }
+            else if (quoted) {
+                frame.push_back ((c == 0xdd) ? 0xbd : (c == 0xdc) ? 0xbc : c);
+                quoted = false;
+            }
+            else if (c == 0xbc) {
+                quoted = true;
+            }
+            else {
+                frame.push_back (c);
+            }
+        }
+    }
+
+    if (write (statsFd__, &stats__, sizeof(stats__)) != sizeof(stats__)) {
+        perror ("stand-in logger");
+    }
+    _exit (0);
+}
+
+/**
+ * Waits up to 50 msecs for input on the pty or the TCP connection. On
+ * the TCP port, a connection is accepted when none is open.
+ *
+ * @return The descriptor to read, -1 if none is ready.
+ */
+int StandInLogger :: wait_input ()
+{
+    struct pollfd pfd;
+
+    if (listenFd__ < 0) {
+        pfd.fd = masterFd__;
+    }
+    else {
+        pfd.fd = (connFd__ < 0) ? listenFd__ : connFd__;
+    }
+    pfd.events = POLLIN;
+    if (poll (&pfd, 1, 50) <= 0) {
+        return -1;
+    }
+
+    if (pfd.fd == listenFd__) {
+        if ((connFd__ = accept (listenFd__, NULL, NULL)) >= 0) {
+            stats__.Connections++;
+            obuf__.setFd (connFd__);
+        }
+        return -1;
+    }
+    return pfd.fd;
+}
+
+/**
+ * Returns the baud rate the pty is set to.
+ */
+long StandInLogger :: current_baud ()
+{
+    return get_custom_baud (masterFd__);
+}
+
+/**
+ * Answers an unquoted frame, which still ends with its signature nullifier.
+ */
+void StandInLogger :: handle_frame (const vector<byte>& frame)
+{
+    if (frame.size() < PakBusHeader::SIZE + 2) {
+        reply_link_state (frame);
+        return;
+    }
+
+    const byte*  hdr   = &frame[0];
+    const byte*  body  = hdr + PakBusHeader::SIZE;
+    int          len   = frame.size() - PakBusHeader::SIZE - 2;
+    byte         proto = (byte)PakBusHeader::HiProtoCode::get(hdr);
+    byte         type  = (byte)PakBusHeader::MsgType::get(hdr);
+    vector<byte> resp;
+
+    if ((proto == 0x00) && (type == 0x09)) {
+        resp.push_back (0x00);
+        resp.push_back ((byte)HelloMsg::HopMetric::get(body));
+        put_uint2 (resp, 0x3c);
+        reply (frame, 0x89, resp);
+        stats__.Hellos++;
+        stats__.HelloBaud = current_baud ();
+    }
+    else if (proto == 0x00) {
+        return;
+    }
+    else if (type == 0x17) {
+        answer_clock (frame, body);
+    }
+    else if (type == 0x18) {
+        answer_prog_stats (frame);
+    }
+    else if (type == 0x1d) {
+        answer_file_upload (frame, body, len);
+    }
+    else if (type == 0x09) {
+        answer_collect (frame, body, len);
+    }
+}
+
+/**
+ * Sends a message to the sender of the given frame, in reply to it.
+ */
+void StandInLogger :: reply (const vector<byte>& frame, byte msg_type,
+        const vector<byte>& body)
+{
+    const byte* req = &frame[0];
+    byte        hdr[PakBusHeader::SIZE];
+
+    PakBusHeader::DstPhyWord::set (hdr,
+            PakBusHeader::LinkState::pack(0x0a) |
+            PakBusHeader::DstPhyAddr::pack(
+                PakBusHeader::SrcPhyAddr::get(req)));
+    PakBusHeader::SrcPhyWord::set (hdr,
+            PakBusHeader::ExpMoreCode::pack(0x01) |
+            PakBusHeader::SrcPhyAddr::pack(
+                PakBusHeader::DstPhyAddr::get(req)));
+    PakBusHeader::DstNodeWord::set (hdr,
+            PakBusHeader::HiProtoCode::pack(
+                PakBusHeader::HiProtoCode::get(req)) |
+            PakBusHeader::DstNodeId::pack(
+                PakBusHeader::SrcNodeId::get(req)));
+    PakBusHeader::SrcNodeWord::set (hdr,
+            PakBusHeader::SrcNodeId::pack(
+                PakBusHeader::DstNodeId::get(req)));
+    PakBusHeader::MsgType::set (hdr, msg_type);
+    PakBusHeader::TranNbr::set (hdr, PakBusHeader::TranNbr::get(req));
+
+    obuf__.appendFrame (hdr, sizeof(hdr), body.empty() ? hdr : &body[0],
+            body.size());
+    obuf__.writeToDevice ();
+}
+
+/**
+ * Answers a link state packet with "ready".
+ */
+void StandInLogger :: reply_link_state (const vector<byte>& frame)
+{
+    const byte* req = &frame[0];
+    byte        hdr[PakBusHeader::LINK_SIZE];
+
+    PakBusHeader::DstPhyWord::set (hdr,
+            PakBusHeader::LinkState::pack(0x0a) |
+            PakBusHeader::DstPhyAddr::pack(
+                PakBusHeader::SrcPhyAddr::get(req)));
+    PakBusHeader::SrcPhyWord::set (hdr,
+            PakBusHeader::SrcPhyAddr::pack(
+                PakBusHeader::DstPhyAddr::get(req)));
+
+    obuf__.beginFrame ();
+    obuf__.putFrameBytes (hdr, sizeof(hdr));
+    obuf__.putSigNullifier ();
+    obuf__.closeFrame ();
+    obuf__.writeToDevice ();
+}
+
+/**
+ * Answers a clock command with the time before the adjustment it carries,
+ * then adjusts the clock.
+ */
+void StandInLogger :: answer_clock (const vector<byte>& frame,
+        const byte* body)
+{
+    vector<byte> resp;
+    int          adjust = (int)ClockRequestMsg::AdjustSecs::get (body);
+
+    resp.push_back (0x00);
+    put_uint4 (resp, (uint4)(time(NULL) + clockOffset__ - SECS_BEFORE_1990));
+    put_uint4 (resp, 0);
+    reply (frame, 0x97, resp);
+
+    stats__.ClockChecks++;
+    if (adjust) {
+        clockOffset__ += adjust;
+        stats__.ClockSets++;
+    }
+}
+
+void StandInLogger :: answer_prog_stats (const vector<byte>& frame)
+{
+    vector<byte> resp;
+
+    resp.push_back (0x00);
+    put_string (resp, "CR1000.Std.20");
+    put_uint2 (resp, 0x1234);
+    put_string (resp, "1234");
+    put_string (resp, "CPU:stand_in.cr1");
+    resp.push_back (0x00);
+    put_string (resp, "CPU:stand_in.cr1");
+    put_uint2 (resp, 0x4321);
+    reply (frame, 0x98, resp);
+}
+
+/**
+ * Answers the upload of the .TDF file. The command carries the security
+ * code, the file name, the close flag, the file offset and the swath.
+ */
+void StandInLogger :: answer_file_upload (const vector<byte>& frame,
+        const byte* body, int len)
+{
+    vector<byte> resp;
+    int          name_len = 0;
+
+    while ((FileRequestMsg::FILE_NAME + name_len < len) &&
+            body[FileRequestMsg::FILE_NAME + name_len]) {
+        name_len++;
+    }
+    const byte* tail = FileRequestMsg::tail (body, name_len);
+    uint4 file_off = FileReceiveTail::FileOffset::get (tail);
+    uint4 swath    = FileReceiveTail::Swath::get (tail);
+
+    resp.push_back (0x00);
+    put_uint4 (resp, file_off);
+    for (uint4 pos = file_off; (pos < tdf__.size()) &&
+            (pos < file_off + swath); pos++) {
+        resp.push_back (tdf__[pos]);
+    }
+    reply (frame, 0x9d, resp);
+    stats__.FileUploads++;
+}
+
+/**
+ * Answers a collect data command on any number of tables. The records of
+ * a table are cut short to keep the response within the maximum payload.
+ */
+void StandInLogger :: answer_collect (const vector<byte>& frame,
+        const byte* body, int len)
+{
+    vector<byte> resp;
+    byte         mode = (byte)CollectRequestMsg::CollectMode::get(body);
+    int          off  = CollectRequestMsg::SIZE;
+    byte         more = 0x00;
+
+    if ((mode == 0x06) && dropEvery__ && 
+            (++rangeCollects__ % dropEvery__ == 0)) {
+        stats__.DroppedCollects++;
+        return;
+    }
+
+    resp.push_back (0x00);
+    while (off + CollectTableSpec::SIZE <= len) {
+        uint2 tbl_nbr = (uint2)CollectTableSpec::TableNbr::get(body + off);
+        if (!tbl_nbr || (tbl_nbr > tables__.size())) {
+            break;
+        }
+        off += CollectTableSpec::SIZE;
+
+        uint4 P1 = 0;
+        uint4 P2 = 0;
+        if ((mode == 0x04) || (mode == 0x05)) {
+            P1 = BigEndian<4>::load (body + off);
+            off += 4;
+        }
+        else if (mode == 0x06) {
+            P1 = BigEndian<4>::load (body + off);
+            P2 = BigEndian<4>::load (body + off + 4);
+            off += 8;
+        }
+        while ((off + 2 <= len) && BigEndian<2>::load (body + off)) {
+            off += 2;
+        }
+        off += 2;
+
+        const Table& tbl = tables__[tbl_nbr - 1];
+        uint4 first = tbl.FirstRec;
+        uint4 end   = tbl.FirstRec + tbl.NbrOfRecs;
+        uint4 beg   = end;
+
+        if (mode == 0x05) {
+            beg = (P1 < tbl.NbrOfRecs) ? end - P1 : first;
+        }
+        else if (mode == 0x04) {
+            beg = (P1 > first) ? P1 : first;
+        }
+        else if (mode == 0x06) {
+            beg = (P1 > first) ? P1 : first;
+            end = (P2 < end) ? P2 : end;
+        }
+
+        int recsize = 4*tbl.NbrOfFields;
+        int room    = (maxPayload__ - (int)resp.size() - 16) / recsize;
+        int nrecs   = (end > beg) ? (int)(end - beg) : 0;
+        if (nrecs > room) {
+            nrecs = (room > 0) ? room : 0;
+            more  = (mode == 0x04) ? 0x01 : more;
+        }
+
+        put_uint2 (resp, tbl_nbr);
+        put_uint4 (resp, nrecs ? beg : 0);
+        put_uint2 (resp, nrecs);
+        for (int idx = 0; idx < nrecs; idx++) {
+            if (idx == 0) {
+                put_uint4 (resp, getRecordTime (tbl_nbr - 1, beg));
+                put_uint4 (resp, 0);
+            }
+            for (int field = 0; field < tbl.NbrOfFields; field++) {
+                put_uint4 (resp, fieldValue (beg + idx, field));
+            }
+        }
+    }
+    resp.push_back (more);
+    reply (frame, 0x89, resp);
+    stats__.Collects++;
+}
+
+/**
+ * Builds the table definitions: the version, then for each table its
+ * name, size, time type, time into the interval, interval and fields.
+ */
+void StandInLogger :: build_tdf ()
+{
+    tdf__.assign (1, 0x01);
+    for (size_t idx = 0; idx < tables__.size(); idx++) {
+        const Table& tbl = tables__[idx];
+
+        put_string (tdf__, tbl.Name);
+        put_uint4 (tdf__, tbl.Size);
+        tdf__.push_back (0x0e);
+        put_uint4 (tdf__, 0);
+        put_uint4 (tdf__, 0);
+        put_uint4 (tdf__, tbl.Interval);
+        put_uint4 (tdf__, 0);
+
+        for (int field = 0; field < tbl.NbrOfFields; field++) {
+            char name[16];
+            sprintf (name, "F%d", field);
+            tdf__.push_back (6);            // 4-byte signed integer
+            put_string (tdf__, name);
+            tdf__.push_back (0x00);         // No alias
+            put_string (tdf__, "Smp");
+            put_string (tdf__, "u");
+            put_string (tdf__, "d");
+            put_uint4 (tdf__, 1);           // Beginning index
+            put_uint4 (tdf__, 1);           // Dimension
+            put_uint4 (tdf__, 0);           // End of the sub-dimensions
+        }
+        tdf__.push_back (0x00);
+    }
+}
@@ -0,0 +1,112 @@
+/**
+ * @file stand_in_logger.h
+ * Declares a stand-in PakBus logger for the tests. It serves the master
+ * of a pty pair from a child process, so that the application under test
+ * talks to the slave side as it would to a serial port, or the
+ * connections accepted on a TCP port of the loopback interface, as a
+ * logger with a built-in IP port would.
+ */
+
+#ifndef STAND_IN_LOGGER_H
+#define STAND_IN_LOGGER_H
+#include <string>
+#include <vector>
+#include "pb5.h"
+using namespace std;
+
+/**
+ * Logger answering the link state packets, the PakCtrl Hello, and the
+ * BMP5 clock, programming statistics, file upload and collect data
+ * (modes 0x04, 0x05 and 0x06) commands. Its clock may be set off the
+ * time of the host, until the application sets it. Its tables hold a fixed set of
+ * records of 4-byte integer fields; the value of field F of record R is
+ * R*100 + F. The table definitions are served as the .TDF file.
+ *
+ * The logger may be set to answer at a single baud rate only: the bytes
+ * received while the pty is set to any other rate are dropped, as a real
+ * logger would see them as line noise. It may also leave every Nth range
+ * collect command (mode 0x06) unanswered, as if the command or response
+ * was lost.
+ */
+class StandInLogger {
+public:
+    /** Counters reported by the logger when stopped. */
+    struct Stats {
+        int  Hellos;         // Hello commands answered
+        int  Collects;       // Collect data commands answered
+        int  FileUploads;    // File upload commands answered
+        int  DroppedReads;   // Reads dropped at a wrong baud rate
+        int  DroppedCollects;// Collect commands left unanswered
+        int  Connections;    // TCP connections accepted
+        int  ClockChecks;    // Clock commands answered
+        int  ClockSets;      // Clock commands setting the clock
+        long HelloBaud;      // Baud rate of the last Hello answered
+    };
+
+    StandInLogger ();
+    ~StandInLogger ();
+    void   addTable (const string& name, uint4 nrecs, int nfields,
+                   uint4 interval);
+    void   setAnswerBaud (long baud) { answerBaud__ = baud; }
+    void   setMaxPayload (int nbytes) { maxPayload__ = nbytes; }
+    void   setDropEvery (int count) { dropEvery__ = count; }
+    void   setClockOffset (int secs) { clockOffset__ = secs; }
+    void   appendRecords (int tbl_idx, uint4 nrecs);
+    string openPty (const string& link_path);
+    int    listenTcp (int backlog = 1);
+    void   writeTdf (const string& path);
+    void   start ();
+    Stats  stop ();
+
+    static uint4 fieldValue (uint4 rec_nbr, int field)
+    {
+        return rec_nbr*100 + field;
+    }
+    uint4  getRecordTime (int tbl_idx, uint4 rec_nbr);
+
+private:
+    struct Table {
+        string Name;
+        uint4  Size;         // Records the table holds
+        uint4  FirstRec;     // Number of the oldest record
+        uint4  NbrOfRecs;
+        int    NbrOfFields;
+        uint4  Interval;     // Seconds between the records
+        uint4  LastTime;     // Time of the newest record
+    };
+
+    void   serve () throw ();
+    int    wait_input ();
+    long   current_baud ();
+    void   handle_frame (const vector<byte>& frame);
+    void   reply (const vector<byte>& frame, byte msg_type,
+                  const vector<byte>& body);
+    void   reply_link_state (const vector<byte>& frame);
+    void   answer_clock (const vector<byte>& frame, const byte* body);
+    void   answer_prog_stats (const vector<byte>& frame);
+    void   answer_file_upload (const vector<byte>& frame,
+                  const byte* body, int len);
+    void   answer_collect (const vector<byte>& frame, const byte* body,
+                  int len);
+    void   build_tdf ();
+
+    vector<Table> tables__;
+    vector<byte>  tdf__;         // Table definitions served as .TDF
+    uint4         baseTime__;    // Time of record 0 (secs since 1990)
+    long          answerBaud__;  // Only baud rate answered, 0 for any
+    int           maxPayload__;  // Maximum collect response body
+    int           dropEvery__;   // Every Nth range collect goes unanswered
+    int           rangeCollects__;
+    int           clockOffset__; // Secs the clock is ahead of the host
+    int           masterFd__;
+    int           slaveFd__;
+    int           listenFd__;
+    int           connFd__;      // Connection accepted, -1 if none
+    string        linkPath__;
+    pid_t         pid__;
+    int           statsFd__;     // Pipe the child reports the stats on
+    Stats         stats__;
+    pakbuf        obuf__;
+};
+
+#endif
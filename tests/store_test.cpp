@@ -0,0 +1,140 @@
+/**
+ * @file store_test.cpp
+ * Checks the state of a table when the writer fails in the middle of a
+ * batch of records: the table advances past the records stored only, so
+ * that storing the rest afterwards leaves each record stored once.
+ */
+
+#include <stdexcept>
+#include "record_fixture.h"
+#include "test_util.h"
+
+// Records of the response, and the one the writer fails on
+#define NUM_RECORDS 10
+#define FAILING_RECORD 6
+
+/**
+ * Per-value writer failing when it begins a given record.
+ */
+class FailingWriter : public RecordingWriter {
+public:
+    FailingWriter () : FailAt(0) {}
+
+    void processRecordBegin (Table& tblRef, int recordIdx, NSec recordTime)
+    {
+        if (recordIdx == FailAt) {
+            throw runtime_error("write failed");
+        }
+        RecordingWriter::processRecordBegin (tblRef, recordIdx, recordTime);
+    }
+
+    int FailAt;
+};
+
+/**
+ * Batch-native writer storing a given number of the records of a batch
+ * before it fails.
+ */
+class FailingBatchWriter : public RecordingWriter {
+public:
+    FailingBatchWriter () : Capacity(0) {}
+
+    void storeBatch (Table& tblRef, const RecordBatch& batch, size_t& stored)
+    {
+        stored = Capacity;
+        throw runtime_error("write failed");
+    }
+
+    size_t Capacity;
+};
+
+/**
+ * Returns the state of the table the reference decoder leaves after the
+ * given number of its records, and the transcript of those records.
+ */
+static Table reference_state (const vector<byte>& data, int nrecs,
+        string& transcript)
+{
+    Table tbl = make_table (TYPICAL_LAYOUT);
+    ReferenceDecoder ref;
+    RecordingWriter* writer = new RecordingWriter;
+    const byte* ptr = &data[0];
+
+    ref.setTableDataWriter (writer);
+    ref.storeReference (tbl, &ptr, 1, nrecs, true);
+    transcript = writer->Transcript;
+    return tbl;
+}
+
+int main ()
+{
+    Table tbl = make_table (TYPICAL_LAYOUT);
+    vector<byte> data = encode_records (tbl, NUM_RECORDS, 1);
+    int record_size = TableDataManager().getRecordSize (tbl);
+    string expected, stored_before;
+    Table ref_all = reference_state (data, NUM_RECORDS, expected);
+    Table ref_before = reference_state (data, FAILING_RECORD - 1,
+            stored_before);
+
+    // The writer fails on a record: the table stops before it
+    TableDataManager mgr;
+    FailingWriter* writer = new FailingWriter;
+    byte* ptr = &data[0];
+    bool thrown = false;
+    mgr.setTableDataWriter (writer);
+    writer->FailAt = FAILING_RECORD;
+    try {
+        mgr.storeRecords (tbl, &ptr, 1, NUM_RECORDS, true);
+    }
+    catch (StorageException& e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(tbl.NextRecord == FAILING_RECORD);
+    CHECK(nseccmp (tbl.LastRecordTime, ref_before.LastRecordTime) == 0);
+    CHECK(writer->Transcript == stored_before);
+
+    // The records from the failing one are stored again, as a new collect
+    // request starting at NextRecord would: each record is stored once
+    writer->FailAt = 0;
+    ptr = &data[0] + 8 + (FAILING_RECORD - 1)*record_size;
+    mgr.storeRecords (tbl, &ptr, tbl.NextRecord,
+            NUM_RECORDS + 1 - tbl.NextRecord, false);
+    CHECK(ptr == &data[0] + data.size());
+    CHECK(tbl.NextRecord == ref_all.NextRecord);
+    CHECK(nseccmp (tbl.LastRecordTime, ref_all.LastRecordTime) == 0);
+    CHECK(writer->Transcript == expected);
+
+    // A batch-native writer reports the records it stored before failing
+    Table batch_tbl = make_table (TYPICAL_LAYOUT);
+    FailingBatchWriter* batch_writer = new FailingBatchWriter;
+    ptr = &data[0];
+    thrown = false;
+    mgr.setTableDataWriter (batch_writer);
+    batch_writer->Capacity = FAILING_RECORD - 1;
+    try {
+        mgr.storeRecords (batch_tbl, &ptr, 1, NUM_RECORDS, true);
+    }
+    catch (StorageException& e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(batch_tbl.NextRecord == FAILING_RECORD);
+    CHECK(nseccmp (batch_tbl.LastRecordTime, ref_before.LastRecordTime)
+            == 0);
+
+    // Nothing stored, nothing advances
+    Table none_tbl = make_table (TYPICAL_LAYOUT);
+    ptr = &data[0];
+    batch_writer->Capacity = 0;
+    try {
+        mgr.storeRecords (none_tbl, &ptr, 1, NUM_RECORDS, true);
+    }
+    catch (StorageException& e) {
+        // Expected, as above
+    }
+    CHECK(none_tbl.NextRecord == 1);
+    CHECK(nseccmp (none_tbl.LastRecordTime, NSec()) == 0);
+
+    return test_result ("store_test");
+}
@@ -0,0 +1,189 @@
+/**
+ * @file tcp_test.cpp
+ * Checks the connections to a logger over TCP: a full session against a
+ * stand-in logger listening on the loopback interface, and the connects
+ * failing at once, refused by the host or timed out, which must leave no
+ * socket open.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include "collection_process.h"
+#include "init_comm.h"
+#include "stand_in_logger.h"
+#include "collector_session.h"
+#include "test_util.h"
+
+// Connect timeout of the timed out connects, in msecs
+#define CONNECT_TIMEOUT 300
+
+/**
+ * Returns true if the given file holds the text.
+ */
+static bool file_contains (const string& path, const string& text)
+{
+    ifstream in(path.c_str());
+    string   content((istreambuf_iterator<char>(in)),
+                     istreambuf_iterator<char>());
+
+    return content.find (text) != string::npos;
+}
+
+/**
+ * Returns a port of the loopback interface nothing listens on.
+ */
+static int closed_port ()
+{
+    struct sockaddr_in addr;
+    socklen_t          len = sizeof(addr);
+    int                fd = socket (AF_INET, SOCK_STREAM, 0);
+
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    bind (fd, (struct sockaddr*)&addr, sizeof(addr));
+    getsockname (fd, (struct sockaddr*)&addr, &len);
+    close (fd);
+    return ntohs (addr.sin_port);
+}
+
+/**
+ * Connects a socket to a port of the loopback interface, waiting up to
+ * the connect timeout for the connect to complete.
+ *
+ * @return The socket, -1 if the connect didn't complete.
+ */
+static int connect_loopback (int port)
+{
+    struct sockaddr_in addr;
+    struct pollfd      pfd;
+    int                fd = socket (AF_INET, SOCK_STREAM, 0);
+
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port        = htons (port);
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    connect (fd, (struct sockaddr*)&addr, sizeof(addr));
+
+    pfd.fd     = fd;
+    pfd.events = POLLOUT;
+    if (poll (&pfd, 1, CONNECT_TIMEOUT) <= 0) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Returns true if connecting to the host and port fails with a
+ * CommException, leaving the connection closed.
+ */
+static bool connect_fails (TcpConn& conn)
+{
+    bool thrown = false;
+
+    try {
+        conn.connect ();
+    }
+    catch (CommException& e) {
+        thrown = true;
+    }
+    return thrown && !conn.isOpen ();
+}
+
+int main ()
+{
+    char tmpl[] = "/tmp/tcp_test.XXXXXX";
+    if (!mkdtemp (tmpl)) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    string work_dir = tmpl;
+    string config_file = work_dir + "/config.xml";
+    string log_file = work_dir + "/session.log";
+
+    SessionConfig cfg;
+    cfg.WorkDir = work_dir;
+    cfg.Host    = "127.0.0.1";
+    cfg.Tables.push_back ("T1");
+
+    // A full session over the connection to the stand-in logger
+    StandInLogger logger;
+    StandInLogger::Stats stats;
+    logger.addTable ("T1", 50, 2, 60);
+    cfg.TcpPort = logger.listenTcp ();
+    write_session_config (config_file, cfg);
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.Connections == 1);
+    CHECK(stats.Hellos > 0);
+    CHECK(stats.FileUploads > 0);
+    CHECK(stats.Collects > 0);
+
+    bool values_ok;
+    vector<uint4> recs = read_record_nbrs (work_dir + "/data", "T1",
+            values_ok);
+    // The table is full: the oldest record, which the logger may be
+    // overwriting, is skipped
+    CHECK(values_ok);
+    CHECK(recs.size() == 49);
+    for (size_t idx = 0; idx < recs.size(); idx++) {
+        CHECK(recs[idx] == idx + 2);
+    }
+    stringstream lock_file;
+    lock_file << "/tmp/" PB5_APP_NAME "-tcp_127.0.0.1_" << cfg.TcpPort
+              << ".lck";
+    unlink (lock_file.str().c_str());
+
+    // A session to a port nothing listens on reports the refusal
+    int port = closed_port ();
+    SessionConfig refused_cfg = cfg;
+    refused_cfg.TcpPort = port;
+    write_session_config (config_file, refused_cfg);
+    run_session (config_file, log_file);
+    CHECK(file_contains (log_file, strerror (ECONNREFUSED)));
+
+    TcpConn refused("127.0.0.1", port);
+    CHECK(connect_fails (refused));
+
+    // A connect failing at once, as to a broadcast address, isn't taken
+    // for a connected socket
+    TcpConn unreachable("255.255.255.255", port);
+    CHECK(connect_fails (unreachable));
+
+    // A port whose backlog is full leaves the connect pending until the
+    // timeout
+    StandInLogger busy;
+    int busy_port = busy.listenTcp (0);
+    vector<int> queued;
+    int fd;
+    while ((fd = connect_loopback (busy_port)) >= 0) {
+        queued.push_back (fd);
+    }
+    TcpConn timed_out("127.0.0.1", busy_port);
+    timed_out.setConnectTimeout (CONNECT_TIMEOUT);
+    double start = bench_now ();
+    CHECK(connect_fails (timed_out));
+    CHECK(bench_now () - start >= 0.9*CONNECT_TIMEOUT/1000);
+    for (size_t idx = 0; idx < queued.size(); idx++) {
+        close (queued[idx]);
+    }
+
+    if (testFailures) {
+        printf ("session log kept in %s\n", work_dir.c_str());
+    }
+    else {
+        system (("rm -rf " + work_dir).c_str());
+    }
+    return test_result ("tcp_test");
+}
@@ -0,0 +1,50 @@
+/**
+ * @file test_util.h
+ * Provides the checks and the timer shared by the tests and benchmarks.
+ * Each test is a program of its own, run by "make check", which exits 
+ * with a nonzero status if any check failed.
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+#include <stdio.h>
+#include <time.h>
+
+// Number of failed checks, and the number of them reported in detail
+static int testFailures = 0;
+#define TEST_MAX_REPORTS 20
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            if (testFailures++ < TEST_MAX_REPORTS) { \
+                fprintf (stderr, "%s:%d: check failed: %s\n", \
+                        __FILE__, __LINE__, #cond); \
+            } \
+        } \
+    } while (0)
+
+/**
+ * Prints the outcome of the test and returns its exit status.
+ */
+inline int test_result (const char* name)
+{
+    if (testFailures) {
+        printf ("%s: %d checks failed\n", name, testFailures);
+        return 1;
+    }
+    printf ("%s: passed\n", name);
+    return 0;
+}
+
+/**
+ * Returns the time in seconds on a monotonic clock.
+ */
+inline double bench_now ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif
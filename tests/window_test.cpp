@@ -0,0 +1,103 @@
+/**
+ * @file window_test.cpp
+ * Checks the pipelined collection of a table (COLLECT_WINDOW above 1)
+ * against a stand-in logger on a pty which leaves some of the collect
+ * commands unanswered: the requests timed out are sent again, and every
+ * record is stored once, in order.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include "collection_process.h"
+#include "stand_in_logger.h"
+#include "collector_session.h"
+#include "test_util.h"
+
+/**
+ * Returns true if the given file holds the text.
+ */
+static bool file_contains (const string& path, const string& text)
+{
+    ifstream in(path.c_str());
+    string   content((istreambuf_iterator<char>(in)),
+                     istreambuf_iterator<char>());
+
+    return content.find (text) != string::npos;
+}
+
+int main ()
+{
+    char tmpl[] = "/tmp/window_test.XXXXXX";
+    if (!mkdtemp (tmpl)) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    string work_dir = tmpl;
+    string config_file = work_dir + "/config.xml";
+    string log_file = work_dir + "/session.log";
+
+    stringstream name;
+    name << "ttyStandIn" << getpid();
+    SessionConfig cfg;
+    cfg.WorkDir       = work_dir;
+    cfg.PortName      = work_dir + "/" + name.str();
+    cfg.BaudRate      = "115200";
+    cfg.CollectWindow = 4;
+    cfg.Tables.push_back ("T1");
+    string lock_file = string("/tmp/" PB5_APP_NAME "-") + name.str() +
+            ".lck";
+
+    StandInLogger logger;
+    StandInLogger::Stats stats;
+    logger.addTable ("T1", 1600, 2, 60);
+    logger.openPty (cfg.PortName);
+    write_session_config (config_file, cfg);
+
+    // The first session collects the table from the oldest record
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.Collects > 0);
+
+    // The second collects the records added since, with a command out of
+    // five lost
+    logger.appendRecords (0, 1000);
+    logger.setDropEvery (5);
+    logger.start ();
+    CHECK(run_session (config_file, log_file));
+    stats = logger.stop ();
+    CHECK(stats.DroppedCollects > 0);
+    CHECK(file_contains (log_file, "Resending request"));
+
+    bool values_ok;
+    vector<uint4> recs = read_record_nbrs (work_dir + "/data", "T1",
+            values_ok);
+    vector<uint4> appended;
+    for (size_t idx = 0; idx < recs.size(); idx++) {
+        if (recs[idx] > 1600) {
+            appended.push_back (recs[idx]);
+        }
+    }
+    CHECK(values_ok);
+    CHECK(appended.size() == 1000);
+    for (size_t idx = 0; idx < appended.size(); idx++) {
+        if (appended[idx] != 1601 + idx) {
+            printf ("record %u stored where %u was expected\n",
+                    appended[idx], (uint4)(1601 + idx));
+            CHECK(appended[idx] == 1601 + idx);
+            break;
+        }
+    }
+
+    unlink (lock_file.c_str());
+    if (testFailures) {
+        printf ("session log kept in %s\n", work_dir.c_str());
+    }
+    else {
+        system (("rm -rf " + work_dir).c_str());
+    }
+    return test_result ("window_test");
+}